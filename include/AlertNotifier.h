@@ -0,0 +1,73 @@
+// Delivery of alert events: recent history and an HTTP webhook
+/**
+ * \file
+ * \brief AlertNotifier class
+ */
+
+#ifndef __AlertNotifier__
+#define __AlertNotifier__
+
+#include <Arduino.h>
+
+#include "AlertRules.h"
+
+// events waiting for the webhook task, notify() drops the oldest when full
+#define ALERT_NOTIFY_QUEUE 8
+#define ALERT_NOTIFY_STACK 6144
+#define ALERT_NOTIFY_TIMEOUT_MS 5000
+// POSTs of one event while the station is connected
+#define ALERT_NOTIFY_RETRIES 3
+#define ALERT_NOTIFY_RETRY_MS 10000
+// station check while an event waits for it to reconnect
+#define ALERT_NOTIFY_OFFLINE_POLL_MS 1000
+// events kept for /api/state
+#define ALERT_RECENT 8
+#define ALERT_URL_MAX_LEN 128
+
+struct alert_message {
+  char rule[ALERT_RULE_MAX_LEN];
+  bool raised;
+  float value;
+  uint32_t time;
+};
+
+//==============================================================================
+/**
+ * \class AlertNotifier
+ * \brief hands alert events from loop() to a low priority sender task
+ *
+ * notify() only copies the event into the history and a queue, it never
+ * waits, so the sampling path is not held up by the network. The task
+ * POSTs each event as JSON to the configured http:// URL, in order.
+ * While the station is not connected events stay queued, however long
+ * that takes; a full queue drops its oldest event. Once connected an
+ * event gets ALERT_NOTIFY_RETRIES POSTs before it counts as failed, a
+ * POST cut off by the station dropping out is not counted.
+ */
+class AlertNotifier {
+  private:
+    QueueHandle_t _queue;
+    portMUX_TYPE _mux;
+    char _url[ALERT_URL_MAX_LEN];
+    alert_message _recent[ALERT_RECENT];
+    uint8_t _recentNext;
+    uint8_t _recentCount;
+    uint32_t _sent;
+    uint32_t _failed;
+    uint32_t _dropped;
+    int _lastStatus;
+    volatile bool _holding;   // the task has an event it has not delivered
+    volatile bool _offline;   // and waits for the station
+    static void _task(void* arg);
+    int _post(const char* url, const alert_message& msg);
+  public:
+    AlertNotifier();
+    void begin();
+    // empty disables the webhook
+    void setUrl(const char* url);
+    // false if the webhook queue is full
+    bool notify(const alert_message& msg);
+    String toJson();
+};
+
+#endif
@@ -0,0 +1,128 @@
+// Threshold, rate of change and sensor fault alerts on every reading
+/**
+ * \file
+ * \brief AlertEngine class and the alert rule syntax
+ *
+ * Rules are one string, separated by ';':
+ *   t>8~0.5@300    temperature above 8 for 300 s, clears below 7.5
+ *   h<20           humidity below 20
+ *   t+3/900        temperature rose by 3 or more within 900 s
+ *   h-10/600@60    humidity fell by 10 within 600 s, for 60 s
+ *   fault@30       no valid reading for 30 s
+ * ~ is the hysteresis (default ALERT_DEFAULT_HYSTERESIS), @ the time the
+ * condition has to hold before the alert is raised (default 0) and / the
+ * rate window (default ALERT_DEFAULT_WINDOW).
+ */
+
+#ifndef __AlertRules__
+#define __AlertRules__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef ALERT_MAX_RULES
+#define ALERT_MAX_RULES 16
+#endif
+#if ALERT_MAX_RULES > 255
+#error "ALERT_MAX_RULES must fit in uint8_t"
+#endif
+// raised/cleared events not yet taken by nextEvent(), the oldest is dropped
+#define ALERT_EVENT_QUEUE 8
+#define ALERT_DEFAULT_HYSTERESIS 0.5f
+#define ALERT_DEFAULT_WINDOW 600
+#define ALERT_RULES_MAX_LEN 256
+#define ALERT_RULE_MAX_LEN 32
+// longest hold or rate window
+#define ALERT_MAX_SECONDS 86400
+
+enum alert_type {
+  ALERT_ABOVE,
+  ALERT_BELOW,
+  ALERT_RISE,
+  ALERT_FALL,
+  ALERT_FAULT
+};
+
+enum alert_channel {
+  ALERT_TEMPERATURE,
+  ALERT_HUMIDITY,
+  ALERT_SENSOR
+};
+
+// compiled rule, limit and hysteresis in the unit of the channel
+struct alert_rule {
+  uint8_t type;
+  uint8_t channel;
+  float limit;
+  float hysteresis;
+  uint32_t holdMs;
+  uint32_t windowMs;
+};
+
+struct alert_event {
+  uint8_t rule;
+  bool raised;
+  float value;
+  uint32_t time;
+};
+
+//==============================================================================
+/**
+ * \class AlertEngine
+ * \brief evaluates a fixed table of rules against each sensor reading
+ *
+ * evaluate() is O(rules) and does not allocate, it is meant to run right
+ * after every sensor read. A rule raises an event at the first reading
+ * that has met its condition for holdMs and clears once the value is
+ * back past the limit by the hysteresis. Rate rules compare against the
+ * older of two anchors that advance every half window, so the change is
+ * measured over half to one window without keeping the readings.
+ * Invalid readings (NAN) leave threshold and rate rules untouched.
+ */
+class AlertEngine {
+  private:
+    struct alert_state {
+      bool active;
+      bool pending;
+      bool primed;
+      uint32_t since;
+      float value;
+      float ref[2];
+      uint32_t refMs[2];
+    };
+    alert_rule _rules[ALERT_MAX_RULES];
+    alert_state _state[ALERT_MAX_RULES];
+    uint8_t _count;
+    alert_event _events[ALERT_EVENT_QUEUE];
+    uint8_t _head;
+    uint8_t _queued;
+    uint32_t _raised;
+    uint32_t _dropped;
+    uint32_t _evaluations;
+    void _push(uint8_t rule, bool raised, float value, uint32_t time);
+    bool _change(alert_state& s, const alert_rule& r, float v, uint32_t ms, float* change);
+  public:
+    AlertEngine();
+    // replaces the table, active alerts are forgotten without an event
+    void setRules(const alert_rule* rules, uint8_t count);
+    // ms is a monotonic clock, time the unix time put into events;
+    // returns the number of events queued
+    uint8_t evaluate(uint32_t ms, uint32_t time, float temperature, float humidity, bool sensorOk);
+    bool nextEvent(alert_event* event);
+    uint8_t count() const { return _count; }
+    const alert_rule& rule(uint8_t i) const { return _rules[i]; }
+    bool active(uint8_t i) const { return _state[i].active; }
+    // value at the last raise or clear
+    float value(uint8_t i) const { return _state[i].value; }
+    uint8_t activeCount() const;
+    uint32_t raised() const { return _raised; }
+    uint32_t dropped() const { return _dropped; }
+    uint32_t evaluations() const { return _evaluations; }
+};
+
+// false on a syntax error, *errorAt is then the offset in spec
+bool ParseAlertRules(const char* spec, alert_rule* rules, uint8_t maxRules, uint8_t* count, size_t* errorAt);
+// "t>8.0~0.5@300", returns 0 if buf is too small
+size_t FormatAlertRule(char* buf, size_t size, const alert_rule& rule);
+
+#endif
@@ -0,0 +1,64 @@
+// Build time selection of the optional subsystems
+/**
+ * \file
+ * \brief APP_* feature flags
+ *
+ * Each flag is 1 unless the environment in platformio.ini sets it to 0,
+ * e.g. build_flags = -DAPP_DISPLAY=0. A subsystem switched off is not
+ * compiled, its library is not linked and its setup() step and loop()
+ * work are gone. The sensor, the SD card and the RTC are always built,
+ * a logger without them has nothing to do.
+ *
+ * Sources used only by a subsystem that is switched off are left out with
+ * src_filter in the same environment, see APP_WEB_SOURCES in platformio.ini.
+ */
+
+#ifndef __AppConfig__
+#define __AppConfig__
+
+// SSD1306 OLED, readings and system info screens
+#ifndef APP_DISPLAY
+#define APP_DISPLAY 1
+#endif
+// tap to switch screens, only useful with the display
+#ifndef APP_BUTTON
+#define APP_BUTTON APP_DISPLAY
+#endif
+// Wi-Fi station and soft-AP, NTP and the alert webhook
+#ifndef APP_NETWORK
+#define APP_NETWORK 1
+#endif
+// web server, pages and the /api and /logs routes
+#ifndef APP_WEB
+#define APP_WEB APP_NETWORK
+#endif
+// DNS answering every name on the soft-AP with the logger
+#ifndef APP_CAPTIVE_DNS
+#define APP_CAPTIVE_DNS APP_WEB
+#endif
+// htlogger.local on the station network
+#ifndef APP_MDNS
+#define APP_MDNS APP_WEB
+#endif
+// WPA2-Enterprise station login, keeps the root certificate in SPIFFS
+#ifndef APP_EAP
+#define APP_EAP APP_NETWORK
+#endif
+
+#if APP_BUTTON && !APP_DISPLAY
+#error "APP_BUTTON needs APP_DISPLAY"
+#endif
+#if APP_WEB && !APP_NETWORK
+#error "APP_WEB needs APP_NETWORK"
+#endif
+#if APP_CAPTIVE_DNS && !APP_WEB
+#error "APP_CAPTIVE_DNS needs APP_WEB"
+#endif
+#if APP_MDNS && !APP_NETWORK
+#error "APP_MDNS needs APP_NETWORK"
+#endif
+#if APP_EAP && !APP_NETWORK
+#error "APP_EAP needs APP_NETWORK"
+#endif
+
+#endif
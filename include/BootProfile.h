@@ -0,0 +1,58 @@
+// Timestamps of the boot phases, first sample and first persisted record
+/**
+ * \file
+ * \brief BootProfile class
+ */
+
+#ifndef __BootProfile__
+#define __BootProfile__
+
+#include <Arduino.h>
+#include "esp_system.h"
+
+enum boot_phase {
+  BOOT_SETUP,
+  BOOT_NET_TASK,
+  BOOT_RTC,
+  BOOT_SENSOR,
+  BOOT_SD,
+  BOOT_TIMERS,
+  BOOT_DISPLAY,
+  BOOT_SETUP_DONE,
+  BOOT_WIFI,
+  BOOT_WWW,
+  BOOT_GOT_IP,
+  BOOT_FIRST_SAMPLE,
+  BOOT_FIRST_RECORD,
+  BOOT_PHASE_COUNT
+};
+
+//==============================================================================
+/**
+ * \class BootProfile
+ * \brief first time each boot phase was reached, in us since the app started
+ *
+ * esp_timer starts with the application, so ROM and second stage
+ * bootloader time (a few hundred ms) is not included. Phases are marked
+ * from setup(), the network start task and the Wi-Fi event task.
+ */
+class BootProfile {
+  private:
+    int64_t _at[BOOT_PHASE_COUNT];
+    esp_reset_reason_t _reason;
+    portMUX_TYPE _mux;
+  public:
+    BootProfile();
+    void begin();
+    // true the first time the phase is marked
+    bool mark(boot_phase phase);
+    bool reached(boot_phase phase) const { return _at[phase] != 0; }
+    uint32_t ms(boot_phase phase) const { return _at[phase] / 1000; }
+    String toJson();
+    void dump(Print& out);
+    static const char* phaseName(boot_phase phase);
+};
+
+extern BootProfile bootProfile;
+
+#endif
@@ -0,0 +1,60 @@
+// Min/max per bucket downsampling of log records for charts
+/**
+ * \file
+ * \brief ChartReducer class
+ */
+
+#ifndef __ChartReducer__
+#define __ChartReducer__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "LogRecord.h"
+
+#define CHART_DEFAULT_POINTS 500
+#define CHART_MAX_POINTS 2000
+
+// one output row, time is the start of the bucket
+struct chart_bucket {
+  uint32_t time;
+  uint32_t count;
+  float tMin;
+  float tMax;
+  float hMin;
+  float hMax;
+};
+
+//==============================================================================
+/**
+ * \class ChartReducer
+ * \brief streaming min/max envelope over fixed time buckets
+ *
+ * [from, to] is split into points / 2 equal buckets, each bucket yields
+ * the minimum and the maximum of every channel, so a channel never gets
+ * more than points values and spikes survive the reduction. Records must
+ * arrive in time order; a bucket is emitted as soon as a record of a
+ * later bucket arrives, memory use is one bucket for any range length.
+ * Empty buckets are not emitted.
+ */
+class ChartReducer {
+  private:
+    uint32_t _from;
+    uint32_t _to;
+    uint32_t _width;
+    uint32_t _index;
+    chart_bucket _bucket;
+  public:
+    ChartReducer() { begin(0, 0, 2); }
+    void begin(uint32_t from, uint32_t to, uint16_t points);
+    uint32_t bucketSeconds() const { return _width; }
+    // true when rec closed the previous bucket, which is copied to *out
+    bool add(const log_record& rec, chart_bucket* out);
+    // last, still open bucket
+    bool finish(chart_bucket* out);
+};
+
+// "[time,tMin,tMax,hMin,hMax,count]", returns 0 if buf is too small
+size_t FormatChartBucket(char* buf, size_t size, const chart_bucket& bucket);
+
+#endif
@@ -0,0 +1,48 @@
+// Downsampled log range as chart data
+/**
+ * \file
+ * \brief ChartResponse class
+ */
+
+#ifndef __ChartResponse__
+#define __ChartResponse__
+
+#include <Arduino.h>
+
+#include "ChartReducer.h"
+#include "ChunkedResponse.h"
+#include "LogRangeReader.h"
+
+// SD blocks read per _fillBuffer() call once it has output
+#define CHART_FILL_CHUNKS 16
+
+//==============================================================================
+/**
+ * \class ChartResponse
+ * \brief chunked JSON of min/max buckets over a time range
+ *
+ * {"from":..,"to":..,"bucket":60,"columns":["time","tMin","tMax","hMin","hMax","count"],
+ *  "rows":[[..],..],"files":1,"corrupt":0}
+ *
+ * Rows are produced while the range is read, memory use does not depend
+ * on the range length.
+ */
+class ChartResponse: public ChunkedResponse {
+  private:
+    enum state {CHART_HEADER, CHART_ROWS, CHART_DONE};
+    LogRangeReader _reader;
+    ChartReducer _reducer;
+    uint32_t _from;
+    uint32_t _to;
+    state _state;
+    uint32_t _rows;
+    char _text[160];
+    void _row(const chart_bucket& bucket);
+  protected:
+    uint32_t _work() const override { return _reader.chunksRead(); }
+    size_t _step(uint8_t* data, size_t len) override;
+  public:
+    ChartResponse(SdFat& sd, LogStore& store, const char* dir, uint32_t from, uint32_t to, uint16_t points);
+};
+
+#endif
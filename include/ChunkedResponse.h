@@ -0,0 +1,58 @@
+// Base of the chunked responses that are built from SD piece by piece
+/**
+ * \file
+ * \brief ChunkedResponse class
+ */
+
+#ifndef __ChunkedResponse__
+#define __ChunkedResponse__
+
+#include <Arduino.h>
+
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+#include "PerfMonitor.h"
+
+// a fill without output yet goes on for this many budgets before it gives up
+#define CHUNKED_IDLE_BUDGETS 16
+
+//==============================================================================
+/**
+ * \class ChunkedResponse
+ * \brief fills the send buffer from _step() under the SD reader lock
+ *
+ * A subclass produces the body in steps: a piece of text or a record
+ * queued with _emit(), bytes written straight into the send buffer, or
+ * just work (SD blocks, directory entries, days) without output. It
+ * counts that work in _work() and calls _finish() with the last piece.
+ *
+ * Once a fill has output it stops after budget units of work, so the
+ * async_tcp task is not held. A fill without output goes on for up to
+ * CHUNKED_IDLE_BUDGETS budgets, as returning nothing makes the server
+ * wait for its next poll, about half a second. Only then, or when the
+ * SD stays locked by the writer, does it return RESPONSE_TRY_AGAIN; an
+ * empty chunk would end the response.
+ */
+class ChunkedResponse: public AsyncAbstractResponse {
+  private:
+    perf_stage _stage;
+    uint32_t _budget;
+    const uint8_t* _piece;
+    size_t _pieceLen;
+    size_t _pieceOff;
+    bool _done;
+  protected:
+    // data must stay unchanged until the next _step()
+    void _emit(const void* data, size_t len);
+    void _finish() { _done = true; }
+    virtual uint32_t _work() const = 0;
+    // bytes written into data, 0 when the step queued a piece or only read
+    virtual size_t _step(uint8_t* data, size_t len) = 0;
+  public:
+    ChunkedResponse(const char* contentType, perf_stage stage, uint32_t budget);
+    bool _sourceValid() const { return true; }
+    virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
+};
+
+#endif
@@ -0,0 +1,43 @@
+// Periodic timer firing at absolute, wall clock aligned deadlines
+/**
+ * \file
+ * \brief DeadlineTimer class
+ */
+
+#ifndef __DeadlineTimer__
+#define __DeadlineTimer__
+
+#include <Arduino.h>
+#include <sys/time.h>
+
+//==============================================================================
+/**
+ * \class DeadlineTimer
+ * \brief polled like SimpleTimer, but without drift
+ *
+ * Deadlines are phase + k * period in system clock time, so a 60 s timer
+ * with phase 0 fires on every full minute. The next deadline is computed
+ * from the previous one, not from the time the job ran, so a busy loop()
+ * delays one run but never shifts the following ones. Deadlines that
+ * passed entirely while loop() was busy are skipped and counted, and
+ * a clock step of more than a period realigns the timer.
+ */
+class DeadlineTimer {
+  private:
+    uint32_t _period;
+    uint32_t _phase;
+    int64_t _deadline;    // us of system time, 0 before the first isReady()
+    uint32_t _lateUs;
+    uint32_t _missed;
+    static int64_t _nowUs();
+    void _align(int64_t now);
+  public:
+    DeadlineTimer();
+    void setInterval(uint32_t periodMs, uint32_t phaseMs = 0);
+    // true once per deadline, lateUs() and missed() describe that run
+    bool isReady();
+    uint32_t lateUs() const { return _lateUs; }
+    uint32_t missed() const { return _missed; }
+};
+
+#endif
@@ -0,0 +1,82 @@
+// Leveled diagnostic log, printed to Serial by a background task
+/**
+ * \file
+ * \brief DebugLog class
+ */
+
+#ifndef __DebugLog__
+#define __DebugLog__
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+// lines above it are not even formatted, setLevel() changes it at run time
+#ifndef DEBUG_LOG_LEVEL
+#define DEBUG_LOG_LEVEL DEBUG_INFO
+#endif
+// lines kept for Serial and /api/debuglog
+#define DEBUG_LOG_LINES 64
+#define DEBUG_LOG_LINE_LEN 96
+#define DEBUG_LOG_STACK 3072
+#define DEBUG_LOG_DRAIN_MS 20
+
+enum debug_level {
+  DEBUG_ERROR,
+  DEBUG_WARN,
+  DEBUG_INFO,
+  DEBUG_VERBOSE
+};
+
+struct debug_line {
+  volatile uint32_t seq;  // seq + 1 once written, 0 while being written
+  uint32_t ms;
+  uint8_t level;
+  char text[DEBUG_LOG_LINE_LEN];
+};
+
+//==============================================================================
+/**
+ * \class DebugLog
+ * \brief formats into a ring of fixed lines, a low priority task prints them
+ *
+ * A writer takes a sequence number with one atomic add and formats into
+ * its own slot, so loop(), the web server and the event tasks never wait
+ * for each other nor for the UART. Each slot carries its sequence number
+ * like a seqlock: readers copy a line and keep it only if the number did
+ * not change meanwhile. Lines the drain task could not print before the
+ * ring wrapped over them are counted as dropped. The last DEBUG_LOG_LINES
+ * lines stay readable through toJson().
+ */
+class DebugLog {
+  private:
+    debug_line _lines[DEBUG_LOG_LINES];
+    volatile uint32_t _head;
+    uint32_t _drained;
+    volatile uint32_t _dropped;
+    volatile uint8_t _level;
+    Print* _out;
+    static void _drainTask(void* arg);
+    void _write(debug_level level, const char* format, va_list args);
+    bool _read(uint32_t seq, debug_line* line) const;
+  public:
+    DebugLog();
+    // starts the drain task, lines written before are printed then
+    void begin(Print& out);
+    void setLevel(debug_level level) { _level = level; }
+    debug_level level() const { return (debug_level)_level; }
+    void error(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void warn(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void info(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void verbose(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    uint32_t written() const { return _head; }
+    uint32_t dropped() const { return _dropped; }
+    // kept lines from seq since on, "next" is the since of the following call
+    String toJson(uint32_t since);
+    static const char* levelName(debug_level level);
+    // false for an unknown name
+    static bool parseLevel(const char* name, debug_level* level);
+};
+
+extern DebugLog debugLog;
+
+#endif
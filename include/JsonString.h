@@ -0,0 +1,15 @@
+// Quote a value as a JSON string
+/**
+ * \file
+ * \brief JsonString()
+ */
+
+#ifndef __JsonString__
+#define __JsonString__
+
+#include <Arduino.h>
+
+// quoted JSON string, user entered values and SSIDs may contain anything
+String JsonString(const String& value);
+
+#endif
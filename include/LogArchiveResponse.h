@@ -0,0 +1,109 @@
+// Stream the log files of a time range as one stored ZIP archive
+/**
+ * \file
+ * \brief LogArchiveResponse class
+ */
+
+#ifndef __LogArchiveResponse__
+#define __LogArchiveResponse__
+
+#include <Arduino.h>
+
+#include <SPI.h>
+#include "SdFat.h"
+#define FS_NO_GLOBALS
+
+#include "ChunkedResponse.h"
+#include "LogRecord.h"
+#include "LogStore.h"
+
+// SD reads and directory entries per _fillBuffer() call once it has output
+#define LOG_ARCHIVE_FILL_CHUNKS 16
+// entries whose CRC is not in a sidecar on the card, kept for the central directory
+#define LOG_ARCHIVE_TRACKED 8
+// central directory header, the largest record built in _out
+#define LOG_ARCHIVE_OUT_MAX (46 + LOG_NAME_MAX)
+
+//==============================================================================
+/**
+ * \class LogArchiveResponse
+ * \brief chunked download of the log files of a range as one ZIP, method stored
+ *
+ * Nothing is buffered per file: the entries are streamed in directory
+ * order and the central directory is rebuilt by a second pass over the
+ * directory once the last one is sent. Every file is read once: a file
+ * closed by LogStore has its size and CRC in the metadata sidecar, the
+ * active file in the metadata LogStore keeps in RAM, and it is cut at
+ * that data size, appends do not change the prefix. Legacy files and
+ * files whose sidecar does not match get their CRC while they are sent,
+ * in a data descriptor after the data (general purpose flag bit 3);
+ * unzip, bsdtar and Python read those, Java's ZipInputStream does not.
+ * LOG_ARCHIVE_TRACKED of the CRCs that are not on the card are kept, the
+ * active file's first; the others are read again for the central
+ * directory.
+ * Files created after the request are left out of both passes and
+ * retention waits for active() to be 0, so both passes see the same files.
+ */
+class LogArchiveResponse: public ChunkedResponse {
+  private:
+    enum state {ARCHIVE_ENTRY, ARCHIVE_CRC, ARCHIVE_DATA, ARCHIVE_DIRECTORY, ARCHIVE_DONE};
+    enum pick {PICK_FILE, PICK_SKIP, PICK_END};
+    struct entry {
+      char name[LOG_NAME_MAX];
+      uint32_t size;
+      uint32_t crc;
+      uint16_t date;      // FAT last write date and time
+      uint16_t time;
+      bool known;         // CRC from the metadata before the data is sent
+      bool active;        // still being written when it was streamed
+      bool descriptor;    // CRC and sizes follow the data
+    };
+    SdFat& _sd;
+    LogStore& _store;
+    const char* _dir;
+    uint32_t _from;
+    uint32_t _to;
+    uint32_t _started;    // FAT date << 16 | time of the request
+    File _dirFile;
+    File _file;
+    bool _dirOpen;
+    bool _fileOpen;
+    state _state;
+    entry _entry;
+    uint32_t _remaining;
+    uint32_t _offset;         // archive bytes of the entries so far
+    uint32_t _directoryStart;
+    uint32_t _directorySize;
+    bool _listing;            // second pass, central directory
+    uint16_t _entries;
+    uint16_t _listed;
+    entry _tracked[LOG_ARCHIVE_TRACKED];
+    uint8_t _trackedCount;
+    uint8_t _out[LOG_ARCHIVE_OUT_MAX];
+    uint32_t _chunks;
+    uint32_t _rereads;
+    static volatile uint8_t _active;
+    bool _openDir();
+    pick _nextFile();
+    bool _openFile();
+    void _track();
+    bool _fromTracked();
+    void _localHeader();
+    void _directoryHeader();
+    void _descriptor();
+    void _endRecord();
+    bool _crcStep(uint8_t* buf, size_t len);
+    void _startData();
+    size_t _data(uint8_t* data, size_t len);
+    void _fail(const char* what);
+  protected:
+    uint32_t _work() const override { return _chunks; }
+    size_t _step(uint8_t* data, size_t len) override;
+  public:
+    LogArchiveResponse(SdFat& sd, LogStore& store, const char* dir, uint32_t from, uint32_t to);
+    ~LogArchiveResponse();
+    // archives being sent, the files they list must not be deleted
+    static uint8_t active() { return _active; }
+};
+
+#endif
@@ -0,0 +1,40 @@
+// Log record export formats: CSV, NDJSON and CBOR
+/**
+ * \file
+ * \brief log record conversion for downloads and host tools
+ *
+ * CSV     the log file format, see LogRecord.h
+ * NDJSON  {"time":1598788800,"ms":250,"temperature":21.5,"humidity":45,"seq":17}
+ * CBOR    indefinite length array of [time, ms, temperature, humidity, seq],
+ *         time as unsigned seconds, values as float32
+ */
+
+#ifndef __LogExport__
+#define __LogExport__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "LogRecord.h"
+
+// longest output of one record in any format
+#define LOG_EXPORT_MAX_LEN 128
+
+enum log_format {
+  LOG_FORMAT_CSV,
+  LOG_FORMAT_NDJSON,
+  LOG_FORMAT_CBOR
+};
+
+// "csv", "ndjson" or "cbor"; false for anything else
+bool ParseLogFormat(const char* name, log_format* format);
+const char* LogFormatContentType(log_format format);
+const char* LogFormatExtension(log_format format);
+
+// bytes before the first and after the last record, 0 if none
+size_t FormatExportHeader(uint8_t* buf, size_t size, log_format format);
+size_t FormatExportFooter(uint8_t* buf, size_t size, log_format format);
+// returns 0 if buf is too small
+size_t FormatExportRecord(uint8_t* buf, size_t size, log_format format, const log_record& rec);
+
+#endif
@@ -0,0 +1,43 @@
+// Stream log records converted to CSV, NDJSON or CBOR
+/**
+ * \file
+ * \brief LogExportResponse class
+ */
+
+#ifndef __LogExportResponse__
+#define __LogExportResponse__
+
+#include <Arduino.h>
+
+#include "ChunkedResponse.h"
+#include "LogExport.h"
+#include "LogRangeReader.h"
+
+// SD blocks read per _fillBuffer() call once it has output
+#define LOG_EXPORT_FILL_CHUNKS 16
+
+//==============================================================================
+/**
+ * \class LogExportResponse
+ * \brief chunked download of a time range or of one file in any log_format
+ *
+ * Records are converted one at a time through a LOG_EXPORT_MAX_LEN
+ * buffer while the SD is read, so memory use is fixed for any size.
+ */
+class LogExportResponse: public ChunkedResponse {
+  private:
+    enum state {EXPORT_HEADER, EXPORT_RECORDS, EXPORT_DONE};
+    LogRangeReader _reader;
+    log_format _format;
+    state _state;
+    uint8_t _out[LOG_EXPORT_MAX_LEN];
+  protected:
+    uint32_t _work() const override { return _reader.chunksRead(); }
+    size_t _step(uint8_t* data, size_t len) override;
+  public:
+    LogExportResponse(SdFat& sd, LogStore& store, const char* dir, uint32_t from, uint32_t to, log_format format);
+    // whole file, named like the file with the extension of format
+    LogExportResponse(SdFat& sd, LogStore& store, const char* dir, const char* name, log_format format);
+};
+
+#endif
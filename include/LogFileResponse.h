@@ -0,0 +1,61 @@
+// Stream a log file, dropping records that fail their checksum
+/**
+ * \file
+ * \brief LogFileResponse class
+ */
+
+#ifndef __LogFileResponse__
+#define __LogFileResponse__
+
+#include <Arduino.h>
+
+#include <SPI.h>
+#include "SdFat.h"
+#define FS_NO_GLOBALS
+
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+#include "LogRecord.h"
+#include "LogStore.h"
+
+// one SD block, so contiguous files can be read block by block
+#define LOG_RESPONSE_CHUNK 512
+
+//==============================================================================
+/**
+ * \class LogFileResponse
+ * \brief chunked download of a log file with corrupt records skipped
+ *
+ * Lines are validated while streaming through a fixed buffer, the number
+ * of skipped records is added to LogStore::corruptRecords(). Reading stops
+ * at the logical end of a preallocated file; contiguous files are read
+ * as raw card blocks without walking the FAT.
+ */
+class LogFileResponse: public AsyncAbstractResponse {
+  private:
+    File _content;
+    SdFat& _sd;
+    LogStore& _store;
+    uint32_t _remaining;
+    uint32_t _block;
+    bool _raw;
+    LogLineSplitter _splitter;
+    char _in[LOG_RESPONSE_CHUNK];
+    size_t _inLen;
+    size_t _inPos;
+    const char* _line;
+    size_t _lineLen;
+    size_t _lineOff;
+    bool _eof;
+    bool _sourceIsValid;
+    uint32_t _corrupt;
+    bool _nextLine();
+  public:
+    LogFileResponse(SdFat &sd, LogStore& store, const String& path);
+    ~LogFileResponse();
+    bool _sourceValid() const { return _sourceIsValid; }
+    virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
+};
+
+#endif
@@ -0,0 +1,106 @@
+// Read the log records of a time range across log files
+/**
+ * \file
+ * \brief LogRangeReader class
+ */
+
+#ifndef __LogRangeReader__
+#define __LogRangeReader__
+
+#include <Arduino.h>
+
+#include <SPI.h>
+#include "SdFat.h"
+#define FS_NO_GLOBALS
+
+#include "LogRecord.h"
+#include "LogStore.h"
+
+// one SD block, so contiguous files can be read block by block
+#define LOG_RANGE_CHUNK 512
+// blocks read by one next() call before it gives up with LOG_RANGE_BUSY
+#define LOG_RANGE_MAX_CHUNKS 8
+// files picked per directory scan
+#define LOG_RANGE_BATCH 16
+
+enum log_range_status {
+  LOG_RANGE_RECORD,
+  LOG_RANGE_BUSY,
+  LOG_RANGE_END
+};
+
+//==============================================================================
+/**
+ * \class LogRangeReader
+ * \brief streams valid records with from <= time <= to, oldest file first
+ *
+ * Files are chosen by the period in their name and then by the first and
+ * last time of their metadata sidecar, so only files that hold records
+ * of the range are opened. They are read in order of their period start,
+ * LOG_RANGE_BATCH of them per directory scan. Inside a file the start of
+ * the range is found by a binary search on record times, so a short
+ * range in a long history costs a few block reads.
+ * resumeAt() continues from a file and offset given by fileName() and
+ * position() of an earlier reader, for readers that follow the log.
+ * Corrupt records are skipped and added to LogStore::corruptRecords().
+ */
+class LogRangeReader {
+  private:
+    struct candidate {
+      uint32_t first;
+      char name[LOG_NAME_MAX];
+    };
+    SdFat& _sd;
+    LogStore& _store;
+    const char* _dir;
+    char _only[LOG_NAME_MAX];
+    uint32_t _from;
+    uint32_t _to;
+    File _file;
+    char _name[LOG_NAME_MAX];
+    bool _open;
+    bool _done;
+    uint32_t _remaining;
+    uint32_t _pos;          // file offset of the next read
+    uint32_t _inStart;      // file offset of _in[0]
+    size_t _skip;           // bytes of the first read before the resume offset
+    bool _resume;
+    uint32_t _resumeOffset;
+    bool _restarted;
+    uint32_t _block;
+    bool _raw;
+    bool _skipLine;
+    LogLineSplitter _splitter;
+    char _in[LOG_RANGE_CHUNK];
+    size_t _inLen;
+    size_t _inPos;
+    uint32_t _corrupt;
+    uint32_t _chunks;
+    uint16_t _files;
+    candidate _batch[LOG_RANGE_BATCH];
+    uint8_t _batchLen;
+    uint8_t _batchPos;
+    uint32_t _lastFirst;
+    bool _refill();
+    bool _openNext();
+    uint32_t _seekFrom(uint32_t dataEnd);
+    bool _fill();
+  public:
+    LogRangeReader(SdFat& sd, LogStore& store, const char* dir, uint32_t from, uint32_t to);
+    ~LogRangeReader();
+    // read only this file of the directory, whatever its name
+    void setFile(const char* name);
+    // start in this file at offset, a line start, and go on with the later files
+    void resumeAt(const char* name, uint32_t offset);
+    // file of the last record and the offset right after it
+    const char* fileName() const { return _name; }
+    uint32_t position() const { return _inStart + _inPos; }
+    // the resume offset was past the end of its file, it was read from the start
+    bool restarted() const { return _restarted; }
+    log_range_status next(log_record* rec);
+    uint32_t chunksRead() const { return _chunks; }
+    uint16_t filesRead() const { return _files; }
+    uint32_t corrupt() const { return _corrupt; }
+};
+
+#endif
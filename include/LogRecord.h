@@ -0,0 +1,77 @@
+// Log record format shared by the logger, the web handlers and host tools
+/**
+ * \file
+ * \brief log record formatting, parsing and CRC
+ *
+ * Record line:  2020-08-30 12:00:00.250;21.500000;45.000000;17;9f3a04c1
+ *               time;temperature;humidity;seq;crc32
+ * The milliseconds of the time field are optional.
+ * The CRC covers everything before the last ';'. Files written before
+ * the CRC was introduced contain 3 field lines, these parse as
+ * LOG_RECORD_LEGACY.
+ */
+
+#ifndef __LogRecord__
+#define __LogRecord__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LOG_RECORD_HEADER "Time;Temperature;Humidity;Seq;CRC\n"
+#define LOG_RECORD_MAX_LEN 100
+
+enum log_record_status {
+  LOG_RECORD_OK,
+  LOG_RECORD_LEGACY,
+  LOG_RECORD_HEADER_LINE,
+  LOG_RECORD_CORRUPT
+};
+
+struct log_record {
+  uint32_t time;      // unix time of the record (RTC time, no TZ)
+  uint16_t ms;
+  float temperature;
+  float humidity;
+  uint32_t seq;       // 1 based record number within its file, 0 for legacy
+};
+
+uint32_t LogCrc32(const void* data, size_t len, uint32_t crc = 0);
+
+// "YYYY-MM-DD hh:mm:ss[.mmm]" <-> unix time
+uint32_t LogMakeTime(int year, int month, int day, int hour, int minute, int second);
+bool LogParseTime(const char* str, size_t len, uint32_t* time, uint16_t* ms = NULL);
+size_t LogFormatTime(char* buf, size_t size, uint32_t time);
+
+// returns line length including '\n', 0 if buf is too small
+size_t FormatLogRecord(char* buf, size_t size, const char* timeString, float temperature, float humidity, uint32_t seq);
+
+// line may or may not include the trailing '\n'
+log_record_status ParseLogRecord(const char* line, size_t len, log_record* rec);
+
+//==============================================================================
+/**
+ * \class LogLineSplitter
+ * \brief splits a byte stream read in arbitrary chunks into lines
+ *
+ * Lines longer than LOG_RECORD_MAX_LEN are cut and returned flagged as
+ * overlong, so corrupt data can never grow the buffer.
+ */
+class LogLineSplitter {
+  private:
+    char _buf[LOG_RECORD_MAX_LEN + 1];
+    size_t _len;
+    bool _overlong;
+  public:
+    LogLineSplitter() { reset(); }
+    void reset() { _len = 0; _overlong = false; }
+    /**
+     * Consume bytes from data until a line is complete. Returns the number
+     * of bytes consumed; *line is set (and *lineLen > 0) when a line is
+     * available, it stays valid until the next call.
+     */
+    size_t push(const char* data, size_t len, const char** line, size_t* lineLen, bool* overlong);
+    // unterminated rest of the stream (torn last line), 0 if none
+    size_t pending(const char** line);
+};
+
+#endif
@@ -0,0 +1,68 @@
+// Log file naming, rotation periods and metadata sidecars
+/**
+ * \file
+ * \brief log file rotation and per file metadata
+ *
+ * File names carry the period they hold:
+ *   monthly  /logs/2020-08_hmd.csv
+ *   daily    /logs/2020-08-30_hmd.csv
+ *   hourly   /logs/2020-08-30T12_hmd.csv
+ * With a size limit the following parts of a period get "_001", "_002",
+ * ... before the extension, which still sorts after the first part.
+ *
+ * Every log file has a sidecar with the same name and a ".meta"
+ * extension holding one checksummed line:
+ *   M1;first;last;count;dataBytes;crc;closed;metaCrc
+ * first/last are the record times, crc is the CRC-32 of the first
+ * dataBytes bytes of the log file. closed is 1 once the file is final.
+ */
+
+#ifndef __LogRotation__
+#define __LogRotation__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "LogRecord.h"
+
+#define LOG_META_EXT ".meta"
+#define LOG_META_MAX_LEN 80
+
+enum log_rotation {
+  LOG_ROTATE_MONTHLY,
+  LOG_ROTATE_DAILY,
+  LOG_ROTATE_HOURLY
+};
+
+struct log_rotation_policy {
+  log_rotation period;
+  uint32_t maxBytes;    // start a new part above this size, 0 = off
+};
+
+struct log_meta {
+  uint32_t first;
+  uint32_t last;
+  uint32_t count;
+  uint32_t dataBytes;
+  uint32_t crc;
+  bool closed;
+};
+
+// longest period in seconds, a month counts 31 days
+uint32_t LogRotationSeconds(log_rotation period);
+size_t LogFileNameFor(char* buf, size_t size, const char* dir, log_rotation period, uint32_t time, uint16_t part);
+// first and last second a log file name can hold records for, path or base name
+bool LogFileSpan(const char* name, uint32_t* first, uint32_t* last);
+
+bool IsLogMetaName(const char* name);
+// sidecar name of a log file, 0 if buf is too small
+size_t LogMetaNameFor(char* buf, size_t size, const char* logName);
+
+void LogMetaClear(log_meta* meta);
+// account file bytes, records are counted separately
+void LogMetaAddBytes(log_meta* meta, const void* data, size_t len);
+void LogMetaAddRecord(log_meta* meta, uint32_t time);
+size_t FormatLogMeta(char* buf, size_t size, const log_meta& meta);
+bool ParseLogMeta(const char* buf, size_t len, log_meta* meta);
+
+#endif
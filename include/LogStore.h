@@ -0,0 +1,98 @@
+// Crash consistent log file writer
+/**
+ * \file
+ * \brief LogStore class
+ */
+
+#ifndef __LogStore__
+#define __LogStore__
+
+#include <Arduino.h>
+
+#include <SPI.h>
+#include "SdFat.h"
+#define FS_NO_GLOBALS
+
+#include "LogRecord.h"
+#include "LogRotation.h"
+#include "StorageStats.h"
+
+// bytes read from the end of the active file by the boot recovery scan
+#define LOG_RECOVERY_TAIL 1024
+#define LOG_NAME_MAX 50
+// average record length used to size preallocated files
+#define LOG_RECORD_AVG_LEN 60
+// appends between checkpoints of the active file's metadata sidecar
+#define LOG_META_INTERVAL 60
+
+//==============================================================================
+/**
+ * \class LogStore
+ * \brief appends checksummed records and repairs torn tails after power loss
+ *
+ * Recovery only reads the last LOG_RECOVERY_TAIL bytes of the active
+ * file, so it takes the same time for any file size.
+ *
+ * A new log file is created as one contiguous, erased extent sized for a
+ * whole rotation period, so appends never touch the FAT. The logical end of data
+ * is kept in RAM and found again at boot by a binary search for the
+ * first erased byte. The file is trimmed to its data when it is closed.
+ *
+ * The file name follows the rotation policy, a new file is started when
+ * the period changes or the size limit would be exceeded. The metadata
+ * of the active file is kept in RAM and checkpointed to its sidecar
+ * every LOG_META_INTERVAL records, so recovery only has to read the
+ * records written after the last checkpoint.
+ */
+class LogStore {
+  private:
+    SdFat& _sd;
+    StorageStats* _stats;
+    const char* _dir;
+    log_rotation_policy _rotation;
+    char _activeName[LOG_NAME_MAX];
+    uint16_t _part;
+    log_meta _meta;
+    uint16_t _metaPending;
+    uint32_t _seq;
+    uint32_t _dataEnd;
+    uint32_t _preallocSize;
+    int16_t _fill;        // erased byte value of the active file, -1 if not preallocated
+    volatile uint32_t _corruptRecords;
+    uint32_t _recoveredBytes;
+    void _nameFor(uint32_t time, uint16_t part, char* name);
+    bool _open(const char* name);
+    void _close();
+    bool _create(const char* name);
+    bool _findDataEnd(FatFile& file, uint32_t* end, int16_t* fill);
+    bool _isPadding(FatFile& file, uint32_t end, uint8_t fill);
+    bool _trim(const char* name);
+    bool _scanMeta(FatFile& file, const char* name, uint32_t end, log_meta* meta);
+    bool _writeMeta(const char* name, const log_meta& meta);
+    void _resized(uint32_t oldSize, uint32_t newSize) { if (_stats) _stats->fileResized(oldSize, newSize); }
+  public:
+    LogStore(SdFat& sd, const char* dir);
+    void setPreallocSize(uint32_t bytes) { _preallocSize = bytes; }
+    void setStats(StorageStats* stats) { _stats = stats; }
+    void setRotation(const log_rotation_policy& rotation) { _rotation = rotation; }
+    const log_rotation_policy& rotation() const { return _rotation; }
+    bool recover(uint32_t now);
+    void closeStale();
+    bool append(const char* timeString, float temperature, float humidity);
+    uint32_t dataSize(const char* name, uint32_t fileSize) const;
+    bool isActive(const char* name) const;
+    const char* activeName() const { return _activeName; }
+    // logical end of the active file, from RAM
+    uint32_t dataEnd() const { return _dataEnd; }
+    // RAM copy for the active file, the sidecar otherwise
+    bool readMeta(const char* name, log_meta* meta);
+    // JSON array of the log files whose records may fall in from..to
+    String listJson(uint32_t from, uint32_t to);
+    void countCorrupt(uint32_t n) { _corruptRecords += n; }
+    uint32_t corruptRecords() const { return _corruptRecords; }
+    uint32_t recoveredBytes() const { return _recoveredBytes; }
+    uint32_t seq() const { return _seq; }
+    bool preallocated() const { return _fill >= 0; }
+};
+
+#endif
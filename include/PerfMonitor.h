@@ -0,0 +1,155 @@
+// Hot-path timing of loop() stages, HTTP handlers and timer jitter
+/**
+ * \file
+ * \brief PerfMonitor class
+ */
+
+#ifndef __PerfMonitor__
+#define __PerfMonitor__
+
+#include <Arduino.h>
+
+// loop stall threshold before a breadcrumb is printed
+#ifndef PERF_STALL_MS
+#define PERF_STALL_MS 2000
+#endif
+
+// period of the serial statistics dump, 0 disables it
+#ifndef PERF_DUMP_INTERVAL
+#define PERF_DUMP_INTERVAL 300000
+#endif
+
+enum perf_stage {
+  PERF_LOOP,
+  PERF_BUTTON,
+  PERF_REFRESH_TEMP,
+  PERF_ADD_SAMPLE,
+  PERF_WRITE_SD,
+  PERF_SYNC_RTC,
+  PERF_UPDATE_DISPLAY,
+  PERF_DNS,
+  PERF_SD_MANAGER,
+  PERF_SD_MOUNT,
+  PERF_RETENTION,
+  PERF_STORAGE_SCAN,
+  PERF_ALERTS,
+  PERF_WIFI_SCAN,
+  PERF_WIFI_CONN,
+  PERF_QUANTILES,
+  PERF_HTTP_LOGS,
+  PERF_HTTP_LOG_FILL,
+  PERF_HTTP_API_LOGS,
+  PERF_HTTP_CHART,
+  PERF_HTTP_CHART_FILL,
+  PERF_HTTP_EXPORT,
+  PERF_HTTP_EXPORT_FILL,
+  PERF_HTTP_ARCHIVE,
+  PERF_HTTP_ARCHIVE_FILL,
+  PERF_HTTP_SYNC,
+  PERF_HTTP_SYNC_FILL,
+  PERF_HTTP_QUANTILES,
+  PERF_HTTP_QUANTILES_FILL,
+  PERF_HTTP_WIFI,
+  PERF_HTTP_STATE,
+  PERF_HTTP_SET,
+  PERF_HTTP_PERF,
+  PERF_HTTP_DEBUG_LOG,
+  PERF_HTTP_ASSET,
+  PERF_HTTP_CONFIG,
+  PERF_STAGE_COUNT
+};
+
+enum perf_timer {
+  PERF_TIMER_TEMP,
+  PERF_TIMER_LOG,
+  PERF_TIMER_DISP_TEMP,
+  PERF_TIMER_DISP,
+  PERF_TIMER_COUNT
+};
+
+// 4 sub buckets per power of two, covers 1us .. ~67s
+#define PERF_HIST_SUB 4
+#define PERF_HIST_BUCKETS (26 * PERF_HIST_SUB)
+
+//==============================================================================
+/**
+ * \class PerfStat
+ * \brief min/avg/max and a log-linear histogram for p99, values in us
+ */
+class PerfStat {
+  public:
+    uint32_t count;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+    uint16_t hist[PERF_HIST_BUCKETS];
+
+    void clear();
+    void add(uint32_t us);
+    uint32_t avg() const { return count ? sum / count : 0; }
+    uint32_t percentile(uint8_t pct) const;
+};
+
+//==============================================================================
+/**
+ * \class PerfMonitor
+ * \brief per stage cycle counter timings, timer lateness and loop stall watchdog
+ */
+class PerfMonitor {
+  private:
+    PerfStat _stages[PERF_STAGE_COUNT];
+    PerfStat _jitter[PERF_TIMER_COUNT];
+    uint32_t _missed[PERF_TIMER_COUNT];
+    portMUX_TYPE _mux;
+    TaskHandle_t _loopTask;
+    volatile perf_stage _loopStage;
+    volatile int64_t _loopStageStart;
+    volatile bool _stallReported;
+    uint32_t _stalls;
+    perf_stage _lastStallStage;
+    uint32_t _lastStallMs;
+    perf_stage _resetStage;
+    bool _resetStageValid;
+    static void _watchdogTask(void* arg);
+    void _checkStall();
+  public:
+    PerfMonitor();
+    void begin();
+    bool isLoopTask() const { return xTaskGetCurrentTaskHandle() == _loopTask; }
+    perf_stage enterLoopStage(perf_stage stage);
+    void leaveLoopStage(perf_stage previous);
+    void record(perf_stage stage, uint32_t us);
+    // lateness against the timer's deadline and deadlines skipped since the last run
+    void timerFired(perf_timer timer, uint32_t lateUs, uint32_t missed);
+    void reset();
+    // extra: more members of the object, each starting with ','
+    String toJson(const String& extra = String());
+    void dump(Print& out);
+    static const char* stageName(perf_stage stage);
+    static const char* timerName(perf_timer timer);
+};
+
+extern PerfMonitor perf;
+
+//==============================================================================
+/**
+ * \class PerfScope
+ * \brief measures the enclosing block with the CPU cycle counter
+ *
+ * Falls back to esp_timer when the cycle counter could have wrapped
+ * (~17s at 240MHz) or the task migrated to the other core.
+ */
+class PerfScope {
+  private:
+    perf_stage _stage;
+    perf_stage _previous;
+    uint32_t _startCycles;
+    int64_t _startUs;
+    int _core;
+    bool _loop;
+  public:
+    PerfScope(perf_stage stage);
+    ~PerfScope();
+};
+
+#endif
@@ -0,0 +1,73 @@
+// Stream daily and merged quantiles of a range of days as JSON
+/**
+ * \file
+ * \brief QuantileResponse class
+ */
+
+#ifndef __QuantileResponse__
+#define __QuantileResponse__
+
+#include <Arduino.h>
+
+#include <SPI.h>
+#include "SdFat.h"
+#define FS_NO_GLOBALS
+
+#include "ChunkedResponse.h"
+#include "QuantileSketch.h"
+#include "QuantileStore.h"
+
+// records read per _fillBuffer() call once it has output
+#define QUANTILE_FILL_DAYS 8
+// longest range of one request
+#define QUANTILE_MAX_DAYS 366
+
+//==============================================================================
+/**
+ * \class QuantileResponse
+ * \brief chunked JSON of p5/p50/p95 per day and over the whole range
+ *
+ * {"from":"2020-11-01","to":"2020-11-07","interval":60,
+ *  "days":[{"day":"2020-11-01","temperature":{"count":1440,"min":..,"max":..,
+ *           "mean":..,"p5":..,"p50":..,"p95":..,"aboveSeconds":..},"humidity":{..}},..],
+ *  "total":{"days":7,"temperature":{..},"humidity":{..}}}
+ *
+ * Days come from the records of QuantileStore, the running day from its
+ * sketches in RAM; days without records are left out. The total merges
+ * the day sketches as they are read. aboveSeconds is only given when a
+ * threshold is set: the estimated share of samples above it times the
+ * samples and the log interval.
+ */
+class QuantileResponse: public ChunkedResponse {
+  private:
+    enum state {QUANTILE_HEADER, QUANTILE_DAYS, QUANTILE_TOTAL, QUANTILE_DONE};
+    SdFat& _sd;
+    QuantileStore& _store;
+    uint32_t _fromDay;
+    uint32_t _toDay;
+    uint32_t _nextDay;
+    uint32_t _interval;
+    float _above[QUANTILE_CHANNELS];
+    state _state;
+    File _file;
+    bool _fileOpen;
+    quantile_file_header _header;
+    QuantileSketch _day[QUANTILE_CHANNELS];
+    QuantileSketch _total[QUANTILE_CHANNELS];
+    uint32_t _days;
+    uint32_t _reads;
+    char _text[512];
+    size_t _textLen;
+    bool _readDay(uint32_t day);
+    void _channels(QuantileSketch* sketches);
+    void _append(const char* format, ...) __attribute__((format(printf, 2, 3)));
+  protected:
+    uint32_t _work() const override { return _reads; }
+    size_t _step(uint8_t* data, size_t len) override;
+  public:
+    QuantileResponse(SdFat& sd, QuantileStore& store, uint32_t fromDay, uint32_t toDay,
+                     uint32_t interval, float tempAbove, float humAbove);
+    ~QuantileResponse();
+};
+
+#endif
@@ -0,0 +1,80 @@
+// Mergeable fixed size quantile sketch (t-digest) of one channel
+/**
+ * \file
+ * \brief QuantileSketch class
+ */
+
+#ifndef __QuantileSketch__
+#define __QuantileSketch__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// centroids kept; the merge needs up to ~0.8 * QUANTILE_COMPRESSION of them
+#define QUANTILE_CENTROIDS 32
+#define QUANTILE_COMPRESSION 36
+// samples collected before they are merged into the centroids
+#define QUANTILE_BUFFER 32
+
+struct quantile_centroid {
+  float mean;
+  float weight;
+};
+
+// persisted form, 208 bytes; a weight fits 16 bits for up to ~500000 samples a day
+struct quantile_channel {
+  float min;
+  float max;
+  uint32_t count;
+  uint8_t centroids;
+  uint8_t reserved[3];
+  float means[QUANTILE_CENTROIDS];
+  uint16_t weights[QUANTILE_CENTROIDS];
+};
+
+//==============================================================================
+/**
+ * \class QuantileSketch
+ * \brief merging t-digest with the arcsine scale function
+ *
+ * Centroids are small near both tails and large in the middle, so p5 and
+ * p95 stay within a fraction of the sample spacing while the sketch never
+ * grows past QUANTILE_CENTROIDS. add() only appends to a buffer; every
+ * QUANTILE_BUFFER samples the buffer is sorted and merged in one pass.
+ * Two sketches merge the same way, so days combine into any range.
+ * min and max are exact and anchor the outer interpolation.
+ */
+class QuantileSketch {
+  private:
+    quantile_centroid _c[QUANTILE_CENTROIDS];
+    uint8_t _n;
+    float _buf[QUANTILE_BUFFER];
+    uint8_t _bufN;
+    float _min;
+    float _max;
+    uint32_t _count;
+    void _compress(const quantile_centroid* in, size_t n);
+    void _mergeSorted(const quantile_centroid* in, size_t n);
+  public:
+    QuantileSketch() { clear(); }
+    void clear();
+    // NaN is ignored
+    void add(float value);
+    void merge(const QuantileSketch& other);
+    // merges the buffer, the queries below call it
+    void flush();
+    uint32_t count() const { return _count; }
+    float min() const { return _min; }
+    float max() const { return _max; }
+    float mean();
+    // value at q in [0, 1], NaN when empty
+    float quantile(float q);
+    // fraction of the samples at or below value
+    float cdf(float value);
+    uint8_t centroids() { flush(); return _n; }
+    void save(quantile_channel* out);
+    // false if the persisted form is not consistent
+    bool load(const quantile_channel& in);
+};
+
+#endif
@@ -0,0 +1,93 @@
+// Daily quantile sketches of the logged readings, one record per day on SD
+/**
+ * \file
+ * \brief QuantileStore class
+ */
+
+#ifndef __QuantileStore__
+#define __QuantileStore__
+
+#include <Arduino.h>
+
+#include <SPI.h>
+#include "SdFat.h"
+#define FS_NO_GLOBALS
+
+#include "QuantileSketch.h"
+
+#define QUANTILE_MAGIC 0x4b535451   // "QTSK"
+#define QUANTILE_VERSION 1
+// the running day is written at this interval, a reboot loses at most that
+#ifndef QUANTILE_CHECKPOINT_MS
+#define QUANTILE_CHECKPOINT_MS 3600000
+#endif
+// 2020-01-01, a record before it was taken with the clock not set
+#define QUANTILE_MIN_DAY 18262
+// a day further past the last record than this is a clock error, not a gap
+#define QUANTILE_MAX_GAP_DAYS 3660
+
+enum quantile_channel_id {QUANTILE_TEMPERATURE, QUANTILE_HUMIDITY, QUANTILE_CHANNELS};
+
+struct quantile_file_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint32_t firstDay;  // of the first record, days since 1970-01-01 UTC
+  uint32_t reserved;
+};
+
+// 424 bytes; day 0 marks a day without records
+struct quantile_day {
+  uint32_t day;
+  uint32_t crc;       // LogCrc32 of channels
+  quantile_channel channels[QUANTILE_CHANNELS];
+};
+
+//==============================================================================
+/**
+ * \class QuantileStore
+ * \brief sketches of the running UTC day, persisted to one file of fixed records
+ *
+ * add() feeds every logged record into a t-digest per channel. When the
+ * first record of a new day arrives the finished day is written; the
+ * running day is also written every QUANTILE_CHECKPOINT_MS and read back
+ * when its first record after a reboot arrives. Record n of the file is
+ * day firstDay + n, so a range is one seek and a sequential read; days
+ * without records are zero filled. A day before firstDay, after the clock
+ * that started the file was ahead, moves the records up and rebases it.
+ *
+ * add() runs in loop() under the SD writer lock. Responses copy the
+ * running day with today(), which takes a mutex against add().
+ */
+class QuantileStore {
+  private:
+    SdFat& _sd;
+    const char* _path;
+    SemaphoreHandle_t _mutex;
+    uint32_t _day;
+    QuantileSketch _sketch[QUANTILE_CHANNELS];
+    bool _dirty;
+    uint32_t _savedMs;
+    uint32_t _saves;
+    uint32_t _errors;
+    bool _save();
+    bool _rebase(File& file, quantile_file_header* header, uint32_t records);
+    void _load(uint32_t day);
+  public:
+    QuantileStore(SdFat& sd, const char* path);
+    void begin();
+    // a logged record, SD writer lock held
+    void add(uint32_t time, float temperature, float humidity);
+    // the day add() is collecting, 0 before the first record
+    uint32_t day() const { return _day; }
+    const char* path() const { return _path; }
+    // copies of the running day's sketches, false if day is not the running one
+    bool today(uint32_t day, QuantileSketch* out);
+    String toJson();
+    // false if file is not a sketch file of this version
+    static bool readHeader(File& file, quantile_file_header* header);
+    // false if the file has no record of day
+    static bool readDay(File& file, const quantile_file_header& header, uint32_t day, quantile_day* out);
+};
+
+#endif
@@ -0,0 +1,113 @@
+// Short lived cache of the JSON bodies of polled API routes
+/**
+ * \file
+ * \brief ResponseCache and CachedResponse classes
+ */
+
+#ifndef __ResponseCache__
+#define __ResponseCache__
+
+#include <Arduino.h>
+
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// buffers per route, one can be rebuilt while the other is still being sent
+#define RESPONSE_CACHE_SLOTS 2
+// /api/state is about 2.1 KB with 8 active alerts, each further one adds up to 60 bytes
+#define RESPONSE_CACHE_STATE_SIZE 3072
+#define RESPONSE_CACHE_CONFIG_SIZE 1536
+// a slot a body does not fit in is grown to it plus this
+#define RESPONSE_CACHE_GROW_SLACK 256
+// free heap, storage and timing figures change without an invalidate()
+#ifndef RESPONSE_CACHE_STATE_TTL_MS
+#define RESPONSE_CACHE_STATE_TTL_MS 1000
+#endif
+// only the settings forms change it, they invalidate it
+#ifndef RESPONSE_CACHE_CONFIG_TTL_MS
+#define RESPONSE_CACHE_CONFIG_TTL_MS 60000
+#endif
+
+enum cache_route {CACHE_STATE, CACHE_CONFIG, CACHE_ROUTE_COUNT};
+
+struct cache_slot {
+  char* data;
+  size_t size;          // allocated
+  size_t len;
+  uint32_t generation;  // of the route when the body was built
+  uint32_t builtMs;
+  uint8_t refs;         // responses still sending it, or the writer filling it
+};
+
+//==============================================================================
+/**
+ * \class ResponseCache
+ * \brief route keyed bodies in buffers allocated once, shared by all clients
+ *
+ * A handler asks get() first; on a hit every client gets a CachedResponse
+ * over the same bytes. On a miss it builds the body as before and hands
+ * it to put(), with the generation it read before building, so a body
+ * built across an invalidate() is not kept. invalidate() only bumps the
+ * generation and may be called from loop(). A slot is rewritten only when
+ * no response holds it; with both slots busy the body is sent without
+ * being cached. A body larger than the slot grows it, only if that fails
+ * is it sent uncached and counted as an overflow.
+ */
+class ResponseCache {
+  private:
+    struct route {
+      const char* name;
+      size_t size;
+      uint32_t ttlMs;
+      volatile uint32_t generation;
+      cache_slot slots[RESPONSE_CACHE_SLOTS];
+      int8_t current;
+      uint32_t hits;
+      uint32_t misses;
+      uint32_t invalidations;
+      uint32_t uncached;    // stale, too large or both slots busy
+      uint32_t grown;       // slots reallocated for a larger body
+      uint32_t overflows;   // bodies that did not fit and could not grow a slot
+      size_t largest;       // body, since reset()
+    };
+    route _routes[CACHE_ROUTE_COUNT];
+    portMUX_TYPE _mux;
+  public:
+    ResponseCache();
+    // allocates the buffers
+    void begin();
+    void invalidate(cache_route r);
+    uint32_t generation(cache_route r) const { return _routes[r].generation; }
+    // the cached body, NULL if there is none or it is stale
+    AsyncWebServerResponse* get(cache_route r);
+    // keeps body if it is still current, the response sends it either way
+    AsyncWebServerResponse* put(cache_route r, uint32_t generation, const String& body);
+    // called by CachedResponse once it is sent
+    void release(cache_route r, uint8_t slot);
+    const char* data(cache_route r, uint8_t slot) const { return _routes[r].slots[slot].data; }
+    size_t length(cache_route r, uint8_t slot) const { return _routes[r].slots[slot].len; }
+    void reset();
+    String toJson();
+};
+
+//==============================================================================
+/**
+ * \class CachedResponse
+ * \brief sends a ResponseCache slot, holding it until the last byte is out
+ */
+class CachedResponse: public AsyncAbstractResponse {
+  private:
+    ResponseCache& _cache;
+    cache_route _route;
+    uint8_t _slot;
+    size_t _sent;
+  public:
+    CachedResponse(ResponseCache& cache, cache_route r, uint8_t slot);
+    ~CachedResponse();
+    bool _sourceValid() const { return true; }
+    virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
+};
+
+extern ResponseCache responseCache;
+
+#endif
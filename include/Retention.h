@@ -0,0 +1,56 @@
+// Retention policy for the logs directory
+/**
+ * \file
+ * \brief Retention class
+ */
+
+#ifndef __Retention__
+#define __Retention__
+
+#include <Arduino.h>
+
+#include <SPI.h>
+#include "SdFat.h"
+#define FS_NO_GLOBALS
+
+#include "LogStore.h"
+#include "StorageStats.h"
+
+// all limits are off when 0
+struct retention_policy {
+  uint32_t maxAgeDays;
+  uint32_t maxMB;
+  uint32_t minFreeMB;
+};
+
+//==============================================================================
+/**
+ * \class Retention
+ * \brief deletes the oldest log files while a retention limit is exceeded
+ *
+ * enforce() removes at most one file per call so a long backlog does not
+ * stall loop(); it returns true while the policy is still violated.
+ * Free space comes from StorageStats, never from a FAT scan.
+ */
+class Retention {
+  private:
+    SdFat& _sd;
+    LogStore& _store;
+    StorageStats& _stats;
+    const char* _dir;
+    retention_policy _policy;
+    uint64_t _logBytes;
+    uint32_t _files;
+    uint64_t _reclaimed;
+    uint32_t _deleted;
+    bool _violated;
+    char _lastDeleted[LOG_NAME_MAX];
+  public:
+    Retention(SdFat& sd, LogStore& store, StorageStats& stats, const char* dir);
+    void setPolicy(const retention_policy& policy) { _policy = policy; }
+    const retention_policy& policy() const { return _policy; }
+    bool enforce(uint32_t now);
+    String toJson();
+};
+
+#endif
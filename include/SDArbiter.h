@@ -0,0 +1,81 @@
+// Serialises SD card access between loop() and the AsyncTCP task
+/**
+ * \file
+ * \brief SDArbiter and SDLock classes
+ */
+
+#ifndef __SDArbiter__
+#define __SDArbiter__
+
+#include <Arduino.h>
+
+#include "PerfMonitor.h"
+
+// how long a log write may wait for a reader to finish its chunk
+#ifndef SD_WRITE_WAIT_MS
+#define SD_WRITE_WAIT_MS 1000
+#endif
+// how long a response chunk waits before it yields the connection
+#ifndef SD_FILL_WAIT_MS
+#define SD_FILL_WAIT_MS 20
+#endif
+// how long a request handler waits before it answers 503
+#ifndef SD_HANDLER_WAIT_MS
+#define SD_HANDLER_WAIT_MS 500
+#endif
+
+enum sd_client {SD_WRITER, SD_READER, SD_CLIENT_COUNT};
+
+//==============================================================================
+/**
+ * \class SDArbiter
+ * \brief writer preferring lock around the shared SdFat volume and SPI bus
+ *
+ * loop() takes the lock as SD_WRITER for log writes, mounts, scans and
+ * retention. Web responses take it as SD_READER for one _fillBuffer()
+ * call at a time, so a download never holds the card for longer than a
+ * chunk. While a writer waits no new reader gets the lock; a reader that
+ * cannot get it in time returns RESPONSE_TRY_AGAIN and is polled again.
+ *
+ * The mutex is recursive with priority inheritance, so nested writer
+ * sections in loop() are fine.
+ */
+class SDArbiter {
+  private:
+    SemaphoreHandle_t _mutex;
+    volatile uint8_t _writersWaiting;
+    portMUX_TYPE _mux;
+    PerfStat _wait[SD_CLIENT_COUNT];
+    PerfStat _hold[SD_CLIENT_COUNT];
+    uint32_t _contended[SD_CLIENT_COUNT];
+    uint32_t _timeouts[SD_CLIENT_COUNT];
+    uint32_t _yields;
+  public:
+    SDArbiter();
+    void begin();
+    bool acquire(sd_client client, uint32_t timeoutMs);
+    void release(sd_client client, uint32_t heldUs);
+    bool writerWaiting() const { return _writersWaiting != 0; }
+    void reset();
+    String toJson();
+};
+
+extern SDArbiter sdArbiter;
+
+//==============================================================================
+/**
+ * \class SDLock
+ * \brief holds the SD lock for the enclosing block, check locked()
+ */
+class SDLock {
+  private:
+    sd_client _client;
+    bool _locked;
+    int64_t _start;
+  public:
+    SDLock(sd_client client, uint32_t timeoutMs);
+    ~SDLock();
+    bool locked() const { return _locked; }
+};
+
+#endif
@@ -0,0 +1,60 @@
+// Mount the SD card once and keep track of its health
+/**
+ * \file
+ * \brief SDManager class
+ */
+
+#ifndef __SDManager__
+#define __SDManager__
+
+#include <Arduino.h>
+
+#include <SPI.h>
+#include "SdFat.h"
+#define FS_NO_GLOBALS
+
+// card presence probe period
+#define SD_PROBE_INTERVAL 5000
+#define SD_BACKOFF_MIN 1000
+#define SD_BACKOFF_MAX 60000
+// consecutive I/O errors before the volume is considered lost
+#define SD_ERROR_LIMIT 3
+
+enum sd_mount_state {SD_UNMOUNTED, SD_MOUNTED, SD_FAILED};
+
+//==============================================================================
+/**
+ * \class SDManager
+ * \brief mounts the card once, remounts with backoff after failures
+ *
+ * Callers only check mounted(), which is a flag read. I/O failures are
+ * reported with ioError(); loop() probes the card CID to detect removal
+ * or a different card and remounts from the main loop only.
+ */
+class SDManager {
+  private:
+    SdFat& _sd;
+    uint8_t _csPin;
+    uint32_t _spiSpeed;
+    volatile sd_mount_state _state;
+    volatile uint8_t _errorRun;
+    uint32_t _errors;
+    uint32_t _mounts;
+    uint32_t _backoff;
+    uint32_t _nextAttempt;
+    uint32_t _lastProbe;
+    uint32_t _serial;
+    bool _mount();
+  public:
+    SDManager(SdFat& sd, uint8_t csPin, uint32_t spiSpeed);
+    bool begin();
+    bool loop();
+    bool mounted() const { return _state == SD_MOUNTED; }
+    sd_mount_state state() const { return _state; }
+    void ioError(const char* what);
+    void ioOk() { _errorRun = 0; }
+    uint32_t mounts() const { return _mounts; }
+    uint32_t errors() const { return _errors; }
+};
+
+#endif
@@ -0,0 +1,65 @@
+// Free space bookkeeping for the SD volume
+/**
+ * \file
+ * \brief StorageStats class
+ */
+
+#ifndef __StorageStats__
+#define __StorageStats__
+
+#include <Arduino.h>
+
+#include <SPI.h>
+#include "SdFat.h"
+#define FS_NO_GLOBALS
+
+// FAT blocks read per background step, ~0.3 ms each at 16 MHz SPI
+#define STORAGE_SCAN_BLOCKS 8
+// full rescan period, corrects for allocations made behind our back
+#define STORAGE_RESCAN_INTERVAL (24UL * 3600 * 1000)
+
+//==============================================================================
+/**
+ * \class StorageStats
+ * \brief card size and free cluster count without blocking FAT scans
+ *
+ * Card and volume geometry are read once per mount. The free cluster
+ * count is kept up to date from the logger's own allocations and
+ * deletions; the FAT itself is only read by scanStep(), a few raw blocks
+ * at a time from the main loop, once per mount and once a day.
+ */
+class StorageStats {
+  private:
+    SdFat& _sd;
+    volatile bool _valid;
+    volatile int32_t _freeClusters;
+    uint32_t _clusterBytes;
+    uint32_t _clusterCount;
+    uint64_t _cardBytes;
+    uint8_t _fatType;
+    uint32_t _fatStart;
+    bool _scanning;
+    uint32_t _scanBlock;
+    uint32_t _scanBlocks;
+    uint32_t _scanFree;
+    uint32_t _lastScan;
+    uint32_t _scans;
+    uint32_t _clusters(uint32_t size) const { return size ? (size - 1) / _clusterBytes + 1 : 0; }
+    void _finishScan(uint32_t free);
+  public:
+    StorageStats(SdFat& sd);
+    void mounted();
+    void unmounted() { _valid = false; _scanning = false; }
+    bool scanStep();
+    void fileResized(uint32_t oldSize, uint32_t newSize);
+    void fileRemoved(uint32_t size) { fileResized(size, 0); }
+    bool valid() const { return _valid; }
+    bool scanning() const { return _scanning; }
+    bool scanDue() const { return _scanning || (_scans > 0 && millis() - _lastScan >= STORAGE_RESCAN_INTERVAL); }
+    uint64_t cardBytes() const { return _cardBytes; }
+    uint64_t freeBytes() const { return _valid ? (uint64_t)_freeClusters * _clusterBytes : 0; }
+    uint64_t volumeBytes() const { return (uint64_t)_clusterCount * _clusterBytes; }
+    uint32_t scans() const { return _scans; }
+};
+
+#endif
@@ -0,0 +1,60 @@
+// Records appended since a cursor, for collectors that follow the log
+/**
+ * \file
+ * \brief SyncResponse class and the sync cursor
+ */
+
+#ifndef __SyncResponse__
+#define __SyncResponse__
+
+#include <Arduino.h>
+
+#include "ChunkedResponse.h"
+#include "LogExport.h"
+#include "LogRangeReader.h"
+
+// records per page unless ?max= asks for fewer or more
+#define SYNC_PAGE_RECORDS 5000
+#define SYNC_MAX_RECORDS 50000
+// SD blocks read per _fillBuffer() call once it has output
+#define SYNC_FILL_CHUNKS 16
+// "<file>,<offset>"
+#define SYNC_CURSOR_MAX_LEN (LOG_NAME_MAX + 12)
+
+// false unless cursor is "<log file name>,<offset>"
+bool ParseSyncCursor(const char* cursor, char* name, size_t size, uint32_t* offset);
+size_t FormatSyncCursor(char* buf, size_t size, const char* name, uint32_t offset);
+// the last line of a page: {"cursor":"..","records":N,"more":false,"restarted":false}
+size_t FormatSyncTrailer(char* buf, size_t size, const char* cursor, uint32_t records, bool more, bool restarted);
+
+//==============================================================================
+/**
+ * \class SyncResponse
+ * \brief NDJSON records after a cursor, then a line with the next cursor
+ *
+ * The cursor is the file and offset right after the last record sent,
+ * an empty one starts at the oldest file. Files are followed in the
+ * order LogRangeReader reads them, so a page can span several files and
+ * a collector that was away for days catches up in pages of max
+ * records. more is true when the page stopped at max rather than at the
+ * end of the log. restarted tells that the cursor file had shrunk and
+ * was sent again from its start.
+ */
+class SyncResponse: public ChunkedResponse {
+  private:
+    enum state {SYNC_RECORDS, SYNC_TRAILER, SYNC_DONE};
+    LogRangeReader _reader;
+    uint32_t _max;
+    uint32_t _records;
+    state _state;
+    char _cursor[SYNC_CURSOR_MAX_LEN];
+    uint8_t _out[SYNC_CURSOR_MAX_LEN + 80];
+  protected:
+    uint32_t _work() const override { return _reader.chunksRead(); }
+    size_t _step(uint8_t* data, size_t len) override;
+  public:
+    // name empty for the start of the log
+    SyncResponse(SdFat& sd, LogStore& store, const char* dir, const char* name, uint32_t offset, uint32_t max);
+};
+
+#endif
@@ -0,0 +1,96 @@
+// System clock disciplined by the DS3231 RTC and NTP
+/**
+ * \file
+ * \brief TimeService class
+ */
+
+#ifndef __TimeService__
+#define __TimeService__
+
+#include <Arduino.h>
+#include <sys/time.h>
+#include "esp_timer.h"
+#include "RTClib.h"
+
+// how often the RTC is compared against the system clock
+#define TIME_CHECK_INTERVAL 3600000UL
+// seconds register poll period while waiting for the RTC second edge
+#define TIME_EDGE_POLL_MS 5
+// shortest NTP baseline used for a drift estimate
+#define TIME_DRIFT_BASELINE 21600UL
+// RTC offset to NTP that triggers setting the RTC
+#define TIME_MAX_OFFSET_MS 250
+// DS3231 aging register, ~0.1 ppm per LSB, positive slows the oscillator
+#define TIME_AGING_PPM 0.1f
+// backward steps of the system clock up to this size are hidden by now()
+#define TIME_MAX_BACKSTEP_US 2000000LL
+
+//==============================================================================
+/**
+ * \class TimeService
+ * \brief sub-second timestamps without per-call I2C reads
+ *
+ * The RTC is read at boot and then once per TIME_CHECK_INTERVAL. The
+ * check waits for the next RTC second edge (polling the seconds
+ * register from loop(), never blocking), which gives the RTC offset to
+ * the system clock to a few ms.
+ *
+ * With NTP the offsets form a drift estimate that is written to the
+ * DS3231 aging register, so the RTC needs fewer and smaller corrections.
+ * It is only set when it is off by more than TIME_MAX_OFFSET_MS, and
+ * then exactly on a second boundary. Without NTP the system clock is
+ * slewed towards the RTC with adjtime() instead of being stepped.
+ *
+ * now() is wall time and only monotonic within a step: it holds the last
+ * value through backward steps shorter than TIME_MAX_BACKSTEP_US, such as
+ * the half second begin() may set too far, but passes larger ones (an
+ * NTP or RTC correction) through and counts them in backSteps(). Ordering
+ * and durations use monotonicUs(), which no clock correction touches.
+ */
+class TimeService {
+  private:
+    enum phase {TIME_IDLE, TIME_WAIT_EDGE, TIME_WAIT_ADJUST};
+    RTC_DS3231& _rtc;
+    portMUX_TYPE _mux;
+    struct timeval _last;
+    uint32_t _backSteps;
+    int64_t _lastBackStepUs;
+    volatile bool _rtcOk;
+    phase _phase;
+    uint32_t _lastCheck;
+    uint32_t _edgeStart;
+    uint32_t _lastPoll;
+    int _edgeSecond;
+    bool _haveRef;
+    int64_t _refSysMs;
+    int32_t _refOffsetMs;
+    int32_t _offsetMs;
+    float _driftPpm;
+    int64_t _pollSysMs;
+    int8_t _aging;
+    uint32_t _i2cReads;
+    uint32_t _rtcSets;
+    int _readSeconds();
+    bool _readAging(int8_t* aging);
+    bool _writeAging(int8_t aging);
+    void _measured(int64_t sysMs, uint32_t rtcTime, bool ntp);
+    static int64_t _sysMs();
+  public:
+    TimeService(RTC_DS3231& rtc);
+    bool begin();
+    void loop(bool ntp);
+    // wall time, see the class comment for what is monotonic
+    void now(struct timeval* tv);
+    // time since boot from esp_timer, never goes back
+    static int64_t monotonicUs() { return esp_timer_get_time(); }
+    // backward steps now() passed through, each one starts a new monotonic run
+    uint32_t backSteps() const { return _backSteps; }
+    size_t format(char* buf, size_t size);
+    bool rtcOk() const { return _rtcOk; }
+    float driftPpm() const { return _driftPpm; }
+    int32_t offsetMs() const { return _offsetMs; }
+    int8_t aging() const { return _aging; }
+    String toJson();
+};
+
+#endif
@@ -0,0 +1,49 @@
+// Web pages embedded in flash at build time
+/**
+ * \file
+ * \brief web_asset table and WebAssetHandler class
+ *
+ * The table is generated from data/ by tools/embed_assets.py before
+ * every build (src/WebAssetsData.cpp, not in git).
+ */
+
+#ifndef __WebAssets__
+#define __WebAssets__
+
+#include <Arduino.h>
+
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+struct web_asset {
+  const char* path;         // URL, sorted
+  const char* contentType;
+  const uint8_t* data;
+  uint32_t length;
+  const char* etag;         // quoted, hash of data
+  bool gzip;
+};
+
+extern const web_asset web_assets[];
+extern const size_t web_asset_count;
+
+// "/" maps to "/index.html", NULL if not embedded
+const web_asset* FindWebAsset(const char* path);
+
+//==============================================================================
+/**
+ * \class WebAssetHandler
+ * \brief serves embedded assets straight from flash with strong ETags
+ *
+ * A matching If-None-Match is answered with 304. Pages revalidate on
+ * every load, files under /src/ are cached for a year since their names
+ * carry the library version.
+ */
+class WebAssetHandler : public AsyncWebHandler {
+  public:
+    virtual bool canHandle(AsyncWebServerRequest* request) override;
+    virtual void handleRequest(AsyncWebServerRequest* request) override;
+    virtual bool isRequestHandlerTrivial() override { return true; }
+};
+
+#endif
@@ -0,0 +1,94 @@
+// Station connection manager: fast reconnect, backoff and outage metrics
+/**
+ * \file
+ * \brief WifiConnection class
+ */
+
+#ifndef __WifiConnection__
+#define __WifiConnection__
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+// first retry after a failed attempt or a lost link, doubled up to the max
+#define WIFI_BACKOFF_MIN_MS 500
+#define WIFI_BACKOFF_MAX_MS 60000
+// an attempt without an IP by then counts as failed
+#define WIFI_CONNECT_TIMEOUT_MS 15000
+// failed attempts on the cached BSSID/channel before a full scan
+#define WIFI_FAST_TRIES 2
+
+enum wifi_conn_state {
+  WIFI_CONN_IDLE,
+  WIFI_CONN_CONNECTING,
+  WIFI_CONN_CONNECTED,
+  WIFI_CONN_WAITING
+};
+
+//==============================================================================
+/**
+ * \class WifiConnection
+ * \brief (re)connects the station without the Arduino auto reconnect
+ *
+ * The BSSID and channel of the last association are kept in Preferences.
+ * An attempt with them skips the all channel scan, which makes a
+ * reconnect take a few hundred ms instead of seconds; after
+ * WIFI_FAST_TRIES failures the next attempt scans, in case the access
+ * point moved. Failures are retried with exponential backoff between
+ * WIFI_BACKOFF_MIN_MS and WIFI_BACKOFF_MAX_MS.
+ *
+ * The event handlers run in the Wi-Fi event task, attempts are started
+ * from begin() and loop(); Preferences are only written from loop().
+ */
+class WifiConnection {
+  private:
+    Preferences& _prefs;
+    portMUX_TYPE _mux;
+    volatile wifi_conn_state _state;
+    char _ssid[33];
+    char _pass[65];
+    bool _eap;
+    uint8_t _bssid[6];
+    uint8_t _channel;
+    bool _cached;
+    volatile bool _learned;
+    uint8_t _seenBssid[6];
+    uint8_t _seenChannel;
+    uint8_t _failures;
+    uint8_t _fastFailures;
+    bool _lastFast;
+    uint32_t _attemptMs;
+    uint32_t _nextMs;
+    uint32_t _lostMs;
+    bool _outage;
+    uint8_t _lastReason;
+    uint32_t _attempts;
+    uint32_t _fastAttempts;
+    uint32_t _fastConnects;
+    uint32_t _connects;
+    uint32_t _reconnects;
+    uint32_t _lastConnectMs;
+    uint32_t _maxConnectMs;
+    uint64_t _sumConnectMs;
+    uint32_t _lastOutageMs;
+    uint32_t _maxOutageMs;
+    uint64_t _sumOutageMs;
+    void _connect();
+    void _failed(uint32_t now);
+    void _loadCache();
+  public:
+    WifiConnection(Preferences& prefs);
+    // empty ssid leaves the station unconnected
+    void begin(const char* ssid, const char* pass, bool eap);
+    // no attempts until the next begin(), events are ignored
+    void stop();
+    void loop();
+    // Wi-Fi event task
+    void onConnected(const uint8_t* bssid, uint8_t channel);
+    void onDisconnected(uint8_t reason);
+    void onGotIP();
+    wifi_conn_state state() const { return _state; }
+    String toJson();
+};
+
+#endif
@@ -0,0 +1,68 @@
+// Rate limited background Wi-Fi scans behind a cache for /api/wifi
+/**
+ * \file
+ * \brief WifiScanner class
+ */
+
+#ifndef __WifiScanner__
+#define __WifiScanner__
+
+#include <Arduino.h>
+
+// scans run while /api/wifi was asked within this time
+#define WIFI_SCAN_DEMAND_MS 20000
+// shortest time between the end of a scan and the start of the next
+#define WIFI_SCAN_INTERVAL_MS 15000
+// a network not seen for this long is dropped from the cache
+#define WIFI_SCAN_TTL_MS 60000
+// dwell per channel, shorter than the 300 ms default to keep gaps short
+#define WIFI_SCAN_CHANNEL_MS 120
+// a scan not done by then is abandoned
+#define WIFI_SCAN_TIMEOUT_MS 10000
+#define WIFI_SCAN_MAX 24
+
+// one SSID, merged over all access points that broadcast it
+struct wifi_network {
+  char ssid[33];
+  uint8_t bssid[6];   // strongest access point
+  int8_t rssi;
+  uint8_t channel;
+  uint8_t secure;     // wifi_auth_mode_t
+  uint8_t aps;
+  uint32_t seenMs;
+};
+
+//==============================================================================
+/**
+ * \class WifiScanner
+ * \brief scans only while the Wi-Fi page polls, answers from a cache
+ *
+ * A scan takes the radio off the AP and STA channel for a few hundred ms
+ * per channel, so it is never started from the HTTP handler. demand()
+ * marks the page as open; loop() starts an async scan at most every
+ * WIFI_SCAN_INTERVAL_MS while it is, and merges the results into the
+ * cache by SSID. The handler only copies the cache.
+ */
+class WifiScanner {
+  private:
+    portMUX_TYPE _mux;
+    wifi_network _networks[WIFI_SCAN_MAX];
+    uint8_t _count;
+    volatile uint32_t _demandMs;
+    volatile bool _demanded;
+    bool _scanning;
+    uint32_t _startMs;
+    uint32_t _doneMs;
+    uint32_t _scans;
+    uint32_t _failed;
+    void _merge(int16_t found, uint32_t now);
+  public:
+    WifiScanner();
+    // called by /api/wifi, never scans itself
+    void demand();
+    void loop();
+    bool scanning() const { return _scanning; }
+    String toJson();
+};
+
+#endif
@@ -0,0 +1,146 @@
+// Delivery of alert events: recent history and an HTTP webhook
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <HTTPClient.h>
+
+#include "AlertNotifier.h"
+
+AlertNotifier::AlertNotifier() {
+  _queue = NULL;
+  _mux = portMUX_INITIALIZER_UNLOCKED;
+  _url[0] = 0;
+  _recentNext = 0;
+  _recentCount = 0;
+  _sent = 0;
+  _failed = 0;
+  _dropped = 0;
+  _lastStatus = 0;
+  _holding = false;
+  _offline = false;
+}
+
+void AlertNotifier::begin() {
+  _queue = xQueueCreate(ALERT_NOTIFY_QUEUE, sizeof(alert_message));
+  xTaskCreatePinnedToCore(_task, "alertNotify", ALERT_NOTIFY_STACK, this, 1, NULL, 0);
+}
+
+void AlertNotifier::setUrl(const char* url) {
+  portENTER_CRITICAL(&_mux);
+  strlcpy(_url, url, sizeof(_url));
+  portEXIT_CRITICAL(&_mux);
+}
+
+bool AlertNotifier::notify(const alert_message& msg) {
+  bool webhook;
+  portENTER_CRITICAL(&_mux);
+  _recent[_recentNext] = msg;
+  _recentNext = (_recentNext + 1) % ALERT_RECENT;
+  if (_recentCount < ALERT_RECENT)
+    _recentCount++;
+  webhook = _url[0] != 0;
+  portEXIT_CRITICAL(&_mux);
+
+  if (!webhook || _queue == NULL)
+    return true;
+  if (xQueueSend(_queue, &msg, 0) == pdTRUE)
+    return true;
+  // the latest state matters most
+  alert_message oldest;
+  if (xQueueReceive(_queue, &oldest, 0) == pdTRUE)
+    _dropped++;
+  if (xQueueSend(_queue, &msg, 0) != pdTRUE) {
+    _dropped++;
+    return false;
+  }
+  return true;
+}
+
+//=============================================================================
+
+void AlertNotifier::_task(void* arg) {
+  AlertNotifier* self = (AlertNotifier*)arg;
+  alert_message msg;
+  char url[ALERT_URL_MAX_LEN];
+  while (true) {
+    if (xQueueReceive(self->_queue, &msg, portMAX_DELAY) != pdTRUE)
+      continue;
+    self->_holding = true;
+    bool sent = false;
+    int attempts = 0;
+    while (!sent && attempts < ALERT_NOTIFY_RETRIES) {
+      portENTER_CRITICAL(&self->_mux);
+      strlcpy(url, self->_url, sizeof(url));
+      portEXIT_CRITICAL(&self->_mux);
+      if (url[0] == 0)
+        break;
+      // offline time does not use up attempts
+      self->_offline = !WiFi.isConnected();
+      if (self->_offline) {
+        vTaskDelay(ALERT_NOTIFY_OFFLINE_POLL_MS / portTICK_PERIOD_MS);
+        continue;
+      }
+      int status = self->_post(url, msg);
+      self->_lastStatus = status;
+      sent = status >= 200 && status < 300;
+      if (sent || (status < 0 && !WiFi.isConnected()))
+        continue;
+      if (++attempts < ALERT_NOTIFY_RETRIES)
+        vTaskDelay(ALERT_NOTIFY_RETRY_MS / portTICK_PERIOD_MS);
+    }
+    self->_holding = false;
+    self->_offline = false;
+    if (sent)
+      self->_sent++;
+    else
+      self->_failed++;
+  }
+}
+
+// HTTP status, or a negative HTTPClient error
+int AlertNotifier::_post(const char* url, const alert_message& msg) {
+  char body[ALERT_RULE_MAX_LEN + 96];
+  int len = snprintf(body, sizeof(body), "{\"device\":\"htlogger\",\"rule\":\"%s\",\"state\":\"%s\",\"value\":%.1f,\"time\":%u}",
+                     msg.rule, msg.raised ? "raised" : "cleared", msg.value, (unsigned)msg.time);
+  HTTPClient http;
+  if (!http.begin(url))
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  http.setTimeout(ALERT_NOTIFY_TIMEOUT_MS);
+  http.addHeader("Content-Type", "application/json");
+  int status = http.POST((uint8_t*)body, len);
+  http.end();
+  return status;
+}
+
+//=============================================================================
+
+String AlertNotifier::toJson() {
+  alert_message recent[ALERT_RECENT];
+  portENTER_CRITICAL(&_mux);
+  uint8_t count = _recentCount;
+  for (uint8_t i = 0; i < count; i++)
+    recent[i] = _recent[(_recentNext + ALERT_RECENT - 1 - i) % ALERT_RECENT];
+  bool webhook = _url[0] != 0;
+  portEXIT_CRITICAL(&_mux);
+  uint32_t queued = (_queue ? uxQueueMessagesWaiting(_queue) : 0) + (_holding ? 1 : 0);
+
+  String json = "{\"recent\":[";
+  for (uint8_t i = 0; i < count; i++) {
+    if (i)
+      json += ",";
+    json += "{\"rule\":\"" + String(recent[i].rule) + "\"";
+    json += ",\"state\":\"" + String(recent[i].raised ? "raised" : "cleared") + "\"";
+    json += ",\"value\":" + String(recent[i].value, 1);
+    json += ",\"time\":" + String(recent[i].time);
+    json += "}";
+  }
+  json += "],\"webhook\":" + String(webhook ? "true" : "false");
+  json += ",\"sent\":" + String(_sent);
+  json += ",\"failed\":" + String(_failed);
+  json += ",\"dropped\":" + String(_dropped);
+  json += ",\"queued\":" + String(queued);
+  json += ",\"offline\":" + String(_offline ? "true" : "false");
+  json += ",\"lastStatus\":" + String(_lastStatus);
+  json += "}";
+  return json;
+}
@@ -0,0 +1,233 @@
+// Threshold, rate of change and sensor fault alerts on every reading
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "AlertRules.h"
+
+static const char alert_ops[] = "><+-";
+
+AlertEngine::AlertEngine() {
+  _raised = 0;
+  _dropped = 0;
+  _evaluations = 0;
+  setRules(NULL, 0);
+}
+
+void AlertEngine::setRules(const alert_rule* rules, uint8_t count) {
+  _count = count < ALERT_MAX_RULES ? count : ALERT_MAX_RULES;
+  for (uint8_t i = 0; i < _count; i++)
+    _rules[i] = rules[i];
+  memset(_state, 0, sizeof(_state));
+  _head = 0;
+  _queued = 0;
+}
+
+uint8_t AlertEngine::activeCount() const {
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < _count; i++)
+    n += _state[i].active;
+  return n;
+}
+
+//=============================================================================
+
+void AlertEngine::_push(uint8_t rule, bool raised, float value, uint32_t time) {
+  if (_queued == ALERT_EVENT_QUEUE) {
+    _head = (_head + 1) % ALERT_EVENT_QUEUE;
+    _queued--;
+    _dropped++;
+  }
+  alert_event& e = _events[(_head + _queued) % ALERT_EVENT_QUEUE];
+  e.rule = rule;
+  e.raised = raised;
+  e.value = value;
+  e.time = time;
+  _queued++;
+}
+
+bool AlertEngine::nextEvent(alert_event* event) {
+  if (_queued == 0)
+    return false;
+  *event = _events[_head];
+  _head = (_head + 1) % ALERT_EVENT_QUEUE;
+  _queued--;
+  return true;
+}
+
+// change against the older anchor, false until there is one; a gap
+// longer than the window starts over
+bool AlertEngine::_change(alert_state& s, const alert_rule& r, float v, uint32_t ms, float* change) {
+  if (!s.primed || ms - s.refMs[1] > r.windowMs) {
+    s.ref[0] = s.ref[1] = v;
+    s.refMs[0] = s.refMs[1] = ms;
+    s.primed = true;
+    return false;
+  }
+  if (ms - s.refMs[1] >= r.windowMs / 2) {
+    s.ref[0] = s.ref[1];
+    s.refMs[0] = s.refMs[1];
+    s.ref[1] = v;
+    s.refMs[1] = ms;
+  }
+  *change = v - s.ref[0];
+  return true;
+}
+
+uint8_t AlertEngine::evaluate(uint32_t ms, uint32_t time, float temperature, float humidity, bool sensorOk) {
+  uint8_t queued = 0;
+  _evaluations++;
+  for (uint8_t i = 0; i < _count; i++) {
+    const alert_rule& r = _rules[i];
+    alert_state& s = _state[i];
+    float v = r.channel == ALERT_HUMIDITY ? humidity : temperature;
+    float value = v;
+    bool on;
+    bool off;
+    if (r.type == ALERT_FAULT) {
+      on = !sensorOk;
+      off = sensorOk;
+      value = 0;
+    } else if (isnan(v)) {
+      continue;
+    } else if (r.type == ALERT_ABOVE) {
+      on = v > r.limit;
+      off = v < r.limit - r.hysteresis;
+    } else if (r.type == ALERT_BELOW) {
+      on = v < r.limit;
+      off = v > r.limit + r.hysteresis;
+    } else {
+      if (!_change(s, r, v, ms, &value))
+        continue;
+      float d = r.type == ALERT_RISE ? value : -value;
+      on = d >= r.limit;
+      off = d < r.limit - r.hysteresis;
+    }
+
+    if (s.active) {
+      if (off) {
+        s.active = false;
+        s.value = value;
+        _push(i, false, value, time);
+        queued++;
+      }
+      continue;
+    }
+    if (!on) {
+      s.pending = false;
+      continue;
+    }
+    if (!s.pending) {
+      s.pending = true;
+      s.since = ms;
+    }
+    if (ms - s.since >= r.holdMs) {
+      s.active = true;
+      s.pending = false;
+      s.value = value;
+      _raised++;
+      _push(i, true, value, time);
+      queued++;
+    }
+  }
+  return queued;
+}
+
+//=============================================================================
+
+static bool parseSeconds(const char** p, uint32_t* ms) {
+  char* end;
+  if (**p < '0' || **p > '9')
+    return false;
+  unsigned long s = strtoul(*p, &end, 10);
+  if (s > ALERT_MAX_SECONDS)
+    return false;
+  *ms = s * 1000;
+  *p = end;
+  return true;
+}
+
+bool ParseAlertRules(const char* spec, alert_rule* rules, uint8_t maxRules, uint8_t* count, size_t* errorAt) {
+  const char* p = spec;
+  *count = 0;
+  while (true) {
+    while (*p == ' ' || *p == ';' || *p == '\n' || *p == '\r')
+      p++;
+    if (*p == 0)
+      return true;
+    if (*count >= maxRules)
+      break;
+
+    alert_rule r;
+    r.limit = 0;
+    r.hysteresis = ALERT_DEFAULT_HYSTERESIS;
+    r.holdMs = 0;
+    r.windowMs = ALERT_DEFAULT_WINDOW * 1000;
+    if (strncmp(p, "fault", 5) == 0) {
+      r.type = ALERT_FAULT;
+      r.channel = ALERT_SENSOR;
+      p += 5;
+    } else {
+      if (*p == 't')
+        r.channel = ALERT_TEMPERATURE;
+      else if (*p == 'h')
+        r.channel = ALERT_HUMIDITY;
+      else
+        break;
+      p++;
+      const char* op = *p ? strchr(alert_ops, *p) : NULL;
+      if (op == NULL)
+        break;
+      r.type = op - alert_ops;
+      p++;
+      char* end;
+      r.limit = strtof(p, &end);
+      if (end == p || isnan(r.limit) || ((r.type == ALERT_RISE || r.type == ALERT_FALL) && r.limit <= 0))
+        break;
+      p = end;
+    }
+
+    bool ok = true;
+    while (ok && *p && *p != ';' && *p != '\n' && *p != '\r') {
+      char opt = *p++;
+      if (opt == ' ') {
+        continue;
+      } else if (opt == '@') {
+        ok = parseSeconds(&p, &r.holdMs);
+      } else if (opt == '/' && (r.type == ALERT_RISE || r.type == ALERT_FALL)) {
+        ok = parseSeconds(&p, &r.windowMs) && r.windowMs >= 2000;
+      } else if (opt == '~' && r.type != ALERT_FAULT) {
+        char* end;
+        r.hysteresis = strtof(p, &end);
+        ok = end != p && r.hysteresis >= 0;
+        p = end;
+      } else {
+        p--;
+        ok = false;
+      }
+    }
+    if (!ok)
+      break;
+    rules[(*count)++] = r;
+  }
+  if (errorAt)
+    *errorAt = p - spec;
+  return false;
+}
+
+size_t FormatAlertRule(char* buf, size_t size, const alert_rule& rule) {
+  int n;
+  if (rule.type == ALERT_FAULT)
+    n = snprintf(buf, size, "fault");
+  else
+    n = snprintf(buf, size, "%c%c%.1f", rule.channel == ALERT_HUMIDITY ? 'h' : 't', alert_ops[rule.type], rule.limit);
+  if (n > 0 && (size_t)n < size && (rule.type == ALERT_RISE || rule.type == ALERT_FALL))
+    n += snprintf(buf + n, size - n, "/%u", (unsigned)(rule.windowMs / 1000));
+  if (n > 0 && (size_t)n < size && rule.type != ALERT_FAULT && rule.hysteresis != ALERT_DEFAULT_HYSTERESIS)
+    n += snprintf(buf + n, size - n, "~%.1f", rule.hysteresis);
+  if (n > 0 && (size_t)n < size && rule.holdMs)
+    n += snprintf(buf + n, size - n, "@%u", (unsigned)(rule.holdMs / 1000));
+  return n > 0 && (size_t)n < size ? n : 0;
+}
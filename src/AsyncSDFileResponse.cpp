@@ -9,6 +9,8 @@
 
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
+#include "PerfMonitor.h"
+#include "SDArbiter.h"
 
 
 class AsyncSDFileResponse: public AsyncAbstractResponse {
@@ -128,6 +130,10 @@ AsyncSDFileResponse::AsyncSDFileResponse(File content, const String& path, const
 }
 
 size_t AsyncSDFileResponse::_fillBuffer(uint8_t *data, size_t len){
+  PerfScope p(PERF_HTTP_LOG_FILL);
+  SDLock lock(SD_READER, SD_FILL_WAIT_MS);
+  if (!lock.locked())
+    return RESPONSE_TRY_AGAIN;
   _content.read(data, len);
   return len;
 }
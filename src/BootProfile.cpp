@@ -0,0 +1,74 @@
+// Timestamps of the boot phases, first sample and first persisted record
+
+#include <Arduino.h>
+#include "esp_timer.h"
+
+#include "BootProfile.h"
+
+BootProfile bootProfile;
+
+static const char* phase_names[BOOT_PHASE_COUNT] = {
+  "setup", "netTask", "rtc", "sensor", "sd", "timers", "display", "setupDone",
+  "wifi", "www", "gotIP", "firstSample", "firstRecord"
+};
+
+//=============================================================================
+
+BootProfile::BootProfile() {
+  _mux = portMUX_INITIALIZER_UNLOCKED;
+  _reason = ESP_RST_UNKNOWN;
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++)
+    _at[i] = 0;
+}
+
+void BootProfile::begin() {
+  _reason = esp_reset_reason();
+}
+
+bool BootProfile::mark(boot_phase phase) {
+  int64_t now = esp_timer_get_time();
+  bool first = false;
+  portENTER_CRITICAL(&_mux);
+  if (_at[phase] == 0) {
+    _at[phase] = now > 0 ? now : 1;
+    first = true;
+  }
+  portEXIT_CRITICAL(&_mux);
+  return first;
+}
+
+const char* BootProfile::phaseName(boot_phase phase) {
+  return phase < BOOT_PHASE_COUNT ? phase_names[phase] : "unknown";
+}
+
+//=============================================================================
+
+String BootProfile::toJson() {
+  String json = "{";
+  json += "\"resetReason\":" + String((int)_reason);
+  json += ",\"phases\":{";
+  bool first = true;
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+    if (!reached((boot_phase)i))
+      continue;
+    if (!first)
+      json += ",";
+    first = false;
+    json += "\"" + String(phase_names[i]) + "\":" + String(ms((boot_phase)i));
+  }
+  json += "}";
+  if (reached(BOOT_FIRST_SAMPLE))
+    json += ",\"firstSampleMs\":" + String(ms(BOOT_FIRST_SAMPLE));
+  if (reached(BOOT_FIRST_RECORD))
+    json += ",\"firstRecordMs\":" + String(ms(BOOT_FIRST_RECORD));
+  json += "}";
+  return json;
+}
+
+void BootProfile::dump(Print& out) {
+  out.printf("Boot phases (reset reason %d):\n", (int)_reason);
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+    if (reached((boot_phase)i))
+      out.printf("  %-12s %6u ms\n", phase_names[i], (unsigned)ms((boot_phase)i));
+  }
+}
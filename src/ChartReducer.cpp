@@ -0,0 +1,56 @@
+// Min/max per bucket downsampling of log records for charts
+
+#include <stdio.h>
+
+#include "ChartReducer.h"
+
+void ChartReducer::begin(uint32_t from, uint32_t to, uint16_t points) {
+  uint32_t buckets = points / 2 ? points / 2 : 1;
+  uint64_t span = (uint64_t)to - from + 1;
+  _from = from;
+  _to = to;
+  _width = (span + buckets - 1) / buckets;
+  _index = 0;
+  _bucket.count = 0;
+}
+
+bool ChartReducer::add(const log_record& rec, chart_bucket* out) {
+  if (rec.time < _from || rec.time > _to)
+    return false;
+
+  bool closed = false;
+  uint32_t index = (rec.time - _from) / _width;
+  // a record stepping back in time is merged into the open bucket
+  if (_bucket.count && index > _index) {
+    *out = _bucket;
+    _bucket.count = 0;
+    closed = true;
+  }
+  if (_bucket.count == 0) {
+    _index = index;
+    _bucket.time = _from + index * _width;
+    _bucket.tMin = _bucket.tMax = rec.temperature;
+    _bucket.hMin = _bucket.hMax = rec.humidity;
+  } else {
+    if (rec.temperature < _bucket.tMin) _bucket.tMin = rec.temperature;
+    if (rec.temperature > _bucket.tMax) _bucket.tMax = rec.temperature;
+    if (rec.humidity < _bucket.hMin) _bucket.hMin = rec.humidity;
+    if (rec.humidity > _bucket.hMax) _bucket.hMax = rec.humidity;
+  }
+  _bucket.count++;
+  return closed;
+}
+
+bool ChartReducer::finish(chart_bucket* out) {
+  if (_bucket.count == 0)
+    return false;
+  *out = _bucket;
+  _bucket.count = 0;
+  return true;
+}
+
+size_t FormatChartBucket(char* buf, size_t size, const chart_bucket& bucket) {
+  int n = snprintf(buf, size, "[%u,%.2f,%.2f,%.2f,%.2f,%u]", (unsigned)bucket.time,
+                   bucket.tMin, bucket.tMax, bucket.hMin, bucket.hMax, (unsigned)bucket.count);
+  return n > 0 && (size_t)n < size ? n : 0;
+}
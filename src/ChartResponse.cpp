@@ -0,0 +1,65 @@
+// Downsampled log range as chart data
+
+#include <Arduino.h>
+
+#include "ChartResponse.h"
+
+ChartResponse::ChartResponse(SdFat& sd, LogStore& store, const char* dir, uint32_t from, uint32_t to, uint16_t points)
+  : ChunkedResponse("application/json", PERF_HTTP_CHART_FILL, CHART_FILL_CHUNKS), _reader(sd, store, dir, from, to) {
+  _reducer.begin(from, to, points);
+  _from = from;
+  _to = to;
+  _state = CHART_HEADER;
+  _rows = 0;
+}
+
+void ChartResponse::_row(const chart_bucket& bucket) {
+  size_t n = 0;
+  if (_rows++)
+    _text[n++] = ',';
+  _emit(_text, n + FormatChartBucket(_text + n, sizeof(_text) - n, bucket));
+}
+
+// next piece of JSON, or a read that did not complete a bucket
+size_t ChartResponse::_step(uint8_t*, size_t) {
+  log_record rec;
+  chart_bucket bucket;
+  int n;
+  switch (_state) {
+    case CHART_HEADER:
+      n = snprintf(_text, sizeof(_text),
+                   "{\"from\":%u,\"to\":%u,\"bucket\":%u,"
+                   "\"columns\":[\"time\",\"tMin\",\"tMax\",\"hMin\",\"hMax\",\"count\"],\"rows\":[",
+                   (unsigned)_from, (unsigned)_to, (unsigned)_reducer.bucketSeconds());
+      _emit(_text, n > 0 ? n : 0);
+      _state = CHART_ROWS;
+      break;
+
+    case CHART_ROWS:
+      switch (_reader.next(&rec)) {
+        case LOG_RANGE_RECORD:
+          if (_reducer.add(rec, &bucket))
+            _row(bucket);
+          break;
+        case LOG_RANGE_BUSY:
+          break;
+        case LOG_RANGE_END:
+          if (_reducer.finish(&bucket)) {
+            _row(bucket);
+            break;
+          }
+          n = snprintf(_text, sizeof(_text), "],\"files\":%u,\"corrupt\":%u}",
+                       (unsigned)_reader.filesRead(), (unsigned)_reader.corrupt());
+          _emit(_text, n > 0 ? n : 0);
+          _state = CHART_DONE;
+          _finish();
+          break;
+      }
+      break;
+
+    case CHART_DONE:
+      _finish();
+      break;
+  }
+  return 0;
+}
@@ -0,0 +1,57 @@
+// Base of the chunked responses that are built from SD piece by piece
+
+#include <Arduino.h>
+
+#include "ChunkedResponse.h"
+#include "SDArbiter.h"
+
+ChunkedResponse::ChunkedResponse(const char* contentType, perf_stage stage, uint32_t budget) {
+  _code = 200;
+  _contentType = contentType;
+  // length is only known at the end
+  _contentLength = 0;
+  _sendContentLength = false;
+  _chunked = true;
+
+  _stage = stage;
+  _budget = budget;
+  _piece = NULL;
+  _pieceLen = 0;
+  _pieceOff = 0;
+  _done = false;
+}
+
+void ChunkedResponse::_emit(const void* data, size_t len) {
+  _piece = (const uint8_t*)data;
+  _pieceLen = len;
+  _pieceOff = 0;
+}
+
+size_t ChunkedResponse::_fillBuffer(uint8_t *data, size_t len){
+  PerfScope p(_stage);
+  SDLock lock(SD_READER, SD_FILL_WAIT_MS);
+  if (!lock.locked())
+    return RESPONSE_TRY_AGAIN;
+  uint32_t start = _work();
+  size_t out = 0;
+  while (out < len) {
+    if (_pieceOff < _pieceLen) {
+      size_t n = _pieceLen - _pieceOff;
+      if (n > len - out)
+        n = len - out;
+      memcpy(data + out, _piece + _pieceOff, n);
+      _pieceOff += n;
+      out += n;
+      continue;
+    }
+    if (_done)
+      break;
+    uint32_t work = _work() - start;
+    if (work >= (out ? _budget : _budget * CHUNKED_IDLE_BUDGETS))
+      break;
+    out += _step(data + out, len - out);
+  }
+  if (out == 0 && !_done)
+    return RESPONSE_TRY_AGAIN;
+  return out;
+}
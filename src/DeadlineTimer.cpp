@@ -0,0 +1,53 @@
+// Periodic timer firing at absolute, wall clock aligned deadlines
+
+#include <Arduino.h>
+
+#include "DeadlineTimer.h"
+
+DeadlineTimer::DeadlineTimer() {
+  _period = 1000;
+  _phase = 0;
+  _deadline = 0;
+  _lateUs = 0;
+  _missed = 0;
+}
+
+void DeadlineTimer::setInterval(uint32_t periodMs, uint32_t phaseMs) {
+  _period = periodMs ? periodMs : 1;
+  _phase = phaseMs % _period;
+  _deadline = 0;
+}
+
+int64_t DeadlineTimer::_nowUs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// first deadline after now
+void DeadlineTimer::_align(int64_t now) {
+  int64_t period = (int64_t)_period * 1000;
+  int64_t phase = (int64_t)_phase * 1000;
+  _deadline = (now - phase) / period * period + phase + period;
+}
+
+bool DeadlineTimer::isReady() {
+  int64_t now = _nowUs();
+  int64_t period = (int64_t)_period * 1000;
+  if (_deadline == 0 || _deadline - now > period) {
+    // first call or the clock was stepped back
+    _align(now);
+    return false;
+  }
+  if (now < _deadline)
+    return false;
+
+  int64_t late = now - _deadline;
+  _missed = late / period;
+  _lateUs = late % period;
+  if (_missed)
+    _align(now);
+  else
+    _deadline += period;
+  return true;
+}
@@ -0,0 +1,183 @@
+// Leveled diagnostic log, printed to Serial by a background task
+
+#include <Arduino.h>
+
+#include "DebugLog.h"
+
+DebugLog debugLog;
+
+static const char* level_names[] = {"error", "warn", "info", "verbose"};
+static const char level_letters[] = "EWIV";
+
+DebugLog::DebugLog() {
+  memset(_lines, 0, sizeof(_lines));
+  _head = 0;
+  _drained = 0;
+  _dropped = 0;
+  _level = DEBUG_LOG_LEVEL;
+  _out = NULL;
+}
+
+void DebugLog::begin(Print& out) {
+  _out = &out;
+  xTaskCreatePinnedToCore(_drainTask, "debugLog", DEBUG_LOG_STACK, this, 0, NULL, 0);
+}
+
+const char* DebugLog::levelName(debug_level level) {
+  return level <= DEBUG_VERBOSE ? level_names[level] : "unknown";
+}
+
+bool DebugLog::parseLevel(const char* name, debug_level* level) {
+  for (uint8_t i = 0; i <= DEBUG_VERBOSE; i++) {
+    if (strcmp(name, level_names[i]) == 0) {
+      *level = (debug_level)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+//=============================================================================
+// writers, any task
+
+void DebugLog::_write(debug_level level, const char* format, va_list args) {
+  uint32_t seq = __atomic_fetch_add(&_head, 1, __ATOMIC_RELAXED);
+  debug_line& line = _lines[seq % DEBUG_LOG_LINES];
+  // readers must see the slot as busy before any of its text changes
+  __atomic_store_n(&line.seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  line.ms = millis();
+  line.level = level;
+  int len = vsnprintf(line.text, sizeof(line.text), format, args);
+  if (len > (int)sizeof(line.text) - 1)
+    len = sizeof(line.text) - 1;
+  // one line each, callers may still end theirs with a newline
+  while (len > 0 && (line.text[len - 1] == '\n' || line.text[len - 1] == '\r'))
+    line.text[--len] = 0;
+  for (int i = 0; i < len; i++) {
+    if ((uint8_t)line.text[i] < ' ')
+      line.text[i] = ' ';
+  }
+  __atomic_store_n(&line.seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+void DebugLog::error(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  _write(DEBUG_ERROR, format, args);
+  va_end(args);
+}
+
+void DebugLog::warn(const char* format, ...) {
+  if (_level < DEBUG_WARN)
+    return;
+  va_list args;
+  va_start(args, format);
+  _write(DEBUG_WARN, format, args);
+  va_end(args);
+}
+
+void DebugLog::info(const char* format, ...) {
+  if (_level < DEBUG_INFO)
+    return;
+  va_list args;
+  va_start(args, format);
+  _write(DEBUG_INFO, format, args);
+  va_end(args);
+}
+
+void DebugLog::verbose(const char* format, ...) {
+  if (_level < DEBUG_VERBOSE)
+    return;
+  va_list args;
+  va_start(args, format);
+  _write(DEBUG_VERBOSE, format, args);
+  va_end(args);
+}
+
+//=============================================================================
+// readers
+
+// copy of line seq, false if it is still being written or already replaced;
+// line->seq is then what the slot held
+bool DebugLog::_read(uint32_t seq, debug_line* line) const {
+  const debug_line& slot = _lines[seq % DEBUG_LOG_LINES];
+  uint32_t before = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+  if (before != seq + 1) {
+    line->seq = before;
+    return false;
+  }
+  line->ms = slot.ms;
+  line->level = slot.level;
+  memcpy(line->text, slot.text, sizeof(line->text));
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  line->seq = __atomic_load_n(&slot.seq, __ATOMIC_RELAXED);
+  line->text[sizeof(line->text) - 1] = 0;
+  return line->seq == before;
+}
+
+void DebugLog::_drainTask(void* arg) {
+  DebugLog* log = (DebugLog*)arg;
+  debug_line line;
+  for (;;) {
+    uint32_t head = log->_head;
+    while (log->_drained != head) {
+      uint32_t lost = 0;
+      if (head - log->_drained > DEBUG_LOG_LINES) {
+        lost = head - log->_drained - DEBUG_LOG_LINES;
+      } else if (!log->_read(log->_drained, &line)) {
+        // a writer still formatting waits for the next round
+        if (line.seq == 0 || line.seq <= log->_drained + 1)
+          break;
+        lost = 1;
+      }
+      if (lost) {
+        log->_dropped += lost;
+        log->_drained += lost;
+        log->_out->printf("-- %u lines dropped\n", lost);
+        continue;
+      }
+      log->_out->printf("%u.%03u %c ", line.ms / 1000, line.ms % 1000, level_letters[line.level]);
+      log->_out->println(line.text);
+      log->_drained++;
+    }
+    vTaskDelay(pdMS_TO_TICKS(DEBUG_LOG_DRAIN_MS));
+  }
+}
+
+String DebugLog::toJson(uint32_t since) {
+  uint32_t head = _head;
+  uint32_t oldest = head > DEBUG_LOG_LINES ? head - DEBUG_LOG_LINES : 0;
+  if (since < oldest || since > head)
+    since = oldest;
+
+  String json = "{";
+  json += "\"level\":\"" + String(levelName(level())) + "\"";
+  json += ",\"written\":" + String(head);
+  json += ",\"dropped\":" + String(_dropped);
+  json += ",\"lines\":[";
+  debug_line line;
+  bool first = true;
+  uint32_t next = since;
+  for (; next != head; next++) {
+    if (!_read(next, &line)) {
+      // not finished yet, the next call gets it
+      if (line.seq == 0 || line.seq <= next + 1)
+        break;
+      continue;
+    }
+    String text = line.text;
+    text.replace("\\", "\\\\");
+    text.replace("\"", "\\\"");
+    if (!first)
+      json += ",";
+    first = false;
+    json += "{\"seq\":" + String(next);
+    json += ",\"ms\":" + String(line.ms);
+    json += ",\"level\":\"" + String(levelName((debug_level)line.level)) + "\"";
+    json += ",\"text\":\"" + text + "\"}";
+  }
+  json += "],\"next\":" + String(next);
+  json += "}";
+  return json;
+}
@@ -0,0 +1,24 @@
+// Quote a value as a JSON string
+
+#include <Arduino.h>
+
+#include "JsonString.h"
+
+String JsonString(const String& value) {
+  String out = "\"";
+  for (unsigned int i = 0; i < value.length(); i++) {
+    char c = value[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((uint8_t)c < 0x20) {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      out += esc;
+    } else {
+      out += c;
+    }
+  }
+  out += "\"";
+  return out;
+}
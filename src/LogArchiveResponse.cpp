@@ -0,0 +1,351 @@
+// Stream the log files of a time range as one stored ZIP archive
+
+#include <Arduino.h>
+
+#include "LogArchiveResponse.h"
+#include "DebugLog.h"
+
+#define ZIP_LOCAL_HEADER 30
+#define ZIP_DIRECTORY_HEADER 46
+#define ZIP_DESCRIPTOR 16
+#define ZIP_END_RECORD 22
+// general purpose flag: CRC and sizes in a data descriptor
+#define ZIP_FLAG_DESCRIPTOR 0x0008
+// version needed to extract: stored entries, no ZIP64
+#define ZIP_VERSION 10
+
+volatile uint8_t LogArchiveResponse::_active = 0;
+
+// ZIP fields are little endian
+static void put16(uint8_t* p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+LogArchiveResponse::LogArchiveResponse(SdFat& sd, LogStore& store, const char* dir, uint32_t from, uint32_t to)
+  : ChunkedResponse("application/zip", PERF_HTTP_ARCHIVE_FILL, LOG_ARCHIVE_FILL_CHUNKS), _sd(sd), _store(store) {
+  addHeader("Content-Disposition", "attachment; filename=\"logs.zip\"");
+
+  _dir = dir;
+  _from = from;
+  _to = to;
+  // same clock as the dateTime() callback that stamps new files
+  struct tm now;
+  _started = 0xffffffff;
+  if (getLocalTime(&now, 0))
+    _started = (uint32_t)FAT_DATE(now.tm_year + 1900, now.tm_mon + 1, now.tm_mday) << 16 |
+               FAT_TIME(now.tm_hour, now.tm_min, now.tm_sec);
+  _dirOpen = false;
+  _fileOpen = false;
+  _state = ARCHIVE_ENTRY;
+  _entry.name[0] = 0;
+  _remaining = 0;
+  _offset = 0;
+  _directoryStart = 0;
+  _directorySize = 0;
+  _listing = false;
+  _entries = 0;
+  _listed = 0;
+  _trackedCount = 0;
+  _chunks = 0;
+  _rereads = 0;
+  _active++;
+}
+
+LogArchiveResponse::~LogArchiveResponse() {
+  if (_fileOpen)
+    _file.close();
+  if (_dirOpen)
+    _dirFile.close();
+  _active--;
+  debugLog.info("Archive of %u files, %u CRC rereads", _entries, _rereads);
+}
+
+// the archive is cut short, unzip then reports it as damaged
+void LogArchiveResponse::_fail(const char* what) {
+  debugLog.error("Archive stopped at %s: %s", _entry.name, what);
+  if (_fileOpen)
+    _file.close();
+  _fileOpen = false;
+  _emit(NULL, 0);
+  _state = ARCHIVE_DONE;
+  _finish();
+}
+
+//=============================================================================
+// both passes pick the same files with the same values
+
+bool LogArchiveResponse::_openDir() {
+  if (_dirOpen)
+    _dirFile.close();
+  _dirFile = _sd.open(_dir, O_READ);
+  _dirOpen = _dirFile ? true : false;
+  return _dirOpen;
+}
+
+LogArchiveResponse::pick LogArchiveResponse::_nextFile() {
+  FatFile file;
+  if (!file.openNext(&_dirFile, O_READ))
+    return PICK_END;
+  _chunks++;
+
+  char filename[LOG_NAME_MAX];
+  dir_t dirEntry;
+  file.getName(filename, sizeof(filename));
+  bool isDir = file.isDir();
+  bool haveEntry = file.dirEntry(&dirEntry);
+  uint32_t size = file.fileSize();
+  file.close();
+
+  uint32_t first, last;
+  if (isDir || !haveEntry || IsLogMetaName(filename) || !LogFileSpan(filename, &first, &last))
+    return PICK_SKIP;
+  uint32_t created = (uint32_t)dirEntry.creationDate << 16 | dirEntry.creationTime;
+  if (first > _to || last < _from || created > _started)
+    return PICK_SKIP;
+
+  char path[LOG_NAME_MAX + 16];
+  snprintf(path, sizeof(path), "%s/%s", _dir, filename);
+  log_meta meta;
+  bool haveMeta = _store.readMeta(path, &meta);
+  if (haveMeta && meta.count && (meta.first > _to || meta.last < _from))
+    return PICK_SKIP;
+
+  strcpy(_entry.name, filename);
+  _entry.date = dirEntry.lastWriteDate;
+  _entry.time = dirEntry.lastWriteTime;
+  _entry.active = _store.isActive(path);
+  _entry.size = _store.dataSize(path, size);
+  // the CRC covers dataBytes: a closed file is trimmed to that, the
+  // metadata of the active file is up to date in RAM unless its scan failed
+  _entry.known = haveMeta && (meta.closed || _entry.active) && meta.dataBytes == _entry.size;
+  _entry.crc = _entry.known ? meta.crc : 0;
+  _entry.descriptor = !_entry.known;
+  return PICK_FILE;
+}
+
+bool LogArchiveResponse::_openFile() {
+  char path[LOG_NAME_MAX + 16];
+  snprintf(path, sizeof(path), "%s/%s", _dir, _entry.name);
+  _file = _sd.open(path, O_READ);
+  _fileOpen = _file ? true : false;
+  _remaining = _entry.size;
+  return _fileOpen;
+}
+
+// CRCs the second pass cannot read from a sidecar, the active file first
+// as it will not have the same size and CRC when the second pass gets to it
+void LogArchiveResponse::_track() {
+  uint8_t slot = _trackedCount;
+  if (slot == LOG_ARCHIVE_TRACKED) {
+    if (!_entry.active)
+      return;
+    for (slot = 0; slot < LOG_ARCHIVE_TRACKED && _tracked[slot].active; slot++);
+    if (slot == LOG_ARCHIVE_TRACKED)
+      return;
+  } else {
+    _trackedCount++;
+  }
+  _tracked[slot] = _entry;
+}
+
+bool LogArchiveResponse::_fromTracked() {
+  for (uint8_t i = 0; i < _trackedCount; i++) {
+    if (strcmp(_tracked[i].name, _entry.name) == 0) {
+      _entry = _tracked[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+// one read of the second pass CRC into the unused send buffer, true once the file is done
+bool LogArchiveResponse::_crcStep(uint8_t* buf, size_t len) {
+  size_t n = _remaining < len ? _remaining : len;
+  _chunks++;
+  if (n && _file.read(buf, n) != (int)n) {
+    _fail("read failed");
+    return false;
+  }
+  _entry.crc = LogCrc32(buf, n, _entry.crc);
+  _remaining -= n;
+  return _remaining == 0;
+}
+
+//=============================================================================
+// ZIP records
+
+void LogArchiveResponse::_localHeader() {
+  size_t nameLen = strlen(_entry.name);
+  memset(_out, 0, ZIP_LOCAL_HEADER);
+  put32(_out, 0x04034b50);
+  put16(_out + 4, ZIP_VERSION);
+  put16(_out + 10, _entry.time);
+  put16(_out + 12, _entry.date);
+  // CRC and sizes are zero when a data descriptor follows
+  if (_entry.descriptor) {
+    put16(_out + 6, ZIP_FLAG_DESCRIPTOR);
+  } else {
+    put32(_out + 14, _entry.crc);
+    put32(_out + 18, _entry.size);
+    put32(_out + 22, _entry.size);
+  }
+  put16(_out + 26, nameLen);
+  memcpy(_out + ZIP_LOCAL_HEADER, _entry.name, nameLen);
+  _emit(_out, ZIP_LOCAL_HEADER + nameLen);
+}
+
+void LogArchiveResponse::_directoryHeader() {
+  size_t nameLen = strlen(_entry.name);
+  memset(_out, 0, ZIP_DIRECTORY_HEADER);
+  put32(_out, 0x02014b50);
+  put16(_out + 4, ZIP_VERSION);
+  put16(_out + 6, ZIP_VERSION);
+  put16(_out + 8, _entry.descriptor ? ZIP_FLAG_DESCRIPTOR : 0);
+  put16(_out + 12, _entry.time);
+  put16(_out + 14, _entry.date);
+  put32(_out + 16, _entry.crc);
+  put32(_out + 20, _entry.size);
+  put32(_out + 24, _entry.size);
+  put16(_out + 28, nameLen);
+  put32(_out + 42, _offset);
+  memcpy(_out + ZIP_DIRECTORY_HEADER, _entry.name, nameLen);
+  _emit(_out, ZIP_DIRECTORY_HEADER + nameLen);
+
+  _offset += ZIP_LOCAL_HEADER + nameLen + _entry.size + (_entry.descriptor ? ZIP_DESCRIPTOR : 0);
+  _directorySize += ZIP_DIRECTORY_HEADER + nameLen;
+  _listed++;
+}
+
+void LogArchiveResponse::_descriptor() {
+  put32(_out, 0x08074b50);
+  put32(_out + 4, _entry.crc);
+  put32(_out + 8, _entry.size);
+  put32(_out + 12, _entry.size);
+  _emit(_out, ZIP_DESCRIPTOR);
+}
+
+void LogArchiveResponse::_endRecord() {
+  memset(_out, 0, ZIP_END_RECORD);
+  put32(_out, 0x06054b50);
+  put16(_out + 8, _listed);
+  put16(_out + 10, _listed);
+  put32(_out + 12, _directorySize);
+  put32(_out + 16, _directoryStart);
+  _emit(_out, ZIP_END_RECORD);
+}
+
+//=============================================================================
+
+void LogArchiveResponse::_startData() {
+  uint32_t end = _offset + ZIP_LOCAL_HEADER + strlen(_entry.name) + _entry.size +
+                 (_entry.descriptor ? ZIP_DESCRIPTOR : 0);
+  if (end < _offset) {
+    _fail("archive over 4 GB");
+    return;
+  }
+  if (_entry.active && _entry.known)
+    _track();
+  _localHeader();
+  _offset = end;
+  _entries++;
+  _remaining = _entry.size;
+  _state = ARCHIVE_DATA;
+}
+
+// file data straight into the response buffer, then its data descriptor
+size_t LogArchiveResponse::_data(uint8_t* data, size_t len) {
+  if (_remaining == 0) {
+    _file.close();
+    _fileOpen = false;
+    if (_entry.descriptor) {
+      _descriptor();
+      _track();
+    }
+    _state = ARCHIVE_ENTRY;
+    return 0;
+  }
+  size_t n = _remaining < len ? _remaining : len;
+  _chunks++;
+  if (_file.read(data, n) != (int)n) {
+    _fail("read failed");
+    return 0;
+  }
+  if (_entry.descriptor)
+    _entry.crc = LogCrc32(data, n, _entry.crc);
+  _remaining -= n;
+  return n;
+}
+
+// file data, the next record or the next step of a pass
+size_t LogArchiveResponse::_step(uint8_t* data, size_t len) {
+  switch (_state) {
+    case ARCHIVE_ENTRY:
+    case ARCHIVE_DIRECTORY:
+      if (!_dirOpen && !_openDir()) {
+        _fail("no directory");
+        return 0;
+      }
+      switch (_nextFile()) {
+        case PICK_SKIP:
+          return 0;
+        case PICK_END:
+          if (!_listing) {
+            _directoryStart = _offset;
+            _offset = 0;
+            _listing = true;
+            _state = ARCHIVE_DIRECTORY;
+            if (!_openDir())
+              _fail("no directory");
+            return 0;
+          }
+          if (_listed != _entries || _offset != _directoryStart) {
+            _fail("files changed");
+            return 0;
+          }
+          _endRecord();
+          _state = ARCHIVE_DONE;
+          _finish();
+          return 0;
+        case PICK_FILE:
+          break;
+      }
+      if (_listing && (_fromTracked() || _entry.known)) {
+        _directoryHeader();
+        return 0;
+      }
+      if (!_openFile()) {
+        _fail("open failed");
+        return 0;
+      }
+      if (_listing) {
+        _rereads++;
+        _state = ARCHIVE_CRC;
+      } else {
+        _startData();
+      }
+      return 0;
+
+    case ARCHIVE_CRC:
+      if (!_crcStep(data, len))
+        return 0;
+      _file.close();
+      _fileOpen = false;
+      _directoryHeader();
+      _state = ARCHIVE_DIRECTORY;
+      return 0;
+
+    case ARCHIVE_DATA:
+      return _data(data, len);
+
+    case ARCHIVE_DONE:
+      _finish();
+      break;
+  }
+  return 0;
+}
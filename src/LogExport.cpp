@@ -0,0 +1,134 @@
+// Log record export formats: CSV, NDJSON and CBOR
+
+#include <stdio.h>
+#include <string.h>
+
+#include "LogExport.h"
+
+bool ParseLogFormat(const char* name, log_format* format) {
+  if (strcmp(name, "csv") == 0)
+    *format = LOG_FORMAT_CSV;
+  else if (strcmp(name, "ndjson") == 0)
+    *format = LOG_FORMAT_NDJSON;
+  else if (strcmp(name, "cbor") == 0)
+    *format = LOG_FORMAT_CBOR;
+  else
+    return false;
+  return true;
+}
+
+const char* LogFormatContentType(log_format format) {
+  switch (format) {
+    case LOG_FORMAT_NDJSON: return "application/x-ndjson";
+    case LOG_FORMAT_CBOR: return "application/cbor";
+    default: return "text/csv";
+  }
+}
+
+const char* LogFormatExtension(log_format format) {
+  switch (format) {
+    case LOG_FORMAT_NDJSON: return ".ndjson";
+    case LOG_FORMAT_CBOR: return ".cbor";
+    default: return ".csv";
+  }
+}
+
+//=============================================================================
+// CBOR (RFC 8949) encoding, only what the records need
+
+static size_t cborUint(uint8_t* p, uint8_t major, uint32_t v) {
+  major <<= 5;
+  if (v < 24) {
+    p[0] = major | v;
+    return 1;
+  }
+  if (v <= 0xff) {
+    p[0] = major | 24;
+    p[1] = v;
+    return 2;
+  }
+  if (v <= 0xffff) {
+    p[0] = major | 25;
+    p[1] = v >> 8;
+    p[2] = v;
+    return 3;
+  }
+  p[0] = major | 26;
+  p[1] = v >> 24;
+  p[2] = v >> 16;
+  p[3] = v >> 8;
+  p[4] = v;
+  return 5;
+}
+
+static size_t cborFloat(uint8_t* p, float f) {
+  uint32_t v;
+  memcpy(&v, &f, sizeof(v));
+  p[0] = 0xfa;
+  p[1] = v >> 24;
+  p[2] = v >> 16;
+  p[3] = v >> 8;
+  p[4] = v;
+  return 5;
+}
+
+//=============================================================================
+
+size_t FormatExportHeader(uint8_t* buf, size_t size, log_format format) {
+  switch (format) {
+    case LOG_FORMAT_CSV: {
+      size_t n = strlen(LOG_RECORD_HEADER);
+      if (n > size)
+        return 0;
+      memcpy(buf, LOG_RECORD_HEADER, n);
+      return n;
+    }
+    case LOG_FORMAT_CBOR:
+      if (size < 1)
+        return 0;
+      buf[0] = 0x9f; // indefinite length array
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+size_t FormatExportFooter(uint8_t* buf, size_t size, log_format format) {
+  if (format != LOG_FORMAT_CBOR || size < 1)
+    return 0;
+  buf[0] = 0xff; // break
+  return 1;
+}
+
+size_t FormatExportRecord(uint8_t* buf, size_t size, log_format format, const log_record& rec) {
+  char* text = (char*)buf;
+  int n;
+  switch (format) {
+    case LOG_FORMAT_CSV: {
+      char timeString[24];
+      size_t len = LogFormatTime(timeString, sizeof(timeString), rec.time);
+      if (rec.ms)
+        snprintf(timeString + len, sizeof(timeString) - len, ".%03u", (unsigned)rec.ms);
+      return FormatLogRecord(text, size, timeString, rec.temperature, rec.humidity, rec.seq);
+    }
+
+    case LOG_FORMAT_NDJSON:
+      n = snprintf(text, size, "{\"time\":%u,\"ms\":%u,\"temperature\":%.6g,\"humidity\":%.6g,\"seq\":%u}\n",
+                   (unsigned)rec.time, (unsigned)rec.ms, rec.temperature, rec.humidity, (unsigned)rec.seq);
+      return n > 0 && (size_t)n < size ? n : 0;
+
+    case LOG_FORMAT_CBOR: {
+      // header + 3 uints + 2 floats, worst case
+      if (size < 1 + 3 * 5 + 2 * 5)
+        return 0;
+      size_t len = cborUint(buf, 4, 5);
+      len += cborUint(buf + len, 0, rec.time);
+      len += cborUint(buf + len, 0, rec.ms);
+      len += cborFloat(buf + len, rec.temperature);
+      len += cborFloat(buf + len, rec.humidity);
+      len += cborUint(buf + len, 0, rec.seq);
+      return len;
+    }
+  }
+  return 0;
+}
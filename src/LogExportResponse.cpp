@@ -0,0 +1,59 @@
+// Stream log records converted to CSV, NDJSON or CBOR
+
+#include <Arduino.h>
+
+#include "LogExportResponse.h"
+
+LogExportResponse::LogExportResponse(SdFat& sd, LogStore& store, const char* dir, uint32_t from, uint32_t to, log_format format)
+  : ChunkedResponse(LogFormatContentType(format), PERF_HTTP_EXPORT_FILL, LOG_EXPORT_FILL_CHUNKS),
+    _reader(sd, store, dir, from, to) {
+  _format = format;
+  _state = EXPORT_HEADER;
+}
+
+LogExportResponse::LogExportResponse(SdFat& sd, LogStore& store, const char* dir, const char* name, log_format format)
+  : LogExportResponse(sd, store, dir, 0, 0xffffffff, format) {
+  _reader.setFile(name);
+
+  char filename[LOG_NAME_MAX];
+  const char* slash = strrchr(name, '/');
+  strncpy(filename, slash ? slash + 1 : name, sizeof(filename) - 1);
+  filename[sizeof(filename) - 1] = 0;
+  char* dot = strrchr(filename, '.');
+  if (dot)
+    *dot = 0;
+  char buf[LOG_NAME_MAX + 40];
+  snprintf(buf, sizeof(buf), "attachment; filename=\"%s%s\"", filename, LogFormatExtension(format));
+  addHeader("Content-Disposition", buf);
+}
+
+// the next record converted, or a read that did not complete one
+size_t LogExportResponse::_step(uint8_t*, size_t) {
+  log_record rec;
+  switch (_state) {
+    case EXPORT_HEADER:
+      _emit(_out, FormatExportHeader(_out, sizeof(_out), _format));
+      _state = EXPORT_RECORDS;
+      break;
+
+    case EXPORT_RECORDS:
+      switch (_reader.next(&rec)) {
+        case LOG_RANGE_RECORD:
+          _emit(_out, FormatExportRecord(_out, sizeof(_out), _format, rec));
+          break;
+        case LOG_RANGE_BUSY:
+          break;
+        case LOG_RANGE_END:
+          _emit(_out, FormatExportFooter(_out, sizeof(_out), _format));
+          _state = EXPORT_DONE;
+          _finish();
+          break;
+      }
+      break;
+
+    case EXPORT_DONE:
+      _finish();
+      break;
+  }
+  return 0;
+}
@@ -0,0 +1,114 @@
+// Stream a log file, dropping records that fail their checksum
+
+#include <Arduino.h>
+
+#include "LogFileResponse.h"
+#include "DebugLog.h"
+#include "PerfMonitor.h"
+#include "SDArbiter.h"
+
+LogFileResponse::LogFileResponse(SdFat &sd, LogStore& store, const String& path) : _sd(sd), _store(store) {
+  _code = 200;
+  _contentType = "text/csv";
+  // length is only known after filtering
+  _contentLength = 0;
+  _sendContentLength = false;
+  _chunked = true;
+
+  _inLen = 0;
+  _inPos = 0;
+  _line = NULL;
+  _lineLen = 0;
+  _lineOff = 0;
+  _eof = false;
+  _corrupt = 0;
+  _content = sd.open(path.c_str(), O_READ);
+  _sourceIsValid = _content;
+  _remaining = 0;
+  _raw = false;
+  if (_sourceIsValid) {
+    _remaining = store.dataSize(path.c_str(), _content.fileSize());
+    uint32_t lastBlock;
+    _raw = _content.contiguousRange(&_block, &lastBlock);
+  }
+
+  int filenameStart = path.lastIndexOf('/') + 1;
+  char buf[26+path.length()-filenameStart];
+  char* filename = (char*)path.c_str() + filenameStart;
+  snprintf(buf, sizeof (buf), "attachment; filename=\"%s\"", filename);
+  addHeader("Content-Disposition", buf);
+}
+
+LogFileResponse::~LogFileResponse(){
+  if(_content)
+    _content.close();
+  if (_corrupt) {
+    _store.countCorrupt(_corrupt);
+    debugLog.warn("Download skipped %u corrupt records", _corrupt);
+  }
+}
+
+// find the next line that is safe to send, false at end of file
+bool LogFileResponse::_nextLine() {
+  while (true) {
+    if (_inPos == _inLen) {
+      if (_eof)
+        return false;
+      int n = _remaining < sizeof(_in) ? _remaining : sizeof(_in);
+      if (n > 0) {
+        if (_raw)
+          n = _sd.card()->readBlock(_block++, (uint8_t*)_in) ? n : -1;
+        else
+          n = _content.read(_in, n);
+      }
+      if (n <= 0) {
+        _eof = true;
+        const char* rest;
+        if (_splitter.pending(&rest))
+          _corrupt++; // torn last line
+        _splitter.reset();
+        return false;
+      }
+      _remaining -= n;
+      _inLen = n;
+      _inPos = 0;
+    }
+
+    const char* line;
+    size_t len;
+    bool overlong;
+    _inPos += _splitter.push(_in + _inPos, _inLen - _inPos, &line, &len, &overlong);
+    if (len == 0)
+      continue;
+
+    log_record rec;
+    if (overlong || ParseLogRecord(line, len, &rec) == LOG_RECORD_CORRUPT) {
+      _corrupt++;
+      continue;
+    }
+    _line = line;
+    _lineLen = len;
+    _lineOff = 0;
+    return true;
+  }
+}
+
+size_t LogFileResponse::_fillBuffer(uint8_t *data, size_t len){
+  PerfScope p(PERF_HTTP_LOG_FILL);
+  // the card is only held for this chunk, a log write waits at most that long
+  SDLock lock(SD_READER, SD_FILL_WAIT_MS);
+  if (!lock.locked())
+    return RESPONSE_TRY_AGAIN;
+  size_t out = 0;
+  while (out < len) {
+    if (_lineOff == _lineLen && !_nextLine())
+      break;
+    size_t n = _lineLen - _lineOff;
+    if (n > len - out)
+      n = len - out;
+    memcpy(data + out, _line + _lineOff, n);
+    _lineOff += n;
+    out += n;
+  }
+  return out;
+}
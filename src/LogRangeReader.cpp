@@ -0,0 +1,270 @@
+// Read the log records of a time range across log files
+
+#include <Arduino.h>
+
+#include "LogRangeReader.h"
+#include "DebugLog.h"
+
+LogRangeReader::LogRangeReader(SdFat& sd, LogStore& store, const char* dir, uint32_t from, uint32_t to) : _sd(sd), _store(store) {
+  _dir = dir;
+  _only[0] = 0;
+  _from = from;
+  _to = to;
+  _name[0] = 0;
+  _open = false;
+  _done = false;
+  _remaining = 0;
+  _pos = 0;
+  _inStart = 0;
+  _skip = 0;
+  _resume = false;
+  _resumeOffset = 0;
+  _restarted = false;
+  _block = 0;
+  _raw = false;
+  _skipLine = false;
+  _inLen = 0;
+  _inPos = 0;
+  _corrupt = 0;
+  _chunks = 0;
+  _files = 0;
+  _batchLen = 0;
+  _batchPos = 0;
+  _lastFirst = 0;
+}
+
+LogRangeReader::~LogRangeReader() {
+  if (_open)
+    _file.close();
+  if (_corrupt) {
+    _store.countCorrupt(_corrupt);
+    debugLog.warn("Range read skipped %u corrupt records", _corrupt);
+  }
+}
+
+void LogRangeReader::setFile(const char* name) {
+  const char* slash = strrchr(name, '/');
+  strncpy(_only, slash ? slash + 1 : name, LOG_NAME_MAX - 1);
+  _only[LOG_NAME_MAX - 1] = 0;
+}
+
+void LogRangeReader::resumeAt(const char* name, uint32_t offset) {
+  const char* slash = strrchr(name, '/');
+  strncpy(_name, slash ? slash + 1 : name, LOG_NAME_MAX - 1);
+  _name[LOG_NAME_MAX - 1] = 0;
+  uint32_t last;
+  if (!LogFileSpan(_name, &_lastFirst, &last))
+    _lastFirst = 0;
+  _resumeOffset = offset;
+  _resume = true;
+}
+
+//=============================================================================
+// next LOG_RANGE_BATCH overlapping files after the last one, by (period start, name)
+
+static bool after(uint32_t first, const char* name, uint32_t lastFirst, const char* lastName) {
+  return first > lastFirst || (first == lastFirst && strcmp(name, lastName) > 0);
+}
+
+bool LogRangeReader::_refill() {
+  File dir = _sd.open(_dir, O_READ);
+  if (!dir)
+    return false;
+
+  FatFile file;
+  char filename[LOG_NAME_MAX];
+  _batchLen = 0;
+  _batchPos = 0;
+  while (file.openNext(&dir, O_READ)) {
+    file.getName(filename, sizeof(filename));
+    bool isDir = file.isDir();
+    file.close();
+    uint32_t first = 0, last = 0xffffffff;
+    if (isDir || IsLogMetaName(filename))
+      continue;
+    if (_only[0] ? strcmp(filename, _only) != 0 : !LogFileSpan(filename, &first, &last))
+      continue;
+    if (first > _to || last < _from || !after(first, filename, _lastFirst, _name))
+      continue;
+
+    // insertion into the sorted batch, the latest one drops out when full
+    int i = _batchLen;
+    if (i == LOG_RANGE_BATCH) {
+      if (after(first, filename, _batch[i - 1].first, _batch[i - 1].name))
+        continue;
+      i--;
+    } else {
+      _batchLen++;
+    }
+    while (i > 0 && after(_batch[i - 1].first, _batch[i - 1].name, first, filename)) {
+      _batch[i] = _batch[i - 1];
+      i--;
+    }
+    _batch[i].first = first;
+    strcpy(_batch[i].name, filename);
+  }
+  dir.close();
+  return _batchLen > 0;
+}
+
+bool LogRangeReader::_openNext() {
+  uint32_t offset = 0;
+  if (_resume) {
+    // the resumed file itself, _refill() goes on after it
+    _resume = false;
+    offset = _resumeOffset;
+  } else {
+    if (_batchPos == _batchLen && !_refill())
+      return false;
+    candidate& next = _batch[_batchPos++];
+    _lastFirst = next.first;
+    strcpy(_name, next.name);
+  }
+  _inStart = offset;
+  _inLen = _inPos = 0;
+
+  char path[LOG_NAME_MAX + 16];
+  snprintf(path, sizeof(path), "%s/%s", _dir, _name);
+  // the sidecar narrows the period down to the records actually held
+  log_meta meta;
+  uint32_t first = _lastFirst;
+  if (_store.readMeta(path, &meta) && meta.count) {
+    if (meta.first > _to || meta.last < _from)
+      return true;
+    first = meta.first;
+  }
+
+  _file = _sd.open(path, O_READ);
+  if (!_file) {
+    debugLog.error("Open of %s failed", path);
+    return true; // try the next one
+  }
+
+  uint32_t dataEnd = _store.dataSize(path, _file.fileSize());
+  if (offset > dataEnd) {
+    // truncated by recovery or replaced since the offset was taken
+    _restarted = true;
+    offset = 0;
+  }
+  uint32_t start = offset ? offset - offset % LOG_RANGE_CHUNK : first < _from ? _seekFrom(dataEnd) : 0;
+  uint32_t lastBlock;
+  _raw = _file.contiguousRange(&_block, &lastBlock);
+  _block += start / LOG_RANGE_CHUNK;
+  if (!_raw && !_file.seekSet(start)) {
+    _file.close();
+    return true;
+  }
+  _remaining = dataEnd - start;
+  _skipLine = start > 0 && offset == 0;
+  _skip = offset - start;
+  _pos = start;
+  _inStart = offset ? offset : start;
+  _splitter.reset();
+  _inLen = _inPos = 0;
+  _open = true;
+  _files++;
+  return true;
+}
+
+// block aligned offset at or before the first record with time >= _from
+uint32_t LogRangeReader::_seekFrom(uint32_t dataEnd) {
+  char buf[2 * LOG_RECORD_MAX_LEN];
+  uint32_t lo = 0;
+  uint32_t hi = dataEnd;
+  while (hi - lo > LOG_RANGE_CHUNK) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    int n = dataEnd - mid < sizeof(buf) ? dataEnd - mid : sizeof(buf);
+    if (!_file.seekSet(mid) || (n = _file.read(buf, n)) <= 0)
+      break;
+    _chunks++;
+    // the first newline ends a partial line, parse the one after it
+    const char* line = (const char*)memchr(buf, '\n', n);
+    const char* end = line ? (const char*)memchr(line + 1, '\n', buf + n - line - 1) : NULL;
+    log_record rec;
+    log_record_status status = end ? ParseLogRecord(line + 1, end - line, &rec) : LOG_RECORD_CORRUPT;
+    if ((status == LOG_RECORD_OK || status == LOG_RECORD_LEGACY) && rec.time < _from)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo - lo % LOG_RANGE_CHUNK;
+}
+
+bool LogRangeReader::_fill() {
+  int n = _remaining < sizeof(_in) ? _remaining : sizeof(_in);
+  if (n > 0) {
+    if (_raw)
+      n = _sd.card()->readBlock(_block++, (uint8_t*)_in) ? n : -1;
+    else
+      n = _file.read(_in, n);
+  }
+  if (n <= 0) {
+    const char* rest;
+    if (_splitter.pending(&rest))
+      _corrupt++; // torn last line
+    return false;
+  }
+  _chunks++;
+  _remaining -= n;
+  _inStart = _pos;
+  _pos += n;
+  _inLen = n;
+  _inPos = _skip < (size_t)n ? _skip : n;
+  _skip = 0;
+  return true;
+}
+
+//=============================================================================
+
+log_range_status LogRangeReader::next(log_record* rec) {
+  uint16_t chunks = 0;
+  while (!_done) {
+    if (!_open) {
+      if (!_openNext())
+        _done = true;
+      continue;
+    }
+    if (_inPos == _inLen) {
+      if (chunks == LOG_RANGE_MAX_CHUNKS)
+        return LOG_RANGE_BUSY;
+      chunks++;
+      if (!_fill()) {
+        _file.close();
+        _open = false;
+      }
+      continue;
+    }
+
+    const char* line;
+    size_t len;
+    bool overlong;
+    _inPos += _splitter.push(_in + _inPos, _inLen - _inPos, &line, &len, &overlong);
+    if (len == 0)
+      continue;
+    if (_skipLine) {
+      // partial line in front of the searched start
+      _skipLine = false;
+      continue;
+    }
+
+    switch (overlong ? LOG_RECORD_CORRUPT : ParseLogRecord(line, len, rec)) {
+      case LOG_RECORD_CORRUPT:
+        _corrupt++;
+        continue;
+      case LOG_RECORD_HEADER_LINE:
+        continue;
+      default:
+        break;
+    }
+    if (rec->time < _from)
+      continue;
+    if (rec->time > _to) {
+      // the rest of this file is later still
+      _file.close();
+      _open = false;
+      continue;
+    }
+    return LOG_RANGE_RECORD;
+  }
+  return LOG_RANGE_END;
+}
@@ -0,0 +1,274 @@
+// Log record format shared by the logger, the web handlers and host tools
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "LogRecord.h"
+
+//=============================================================================
+// CRC-32 (IEEE 802.3), nibble table to keep flash use small
+
+static const uint32_t crc_nibble[16] = {
+  0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+  0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+  0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+  0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+#ifdef ARDUINO
+uint32_t LogCrc32(const void* data, size_t len, uint32_t crc) {
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ crc_nibble[crc & 0x0f];
+    crc = (crc >> 4) ^ crc_nibble[crc & 0x0f];
+  }
+  return ~crc;
+}
+#else
+// host tools: slicing-by-8 over 8 KB of tables built from the nibble table,
+// the CRC is the same, it is just faster on gigabytes of logs
+static uint32_t crc_slice[8][256];
+
+static bool initCrcSlices() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    crc = (crc >> 4) ^ crc_nibble[crc & 0x0f];
+    crc = (crc >> 4) ^ crc_nibble[crc & 0x0f];
+    crc_slice[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int k = 1; k < 8; k++)
+      crc_slice[k][i] = (crc_slice[k - 1][i] >> 8) ^ crc_slice[0][crc_slice[k - 1][i] & 0xff];
+  }
+  return true;
+}
+
+uint32_t LogCrc32(const void* data, size_t len, uint32_t crc) {
+  static const bool ready = initCrcSlices();
+  (void)ready;
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  while (len >= 8) {
+    uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+    uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+    crc = crc_slice[7][lo & 0xff] ^ crc_slice[6][(lo >> 8) & 0xff] ^
+          crc_slice[5][(lo >> 16) & 0xff] ^ crc_slice[4][lo >> 24] ^
+          crc_slice[3][hi & 0xff] ^ crc_slice[2][(hi >> 8) & 0xff] ^
+          crc_slice[1][(hi >> 16) & 0xff] ^ crc_slice[0][hi >> 24];
+    p += 8;
+    len -= 8;
+  }
+  while (len--)
+    crc = (crc >> 8) ^ crc_slice[0][(crc ^ *p++) & 0xff];
+  return ~crc;
+}
+#endif
+
+//=============================================================================
+
+uint32_t LogMakeTime(int year, int month, int day, int hour, int minute, int second) {
+  // days from civil, proleptic gregorian
+  year -= month <= 2;
+  int era = year / 400;
+  int yoe = year - era * 400;
+  int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int32_t days = era * 146097 + doe - 719468;
+  return (uint32_t)days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+static bool parseDigits(const char* p, int n, int* out) {
+  int v = 0;
+  for (int i = 0; i < n; i++) {
+    if (p[i] < '0' || p[i] > '9')
+      return false;
+    v = v * 10 + (p[i] - '0');
+  }
+  *out = v;
+  return true;
+}
+
+bool LogParseTime(const char* str, size_t len, uint32_t* time, uint16_t* ms) {
+  int year, month, day, hour, minute, second, milli = 0;
+  if ((len != 19 && len != 23) || str[4] != '-' || str[7] != '-' || str[10] != ' ' || str[13] != ':' || str[16] != ':')
+    return false;
+  if (!parseDigits(str, 4, &year) || !parseDigits(str + 5, 2, &month) || !parseDigits(str + 8, 2, &day) ||
+      !parseDigits(str + 11, 2, &hour) || !parseDigits(str + 14, 2, &minute) || !parseDigits(str + 17, 2, &second))
+    return false;
+  if (len == 23 && (str[19] != '.' || !parseDigits(str + 20, 3, &milli)))
+    return false;
+  if (year < 1970 || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+    return false;
+  *time = LogMakeTime(year, month, day, hour, minute, second);
+  if (ms)
+    *ms = milli;
+  return true;
+}
+
+size_t LogFormatTime(char* buf, size_t size, uint32_t time) {
+  uint32_t days = time / 86400;
+  uint32_t secs = time % 86400;
+  // civil from days
+  int32_t z = days + 719468;
+  int32_t era = z / 146097;
+  uint32_t doe = z - era * 146097;
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int32_t year = yoe + era * 400;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153;
+  uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+  uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+  year += month <= 2;
+  int n = snprintf(buf, size, "%04d-%02u-%02u %02u:%02u:%02u", (int)year, (unsigned)month, (unsigned)day,
+                   (unsigned)(secs / 3600), (unsigned)(secs / 60 % 60), (unsigned)(secs % 60));
+  return n > 0 && (size_t)n < size ? n : 0;
+}
+
+//=============================================================================
+
+size_t FormatLogRecord(char* buf, size_t size, const char* timeString, float temperature, float humidity, uint32_t seq) {
+  int n = snprintf(buf, size, "%s;%f;%f;%u", timeString, temperature, humidity, (unsigned)seq);
+  if (n < 0 || (size_t)n + 10 >= size)
+    return 0;
+  uint32_t crc = LogCrc32(buf, n);
+  n += snprintf(buf + n, size - n, ";%08x\n", (unsigned)crc);
+  return n;
+}
+
+// plain decimal number as written by printf("%f"), no exponent, no nan
+static bool parseFloat(const char* p, const char* end, float* out) {
+  bool neg = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    neg = *p == '-';
+    p++;
+  }
+  if (p == end)
+    return false;
+
+  uint32_t mant = 0;
+  int digits = 0;
+  int scale = 0;
+  bool dot = false;
+  for (; p < end; p++) {
+    if (*p == '.' && !dot) {
+      dot = true;
+      continue;
+    }
+    if (*p < '0' || *p > '9')
+      return false;
+    if (digits < 9) {
+      mant = mant * 10 + (*p - '0');
+      digits++;
+      if (dot) scale++;
+    } else if (!dot) {
+      return false;
+    }
+  }
+  if (digits == 0)
+    return false;
+
+  static const float pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f};
+  float v = mant / pow10[scale];
+  *out = neg ? -v : v;
+  return true;
+}
+
+static bool parseUint(const char* p, const char* end, int base, uint32_t* out) {
+  if (p == end || end - p > 10)
+    return false;
+  uint32_t v = 0;
+  for (; p < end; p++) {
+    int d;
+    if (*p >= '0' && *p <= '9') d = *p - '0';
+    else if (base == 16 && *p >= 'a' && *p <= 'f') d = *p - 'a' + 10;
+    else if (base == 16 && *p >= 'A' && *p <= 'F') d = *p - 'A' + 10;
+    else return false;
+    v = v * base + d;
+  }
+  *out = v;
+  return true;
+}
+
+log_record_status ParseLogRecord(const char* line, size_t len, log_record* rec) {
+  if (len > 0 && line[len - 1] == '\n')
+    len--;
+  if (len > 0 && line[len - 1] == '\r')
+    len--;
+  if (len >= 5 && memcmp(line, "Time;", 5) == 0)
+    return LOG_RECORD_HEADER_LINE;
+
+  const char* end = line + len;
+  const char* field[6];
+  int fields = 0;
+  field[fields++] = line;
+  for (const char* p = line; p < end && fields < 6; p++) {
+    if (*p == ';')
+      field[fields++] = p + 1;
+  }
+  if (fields != 3 && fields != 5)
+    return LOG_RECORD_CORRUPT;
+  field[fields] = end + 1;
+
+  if (!LogParseTime(field[0], field[1] - field[0] - 1, &rec->time, &rec->ms) ||
+      !parseFloat(field[1], field[2] - 1, &rec->temperature) ||
+      !parseFloat(field[2], field[3] - 1, &rec->humidity))
+    return LOG_RECORD_CORRUPT;
+
+  if (fields == 3) {
+    rec->seq = 0;
+    return LOG_RECORD_LEGACY;
+  }
+
+  uint32_t crc;
+  if (!parseUint(field[3], field[4] - 1, 10, &rec->seq) ||
+      field[5] - field[4] - 1 != 8 ||
+      !parseUint(field[4], field[5] - 1, 16, &crc))
+    return LOG_RECORD_CORRUPT;
+
+  if (LogCrc32(line, field[4] - 1 - line) != crc)
+    return LOG_RECORD_CORRUPT;
+  return LOG_RECORD_OK;
+}
+
+//=============================================================================
+
+size_t LogLineSplitter::push(const char* data, size_t len, const char** line, size_t* lineLen, bool* overlong) {
+  *lineLen = 0;
+  const char* nl = (const char*)memchr(data, '\n', len);
+  size_t take = nl ? nl - data + 1 : len;
+
+  // whole line inside the caller's buffer, no copy needed
+  if (_len == 0 && !_overlong && nl && take <= LOG_RECORD_MAX_LEN) {
+    *line = data;
+    *lineLen = take;
+    *overlong = false;
+    return take;
+  }
+
+  size_t room = LOG_RECORD_MAX_LEN - _len;
+  if (take > room) {
+    memcpy(_buf + _len, data, room);
+    _len += room;
+    _overlong = true;
+  } else {
+    memcpy(_buf + _len, data, take);
+    _len += take;
+  }
+
+  if (nl) {
+    *line = _buf;
+    *lineLen = _len;
+    *overlong = _overlong;
+    _len = 0;
+    _overlong = false;
+  }
+  return take;
+}
+
+size_t LogLineSplitter::pending(const char** line) {
+  *line = _buf;
+  return _len;
+}
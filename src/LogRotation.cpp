@@ -0,0 +1,143 @@
+// Log file naming, rotation periods and metadata sidecars
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "LogRotation.h"
+
+uint32_t LogRotationSeconds(log_rotation period) {
+  switch (period) {
+    case LOG_ROTATE_DAILY: return 86400;
+    case LOG_ROTATE_HOURLY: return 3600;
+    default: return 31UL * 86400;
+  }
+}
+
+size_t LogFileNameFor(char* buf, size_t size, const char* dir, log_rotation period, uint32_t time, uint16_t part) {
+  char date[20];
+  LogFormatTime(date, sizeof(date), time);
+  // "YYYY-MM-DD hh:mm:ss"
+  int n;
+  switch (period) {
+    case LOG_ROTATE_DAILY:
+      n = snprintf(buf, size, "%s/%.10s_hmd", dir, date);
+      break;
+    case LOG_ROTATE_HOURLY:
+      n = snprintf(buf, size, "%s/%.10sT%.2s_hmd", dir, date, date + 11);
+      break;
+    default:
+      n = snprintf(buf, size, "%s/%.7s_hmd", dir, date);
+      break;
+  }
+  if (n > 0 && part)
+    n += snprintf(buf + n, size > (size_t)n ? size - n : 0, "_%03u", (unsigned)part);
+  if (n > 0)
+    n += snprintf(buf + n, size > (size_t)n ? size - n : 0, ".csv");
+  return n > 0 && (size_t)n < size ? n : 0;
+}
+
+static bool digits(const char* p, int n, int* out) {
+  int v = 0;
+  for (int i = 0; i < n; i++) {
+    if (p[i] < '0' || p[i] > '9')
+      return false;
+    v = v * 10 + p[i] - '0';
+  }
+  *out = v;
+  return true;
+}
+
+bool LogFileSpan(const char* name, uint32_t* first, uint32_t* last) {
+  const char* slash = strrchr(name, '/');
+  if (slash)
+    name = slash + 1;
+  int year, month, day, hour;
+  if (strlen(name) < 8 || !digits(name, 4, &year) || name[4] != '-' || !digits(name + 5, 2, &month) ||
+      month < 1 || month > 12)
+    return false;
+
+  if (name[7] == '_') {
+    *first = LogMakeTime(year, month, 1, 0, 0, 0);
+    *last = (month == 12 ? LogMakeTime(year + 1, 1, 1, 0, 0, 0) : LogMakeTime(year, month + 1, 1, 0, 0, 0)) - 1;
+    return true;
+  }
+  if (name[7] != '-' || strlen(name) < 11 || !digits(name + 8, 2, &day) || day < 1 || day > 31)
+    return false;
+  if (name[10] == '_') {
+    *first = LogMakeTime(year, month, day, 0, 0, 0);
+    *last = *first + 86399;
+    return true;
+  }
+  if (name[10] != 'T' || strlen(name) < 14 || !digits(name + 11, 2, &hour) || hour > 23 || name[13] != '_')
+    return false;
+  *first = LogMakeTime(year, month, day, hour, 0, 0);
+  *last = *first + 3599;
+  return true;
+}
+
+//=============================================================================
+
+bool IsLogMetaName(const char* name) {
+  size_t len = strlen(name);
+  size_t ext = strlen(LOG_META_EXT);
+  return len >= ext && strcmp(name + len - ext, LOG_META_EXT) == 0;
+}
+
+size_t LogMetaNameFor(char* buf, size_t size, const char* logName) {
+  const char* dot = strrchr(logName, '.');
+  const char* slash = strrchr(logName, '/');
+  size_t base = dot && (!slash || dot > slash) ? dot - logName : strlen(logName);
+  if (base + strlen(LOG_META_EXT) >= size)
+    return 0;
+  memcpy(buf, logName, base);
+  strcpy(buf + base, LOG_META_EXT);
+  return base + strlen(LOG_META_EXT);
+}
+
+void LogMetaClear(log_meta* meta) {
+  memset(meta, 0, sizeof(*meta));
+}
+
+void LogMetaAddBytes(log_meta* meta, const void* data, size_t len) {
+  meta->crc = LogCrc32(data, len, meta->crc);
+  meta->dataBytes += len;
+}
+
+void LogMetaAddRecord(log_meta* meta, uint32_t time) {
+  if (meta->count == 0 || time < meta->first)
+    meta->first = time;
+  if (time > meta->last)
+    meta->last = time;
+  meta->count++;
+}
+
+size_t FormatLogMeta(char* buf, size_t size, const log_meta& meta) {
+  int n = snprintf(buf, size, "M1;%u;%u;%u;%u;%08x;%u", (unsigned)meta.first, (unsigned)meta.last, (unsigned)meta.count,
+                   (unsigned)meta.dataBytes, (unsigned)meta.crc, meta.closed ? 1 : 0);
+  if (n < 0 || (size_t)n + 10 >= size)
+    return 0;
+  n += snprintf(buf + n, size - n, ";%08x\n", (unsigned)LogCrc32(buf, n));
+  return n;
+}
+
+bool ParseLogMeta(const char* buf, size_t len, log_meta* meta) {
+  char line[LOG_META_MAX_LEN + 1];
+  if (len > LOG_META_MAX_LEN)
+    return false;
+  memcpy(line, buf, len);
+  line[len] = 0;
+
+  unsigned first, last, count, dataBytes, crc, closed, metaCrc;
+  int body = 0;
+  if (sscanf(line, "M1;%u;%u;%u;%u;%8x;%u%n;%8x", &first, &last, &count, &dataBytes, &crc, &closed, &body, &metaCrc) != 7 ||
+      LogCrc32(line, body) != metaCrc)
+    return false;
+  meta->first = first;
+  meta->last = last;
+  meta->count = count;
+  meta->dataBytes = dataBytes;
+  meta->crc = crc;
+  meta->closed = closed != 0;
+  return true;
+}
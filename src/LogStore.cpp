@@ -0,0 +1,539 @@
+// Crash consistent log file writer
+
+#include <Arduino.h>
+
+#include "LogStore.h"
+#include "DebugLog.h"
+
+LogStore::LogStore(SdFat& sd, const char* dir) : _sd(sd) {
+  _stats = NULL;
+  _dir = dir;
+  _rotation.period = LOG_ROTATE_MONTHLY;
+  _rotation.maxBytes = 0;
+  _activeName[0] = 0;
+  _part = 0;
+  LogMetaClear(&_meta);
+  _metaPending = 0;
+  _seq = 0;
+  _dataEnd = 0;
+  _preallocSize = 0;
+  _fill = -1;
+  _corruptRecords = 0;
+  _recoveredBytes = 0;
+}
+
+static const char* baseName(const char* path) {
+  const char* slash = strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+bool LogStore::isActive(const char* name) const {
+  return _activeName[0] && strcmp(baseName(name), baseName(_activeName)) == 0;
+}
+
+// readers must stop at the logical end, the rest of a preallocated file is blank
+uint32_t LogStore::dataSize(const char* name, uint32_t fileSize) const {
+  if (_fill >= 0 && isActive(name) && _dataEnd < fileSize)
+    return _dataEnd;
+  return fileSize;
+}
+
+//=============================================================================
+// logical end of a possibly preallocated file
+
+bool LogStore::_findDataEnd(FatFile& file, uint32_t* end, int16_t* fill) {
+  uint32_t size = file.fileSize();
+  *end = size;
+  *fill = -1;
+  if (size == 0)
+    return true;
+
+  uint8_t b;
+  if (!file.seekSet(size - 1) || file.read(&b, 1) != 1)
+    return false;
+  if (b != 0x00 && b != 0xff)
+    return true; // ends in text, not preallocated
+
+  // records never contain the erased value, so "byte is blank" is monotonic
+  *fill = b;
+  uint32_t lo = 0;
+  uint32_t hi = size - 1;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (!file.seekSet(mid) || file.read(&b, 1) != 1)
+      return false;
+    if (b == *fill)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  *end = lo;
+  return true;
+}
+
+// end follows a complete line and every byte from it on is the erased value
+bool LogStore::_isPadding(FatFile& file, uint32_t end, uint8_t fill) {
+  uint8_t buf[512];
+  if (end > 0 && (!file.seekSet(end - 1) || file.read(buf, 1) != 1 || buf[0] != '\n'))
+    return false;
+  uint32_t size = file.fileSize();
+  if (!file.seekSet(end))
+    return false;
+  while (end < size) {
+    int n = file.read(buf, size - end < sizeof(buf) ? size - end : sizeof(buf));
+    if (n <= 0)
+      return false;
+    for (int i = 0; i < n; i++) {
+      if (buf[i] != fill)
+        return false;
+    }
+    end += n;
+  }
+  return true;
+}
+
+//=============================================================================
+// allocate a contiguous, erased extent for a new log file
+
+bool LogStore::_create(const char* name) {
+  uint32_t size = _rotation.maxBytes && _rotation.maxBytes < _preallocSize ? _rotation.maxBytes : _preallocSize;
+  if (size == 0)
+    return false;
+
+  FatFile file;
+  if (!file.createContiguous(_sd.vwd(), name, size)) {
+    debugLog.error("Preallocation of %s failed", name);
+    return false;
+  }
+
+  uint32_t bgnBlock, endBlock;
+  uint8_t first, last;
+  bool ok = file.contiguousRange(&bgnBlock, &endBlock) && _sd.card()->erase(bgnBlock, endBlock);
+  if (ok) {
+    // erase leaves 0x00 or 0xff depending on the card, drop stale cached blocks
+    _sd.vol()->cacheClear();
+    ok = file.seekSet(0) && file.read(&first, 1) == 1 &&
+         file.seekSet(file.fileSize() - 1) && file.read(&last, 1) == 1 &&
+         first == last && (first == 0x00 || first == 0xff);
+  }
+  if (ok)
+    ok = file.seekSet(0) && file.write(LOG_RECORD_HEADER, strlen(LOG_RECORD_HEADER)) == (int)strlen(LOG_RECORD_HEADER);
+  if (!ok) {
+    debugLog.warn("Erase of %s failed, using on demand allocation", name);
+    file.remove();
+    return false;
+  }
+  _resized(0, file.fileSize());
+  file.close();
+
+  _fill = first;
+  _dataEnd = strlen(LOG_RECORD_HEADER);
+  LogMetaAddBytes(&_meta, LOG_RECORD_HEADER, _dataEnd);
+  debugLog.info("Preallocated %s, %u bytes", name, size);
+  return true;
+}
+
+bool LogStore::_trim(const char* name) {
+  File logFile = _sd.open(name, O_RDWR);
+  uint32_t size = logFile ? logFile.fileSize() : 0;
+  if (!logFile || !logFile.truncate(_dataEnd)) {
+    debugLog.error("Trim of %s failed", name);
+    return false;
+  }
+  _resized(size, _dataEnd);
+  logFile.close();
+  debugLog.info("Closed %s at %u bytes", name, _dataEnd);
+  return true;
+}
+
+// trim preallocated files left open by a power loss at the end of a period
+void LogStore::closeStale() {
+  File logs = _sd.open(_dir, O_READ);
+  if (!logs)
+    return;
+
+  FatFile file;
+  char filename[LOG_NAME_MAX];
+  char path[LOG_NAME_MAX];
+  while (file.openNext(&logs, O_RDWR)) {
+    file.getName(filename, sizeof(filename));
+    uint32_t end;
+    int16_t fill;
+    if (!file.isDir() && !IsLogMetaName(filename) && !isActive(filename) &&
+        _findDataEnd(file, &end, &fill) && fill >= 0) {
+      uint32_t size = file.fileSize();
+      // a record that happens to end in the erased value is not padding
+      if (!_isPadding(file, end, fill)) {
+        debugLog.warn("Stale %s does not end in padding, kept", filename);
+        file.close();
+        continue;
+      }
+      if (file.truncate(end)) {
+        _resized(size, end);
+        debugLog.info("Closed stale %s at %u bytes", filename, end);
+        log_meta meta;
+        // a name too long for a path was not made by LogFileNameFor()
+        int n = snprintf(path, sizeof(path), "%s/%s", _dir, filename);
+        if (n > 0 && (size_t)n < sizeof(path) && _scanMeta(file, path, end, &meta)) {
+          meta.closed = true;
+          _writeMeta(path, meta);
+        }
+      }
+    }
+    file.close();
+  }
+  logs.close();
+}
+
+//=============================================================================
+// file name of the period holding time
+
+void LogStore::_nameFor(uint32_t time, uint16_t part, char* name) {
+  if (!LogFileNameFor(name, LOG_NAME_MAX, _dir, _rotation.period, time, part))
+    name[0] = 0;
+}
+
+// make the file of the current period active, continuing at its last part
+bool LogStore::recover(uint32_t now) {
+  char name[LOG_NAME_MAX];
+  char next[LOG_NAME_MAX];
+  _part = 0;
+  if (_rotation.maxBytes) {
+    while (_part < 999) {
+      _nameFor(now, _part + 1, next);
+      if (!_sd.exists(next))
+        break;
+      _part++;
+    }
+  }
+  _nameFor(now, _part, name);
+  return _open(name);
+}
+
+//=============================================================================
+// drop a torn last line and pick up the sequence number of the last record
+
+bool LogStore::_open(const char* name) {
+  strncpy(_activeName, name, LOG_NAME_MAX - 1);
+  _activeName[LOG_NAME_MAX - 1] = 0;
+  _seq = 0;
+  _dataEnd = 0;
+  _fill = -1;
+  LogMetaClear(&_meta);
+  _metaPending = 0;
+
+  File logFile = _sd.open(name, O_RDWR);
+  if (!logFile)
+    return true; // nothing written yet
+
+  uint32_t size;
+  if (!_findDataEnd(logFile, &size, &_fill)) {
+    debugLog.error("Log recovery: read of %s failed", name);
+    logFile.close();
+    return false;
+  }
+
+  uint32_t start = size > LOG_RECOVERY_TAIL ? size - LOG_RECOVERY_TAIL : 0;
+  char tail[LOG_RECOVERY_TAIL];
+  if (!logFile.seekSet(start) || logFile.read(tail, size - start) != (int)(size - start)) {
+    debugLog.error("Log recovery: read of %s failed", name);
+    logFile.close();
+    return false;
+  }
+  int len = size - start;
+  int validEnd = 0;
+  bool found = false;
+  // walk complete lines backwards, the first one is cut unless start == 0
+  int lineEnd = len;
+  while (lineEnd > 0 && !found) {
+    int nl = lineEnd - 1;
+    while (nl >= 0 && tail[nl] != '\n')
+      nl--;
+    if (nl < 0)
+      break;
+    // tail[nl] ends a line, find where that line starts
+    int lineStart = nl - 1;
+    while (lineStart >= 0 && tail[lineStart] != '\n')
+      lineStart--;
+    lineStart++;
+    if (lineStart == 0 && start > 0)
+      break;
+
+    log_record rec;
+    switch (ParseLogRecord(tail + lineStart, nl + 1 - lineStart, &rec)) {
+      case LOG_RECORD_OK:
+        _seq = rec.seq;
+        found = true;
+        break;
+      case LOG_RECORD_LEGACY:
+      case LOG_RECORD_HEADER_LINE:
+        found = true;
+        break;
+      case LOG_RECORD_CORRUPT:
+        break;
+    }
+    if (found)
+      validEnd = nl + 1;
+    lineEnd = nl;
+  }
+
+  if (!found && start > 0) {
+    // no usable record in the window, only cut what follows the last newline
+    validEnd = len;
+    while (validEnd > 0 && tail[validEnd - 1] != '\n')
+      validEnd--;
+  }
+
+  uint32_t newSize = start + validEnd;
+  if (newSize < size) {
+    bool ok;
+    if (_fill >= 0) {
+      // blank the torn bytes again so the next scan ends at newSize
+      memset(tail, _fill, size - newSize);
+      ok = logFile.seekSet(newSize) && logFile.write(tail, size - newSize) == (int)(size - newSize);
+    } else {
+      ok = logFile.truncate(newSize);
+      if (ok)
+        _resized(size, newSize);
+    }
+    if (!ok) {
+      debugLog.error("Log recovery: truncate of %s failed", name);
+      logFile.close();
+      return false;
+    }
+    _recoveredBytes += size - newSize;
+    debugLog.warn("Log recovery: %s truncated %u torn bytes", name, size - newSize);
+  }
+  _dataEnd = newSize;
+  if (!_scanMeta(logFile, name, _dataEnd, &_meta))
+    debugLog.warn("Log recovery: metadata of %s incomplete", name);
+  logFile.close();
+  return true;
+}
+
+//=============================================================================
+// metadata up to end, from the sidecar checkpoint on, from scratch without one
+
+bool LogStore::_scanMeta(FatFile& file, const char* name, uint32_t end, log_meta* meta) {
+  char buf[LOG_META_MAX_LEN];
+  LogMetaClear(meta);
+  if (LogMetaNameFor(buf, sizeof(buf), name)) {
+    File metaFile = _sd.open(buf, O_READ);
+    if (metaFile) {
+      int n = metaFile.read(buf, sizeof(buf));
+      metaFile.close();
+      if (n <= 0 || !ParseLogMeta(buf, n, meta) || meta->dataBytes > end)
+        LogMetaClear(meta);
+    }
+  }
+  meta->closed = false;
+
+  // checkpoints are taken at line ends
+  LogLineSplitter splitter;
+  char chunk[512];
+  uint32_t pos = meta->dataBytes;
+  if (pos < end && !file.seekSet(pos))
+    return false;
+  while (pos < end) {
+    int n = end - pos < sizeof(chunk) ? end - pos : sizeof(chunk);
+    n = file.read(chunk, n);
+    if (n <= 0)
+      return false;
+    LogMetaAddBytes(meta, chunk, n);
+    pos += n;
+    for (int off = 0; off < n; ) {
+      const char* line;
+      size_t len;
+      bool overlong;
+      log_record rec;
+      off += splitter.push(chunk + off, n - off, &line, &len, &overlong);
+      if (len == 0 || overlong)
+        continue;
+      log_record_status status = ParseLogRecord(line, len, &rec);
+      if (status == LOG_RECORD_OK || status == LOG_RECORD_LEGACY)
+        LogMetaAddRecord(meta, rec.time);
+    }
+  }
+  return true;
+}
+
+bool LogStore::_writeMeta(const char* name, const log_meta& meta) {
+  char metaName[LOG_NAME_MAX];
+  char buf[LOG_META_MAX_LEN];
+  size_t len = FormatLogMeta(buf, sizeof(buf), meta);
+  if (!LogMetaNameFor(metaName, sizeof(metaName), name) || len == 0)
+    return false;
+
+  // overwrite in place, the file keeps its cluster
+  File metaFile = _sd.open(metaName, O_RDWR | O_CREAT);
+  uint32_t size = metaFile ? metaFile.fileSize() : 0;
+  if (!metaFile || !metaFile.seekSet(0) || metaFile.write(buf, len) != (int)len ||
+      (size > len && !metaFile.truncate(len))) {
+    debugLog.error("Write of %s failed", metaName);
+    if (metaFile)
+      metaFile.close();
+    return false;
+  }
+  _resized(size, metaFile.fileSize());
+  metaFile.close();
+  return true;
+}
+
+bool LogStore::readMeta(const char* name, log_meta* meta) {
+  if (isActive(name)) {
+    *meta = _meta;
+    return true;
+  }
+  char buf[LOG_META_MAX_LEN];
+  char path[LOG_NAME_MAX];
+  int len = strchr(name, '/') ? snprintf(path, sizeof(path), "%s", name)
+                              : snprintf(path, sizeof(path), "%s/%s", _dir, name);
+  if (len <= 0 || (size_t)len >= sizeof(path) || !LogMetaNameFor(buf, sizeof(buf), path))
+    return false;
+  File metaFile = _sd.open(buf, O_READ);
+  if (!metaFile)
+    return false;
+  int n = metaFile.read(buf, sizeof(buf));
+  metaFile.close();
+  return n > 0 && ParseLogMeta(buf, n, meta);
+}
+
+// files without a sidecar are picked by the period in their name
+String LogStore::listJson(uint32_t from, uint32_t to) {
+  String json = "[";
+  File logs = _sd.open(_dir, O_READ);
+  FatFile file;
+  dir_t entry;
+  log_meta meta;
+
+  char filename[LOG_NAME_MAX];
+  char filetime[50];
+  bool first = true;
+  while (file.openNext(&logs, O_READ)) {
+    file.getName(filename, sizeof(filename));
+    if (IsLogMetaName(filename)) {
+      file.close();
+      continue;
+    }
+    bool hasMeta = readMeta(filename, &meta) && meta.count;
+    if (!hasMeta && !LogFileSpan(filename, &meta.first, &meta.last)) {
+      meta.first = 0;
+      meta.last = 0xffffffff;
+    }
+    if (meta.first > to || meta.last < from) {
+      file.close();
+      continue;
+    }
+
+    if (first) {
+      first = false;
+    } else {
+      json += ",";
+    }
+
+    if (!file.dirEntry(&entry)) {
+      debugLog.error("file.dirEntry failed");
+    }
+
+    sprintf(filetime, "%04d-%02d-%02d %02d:%02d:%02d", FAT_YEAR(entry.lastWriteDate), FAT_MONTH(entry.lastWriteDate), FAT_DAY(entry.lastWriteDate), FAT_HOUR(entry.lastWriteTime), FAT_MINUTE(entry.lastWriteTime), FAT_SECOND(entry.lastWriteTime));
+    json += "{";
+    json += "\"name\":\"" + String(filename) + "\"";
+    json += ",\"date\":\"" + String(filetime) + "\"";
+    json += ",\"size\":" + String(dataSize(filename, file.fileSize()));
+    if (hasMeta) {
+      json += ",\"first\":" + String(meta.first);
+      json += ",\"last\":" + String(meta.last);
+      json += ",\"count\":" + String(meta.count);
+      json += ",\"closed\":" + String(meta.closed ? "true" : "false");
+    }
+    json += "}";
+
+    file.close();
+  }
+  logs.close();
+  json += "]";
+  return json;
+}
+
+// finish the active file: give the unused extent back and mark the metadata final
+void LogStore::_close() {
+  if (!_activeName[0])
+    return;
+  if (_fill >= 0)
+    _trim(_activeName);
+  _meta.closed = true;
+  _writeMeta(_activeName, _meta);
+  _activeName[0] = 0;
+}
+
+//=============================================================================
+
+bool LogStore::append(const char* timeString, float temperature, float humidity) {
+  uint32_t time;
+  if (!LogParseTime(timeString, strlen(timeString), &time)) {
+    debugLog.error("Log: bad time %s", timeString);
+    return false;
+  }
+
+  // a new period starts again at the first part
+  char name[LOG_NAME_MAX];
+  _nameFor(time, _part, name);
+  if (_part && strcmp(name, _activeName) != 0) {
+    _part = 0;
+    _nameFor(time, 0, name);
+  }
+
+  char logLine[LOG_RECORD_MAX_LEN];
+  size_t len = FormatLogRecord(logLine, sizeof(logLine), timeString, temperature, humidity, _seq + 1);
+  if (_rotation.maxBytes && strcmp(name, _activeName) == 0 && _meta.count &&
+      _dataEnd + len > _rotation.maxBytes && _part < 999) {
+    _part++;
+    _nameFor(time, _part, name);
+  }
+
+  if (strcmp(name, _activeName) != 0) {
+    _close();
+    _open(name);
+    len = FormatLogRecord(logLine, sizeof(logLine), timeString, temperature, humidity, _seq + 1);
+  }
+
+  if (_dataEnd == 0 && !_sd.exists(name))
+    _create(name);
+
+  File logFile = _sd.open(name, O_RDWR | O_CREAT);
+  if (!logFile) {
+    debugLog.error("Open of %s failed", name);
+    return false;
+  }
+
+  uint32_t oldSize = logFile.fileSize();
+  if (oldSize == 0) {
+    if (logFile.write(LOG_RECORD_HEADER) != (int)strlen(LOG_RECORD_HEADER)) {
+      debugLog.error("Write to %s failed", name);
+      logFile.close();
+      return false;
+    }
+    _dataEnd = strlen(LOG_RECORD_HEADER);
+    LogMetaAddBytes(&_meta, LOG_RECORD_HEADER, _dataEnd);
+  }
+
+  if (len == 0 || !logFile.seekSet(_dataEnd) || logFile.write(logLine, len) != (int)len) {
+    debugLog.error("Write to %s failed", name);
+    logFile.close();
+    return false;
+  }
+
+  _resized(oldSize, logFile.fileSize());
+  if (!logFile.close()) {
+    debugLog.error("Close of %s failed", name);
+    return false;
+  }
+  _seq++;
+  _dataEnd += len;
+  LogMetaAddBytes(&_meta, logLine, len);
+  LogMetaAddRecord(&_meta, time);
+  if (++_metaPending >= LOG_META_INTERVAL && _writeMeta(name, _meta))
+    _metaPending = 0;
+  debugLog.verbose("Log: %s", logLine);
+  return true;
+}
@@ -0,0 +1,302 @@
+// Hot-path timing of loop() stages, HTTP handlers and timer jitter
+
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "esp_system.h"
+
+#include "PerfMonitor.h"
+
+PerfMonitor perf;
+
+// survives a watchdog reset, so the next boot can tell where loop() hung
+RTC_NOINIT_ATTR static uint32_t rtc_stage_magic;
+RTC_NOINIT_ATTR static uint32_t rtc_stage;
+#define RTC_STAGE_MAGIC 0x50455246
+
+static const char* stage_names[PERF_STAGE_COUNT] = {
+  "loop", "button", "refreshTemp", "addSample", "writeSD", "syncRTC",
+  "updateDisplay", "dns", "sdManager", "sdMount", "retention", "storageScan", "alerts", "wifiScan", "wifiConn", "quantiles", "httpLogs", "httpLogFill", "httpApiLogs",
+  "httpChart", "httpChartFill", "httpExport", "httpExportFill", "httpArchive", "httpArchiveFill", "httpSync", "httpSyncFill",
+  "httpQuantiles", "httpQuantilesFill",
+  "httpWifi", "httpState", "httpSet", "httpPerf", "httpDebugLog", "httpAsset", "httpConfig"
+};
+
+static const char* timer_names[PERF_TIMER_COUNT] = {
+  "tempTimer", "tempLogTimer", "dispTempTimer", "dispTimer"
+};
+
+//=============================================================================
+
+void PerfStat::clear() {
+  count = 0;
+  sum = 0;
+  min = UINT32_MAX;
+  max = 0;
+  memset(hist, 0, sizeof(hist));
+}
+
+static int bucketOf(uint32_t us) {
+  if (us < PERF_HIST_SUB)
+    return us;
+  int msb = 31 - __builtin_clz(us);
+  int b = (msb - 1) * PERF_HIST_SUB + ((us >> (msb - 2)) & (PERF_HIST_SUB - 1));
+  return b < PERF_HIST_BUCKETS ? b : PERF_HIST_BUCKETS - 1;
+}
+
+static uint32_t bucketUpper(int b) {
+  if (b < PERF_HIST_SUB)
+    return b;
+  int msb = b / PERF_HIST_SUB + 1;
+  uint32_t lower = (uint32_t)(PERF_HIST_SUB + b % PERF_HIST_SUB) << (msb - 2);
+  return lower + (1UL << (msb - 2)) - 1;
+}
+
+void PerfStat::add(uint32_t us) {
+  count++;
+  sum += us;
+  if (us < min) min = us;
+  if (us > max) max = us;
+  int b = bucketOf(us);
+  if (hist[b] == UINT16_MAX) {
+    // keep the shape of the distribution, forget old samples
+    for (int i = 0; i < PERF_HIST_BUCKETS; i++)
+      hist[i] >>= 1;
+  }
+  hist[b]++;
+}
+
+uint32_t PerfStat::percentile(uint8_t pct) const {
+  uint32_t total = 0;
+  for (int i = 0; i < PERF_HIST_BUCKETS; i++)
+    total += hist[i];
+  if (total == 0)
+    return 0;
+
+  uint32_t target = (total * pct + 99) / 100;
+  uint32_t acc = 0;
+  for (int i = 0; i < PERF_HIST_BUCKETS; i++) {
+    acc += hist[i];
+    if (acc >= target) {
+      uint32_t upper = bucketUpper(i);
+      return upper < max ? upper : max;
+    }
+  }
+  return max;
+}
+
+//=============================================================================
+
+PerfMonitor::PerfMonitor() {
+  _mux = portMUX_INITIALIZER_UNLOCKED;
+  _loopTask = NULL;
+  _loopStage = PERF_LOOP;
+  _loopStageStart = 0;
+  _stallReported = false;
+  _resetStageValid = false;
+  reset();
+}
+
+void PerfMonitor::reset() {
+  portENTER_CRITICAL(&_mux);
+  for (int i = 0; i < PERF_STAGE_COUNT; i++)
+    _stages[i].clear();
+  for (int i = 0; i < PERF_TIMER_COUNT; i++) {
+    _jitter[i].clear();
+    _missed[i] = 0;
+  }
+  _stalls = 0;
+  _lastStallStage = PERF_LOOP;
+  _lastStallMs = 0;
+  portEXIT_CRITICAL(&_mux);
+}
+
+// must be called from setup(), which runs in the loop task
+void PerfMonitor::begin() {
+  _loopTask = xTaskGetCurrentTaskHandle();
+
+  esp_reset_reason_t reason = esp_reset_reason();
+  if (rtc_stage_magic == RTC_STAGE_MAGIC && rtc_stage < PERF_STAGE_COUNT &&
+      (reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT || reason == ESP_RST_WDT)) {
+    _resetStage = (perf_stage)rtc_stage;
+    _resetStageValid = true;
+    Serial.printf("Watchdog reset while loop() was in stage %s\n", stageName(_resetStage));
+  }
+  rtc_stage_magic = RTC_STAGE_MAGIC;
+  rtc_stage = PERF_LOOP;
+
+  xTaskCreate(_watchdogTask, "perfWdt", 2048, this, 1, NULL);
+}
+
+perf_stage PerfMonitor::enterLoopStage(perf_stage stage) {
+  perf_stage previous = _loopStage;
+  _loopStage = stage;
+  _loopStageStart = esp_timer_get_time();
+  _stallReported = false;
+  rtc_stage = stage;
+  return previous;
+}
+
+void PerfMonitor::leaveLoopStage(perf_stage previous) {
+  _loopStage = previous;
+  _loopStageStart = esp_timer_get_time();
+  _stallReported = false;
+  rtc_stage = previous;
+}
+
+void PerfMonitor::record(perf_stage stage, uint32_t us) {
+  portENTER_CRITICAL(&_mux);
+  _stages[stage].add(us);
+  portEXIT_CRITICAL(&_mux);
+}
+
+// lateness of a polled timer against its nominal period
+void PerfMonitor::timerFired(perf_timer timer, uint32_t lateUs, uint32_t missed) {
+  portENTER_CRITICAL(&_mux);
+  _jitter[timer].add(lateUs);
+  _missed[timer] += missed;
+  portEXIT_CRITICAL(&_mux);
+}
+
+//=============================================================================
+
+void PerfMonitor::_watchdogTask(void* arg) {
+  PerfMonitor* self = (PerfMonitor*)arg;
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(PERF_STALL_MS / 4));
+    self->_checkStall();
+  }
+}
+
+void PerfMonitor::_checkStall() {
+  // stage start is refreshed on every enter/leave, so anything running
+  // longer than the threshold without passing a stage boundary is a stall
+  if (_stallReported || _loopStageStart == 0)
+    return;
+
+  perf_stage stage = _loopStage;
+  int64_t elapsed = (esp_timer_get_time() - _loopStageStart) / 1000;
+  if (elapsed < PERF_STALL_MS)
+    return;
+
+  _stallReported = true;
+  portENTER_CRITICAL(&_mux);
+  _stalls++;
+  _lastStallStage = stage;
+  _lastStallMs = elapsed;
+  portEXIT_CRITICAL(&_mux);
+  Serial.printf("Loop stall: stage %s running for %lld ms\n", stageName(stage), (long long)elapsed);
+}
+
+//=============================================================================
+
+const char* PerfMonitor::stageName(perf_stage stage) {
+  return stage < PERF_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+const char* PerfMonitor::timerName(perf_timer timer) {
+  return timer < PERF_TIMER_COUNT ? timer_names[timer] : "unknown";
+}
+
+static String statJson(const char* name, const PerfStat& s, const String& extra = String()) {
+  String json = "{";
+  json += "\"name\":\"" + String(name) + "\"";
+  json += ",\"count\":" + String(s.count);
+  json += ",\"min\":" + String(s.count ? s.min : 0);
+  json += ",\"avg\":" + String(s.avg());
+  json += ",\"max\":" + String(s.max);
+  json += ",\"p99\":" + String(s.percentile(99));
+  json += extra;
+  json += "}";
+  return json;
+}
+
+String PerfMonitor::toJson(const String& extra) {
+  PerfStat* stages = (PerfStat*)malloc(sizeof(_stages));
+  PerfStat* jitter = (PerfStat*)malloc(sizeof(_jitter));
+  uint32_t missed[PERF_TIMER_COUNT];
+  if (stages == NULL || jitter == NULL) {
+    free(stages);
+    free(jitter);
+    return "{\"unit\":\"us\"" + extra + "}";
+  }
+
+  portENTER_CRITICAL(&_mux);
+  memcpy(stages, _stages, sizeof(_stages));
+  memcpy(jitter, _jitter, sizeof(_jitter));
+  memcpy(missed, _missed, sizeof(_missed));
+  uint32_t stalls = _stalls;
+  perf_stage lastStallStage = _lastStallStage;
+  uint32_t lastStallMs = _lastStallMs;
+  portEXIT_CRITICAL(&_mux);
+
+  String json = "{\"unit\":\"us\",\"stages\":[";
+  for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+    if (i) json += ",";
+    json += statJson(stage_names[i], stages[i]);
+  }
+  json += "],\"jitter\":[";
+  for (int i = 0; i < PERF_TIMER_COUNT; i++) {
+    if (i) json += ",";
+    json += statJson(timer_names[i], jitter[i], ",\"missed\":" + String(missed[i]));
+  }
+  json += "]";
+  json += ",\"stalls\":" + String(stalls);
+  json += ",\"lastStallStage\":\"" + String(stalls ? stageName(lastStallStage) : "") + "\"";
+  json += ",\"lastStallMs\":" + String(lastStallMs);
+  json += ",\"resetStage\":\"" + String(_resetStageValid ? stageName(_resetStage) : "") + "\"";
+  json += extra;
+  json += "}";
+
+  free(stages);
+  free(jitter);
+  return json;
+}
+
+void PerfMonitor::dump(Print& out) {
+  out.println("Perf [us]       count      min      avg      max      p99");
+  for (int i = 0; i < PERF_STAGE_COUNT + PERF_TIMER_COUNT; i++) {
+    PerfStat s;
+    const char* name;
+    portENTER_CRITICAL(&_mux);
+    if (i < PERF_STAGE_COUNT) {
+      s = _stages[i];
+      name = stage_names[i];
+    } else {
+      s = _jitter[i - PERF_STAGE_COUNT];
+      name = timer_names[i - PERF_STAGE_COUNT];
+    }
+    portEXIT_CRITICAL(&_mux);
+    if (s.count == 0)
+      continue;
+    out.printf("%-14s %6u %8u %8u %8u %8u\n", name, s.count, s.min, s.avg(), s.max, s.percentile(99));
+  }
+  if (_stalls)
+    out.printf("stalls: %u, last in %s (%u ms)\n", _stalls, stageName(_lastStallStage), _lastStallMs);
+}
+
+//=============================================================================
+
+PerfScope::PerfScope(perf_stage stage) {
+  _stage = stage;
+  _loop = perf.isLoopTask();
+  if (_loop)
+    _previous = perf.enterLoopStage(stage);
+  _core = xPortGetCoreID();
+  _startUs = esp_timer_get_time();
+  _startCycles = ESP.getCycleCount();
+}
+
+PerfScope::~PerfScope() {
+  uint32_t cycles = ESP.getCycleCount() - _startCycles;
+  int64_t us = esp_timer_get_time() - _startUs;
+
+  uint32_t elapsed;
+  if (us > 10000000 || xPortGetCoreID() != _core)
+    elapsed = us;
+  else
+    elapsed = cycles / ESP.getCpuFreqMHz();
+
+  perf.record(_stage, elapsed);
+  if (_loop)
+    perf.leaveLoopStage(_previous);
+}
@@ -0,0 +1,122 @@
+// Stream daily and merged quantiles of a range of days as JSON
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+#include "QuantileResponse.h"
+#include "LogRecord.h"
+
+static const char* channel_names[QUANTILE_CHANNELS] = {"temperature", "humidity"};
+
+QuantileResponse::QuantileResponse(SdFat& sd, QuantileStore& store, uint32_t fromDay, uint32_t toDay,
+                                   uint32_t interval, float tempAbove, float humAbove)
+  : ChunkedResponse("application/json", PERF_HTTP_QUANTILES_FILL, QUANTILE_FILL_DAYS), _sd(sd), _store(store) {
+  _fromDay = fromDay;
+  _toDay = toDay;
+  _nextDay = fromDay;
+  _interval = interval;
+  _above[QUANTILE_TEMPERATURE] = tempAbove;
+  _above[QUANTILE_HUMIDITY] = humAbove;
+  _state = QUANTILE_HEADER;
+  _fileOpen = false;
+  _days = 0;
+  _reads = 0;
+  _textLen = 0;
+}
+
+QuantileResponse::~QuantileResponse() {
+  if (_fileOpen)
+    _file.close();
+}
+
+void QuantileResponse::_append(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(_text + _textLen, sizeof(_text) - _textLen, format, args);
+  va_end(args);
+  if (n > 0)
+    _textLen += (size_t)n < sizeof(_text) - _textLen ? n : sizeof(_text) - _textLen - 1;
+}
+
+// the running day from RAM, the others from the file
+bool QuantileResponse::_readDay(uint32_t day) {
+  if (_store.today(day, _day))
+    return _day[QUANTILE_TEMPERATURE].count() > 0;
+  if (!_fileOpen)
+    return false;
+  quantile_day record;
+  _reads++;
+  if (!QuantileStore::readDay(_file, _header, day, &record))
+    return false;
+  for (int c = 0; c < QUANTILE_CHANNELS; c++) {
+    if (!_day[c].load(record.channels[c]))
+      return false;
+  }
+  return true;
+}
+
+void QuantileResponse::_channels(QuantileSketch* sketches) {
+  for (int c = 0; c < QUANTILE_CHANNELS; c++) {
+    QuantileSketch& s = sketches[c];
+    _append(",\"%s\":{\"count\":%u", channel_names[c], (unsigned)s.count());
+    if (s.count()) {
+      _append(",\"min\":%.2f,\"max\":%.2f,\"mean\":%.2f,\"p5\":%.2f,\"p50\":%.2f,\"p95\":%.2f",
+              s.min(), s.max(), s.mean(), s.quantile(0.05f), s.quantile(0.5f), s.quantile(0.95f));
+      if (!isnan(_above[c]))
+        _append(",\"aboveSeconds\":%u", (unsigned)((1 - s.cdf(_above[c])) * s.count() * _interval + 0.5f));
+    }
+    _append("}");
+  }
+}
+
+// next piece of JSON, a day without records gives none
+size_t QuantileResponse::_step(uint8_t*, size_t) {
+  char date[24];
+  _textLen = 0;
+  switch (_state) {
+    case QUANTILE_HEADER:
+      _file = _sd.open(_store.path(), O_READ);
+      _fileOpen = _file ? true : false;
+      if (_fileOpen && !QuantileStore::readHeader(_file, &_header)) {
+        _file.close();
+        _fileOpen = false;
+      }
+      LogFormatTime(date, sizeof(date), _fromDay * 86400);
+      _append("{\"from\":\"%.10s\"", date);
+      LogFormatTime(date, sizeof(date), _toDay * 86400);
+      _append(",\"to\":\"%.10s\",\"interval\":%u,\"days\":[", date, (unsigned)_interval);
+      _state = QUANTILE_DAYS;
+      break;
+
+    case QUANTILE_DAYS:
+      if (_nextDay > _toDay) {
+        _state = QUANTILE_TOTAL;
+        break;
+      }
+      if (_readDay(_nextDay)) {
+        LogFormatTime(date, sizeof(date), _nextDay * 86400);
+        _append("%s{\"day\":\"%.10s\"", _days ? "," : "", date);
+        _channels(_day);
+        _append("}");
+        for (int c = 0; c < QUANTILE_CHANNELS; c++)
+          _total[c].merge(_day[c]);
+        _days++;
+      }
+      _nextDay++;
+      break;
+
+    case QUANTILE_TOTAL:
+      _append("],\"total\":{\"days\":%u", (unsigned)_days);
+      _channels(_total);
+      _append("}}");
+      _state = QUANTILE_DONE;
+      _finish();
+      break;
+
+    case QUANTILE_DONE:
+      _finish();
+      break;
+  }
+  _emit(_text, _textLen);
+  return 0;
+}
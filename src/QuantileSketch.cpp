@@ -0,0 +1,230 @@
+// Mergeable fixed size quantile sketch (t-digest) of one channel
+
+#include <math.h>
+#include <string.h>
+
+#include "QuantileSketch.h"
+
+#ifndef PI
+#define PI 3.14159265358979f
+#endif
+
+// arcsine scale: a centroid may span one unit of k, which is narrow at the tails
+static float kScale(float q) {
+  return QUANTILE_COMPRESSION / (2 * PI) * asinf(2 * q - 1);
+}
+
+static float kInverse(float k) {
+  float a = k * 2 * PI / QUANTILE_COMPRESSION;
+  if (a >= PI / 2)
+    return 1;
+  return (sinf(a) + 1) / 2;
+}
+
+void QuantileSketch::clear() {
+  _n = 0;
+  _bufN = 0;
+  _min = NAN;
+  _max = NAN;
+  _count = 0;
+}
+
+void QuantileSketch::add(float value) {
+  if (isnan(value))
+    return;
+  if (_count == 0 || value < _min)
+    _min = value;
+  if (_count == 0 || value > _max)
+    _max = value;
+  _count++;
+  _buf[_bufN++] = value;
+  if (_bufN == QUANTILE_BUFFER)
+    flush();
+}
+
+//=============================================================================
+// merging
+
+// in is sorted by mean, one pass builds the new centroids
+void QuantileSketch::_compress(const quantile_centroid* in, size_t n) {
+  float total = 0;
+  for (size_t i = 0; i < n; i++)
+    total += in[i].weight;
+  _n = 0;
+  if (n == 0)
+    return;
+  float before = 0;
+  float limit = total * kInverse(kScale(0) + 1);
+  quantile_centroid cur = in[0];
+  for (size_t i = 1; i < n; i++) {
+    // the last slot takes whatever is left, the compression keeps it from happening
+    if (before + cur.weight + in[i].weight <= limit || _n == QUANTILE_CENTROIDS - 1) {
+      cur.weight += in[i].weight;
+      cur.mean += (in[i].mean - cur.mean) * in[i].weight / cur.weight;
+    } else {
+      _c[_n++] = cur;
+      before += cur.weight;
+      limit = total * kInverse(kScale(before / total) + 1);
+      cur = in[i];
+    }
+  }
+  _c[_n++] = cur;
+}
+
+void QuantileSketch::_mergeSorted(const quantile_centroid* in, size_t n) {
+  quantile_centroid all[QUANTILE_CENTROIDS + (QUANTILE_BUFFER > QUANTILE_CENTROIDS ? QUANTILE_BUFFER : QUANTILE_CENTROIDS)];
+  size_t a = 0;
+  size_t b = 0;
+  size_t k = 0;
+  while (a < _n || b < n) {
+    if (b == n || (a < _n && _c[a].mean <= in[b].mean))
+      all[k++] = _c[a++];
+    else
+      all[k++] = in[b++];
+  }
+  _compress(all, k);
+}
+
+void QuantileSketch::flush() {
+  if (_bufN == 0)
+    return;
+  quantile_centroid in[QUANTILE_BUFFER];
+  // insertion sort, the buffer is small and readings are close to sorted
+  for (uint8_t i = 0; i < _bufN; i++) {
+    float v = _buf[i];
+    int j = i;
+    for (; j > 0 && in[j - 1].mean > v; j--)
+      in[j] = in[j - 1];
+    in[j].mean = v;
+    in[j].weight = 1;
+  }
+  size_t n = _bufN;
+  _bufN = 0;
+  _mergeSorted(in, n);
+}
+
+void QuantileSketch::merge(const QuantileSketch& other) {
+  if (other._count == 0)
+    return;
+  QuantileSketch copy = other;
+  copy.flush();
+  flush();
+  if (_count == 0 || copy._min < _min)
+    _min = copy._min;
+  if (_count == 0 || copy._max > _max)
+    _max = copy._max;
+  _count += copy._count;
+  _mergeSorted(copy._c, copy._n);
+}
+
+//=============================================================================
+// queries, linear between the centroid centres and out to min and max
+
+float QuantileSketch::mean() {
+  flush();
+  if (_count == 0)
+    return NAN;
+  double sum = 0;
+  double total = 0;
+  for (uint8_t i = 0; i < _n; i++) {
+    sum += (double)_c[i].mean * _c[i].weight;
+    total += _c[i].weight;
+  }
+  return sum / total;
+}
+
+float QuantileSketch::quantile(float q) {
+  flush();
+  if (_count == 0)
+    return NAN;
+  float total = 0;
+  for (uint8_t i = 0; i < _n; i++)
+    total += _c[i].weight;
+  float t = q * total;
+  if (t <= 0)
+    return _min;
+  if (t >= total)
+    return _max;
+
+  float left = 0;
+  float centre = _c[0].weight / 2;
+  if (t < centre)
+    return _min + (_c[0].mean - _min) * t / centre;
+  for (uint8_t i = 0; i + 1 < _n; i++) {
+    float next = left + _c[i].weight + _c[i + 1].weight / 2;
+    if (t < next)
+      return _c[i].mean + (_c[i + 1].mean - _c[i].mean) * (t - centre) / (next - centre);
+    left += _c[i].weight;
+    centre = next;
+  }
+  if (total <= centre)
+    return _max;
+  return _c[_n - 1].mean + (_max - _c[_n - 1].mean) * (t - centre) / (total - centre);
+}
+
+float QuantileSketch::cdf(float value) {
+  flush();
+  if (_count == 0)
+    return NAN;
+  if (value < _min)
+    return 0;
+  if (value >= _max)
+    return 1;
+  float total = 0;
+  for (uint8_t i = 0; i < _n; i++)
+    total += _c[i].weight;
+
+  float x = _min;
+  float t = 0;
+  float left = 0;
+  for (uint8_t i = 0; i <= _n; i++) {
+    float nextX = i < _n ? _c[i].mean : _max;
+    float nextT = i < _n ? left + _c[i].weight / 2 : total;
+    if (value < nextX) {
+      if (nextX <= x)
+        return t / total;
+      return (t + (nextT - t) * (value - x) / (nextX - x)) / total;
+    }
+    if (i < _n)
+      left += _c[i].weight;
+    x = nextX;
+    t = nextT;
+  }
+  return 1;
+}
+
+//=============================================================================
+
+void QuantileSketch::save(quantile_channel* out) {
+  flush();
+  memset(out, 0, sizeof(*out));
+  out->min = _min;
+  out->max = _max;
+  out->count = _count;
+  out->centroids = _n;
+  for (uint8_t i = 0; i < _n; i++) {
+    out->means[i] = _c[i].mean;
+    out->weights[i] = _c[i].weight < 65535 ? (uint16_t)(_c[i].weight + 0.5f) : 65535;
+  }
+}
+
+bool QuantileSketch::load(const quantile_channel& in) {
+  clear();
+  if (in.centroids > QUANTILE_CENTROIDS || (in.count == 0) != (in.centroids == 0))
+    return false;
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < in.centroids; i++) {
+    if (in.weights[i] == 0 || (i && in.means[i] < in.means[i - 1]))
+      return false;
+    total += in.weights[i];
+    _c[i].mean = in.means[i];
+    _c[i].weight = in.weights[i];
+  }
+  if (total != in.count)
+    return false;
+  _n = in.centroids;
+  _count = in.count;
+  _min = in.min;
+  _max = in.max;
+  return true;
+}
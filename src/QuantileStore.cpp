@@ -0,0 +1,223 @@
+// Daily quantile sketches of the logged readings, one record per day on SD
+
+#include <Arduino.h>
+
+#include "QuantileStore.h"
+#include "DebugLog.h"
+#include "LogRecord.h"
+
+QuantileStore::QuantileStore(SdFat& sd, const char* path) : _sd(sd) {
+  _path = path;
+  _mutex = NULL;
+  _day = 0;
+  _dirty = false;
+  _savedMs = 0;
+  _saves = 0;
+  _errors = 0;
+}
+
+void QuantileStore::begin() {
+  if (_mutex == NULL)
+    _mutex = xSemaphoreCreateMutex();
+}
+
+//=============================================================================
+// file
+
+bool QuantileStore::readHeader(File& file, quantile_file_header* header) {
+  return file.seekSet(0) && file.read(header, sizeof(*header)) == (int)sizeof(*header) &&
+         header->magic == QUANTILE_MAGIC && header->version == QUANTILE_VERSION &&
+         header->recordSize == sizeof(quantile_day);
+}
+
+bool QuantileStore::readDay(File& file, const quantile_file_header& header, uint32_t day, quantile_day* out) {
+  if (day < header.firstDay)
+    return false;
+  uint32_t pos = sizeof(header) + (day - header.firstDay) * sizeof(quantile_day);
+  if (pos + sizeof(quantile_day) > file.fileSize())
+    return false;
+  return file.seekSet(pos) && file.read(out, sizeof(*out)) == (int)sizeof(*out) && out->day == day &&
+         out->crc == LogCrc32(out->channels, sizeof(out->channels));
+}
+
+bool QuantileStore::_save() {
+  quantile_day record;
+  memset(&record, 0, sizeof(record));
+  record.day = _day;
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  for (int c = 0; c < QUANTILE_CHANNELS; c++)
+    _sketch[c].save(&record.channels[c]);
+  xSemaphoreGive(_mutex);
+  record.crc = LogCrc32(record.channels, sizeof(record.channels));
+  _savedMs = millis();
+
+  File file = _sd.open(_path, O_RDWR | O_CREAT);
+  if (!file) {
+    debugLog.error("Quantiles: open of %s failed", _path);
+    _errors++;
+    return false;
+  }
+  quantile_file_header header;
+  if (file.fileSize() == 0) {
+    memset(&header, 0, sizeof(header));
+    header.magic = QUANTILE_MAGIC;
+    header.version = QUANTILE_VERSION;
+    header.recordSize = sizeof(quantile_day);
+    header.firstDay = _day;
+    if (file.write(&header, sizeof(header)) != (int)sizeof(header)) {
+      debugLog.error("Quantiles: header write failed");
+      file.close();
+      _errors++;
+      return false;
+    }
+  } else if (!readHeader(file, &header)) {
+    debugLog.error("Quantiles: %s is not a sketch file", _path);
+    file.close();
+    _errors++;
+    return false;
+  }
+
+  uint32_t records = (file.fileSize() - sizeof(header)) / sizeof(quantile_day);
+  if (_day < header.firstDay && header.firstDay - _day <= QUANTILE_MAX_GAP_DAYS) {
+    if (!_rebase(file, &header, records)) {
+      debugLog.error("Quantiles: rebase to day %u failed", _day);
+      file.close();
+      _errors++;
+      return false;
+    }
+    records = (file.fileSize() - sizeof(header)) / sizeof(quantile_day);
+  }
+  if (_day < header.firstDay || _day - header.firstDay > records + QUANTILE_MAX_GAP_DAYS) {
+    debugLog.warn("Quantiles: day %u outside the file, clock?", _day);
+    file.close();
+    _errors++;
+    return false;
+  }
+  uint32_t index = _day - header.firstDay;
+  bool ok = file.seekSet(sizeof(header) + records * sizeof(quantile_day));
+  // days without records in between, marked by day 0
+  if (ok && records < index) {
+    quantile_day empty;
+    memset(&empty, 0, sizeof(empty));
+    for (; ok && records < index; records++)
+      ok = file.write(&empty, sizeof(empty)) == (int)sizeof(empty);
+  }
+  ok = ok && file.seekSet(sizeof(header) + index * sizeof(quantile_day)) &&
+       file.write(&record, sizeof(record)) == (int)sizeof(record);
+  file.close();
+  if (!ok) {
+    debugLog.error("Quantiles: write of day %u failed", _day);
+    _errors++;
+    return false;
+  }
+  _dirty = false;
+  _saves++;
+  return true;
+}
+
+// makes _day the first day: records move up by the difference, the days
+// in front are zero filled. The header is written last, a reader before
+// that finds each day at its old place or not at all.
+bool QuantileStore::_rebase(File& file, quantile_file_header* header, uint32_t records) {
+  uint32_t shift = header->firstDay - _day;
+  debugLog.warn("Quantiles: day %u before the file's first day %u, moving %u records",
+                _day, header->firstDay, records);
+  quantile_day record;
+  memset(&record, 0, sizeof(record));
+  // a seek past the end fails, the file is extended first
+  bool ok = file.seekSet(sizeof(*header) + records * sizeof(record));
+  for (uint32_t i = 0; ok && i < shift; i++)
+    ok = file.write(&record, sizeof(record)) == (int)sizeof(record);
+  for (uint32_t i = records; ok && i-- > 0;) {
+    ok = file.seekSet(sizeof(*header) + i * sizeof(record)) &&
+         file.read(&record, sizeof(record)) == (int)sizeof(record) &&
+         file.seekSet(sizeof(*header) + (i + shift) * sizeof(record)) &&
+         file.write(&record, sizeof(record)) == (int)sizeof(record);
+  }
+  memset(&record, 0, sizeof(record));
+  for (uint32_t i = 0; ok && i < shift && i < records; i++) {
+    ok = file.seekSet(sizeof(*header) + i * sizeof(record)) &&
+         file.write(&record, sizeof(record)) == (int)sizeof(record);
+  }
+  if (!ok)
+    return false;
+  header->firstDay = _day;
+  return file.seekSet(0) && file.write(header, sizeof(*header)) == (int)sizeof(*header);
+}
+
+// continue a day written before a reboot
+void QuantileStore::_load(uint32_t day) {
+  quantile_file_header header;
+  quantile_day record;
+  File file = _sd.open(_path, O_READ);
+  bool found = file && readHeader(file, &header) && readDay(file, header, day, &record);
+  if (file)
+    file.close();
+  if (!found)
+    return;
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  for (int c = 0; c < QUANTILE_CHANNELS; c++) {
+    if (!_sketch[c].load(record.channels[c]))
+      _sketch[c].clear();
+  }
+  xSemaphoreGive(_mutex);
+  debugLog.info("Quantiles: day %u continued at %u records", day, _sketch[QUANTILE_TEMPERATURE].count());
+}
+
+//=============================================================================
+
+void QuantileStore::add(uint32_t time, float temperature, float humidity) {
+  uint32_t day = time / 86400;
+  if (day < QUANTILE_MIN_DAY)
+    return;
+  if (day != _day) {
+    // day close
+    if (_day && _dirty)
+      _save();
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    for (int c = 0; c < QUANTILE_CHANNELS; c++)
+      _sketch[c].clear();
+    _day = day;
+    xSemaphoreGive(_mutex);
+    _load(day);
+    _savedMs = millis();
+  }
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  _sketch[QUANTILE_TEMPERATURE].add(temperature);
+  _sketch[QUANTILE_HUMIDITY].add(humidity);
+  xSemaphoreGive(_mutex);
+  _dirty = true;
+  if (millis() - _savedMs >= QUANTILE_CHECKPOINT_MS)
+    _save();
+}
+
+bool QuantileStore::today(uint32_t day, QuantileSketch* out) {
+  if (_mutex == NULL)
+    return false;
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  bool running = day == _day;
+  if (running) {
+    for (int c = 0; c < QUANTILE_CHANNELS; c++)
+      out[c] = _sketch[c];
+  }
+  xSemaphoreGive(_mutex);
+  return running;
+}
+
+String QuantileStore::toJson() {
+  uint32_t day = 0;
+  uint32_t samples = 0;
+  if (_mutex != NULL) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    day = _day;
+    samples = _sketch[QUANTILE_TEMPERATURE].count();
+    xSemaphoreGive(_mutex);
+  }
+  String json = "{";
+  json += "\"day\":" + String(day);
+  json += ",\"samples\":" + String(samples);
+  json += ",\"saves\":" + String(_saves);
+  json += ",\"errors\":" + String(_errors);
+  json += "}";
+  return json;
+}
@@ -0,0 +1,207 @@
+// Short lived cache of the JSON bodies of polled API routes
+
+#include <Arduino.h>
+
+#include "ResponseCache.h"
+#include "DebugLog.h"
+
+ResponseCache responseCache;
+
+static const char* route_names[CACHE_ROUTE_COUNT] = {"state", "config"};
+static const size_t route_sizes[CACHE_ROUTE_COUNT] = {RESPONSE_CACHE_STATE_SIZE, RESPONSE_CACHE_CONFIG_SIZE};
+static const uint32_t route_ttls[CACHE_ROUTE_COUNT] = {RESPONSE_CACHE_STATE_TTL_MS, RESPONSE_CACHE_CONFIG_TTL_MS};
+
+ResponseCache::ResponseCache() {
+  _mux = portMUX_INITIALIZER_UNLOCKED;
+  for (int r = 0; r < CACHE_ROUTE_COUNT; r++) {
+    route& rt = _routes[r];
+    rt.name = route_names[r];
+    rt.size = route_sizes[r];
+    rt.ttlMs = route_ttls[r];
+    rt.generation = 0;
+    rt.current = -1;
+    for (int s = 0; s < RESPONSE_CACHE_SLOTS; s++) {
+      rt.slots[s].data = NULL;
+      rt.slots[s].size = 0;
+      rt.slots[s].len = 0;
+      rt.slots[s].generation = 0;
+      rt.slots[s].builtMs = 0;
+      rt.slots[s].refs = 0;
+    }
+  }
+  reset();
+}
+
+// before the web server starts, a slot left NULL is never used
+void ResponseCache::begin() {
+  for (int r = 0; r < CACHE_ROUTE_COUNT; r++) {
+    for (int s = 0; s < RESPONSE_CACHE_SLOTS; s++) {
+      cache_slot& slot = _routes[r].slots[s];
+      if (slot.data == NULL) {
+        slot.data = (char*)malloc(_routes[r].size);
+        slot.size = slot.data ? _routes[r].size : 0;
+      }
+      if (slot.data == NULL)
+        debugLog.error("Response cache: no memory for %s", _routes[r].name);
+    }
+  }
+}
+
+void ResponseCache::invalidate(cache_route r) {
+  portENTER_CRITICAL(&_mux);
+  _routes[r].generation++;
+  _routes[r].invalidations++;
+  portEXIT_CRITICAL(&_mux);
+}
+
+//=============================================================================
+
+AsyncWebServerResponse* ResponseCache::get(cache_route r) {
+  route& rt = _routes[r];
+  portENTER_CRITICAL(&_mux);
+  int8_t s = rt.current;
+  bool hit = s >= 0 && rt.slots[s].generation == rt.generation &&
+             millis() - rt.slots[s].builtMs < rt.ttlMs;
+  if (hit) {
+    rt.slots[s].refs++;
+    rt.hits++;
+  } else {
+    rt.misses++;
+  }
+  portEXIT_CRITICAL(&_mux);
+  return hit ? new CachedResponse(*this, r, s) : NULL;
+}
+
+AsyncWebServerResponse* ResponseCache::put(cache_route r, uint32_t generation, const String& body) {
+  route& rt = _routes[r];
+  size_t len = body.length();
+  int8_t s = -1;
+  portENTER_CRITICAL(&_mux);
+  if (len > rt.largest)
+    rt.largest = len;
+  if (generation == rt.generation) {
+    // the idle slot first, clients may still be reading the current one
+    for (int8_t i = 0; i < RESPONSE_CACHE_SLOTS && s < 0; i++) {
+      if (i != rt.current && rt.slots[i].data && rt.slots[i].refs == 0)
+        s = i;
+    }
+    if (s < 0 && rt.current >= 0 && rt.slots[rt.current].refs == 0)
+      s = rt.current;
+  }
+  if (s < 0) {
+    rt.uncached++;
+  } else {
+    // held by the writer, then by the response returned
+    rt.slots[s].refs = 1;
+    if (rt.current == s)
+      rt.current = -1;
+  }
+  portEXIT_CRITICAL(&_mux);
+  if (s < 0)
+    return new AsyncBasicResponse(200, "application/json", body);
+
+  // the slot is ours alone until current points to it
+  if (len > rt.slots[s].size) {
+    char* data = (char*)realloc(rt.slots[s].data, len + RESPONSE_CACHE_GROW_SLACK);
+    portENTER_CRITICAL(&_mux);
+    if (data != NULL) {
+      rt.slots[s].data = data;
+      rt.slots[s].size = len + RESPONSE_CACHE_GROW_SLACK;
+      rt.grown++;
+    } else {
+      rt.slots[s].refs = 0;
+      rt.overflows++;
+      rt.uncached++;
+    }
+    portEXIT_CRITICAL(&_mux);
+    if (data == NULL) {
+      debugLog.warn("Response cache: %u byte %s body does not fit", (unsigned)len, rt.name);
+      return new AsyncBasicResponse(200, "application/json", body);
+    }
+  }
+
+  memcpy(rt.slots[s].data, body.c_str(), len);
+  portENTER_CRITICAL(&_mux);
+  rt.slots[s].len = len;
+  rt.slots[s].generation = generation;
+  rt.slots[s].builtMs = millis();
+  rt.current = s;
+  portEXIT_CRITICAL(&_mux);
+  return new CachedResponse(*this, r, s);
+}
+
+void ResponseCache::release(cache_route r, uint8_t slot) {
+  portENTER_CRITICAL(&_mux);
+  _routes[r].slots[slot].refs--;
+  portEXIT_CRITICAL(&_mux);
+}
+
+//=============================================================================
+
+void ResponseCache::reset() {
+  portENTER_CRITICAL(&_mux);
+  for (int r = 0; r < CACHE_ROUTE_COUNT; r++) {
+    _routes[r].hits = 0;
+    _routes[r].misses = 0;
+    _routes[r].invalidations = 0;
+    _routes[r].uncached = 0;
+    _routes[r].grown = 0;
+    _routes[r].overflows = 0;
+    _routes[r].largest = 0;
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+String ResponseCache::toJson() {
+  String json = "{";
+  for (int r = 0; r < CACHE_ROUTE_COUNT; r++) {
+    const route& rt = _routes[r];
+    uint32_t requests = rt.hits + rt.misses;
+    size_t size = 0;
+    for (int s = 0; s < RESPONSE_CACHE_SLOTS; s++) {
+      if (rt.slots[s].size > size)
+        size = rt.slots[s].size;
+    }
+    if (r)
+      json += ",";
+    json += "\"" + String(rt.name) + "\":{";
+    json += "\"hits\":" + String(rt.hits);
+    json += ",\"misses\":" + String(rt.misses);
+    json += ",\"hitRate\":" + String(requests ? (float)rt.hits / requests : 0, 3);
+    json += ",\"invalidations\":" + String(rt.invalidations);
+    json += ",\"uncached\":" + String(rt.uncached);
+    json += ",\"size\":" + String((uint32_t)size);
+    json += ",\"largest\":" + String((uint32_t)rt.largest);
+    json += ",\"grown\":" + String(rt.grown);
+    json += ",\"overflows\":" + String(rt.overflows);
+    json += ",\"ttlMs\":" + String(rt.ttlMs);
+    json += "}";
+  }
+  json += "}";
+  return json;
+}
+
+//=============================================================================
+
+CachedResponse::CachedResponse(ResponseCache& cache, cache_route r, uint8_t slot)
+  : _cache(cache), _route(r), _slot(slot) {
+  _code = 200;
+  _contentType = "application/json";
+  _contentLength = cache.length(r, slot);
+  _sendContentLength = true;
+  _chunked = false;
+  _sent = 0;
+}
+
+CachedResponse::~CachedResponse() {
+  _cache.release(_route, _slot);
+}
+
+size_t CachedResponse::_fillBuffer(uint8_t *buf, size_t maxLen) {
+  size_t n = _contentLength - _sent;
+  if (n > maxLen)
+    n = maxLen;
+  memcpy(buf, _cache.data(_route, _slot) + _sent, n);
+  _sent += n;
+  return n;
+}
@@ -0,0 +1,113 @@
+// Retention policy for the logs directory
+
+#include <Arduino.h>
+
+#include "Retention.h"
+#include "DebugLog.h"
+
+Retention::Retention(SdFat& sd, LogStore& store, StorageStats& stats, const char* dir)
+  : _sd(sd), _store(store), _stats(stats), _dir(dir) {
+  _policy.maxAgeDays = 0;
+  _policy.maxMB = 0;
+  _policy.minFreeMB = 0;
+  _logBytes = 0;
+  _files = 0;
+  _reclaimed = 0;
+  _deleted = 0;
+  _violated = false;
+  _lastDeleted[0] = 0;
+}
+
+//=============================================================================
+
+bool Retention::enforce(uint32_t now) {
+  File logs = _sd.open(_dir, O_READ);
+  if (!logs)
+    return false;
+
+  // oldest by the period in the name, names of one period sort by part
+  FatFile file;
+  dir_t entry;
+  char filename[LOG_NAME_MAX];
+  char oldest[LOG_NAME_MAX] = "";
+  uint32_t oldestFirst = 0;
+  uint32_t oldestSize = 0;
+  uint32_t oldestWrite = 0;
+  uint64_t total = 0;
+  uint32_t files = 0;
+  while (file.openNext(&logs, O_READ)) {
+    file.getName(filename, sizeof(filename));
+    if (!file.isDir() && !IsLogMetaName(filename)) {
+      uint32_t size = _store.dataSize(filename, file.fileSize());
+      uint32_t first, last;
+      if (!LogFileSpan(filename, &first, &last))
+        first = 0;
+      total += size;
+      files++;
+      if (!_store.isActive(filename) && file.dirEntry(&entry) &&
+          (oldest[0] == 0 || first < oldestFirst || (first == oldestFirst && strcmp(filename, oldest) < 0))) {
+        strcpy(oldest, filename);
+        oldestFirst = first;
+        oldestSize = file.fileSize();
+        oldestWrite = LogMakeTime(FAT_YEAR(entry.lastWriteDate), FAT_MONTH(entry.lastWriteDate), FAT_DAY(entry.lastWriteDate),
+                                  FAT_HOUR(entry.lastWriteTime), FAT_MINUTE(entry.lastWriteTime), FAT_SECOND(entry.lastWriteTime));
+      }
+    }
+    file.close();
+  }
+  logs.close();
+  _logBytes = total;
+  _files = files;
+
+  bool tooOld = _policy.maxAgeDays && oldest[0] && now > oldestWrite && now - oldestWrite > _policy.maxAgeDays * 86400UL;
+  bool tooBig = _policy.maxMB && total > (uint64_t)_policy.maxMB << 20;
+  bool tooFull = _policy.minFreeMB && _stats.valid() && _stats.freeBytes() < (uint64_t)_policy.minFreeMB << 20;
+  _violated = tooOld || tooBig || tooFull;
+  if (!_violated || oldest[0] == 0)
+    return false;
+
+  char path[LOG_NAME_MAX + 10];
+  snprintf(path, sizeof(path), "%s/%s", _dir, oldest);
+  if (!_sd.remove(path)) {
+    debugLog.error("Retention: remove of %s failed", path);
+    return false;
+  }
+  _stats.fileRemoved(oldestSize);
+  _reclaimed += oldestSize;
+
+  // the sidecar goes with its log
+  char metaPath[LOG_NAME_MAX + 10];
+  if (LogMetaNameFor(metaPath, sizeof(metaPath), path)) {
+    File meta = _sd.open(metaPath, O_RDWR);
+    uint32_t size = meta ? meta.fileSize() : 0;
+    if (meta && meta.remove()) {
+      _stats.fileRemoved(size);
+      _reclaimed += size;
+    }
+  }
+  _deleted++;
+  _logBytes -= oldestSize;
+  _files--;
+  strcpy(_lastDeleted, oldest);
+  debugLog.info("Retention: removed %s (%u bytes, %s)", oldest, oldestSize,
+                tooOld ? "age" : tooBig ? "size" : "free space");
+  return true;
+}
+
+//=============================================================================
+
+String Retention::toJson() {
+  String json = "{";
+  json += "\"maxAgeDays\":" + String(_policy.maxAgeDays);
+  json += ",\"maxMB\":" + String(_policy.maxMB);
+  json += ",\"minFreeMB\":" + String(_policy.minFreeMB);
+  json += ",\"violated\":" + String(_violated ? "true" : "false");
+  json += ",\"files\":" + String(_files);
+  json += ",\"logBytes\":" + String((uint32_t)_logBytes);
+  json += ",\"freeKB\":" + String((uint32_t)(_stats.freeBytes() >> 10));
+  json += ",\"deleted\":" + String(_deleted);
+  json += ",\"reclaimedBytes\":" + String((uint32_t)_reclaimed);
+  json += ",\"lastDeleted\":\"" + String(_lastDeleted) + "\"";
+  json += "}";
+  return json;
+}
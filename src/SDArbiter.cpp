@@ -0,0 +1,142 @@
+// Serialises SD card access between loop() and the AsyncTCP task
+
+#include <Arduino.h>
+#include "esp_timer.h"
+
+#include "SDArbiter.h"
+
+SDArbiter sdArbiter;
+
+static const char* client_names[SD_CLIENT_COUNT] = {"writer", "reader"};
+
+//=============================================================================
+
+SDArbiter::SDArbiter() {
+  _mutex = NULL;
+  _writersWaiting = 0;
+  _mux = portMUX_INITIALIZER_UNLOCKED;
+  reset();
+}
+
+void SDArbiter::begin() {
+  if (_mutex == NULL)
+    _mutex = xSemaphoreCreateRecursiveMutex();
+}
+
+void SDArbiter::reset() {
+  portENTER_CRITICAL(&_mux);
+  for (int i = 0; i < SD_CLIENT_COUNT; i++) {
+    _wait[i].clear();
+    _hold[i].clear();
+    _contended[i] = 0;
+    _timeouts[i] = 0;
+  }
+  _yields = 0;
+  portEXIT_CRITICAL(&_mux);
+}
+
+//=============================================================================
+
+bool SDArbiter::acquire(sd_client client, uint32_t timeoutMs) {
+  // setup() runs before the web server, nothing to arbitrate yet
+  if (_mutex == NULL)
+    return true;
+
+  int64_t start = esp_timer_get_time();
+  bool contended = false;
+  bool yielded = false;
+  bool ok;
+
+  if (client == SD_WRITER) {
+    portENTER_CRITICAL(&_mux);
+    _writersWaiting++;
+    portEXIT_CRITICAL(&_mux);
+    ok = xSemaphoreTakeRecursive(_mutex, 0) == pdTRUE;
+    if (!ok) {
+      contended = true;
+      ok = xSemaphoreTakeRecursive(_mutex, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+    }
+    portENTER_CRITICAL(&_mux);
+    _writersWaiting--;
+    portEXIT_CRITICAL(&_mux);
+  } else {
+    // readers step aside while a writer is queued, the writer gets the
+    // lock as soon as the current chunk is done
+    int64_t deadline = start + (int64_t)timeoutMs * 1000;
+    for (;;) {
+      if (_writersWaiting) {
+        yielded = true;
+      } else if (xSemaphoreTakeRecursive(_mutex, 0) == pdTRUE) {
+        ok = true;
+        break;
+      }
+      contended = true;
+      if (esp_timer_get_time() >= deadline) {
+        ok = false;
+        break;
+      }
+      vTaskDelay(1);
+    }
+  }
+
+  uint32_t waited = esp_timer_get_time() - start;
+  portENTER_CRITICAL(&_mux);
+  _wait[client].add(waited);
+  if (contended) _contended[client]++;
+  if (!ok) _timeouts[client]++;
+  if (yielded) _yields++;
+  portEXIT_CRITICAL(&_mux);
+  return ok;
+}
+
+void SDArbiter::release(sd_client client, uint32_t heldUs) {
+  if (_mutex == NULL)
+    return;
+  portENTER_CRITICAL(&_mux);
+  _hold[client].add(heldUs);
+  portEXIT_CRITICAL(&_mux);
+  xSemaphoreGiveRecursive(_mutex);
+}
+
+//=============================================================================
+
+String SDArbiter::toJson() {
+  String json = "{";
+  for (int i = 0; i < SD_CLIENT_COUNT; i++) {
+    portENTER_CRITICAL(&_mux);
+    PerfStat wait = _wait[i];
+    PerfStat hold = _hold[i];
+    uint32_t contended = _contended[i];
+    uint32_t timeouts = _timeouts[i];
+    portEXIT_CRITICAL(&_mux);
+
+    if (i > 0)
+      json += ",";
+    json += "\"" + String(client_names[i]) + "\":{";
+    json += "\"locks\":" + String(wait.count);
+    json += ",\"contended\":" + String(contended);
+    json += ",\"timeouts\":" + String(timeouts);
+    json += ",\"waitAvgUs\":" + String(wait.avg());
+    json += ",\"waitP99Us\":" + String(wait.percentile(99));
+    json += ",\"waitMaxUs\":" + String(wait.max);
+    json += ",\"holdAvgUs\":" + String(hold.avg());
+    json += ",\"holdMaxUs\":" + String(hold.max);
+    json += "}";
+  }
+  json += ",\"readerYields\":" + String(_yields);
+  json += "}";
+  return json;
+}
+
+//=============================================================================
+
+SDLock::SDLock(sd_client client, uint32_t timeoutMs) {
+  _client = client;
+  _locked = sdArbiter.acquire(client, timeoutMs);
+  _start = esp_timer_get_time();
+}
+
+SDLock::~SDLock() {
+  if (_locked)
+    sdArbiter.release(_client, esp_timer_get_time() - _start);
+}
@@ -0,0 +1,91 @@
+// Mount the SD card once and keep track of its health
+
+#include <Arduino.h>
+
+#include "SDManager.h"
+#include "DebugLog.h"
+#include "PerfMonitor.h"
+
+SDManager::SDManager(SdFat& sd, uint8_t csPin, uint32_t spiSpeed) : _sd(sd) {
+  _csPin = csPin;
+  _spiSpeed = spiSpeed;
+  _state = SD_UNMOUNTED;
+  _errorRun = 0;
+  _errors = 0;
+  _mounts = 0;
+  _backoff = SD_BACKOFF_MIN;
+  _nextAttempt = 0;
+  _lastProbe = 0;
+  _serial = 0;
+}
+
+bool SDManager::_mount() {
+  bool mounted;
+  {
+    // what every request paid before the card was mounted once
+    PerfScope p(PERF_SD_MOUNT);
+    mounted = _sd.begin(_csPin, _spiSpeed);
+  }
+  if (!mounted) {
+    _state = SD_FAILED;
+    _nextAttempt = millis() + _backoff;
+    debugLog.warn("SD Card failed, or not present, retry in %u ms", _backoff);
+    _backoff = _backoff * 2 > SD_BACKOFF_MAX ? SD_BACKOFF_MAX : _backoff * 2;
+    return false;
+  }
+
+  cid_t cid;
+  _serial = _sd.card()->readCID(&cid) ? cid.psn : 0;
+  _state = SD_MOUNTED;
+  _errorRun = 0;
+  _backoff = SD_BACKOFF_MIN;
+  _lastProbe = millis();
+  _mounts++;
+  debugLog.info("SD card mounted, serial %08x", _serial);
+  return true;
+}
+
+bool SDManager::begin() {
+  return _mount();
+}
+
+//=============================================================================
+// returns true when the card was (re)mounted in this call
+
+bool SDManager::loop() {
+  uint32_t now = millis();
+
+  if (_state != SD_MOUNTED) {
+    if ((int32_t)(now - _nextAttempt) < 0)
+      return false;
+    return _mount();
+  }
+
+  if (now - _lastProbe < SD_PROBE_INTERVAL)
+    return false;
+  _lastProbe = now;
+
+  // a removed card stops answering, a reinserted one is back in idle state
+  // and needs the full init sequence; a swapped card has another serial
+  cid_t cid;
+  if (!_sd.card()->readCID(&cid)) {
+    debugLog.warn("SD card not responding");
+    _state = SD_FAILED;
+    _nextAttempt = now;
+    return false;
+  }
+  if (cid.psn != _serial) {
+    debugLog.info("SD card changed");
+    return _mount();
+  }
+  return false;
+}
+
+void SDManager::ioError(const char* what) {
+  _errors++;
+  debugLog.error("SD I/O error: %s", what);
+  if (++_errorRun >= SD_ERROR_LIMIT && _state == SD_MOUNTED) {
+    _state = SD_FAILED;
+    _nextAttempt = millis();
+  }
+}
@@ -0,0 +1,109 @@
+// Free space bookkeeping for the SD volume
+
+#include <Arduino.h>
+
+#include "StorageStats.h"
+#include "DebugLog.h"
+
+StorageStats::StorageStats(SdFat& sd) : _sd(sd) {
+  _valid = false;
+  _freeClusters = 0;
+  _clusterBytes = 512;
+  _clusterCount = 0;
+  _cardBytes = 0;
+  _fatType = 0;
+  _fatStart = 0;
+  _scanning = false;
+  _scanBlock = 0;
+  _scanBlocks = 0;
+  _scanFree = 0;
+  _lastScan = 0;
+  _scans = 0;
+}
+
+// geometry only, the free count follows from the background scan
+void StorageStats::mounted() {
+  _cardBytes = (uint64_t)_sd.card()->cardSize() * 512;
+  _clusterBytes = 512UL * _sd.vol()->blocksPerCluster();
+  _clusterCount = _sd.vol()->clusterCount();
+  _fatType = _sd.vol()->fatType();
+  _fatStart = _sd.vol()->fatStartBlock();
+  _valid = false;
+
+  _scanning = true;
+  _scanBlock = 0;
+  _scanFree = 0;
+  // entries 0 and 1 are reserved, clusters are numbered from 2
+  uint32_t entries = _clusterCount + 2;
+  _scanBlocks = _fatType == 32 ? (entries + 127) / 128 : (entries + 255) / 256;
+}
+
+void StorageStats::_finishScan(uint32_t free) {
+  _freeClusters = free;
+  _valid = true;
+  _scanning = false;
+  _lastScan = millis();
+  _scans++;
+}
+
+//=============================================================================
+// one low priority step of the free cluster scan, true while scanning
+
+bool StorageStats::scanStep() {
+  if (!_scanning) {
+    if (!scanDue())
+      return false;
+    _scanning = true;
+    _scanBlock = 0;
+    _scanFree = 0;
+  }
+
+  if (_fatType != 16 && _fatType != 32) {
+    // FAT12 only exists on tiny volumes, let SdFat count
+    int32_t free = _sd.vol()->freeClusterCount();
+    if (free >= 0)
+      _finishScan(free);
+    else
+      _scanning = false;
+    return false;
+  }
+
+  uint8_t block[512];
+  for (int i = 0; i < STORAGE_SCAN_BLOCKS && _scanBlock < _scanBlocks; i++, _scanBlock++) {
+    if (!_sd.card()->readBlock(_fatStart + _scanBlock, block)) {
+      _scanning = false;
+      return false;
+    }
+    uint32_t perBlock = _fatType == 32 ? 128 : 256;
+    uint32_t first = _scanBlock * perBlock;
+    for (uint32_t e = 0; e < perBlock; e++) {
+      uint32_t cluster = first + e;
+      if (cluster < 2 || cluster >= _clusterCount + 2)
+        continue;
+      uint32_t value;
+      if (_fatType == 32)
+        value = (block[4 * e] | block[4 * e + 1] << 8 | block[4 * e + 2] << 16 | (uint32_t)block[4 * e + 3] << 24) & 0x0FFFFFFF;
+      else
+        value = block[2 * e] | block[2 * e + 1] << 8;
+      if (value == 0)
+        _scanFree++;
+    }
+  }
+
+  if (_scanBlock >= _scanBlocks) {
+    // clusters allocated during the pass may be off by a few, the next
+    // daily scan settles them
+    _finishScan(_scanFree);
+    debugLog.info("SD free space scan: %u free clusters", _scanFree);
+    return false;
+  }
+  return true;
+}
+
+void StorageStats::fileResized(uint32_t oldSize, uint32_t newSize) {
+  if (!_valid)
+    return;
+  _freeClusters -= (int32_t)(_clusters(newSize) - _clusters(oldSize));
+  if (_freeClusters < 0)
+    _freeClusters = 0;
+}
@@ -0,0 +1,90 @@
+// Records appended since a cursor, for collectors that follow the log
+
+#include <Arduino.h>
+
+#include "SyncResponse.h"
+
+bool ParseSyncCursor(const char* cursor, char* name, size_t size, uint32_t* offset) {
+  const char* comma = strrchr(cursor, ',');
+  if (!comma || comma == cursor || (size_t)(comma - cursor) >= size)
+    return false;
+  size_t len = comma - cursor;
+  memcpy(name, cursor, len);
+  name[len] = 0;
+  // a base name of the log directory, nothing else can be reached
+  uint32_t first, last;
+  if (strchr(name, '/') || IsLogMetaName(name) || !LogFileSpan(name, &first, &last))
+    return false;
+  char* end;
+  unsigned long value = strtoul(comma + 1, &end, 10);
+  if (end == comma + 1 || *end != 0)
+    return false;
+  *offset = value;
+  return true;
+}
+
+size_t FormatSyncCursor(char* buf, size_t size, const char* name, uint32_t offset) {
+  const char* slash = strrchr(name, '/');
+  int n = snprintf(buf, size, "%s,%u", slash ? slash + 1 : name, offset);
+  return n > 0 && (size_t)n < size ? n : 0;
+}
+
+size_t FormatSyncTrailer(char* buf, size_t size, const char* cursor, uint32_t records, bool more, bool restarted) {
+  int n = snprintf(buf, size, "{\"cursor\":\"%s\",\"records\":%u,\"more\":%s,\"restarted\":%s}\n",
+                   cursor, records, more ? "true" : "false", restarted ? "true" : "false");
+  return n > 0 && (size_t)n < size ? n : 0;
+}
+
+//=============================================================================
+
+SyncResponse::SyncResponse(SdFat& sd, LogStore& store, const char* dir, const char* name, uint32_t offset, uint32_t max)
+  : ChunkedResponse(LogFormatContentType(LOG_FORMAT_NDJSON), PERF_HTTP_SYNC_FILL, SYNC_FILL_CHUNKS),
+    _reader(sd, store, dir, 0, 0xffffffff) {
+  _max = max;
+  _records = 0;
+  _state = SYNC_RECORDS;
+  _cursor[0] = 0;
+  if (name[0]) {
+    _reader.resumeAt(name, offset);
+    FormatSyncCursor(_cursor, sizeof(_cursor), name, offset);
+  }
+}
+
+// next record or the trailer, or a read that did not complete a record
+size_t SyncResponse::_step(uint8_t*, size_t) {
+  log_record rec;
+  switch (_state) {
+    case SYNC_RECORDS:
+      if (_records == _max) {
+        _state = SYNC_TRAILER;
+        break;
+      }
+      switch (_reader.next(&rec)) {
+        case LOG_RANGE_RECORD:
+          _emit(_out, FormatExportRecord(_out, sizeof(_out), LOG_FORMAT_NDJSON, rec));
+          _records++;
+          FormatSyncCursor(_cursor, sizeof(_cursor), _reader.fileName(), _reader.position());
+          break;
+        case LOG_RANGE_BUSY:
+          break;
+        case LOG_RANGE_END:
+          // the end of the last file, so the next poll does not read it again
+          if (_reader.fileName()[0])
+            FormatSyncCursor(_cursor, sizeof(_cursor), _reader.fileName(), _reader.position());
+          _state = SYNC_TRAILER;
+          break;
+      }
+      break;
+
+    case SYNC_TRAILER:
+      _emit(_out, FormatSyncTrailer((char*)_out, sizeof(_out), _cursor, _records, _records == _max, _reader.restarted()));
+      _state = SYNC_DONE;
+      _finish();
+      break;
+
+    case SYNC_DONE:
+      _finish();
+      break;
+  }
+  return 0;
+}
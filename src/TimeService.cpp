@@ -0,0 +1,284 @@
+// System clock disciplined by the DS3231 RTC and NTP
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#include "TimeService.h"
+#include "DebugLog.h"
+#include "LogRecord.h"
+
+#define DS3231_ADDRESS 0x68
+#define DS3231_SECONDS 0x00
+#define DS3231_AGING 0x10
+
+// first check shortly after boot, begin() only sets the clock to +-0.5s
+#define TIME_FIRST_CHECK 10000UL
+// no second edge within this time means the oscillator stopped
+#define TIME_EDGE_TIMEOUT 1500
+// the RTC is set when the system clock is within this far past a second
+#define TIME_ADJUST_WINDOW_US 20000
+#define TIME_ADJUST_TIMEOUT 3000
+// the system clock is stepped instead of slewed above this offset
+#define TIME_MAX_SLEW_MS 1000
+// larger drift estimates mean the reference was taken before an NTP step
+#define TIME_MAX_DRIFT_PPM 20.0f
+
+TimeService::TimeService(RTC_DS3231& rtc) : _rtc(rtc) {
+  _mux = portMUX_INITIALIZER_UNLOCKED;
+  _last.tv_sec = 0;
+  _last.tv_usec = 0;
+  _backSteps = 0;
+  _lastBackStepUs = 0;
+  _rtcOk = false;
+  _phase = TIME_IDLE;
+  _lastCheck = 0;
+  _edgeStart = 0;
+  _lastPoll = 0;
+  _edgeSecond = -1;
+  _pollSysMs = 0;
+  _haveRef = false;
+  _refSysMs = 0;
+  _refOffsetMs = 0;
+  _offsetMs = 0;
+  _driftPpm = 0;
+  _aging = 0;
+  _i2cReads = 0;
+  _rtcSets = 0;
+}
+
+int64_t TimeService::_sysMs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//=============================================================================
+// raw register access, RTClib has no aging support
+
+int TimeService::_readSeconds() {
+  _i2cReads++;
+  Wire.beginTransmission(DS3231_ADDRESS);
+  Wire.write(DS3231_SECONDS);
+  if (Wire.endTransmission() != 0 || Wire.requestFrom(DS3231_ADDRESS, 1) != 1)
+    return -1;
+  uint8_t bcd = Wire.read() & 0x7f;
+  return (bcd >> 4) * 10 + (bcd & 0x0f);
+}
+
+bool TimeService::_readAging(int8_t* aging) {
+  _i2cReads++;
+  Wire.beginTransmission(DS3231_ADDRESS);
+  Wire.write(DS3231_AGING);
+  if (Wire.endTransmission() != 0 || Wire.requestFrom(DS3231_ADDRESS, 1) != 1)
+    return false;
+  *aging = (int8_t)Wire.read();
+  return true;
+}
+
+bool TimeService::_writeAging(int8_t aging) {
+  Wire.beginTransmission(DS3231_ADDRESS);
+  Wire.write(DS3231_AGING);
+  Wire.write((uint8_t)aging);
+  return Wire.endTransmission() == 0;
+}
+
+//=============================================================================
+
+bool TimeService::begin() {
+  if (!_rtc.begin()) {
+    debugLog.error("RTC initialization failed");
+    _rtcOk = false;
+    return false;
+  }
+
+  _i2cReads++;
+  if (_rtc.lostPower()) {
+    debugLog.warn("RTC lost power, initializing with build time");
+    _rtc.adjust(DateTime(__DATE__, __TIME__));
+    _rtcOk = false;
+  } else {
+    _rtcOk = true;
+  }
+  _readAging(&_aging);
+
+  // the RTC has no sub-second register, start in the middle of the second
+  _i2cReads++;
+  struct timeval tv = {(time_t)_rtc.now().unixtime(), 500000};
+  settimeofday(&tv, NULL);
+  debugLog.info("SYS time adjusted");
+
+  _lastCheck = millis() - TIME_CHECK_INTERVAL + TIME_FIRST_CHECK;
+  return _rtcOk;
+}
+
+//=============================================================================
+
+void TimeService::loop(bool ntp) {
+  switch (_phase) {
+    case TIME_IDLE:
+      if (millis() - _lastCheck < TIME_CHECK_INTERVAL)
+        return;
+      _lastCheck = millis();
+      _i2cReads++;
+      if (_rtc.lostPower())
+        _rtcOk = false;
+      if (!_rtcOk) {
+        if (ntp) {
+          _edgeStart = millis();
+          _phase = TIME_WAIT_ADJUST;
+        }
+        return;
+      }
+      _edgeSecond = _readSeconds();
+      _pollSysMs = _sysMs();
+      _lastPoll = _edgeStart = millis();
+      _phase = TIME_WAIT_EDGE;
+      return;
+
+    case TIME_WAIT_EDGE: {
+      if (millis() - _lastPoll < TIME_EDGE_POLL_MS)
+        return;
+      if (millis() - _edgeStart > TIME_EDGE_TIMEOUT) {
+        debugLog.error("RTC not running");
+        _rtcOk = false;
+        _phase = TIME_IDLE;
+        return;
+      }
+      int second = _readSeconds();
+      int64_t sysMs = _sysMs();
+      _lastPoll = millis();
+      if (second >= 0 && _edgeSecond >= 0 && second != _edgeSecond) {
+        // the edge fell between the last two polls
+        int64_t edgeMs = (_pollSysMs + sysMs) / 2;
+        _i2cReads++;
+        _phase = TIME_IDLE;
+        _measured(edgeMs, _rtc.now().unixtime(), ntp);
+        return;
+      }
+      _edgeSecond = second;
+      _pollSysMs = sysMs;
+      return;
+    }
+
+    case TIME_WAIT_ADJUST: {
+      if (!ntp || millis() - _edgeStart > TIME_ADJUST_TIMEOUT) {
+        _phase = TIME_IDLE;
+        return;
+      }
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      if (tv.tv_usec >= TIME_ADJUST_WINDOW_US)
+        return;
+      // setting the RTC restarts its countdown chain, so the edge lines up with tv_sec
+      _rtc.adjust(DateTime((uint32_t)tv.tv_sec));
+      _rtcSets++;
+      _rtcOk = true;
+      _haveRef = false;
+      _phase = TIME_IDLE;
+      debugLog.info("RTC adjusted");
+      return;
+    }
+  }
+}
+
+// one RTC vs system clock comparison, rtcTime became valid at sysMs
+void TimeService::_measured(int64_t sysMs, uint32_t rtcTime, bool ntp) {
+  _offsetMs = (int64_t)rtcTime * 1000 - sysMs;
+
+  if (!ntp) {
+    // the RTC is the best reference, bring the system clock to it
+    _haveRef = false;
+    if (abs(_offsetMs) > TIME_MAX_SLEW_MS) {
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      int64_t us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec + (int64_t)_offsetMs * 1000;
+      tv.tv_sec = us / 1000000;
+      tv.tv_usec = us % 1000000;
+      settimeofday(&tv, NULL);
+      debugLog.info("SYS time adjusted");
+    } else if (_offsetMs != 0) {
+      struct timeval delta = {(time_t)(_offsetMs / 1000), (suseconds_t)(_offsetMs % 1000) * 1000};
+      adjtime(&delta, NULL);
+    }
+    return;
+  }
+
+  if (abs(_offsetMs) >= TIME_MAX_OFFSET_MS) {
+    _edgeStart = millis();
+    _phase = TIME_WAIT_ADJUST;
+    return;
+  }
+
+  if (!_haveRef) {
+    _haveRef = true;
+    _refSysMs = sysMs;
+    _refOffsetMs = _offsetMs;
+    return;
+  }
+  if (sysMs - _refSysMs < (int64_t)TIME_DRIFT_BASELINE * 1000)
+    return;
+
+  // positive drift: the RTC runs fast against NTP
+  float ppm = (float)(_offsetMs - _refOffsetMs) * 1e6f / (float)(sysMs - _refSysMs);
+  _refSysMs = sysMs;
+  _refOffsetMs = _offsetMs;
+  if (fabsf(ppm) > TIME_MAX_DRIFT_PPM)
+    return;
+  _driftPpm = ppm;
+
+  // half steps, a few ms of edge uncertainty must not make the register dither
+  int step = (int)lroundf(ppm / TIME_AGING_PPM / 2);
+  int aging = constrain(_aging + step, -127, 127);
+  if (aging != _aging && _writeAging(aging)) {
+    debugLog.info("RTC drift %.2fppm, aging %d -> %d", ppm, _aging, aging);
+    _aging = aging;
+  }
+}
+
+//=============================================================================
+// system time, never going back by less than TIME_MAX_BACKSTEP_US
+
+void TimeService::now(struct timeval* tv) {
+  gettimeofday(tv, NULL);
+  portENTER_CRITICAL(&_mux);
+  int64_t back = ((int64_t)_last.tv_sec - tv->tv_sec) * 1000000 + (_last.tv_usec - tv->tv_usec);
+  bool stepped = back >= TIME_MAX_BACKSTEP_US;
+  if (back > 0 && !stepped) {
+    *tv = _last;
+  } else {
+    _last = *tv;
+    if (stepped) {
+      _backSteps++;
+      _lastBackStepUs = back;
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+  if (stepped)
+    debugLog.warn("SYS time stepped back %lld ms", (long long)(back / 1000));
+}
+
+// "YYYY-MM-DD hh:mm:ss.mmm"
+size_t TimeService::format(char* buf, size_t size) {
+  struct timeval tv;
+  now(&tv);
+  size_t n = LogFormatTime(buf, size, tv.tv_sec);
+  if (n == 0 || n + 4 >= size)
+    return n;
+  n += snprintf(buf + n, size - n, ".%03u", (unsigned)(tv.tv_usec / 1000));
+  return n;
+}
+
+String TimeService::toJson() {
+  String json = "{";
+  json += "\"rtcOk\":" + String(_rtcOk ? "true" : "false");
+  json += ",\"offsetMs\":" + String(_offsetMs);
+  json += ",\"driftPpm\":" + String(_driftPpm, 2);
+  json += ",\"aging\":" + String(_aging);
+  json += ",\"rtcSets\":" + String(_rtcSets);
+  json += ",\"backSteps\":" + String(_backSteps);
+  json += ",\"lastBackStepMs\":" + String((int32_t)(_lastBackStepUs / 1000));
+  json += ",\"i2cReads\":" + String(_i2cReads);
+  json += ",\"lastCheckS\":" + String((millis() - _lastCheck) / 1000);
+  json += "}";
+  return json;
+}
@@ -0,0 +1,58 @@
+// Web pages embedded in flash at build time
+
+#include <Arduino.h>
+
+#include "WebAssets.h"
+#include "PerfMonitor.h"
+
+const web_asset* FindWebAsset(const char* path) {
+  if (strcmp(path, "/") == 0)
+    path = "/index.html";
+  size_t lo = 0;
+  size_t hi = web_asset_count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    int cmp = strcmp(web_assets[mid].path, path);
+    if (cmp == 0)
+      return &web_assets[mid];
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return NULL;
+}
+
+//=============================================================================
+
+bool WebAssetHandler::canHandle(AsyncWebServerRequest* request) {
+  return (request->method() == HTTP_GET || request->method() == HTTP_HEAD) &&
+         FindWebAsset(request->url().c_str()) != NULL;
+}
+
+void WebAssetHandler::handleRequest(AsyncWebServerRequest* request) {
+  PerfScope p(PERF_HTTP_ASSET);
+  const web_asset* asset = FindWebAsset(request->url().c_str());
+  if (asset == NULL) {
+    request->send(404);
+    return;
+  }
+  const char* cacheControl = strncmp(asset->path, "/src/", 5) == 0 ? "public, max-age=31536000" : "no-cache";
+
+  // may carry a list of tags or *
+  AsyncWebHeader* ifNoneMatch = request->getHeader("If-None-Match");
+  if (ifNoneMatch != NULL && (ifNoneMatch->value() == "*" || ifNoneMatch->value().indexOf(asset->etag) >= 0)) {
+    AsyncWebServerResponse* resp = request->beginResponse(304);
+    resp->addHeader("ETag", asset->etag);
+    resp->addHeader("Cache-Control", cacheControl);
+    request->send(resp);
+    return;
+  }
+
+  AsyncWebServerResponse* resp = request->beginResponse_P(200, asset->contentType, asset->data, asset->length);
+  if (asset->gzip)
+    resp->addHeader("Content-Encoding", "gzip");
+  resp->addHeader("ETag", asset->etag);
+  resp->addHeader("Cache-Control", cacheControl);
+  request->send(resp);
+}
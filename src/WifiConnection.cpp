@@ -0,0 +1,223 @@
+// Station connection manager: fast reconnect, backoff and outage metrics
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "WifiConnection.h"
+
+static const char* state_names[] = {"idle", "connecting", "connected", "waiting"};
+
+WifiConnection::WifiConnection(Preferences& prefs) : _prefs(prefs) {
+  _mux = portMUX_INITIALIZER_UNLOCKED;
+  _state = WIFI_CONN_IDLE;
+  _ssid[0] = 0;
+  _pass[0] = 0;
+  _eap = false;
+  _channel = 0;
+  _cached = false;
+  _learned = false;
+  _seenChannel = 0;
+  _failures = 0;
+  _fastFailures = 0;
+  _lastFast = false;
+  _attemptMs = 0;
+  _nextMs = 0;
+  _lostMs = 0;
+  _outage = false;
+  _lastReason = 0;
+  _attempts = 0;
+  _fastAttempts = 0;
+  _fastConnects = 0;
+  _connects = 0;
+  _reconnects = 0;
+  _lastConnectMs = 0;
+  _maxConnectMs = 0;
+  _sumConnectMs = 0;
+  _lastOutageMs = 0;
+  _maxOutageMs = 0;
+  _sumOutageMs = 0;
+}
+
+// the cache only applies to the SSID it was learned on
+void WifiConnection::_loadCache() {
+  _cached = _prefs.getString("lastSSID") == _ssid &&
+            _prefs.getBytes("lastBSSID", _bssid, sizeof(_bssid)) == sizeof(_bssid);
+  _channel = _prefs.getUInt("lastChannel", 0);
+  if (_channel < 1 || _channel > 14)
+    _cached = false;
+}
+
+void WifiConnection::begin(const char* ssid, const char* pass, bool eap) {
+  // reconnects are ours, and every WiFi.begin() would write the flash
+  WiFi.setAutoReconnect(false);
+  WiFi.persistent(false);
+
+  portENTER_CRITICAL(&_mux);
+  strlcpy(_ssid, ssid, sizeof(_ssid));
+  strlcpy(_pass, pass, sizeof(_pass));
+  _eap = eap;
+  _failures = 0;
+  _fastFailures = 0;
+  _state = _ssid[0] ? WIFI_CONN_CONNECTING : WIFI_CONN_IDLE;
+  portEXIT_CRITICAL(&_mux);
+
+  if (_state == WIFI_CONN_IDLE)
+    return;
+  _loadCache();
+  _connect();
+}
+
+void WifiConnection::stop() {
+  _state = WIFI_CONN_IDLE;
+}
+
+void WifiConnection::_connect() {
+  _attempts++;
+  _attemptMs = millis();
+  _lastFast = _cached && _fastFailures < WIFI_FAST_TRIES;
+  // EAP credentials are set on the supplicant, not passed here
+  const char* pass = _eap || _pass[0] == 0 ? NULL : _pass;
+  if (_lastFast) {
+    _fastAttempts++;
+    WiFi.begin(_ssid, pass, _channel, _bssid);
+  } else {
+    WiFi.begin(_ssid, pass);
+  }
+}
+
+// called with the state still CONNECTING or CONNECTED
+void WifiConnection::_failed(uint32_t now) {
+  if (_lastFast)
+    _fastFailures++;
+  if (_failures < 16)
+    _failures++;
+  uint32_t backoff = WIFI_BACKOFF_MIN_MS << (_failures - 1);
+  _nextMs = now + (backoff < WIFI_BACKOFF_MAX_MS ? backoff : WIFI_BACKOFF_MAX_MS);
+  _state = WIFI_CONN_WAITING;
+}
+
+void WifiConnection::loop() {
+  uint32_t now = millis();
+
+  if (_learned) {
+    _learned = false;
+    if (!_cached || _channel != _seenChannel || memcmp(_bssid, _seenBssid, sizeof(_bssid)) != 0) {
+      memcpy(_bssid, _seenBssid, sizeof(_bssid));
+      _channel = _seenChannel;
+      _cached = true;
+      _prefs.putString("lastSSID", _ssid);
+      _prefs.putBytes("lastBSSID", _bssid, sizeof(_bssid));
+      _prefs.putUInt("lastChannel", _channel);
+    }
+  }
+
+  bool attempt = false;
+  bool timeout = false;
+  portENTER_CRITICAL(&_mux);
+  if (_state == WIFI_CONN_CONNECTING && now - _attemptMs > WIFI_CONNECT_TIMEOUT_MS) {
+    _failed(now);
+    timeout = true;
+  } else if (_state == WIFI_CONN_WAITING && (int32_t)(now - _nextMs) >= 0) {
+    _state = WIFI_CONN_CONNECTING;
+    attempt = true;
+  }
+  portEXIT_CRITICAL(&_mux);
+
+  if (timeout)
+    WiFi.disconnect();
+  if (attempt)
+    _connect();
+}
+
+//=============================================================================
+
+void WifiConnection::onConnected(const uint8_t* bssid, uint8_t channel) {
+  memcpy(_seenBssid, bssid, sizeof(_seenBssid));
+  _seenChannel = channel;
+  _learned = true;
+}
+
+void WifiConnection::onDisconnected(uint8_t reason) {
+  uint32_t now = millis();
+  portENTER_CRITICAL(&_mux);
+  _lastReason = reason;
+  if (_state == WIFI_CONN_CONNECTED) {
+    // the link was up, retry at once with the cached access point
+    _outage = true;
+    _lostMs = now;
+    _failures = 0;
+    _fastFailures = 0;
+    _lastFast = false;
+    _failed(now);
+    _nextMs = now;
+  } else if (_state == WIFI_CONN_CONNECTING) {
+    _failed(now);
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+void WifiConnection::onGotIP() {
+  uint32_t now = millis();
+  portENTER_CRITICAL(&_mux);
+  if (_state != WIFI_CONN_IDLE) {
+    uint32_t connectMs = now - _attemptMs;
+    _connects++;
+    _lastConnectMs = connectMs;
+    _sumConnectMs += connectMs;
+    if (connectMs > _maxConnectMs)
+      _maxConnectMs = connectMs;
+    if (_lastFast)
+      _fastConnects++;
+    if (_outage) {
+      uint32_t outageMs = now - _lostMs;
+      _outage = false;
+      _reconnects++;
+      _lastOutageMs = outageMs;
+      _sumOutageMs += outageMs;
+      if (outageMs > _maxOutageMs)
+        _maxOutageMs = outageMs;
+    }
+    _failures = 0;
+    _fastFailures = 0;
+    _state = WIFI_CONN_CONNECTED;
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+//=============================================================================
+
+String WifiConnection::toJson() {
+  portENTER_CRITICAL(&_mux);
+  wifi_conn_state state = _state;
+  bool outage = _outage;
+  uint32_t outageMs = outage ? millis() - _lostMs : 0;
+  uint32_t nextMs = state == WIFI_CONN_WAITING ? _nextMs - millis() : 0;
+  portEXIT_CRITICAL(&_mux);
+
+  String json = "{";
+  json += "\"state\":\"" + String(state_names[state]) + "\"";
+  if (state == WIFI_CONN_CONNECTED) {
+    json += ",\"bssid\":\"" + WiFi.BSSIDstr() + "\"";
+    json += ",\"channel\":" + String(WiFi.channel());
+    json += ",\"rssi\":" + String(WiFi.RSSI());
+  }
+  json += ",\"cached\":" + String(_cached ? "true" : "false");
+  json += ",\"attempts\":" + String(_attempts);
+  json += ",\"fastAttempts\":" + String(_fastAttempts);
+  json += ",\"fastConnects\":" + String(_fastConnects);
+  json += ",\"connects\":" + String(_connects);
+  json += ",\"lastConnectMs\":" + String(_lastConnectMs);
+  json += ",\"avgConnectMs\":" + String(_connects ? (uint32_t)(_sumConnectMs / _connects) : 0);
+  json += ",\"maxConnectMs\":" + String(_maxConnectMs);
+  json += ",\"reconnects\":" + String(_reconnects);
+  json += ",\"lastOutageMs\":" + String(_lastOutageMs);
+  json += ",\"maxOutageMs\":" + String(_maxOutageMs);
+  json += ",\"totalOutageS\":" + String((uint32_t)(_sumOutageMs / 1000));
+  if (outage)
+    json += ",\"outageMs\":" + String(outageMs);
+  if (state == WIFI_CONN_WAITING)
+    json += ",\"retryInMs\":" + String((int32_t)nextMs > 0 ? nextMs : 0);
+  json += ",\"lastReason\":" + String(_lastReason);
+  json += "}";
+  return json;
+}
@@ -0,0 +1,160 @@
+// Rate limited background Wi-Fi scans behind a cache for /api/wifi
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "WifiScanner.h"
+#include "JsonString.h"
+
+WifiScanner::WifiScanner() {
+  _mux = portMUX_INITIALIZER_UNLOCKED;
+  _count = 0;
+  _demandMs = 0;
+  _demanded = false;
+  _scanning = false;
+  _startMs = 0;
+  _doneMs = 0;
+  _scans = 0;
+  _failed = 0;
+}
+
+void WifiScanner::demand() {
+  _demandMs = millis();
+  _demanded = true;
+}
+
+void WifiScanner::loop() {
+  uint32_t now = millis();
+  if (_scanning) {
+    int16_t found = WiFi.scanComplete();
+    if (found == WIFI_SCAN_RUNNING && now - _startMs < WIFI_SCAN_TIMEOUT_MS)
+      return;
+    _scanning = false;
+    _doneMs = now;
+    if (found >= 0) {
+      _merge(found, now);
+      _scans++;
+    } else {
+      _failed++;
+    }
+    WiFi.scanDelete();
+    return;
+  }
+
+  if (!_demanded)
+    return;
+  if (now - _demandMs > WIFI_SCAN_DEMAND_MS) {
+    _demanded = false;
+    return;
+  }
+  if (_scans + _failed && now - _doneMs < WIFI_SCAN_INTERVAL_MS)
+    return;
+  if (WiFi.scanNetworks(true, false, false, WIFI_SCAN_CHANNEL_MS) == WIFI_SCAN_FAILED) {
+    _failed++;
+    _doneMs = now;
+    return;
+  }
+  _scanning = true;
+  _startMs = now;
+}
+
+// the strongest access point of an SSID wins, networks not seen for
+// WIFI_SCAN_TTL_MS are dropped, the weakest give way when the cache is full
+void WifiScanner::_merge(int16_t found, uint32_t now) {
+  wifi_network networks[WIFI_SCAN_MAX];
+  portENTER_CRITICAL(&_mux);
+  uint8_t count = _count;
+  memcpy(networks, _networks, sizeof(wifi_network) * count);
+  portEXIT_CRITICAL(&_mux);
+
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (now - networks[i].seenMs <= WIFI_SCAN_TTL_MS) {
+      networks[kept++] = networks[i];
+    }
+  }
+  count = kept;
+
+  for (int16_t i = 0; i < found; i++) {
+    String ssid = WiFi.SSID(i);
+    if (ssid.length() == 0)
+      continue;
+    int8_t rssi = WiFi.RSSI(i);
+    uint8_t j = 0;
+    while (j < count && strcmp(networks[j].ssid, ssid.c_str()) != 0)
+      j++;
+    if (j == count) {
+      if (count < WIFI_SCAN_MAX) {
+        count++;
+      } else {
+        uint8_t weakest = 0;
+        for (uint8_t k = 1; k < count; k++) {
+          if (networks[k].rssi < networks[weakest].rssi)
+            weakest = k;
+        }
+        if (networks[weakest].rssi >= rssi)
+          continue;
+        j = weakest;
+      }
+      strlcpy(networks[j].ssid, ssid.c_str(), sizeof(networks[j].ssid));
+      networks[j].seenMs = now - 1;
+    }
+    wifi_network& n = networks[j];
+    // the first sighting in this scan replaces the cached values
+    bool firstSighting = n.seenMs != now;
+    if (firstSighting || rssi > n.rssi) {
+      memcpy(n.bssid, WiFi.BSSID(i), sizeof(n.bssid));
+      n.rssi = rssi;
+      n.channel = WiFi.channel(i);
+      n.secure = WiFi.encryptionType(i);
+    }
+    n.aps = firstSighting ? 1 : n.aps + 1;
+    n.seenMs = now;
+  }
+
+  portENTER_CRITICAL(&_mux);
+  memcpy(_networks, networks, sizeof(wifi_network) * count);
+  _count = count;
+  portEXIT_CRITICAL(&_mux);
+}
+
+//=============================================================================
+
+String WifiScanner::toJson() {
+  wifi_network networks[WIFI_SCAN_MAX];
+  portENTER_CRITICAL(&_mux);
+  uint8_t count = _count;
+  memcpy(networks, _networks, sizeof(wifi_network) * count);
+  portEXIT_CRITICAL(&_mux);
+
+  uint32_t now = millis();
+  String json = "{";
+  json += "\"age\":" + String(_scans ? (int32_t)((now - _doneMs) / 1000) : -1);
+  json += ",\"scanning\":" + String(_scanning ? "true" : "false");
+  json += ",\"scans\":" + String(_scans);
+  json += ",\"failed\":" + String(_failed);
+  json += ",\"networks\":[";
+  bool first = true;
+  char bssid[18];
+  for (uint8_t i = 0; i < count; i++) {
+    const wifi_network& n = networks[i];
+    if (now - n.seenMs > WIFI_SCAN_TTL_MS)
+      continue;
+    if (!first)
+      json += ",";
+    first = false;
+    snprintf(bssid, sizeof(bssid), "%02X:%02X:%02X:%02X:%02X:%02X", n.bssid[0], n.bssid[1], n.bssid[2], n.bssid[3], n.bssid[4], n.bssid[5]);
+    json += "{";
+    // SSIDs are up to 32 arbitrary bytes
+    json += "\"ssid\":" + JsonString(n.ssid);
+    json += ",\"rssi\":" + String(n.rssi);
+    json += ",\"bssid\":\"" + String(bssid) + "\"";
+    json += ",\"channel\":" + String(n.channel);
+    json += ",\"secure\":" + String(n.secure);
+    json += ",\"aps\":" + String(n.aps);
+    json += ",\"age\":" + String((now - n.seenMs) / 1000);
+    json += "}";
+  }
+  json += "]}";
+  return json;
+}
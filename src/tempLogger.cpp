@@ -5,21 +5,36 @@
   Persistent logs on SD Card
   Logs use RTC time
 */
+// APP_* flags, which of the optional subsystems are built
+#include "AppConfig.h"
+
+#if APP_EAP
 #include "esp_wpa2.h"
+#endif
+#if APP_NETWORK
 #include <WiFi.h>
+#endif
+#if APP_CAPTIVE_DNS
 #include <DNSServer.h>
+#endif
 #include "RTClib.h"
 
 #include <sys/time.h>
+#if APP_NETWORK
 #include <WiFiUdp.h>
 #include "lwip/apps/sntp.h"
+#endif
 
+#if APP_MDNS
 #include <ESPmDNS.h>
+#endif
 
 
+#if APP_BUTTON
 #include "Button2.h"
 #define BUTTON_PIN  2
 Button2 button = Button2(BUTTON_PIN);
+#endif
 
 #include <Preferences.h>
 Preferences preferences;
@@ -27,8 +42,10 @@ Preferences preferences;
 // OLED
 #include <SPI.h>
 #include <Wire.h>
+#if APP_DISPLAY
 #include <Adafruit_GFX.h>
 #include "Adafruit_SSD1306.h"
+#endif
 
 #include <SimpleTimer.h>
 
@@ -37,24 +54,67 @@ Preferences preferences;
 //#include "sdios.h"
 
 #define FS_NO_GLOBALS
+#if APP_EAP
 #include "SPIFFS.h"
+#endif
 
+#if APP_WEB
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include "AsyncSDFileResponse.h"
+#include "LogFileResponse.h"
+#include "ChartResponse.h"
+#include "LogExportResponse.h"
+#include "LogArchiveResponse.h"
+#include "SyncResponse.h"
+#include "QuantileResponse.h"
+#include "ResponseCache.h"
+#include "WebAssets.h"
+#include "WifiScanner.h"
+#include "JsonString.h"
+#endif
+#include "LogStore.h"
+#include "QuantileStore.h"
+#include "SDManager.h"
+#include "SDArbiter.h"
+#include "StorageStats.h"
+#include "Retention.h"
+#include "TimeService.h"
+#include "PerfMonitor.h"
+#include "DebugLog.h"
+#include "DeadlineTimer.h"
+#include "BootProfile.h"
+#include "AlertRules.h"
+#include "AlertNotifier.h"
+#if APP_NETWORK
+#include "WifiConnection.h"
+#endif
 
 
 RTC_DS3231 RTC;
+TimeService timeService(RTC);
 
-const char* LogFileName = "/logs/%04ld-%02d_hmd.csv";
 
 // SD Reader
 const int SD_CS = 5;
 #define SPI_SPEED SD_SCK_MHZ(16)
 SdFat sd;
+SDManager sdManager(sd, SD_CS, SPI_SPEED);
+LogStore logStore(sd, "/logs");
+QuantileStore quantileStore(sd, "/quantiles.dat");
+StorageStats storageStats(sd);
+Retention retention(sd, logStore, storageStats, "/logs");
 
+#if APP_CAPTIVE_DNS
 DNSServer dnsServer;
+#endif
+#if APP_WEB
 AsyncWebServer server(80);
+WifiScanner wifiScanner;
+#endif
+#if APP_NETWORK
+WifiConnection wifiConnection(preferences);
+#endif
 
 // Temerature / humidity sensor
 #include <dhtnew.h>
@@ -62,14 +122,40 @@ AsyncWebServer server(80);
 #define DHTTYPE 22   // DHT 22  (AM2302)
 DHTNEW dht(DHTPIN);
 
+#if APP_DISPLAY
 // OLED
 Adafruit_SSD1306 display(128, 64, &Wire, -1);
+#endif
 
 
-SimpleTimer tempTimer;
-SimpleTimer tempLogTimer;
-SimpleTimer dispTimer;
-SimpleTimer dispTempTimer;
+DeadlineTimer tempTimer;
+DeadlineTimer tempLogTimer;
+DeadlineTimer dispTimer;
+DeadlineTimer dispTempTimer;
+SimpleTimer perfDumpTimer;
+SimpleTimer retentionTimer;
+bool retentionPending = false;
+// storage settings changed, the policies are swapped in loop() under the writer lock
+bool storagePending = false;
+AlertEngine alerts;
+#if APP_NETWORK
+AlertNotifier alertNotifier;
+#endif
+// rules changed, compiled from loop() where they are evaluated
+bool alertsPending = true;
+// the first valid reading is logged at once, not on the next full interval
+bool bootRecordPending = true;
+// set by NetStartTask once the web server and DNS are up
+volatile bool netReady = false;
+// AP settings changed, Wi-Fi is restarted from loop() next to wifiConnection.loop()
+volatile bool wifiRestartPending = false;
+#define NET_START_STACK 8192
+
+#define TEMP_LOG_INTERVAL 60000
+// sensor read grid, the supersample slots fall on it so they get a fresh reading
+#define DISP_TEMP_INTERVAL 2500
+#define DISP_INTERVAL 200
+#define RETENTION_INTERVAL 600000
 
 //Web security
 const char* www_username = "admin";
@@ -92,7 +178,12 @@ const int screen_dim_time = 60;
 bool screen_dimmed = false;
 bool screen_saver = false;
 
+// samples per log interval, taken in the middle of equal slots
 #define LOG_SUPERSAMPLE 4
+#define LOG_SLOT (TEMP_LOG_INTERVAL / LOG_SUPERSAMPLE)
+#if (LOG_SLOT / 2) % DISP_TEMP_INTERVAL != 0 || LOG_SLOT % DISP_TEMP_INTERVAL != 0
+#error "supersample slots must fall on the DISP_TEMP_INTERVAL grid"
+#endif
 struct th_log_item {
   float temperature;
   float humidity;
@@ -108,35 +199,67 @@ module_status rtcState = MODULE_UNK;
 module_status dhtState = MODULE_UNK;
 module_status wifiState = MODULE_UNK;
 
-void InitRTC();
-int setUnixtime(time_t unixtime);
 void dateTime(uint16_t* date, uint16_t* time);
+#if APP_DISPLAY
 void PrintSysInfo();
+#endif
+#if APP_BUTTON
 void ButtonTap(Button2& btn);
+#endif
+#if APP_NETWORK
 void WiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info);
 void WiFiLostIP(WiFiEvent_t event, WiFiEventInfo_t info);
+void WiFiStaConnected(WiFiEvent_t event, WiFiEventInfo_t info);
+void WiFiStaDisconnected(WiFiEvent_t event, WiFiEventInfo_t info);
+#endif
 char* GetSysTimeString();
 char* GetTimeString();
+#if APP_WEB
 void onGetLogs(AsyncWebServerRequest * request);
 void onApiLogsGet(AsyncWebServerRequest * request);
+void onApiChart(AsyncWebServerRequest * request);
+void onApiExport(AsyncWebServerRequest * request);
+void onGetLogsArchive(AsyncWebServerRequest * request);
+void onApiSync(AsyncWebServerRequest * request);
+void onApiQuantiles(AsyncWebServerRequest * request);
+bool GetFormatParam(AsyncWebServerRequest * request, log_format* format);
+uint32_t GetTimeParam(AsyncWebServerRequest * request, const char* name, uint32_t def);
 void onApiWifi(AsyncWebServerRequest * request);
 void onApiState(AsyncWebServerRequest * request);
+void onApiPerf(AsyncWebServerRequest * request);
+void onApiDebugLog(AsyncWebServerRequest * request);
+void onApiConfig(AsyncWebServerRequest * request);
 void notFound(AsyncWebServerRequest * request);
 void onSet_WifiPost(AsyncWebServerRequest * request);
 void onSet_Wifi_ApPost(AsyncWebServerRequest * request);
 void onSet_SettingsPost(AsyncWebServerRequest * request);
-String indexProc(const String& var);
+void StartWWW();
+bool StateChanged();
+#endif
 String GetTemperature();
 String GetHumidity();
-String GetButtonStyle(module_status s);
 float GetAvgTemperature ();
 float GetAvgHumidity ();
+#if APP_DISPLAY
 void ScreenSaver(bool on);
 void DisplayReadings();
+#endif
+#if APP_NETWORK
 void StartWifi();
+void NetStartTask(void* arg);
+#endif
+bool NtpSynced();
 bool IsValidReading(float reading);
-String MakeLogsTable();
-void StartWWW();
+void OnSDMounted();
+void LoadRetentionPolicy();
+void LoadRotationPolicy();
+void WriteBootRecord();
+void RefreshTemp();
+void AddTempHumidToArray();
+void WriteReadingsToSD();
+void LoadAlertRules();
+void EvaluateAlerts();
+String AlertsToJson();
 
 void InitLogArray() {
   for (int i = 0; i < LOG_SUPERSAMPLE; i++) {
@@ -150,97 +273,135 @@ void InitLogArray() {
 
 void setup() {
   Serial.begin(115200);
+  debugLog.begin(Serial);
+  bootProfile.begin();
+  perf.begin();
+  sdArbiter.begin();
+  quantileStore.begin();
   preferences.begin("dht-app", false);
+#if APP_NETWORK
+  alertNotifier.begin();
+#endif
+  LoadAlertRules();
+  bootProfile.mark(BOOT_SETUP);
 
-  if (!SPIFFS.begin()) {
-    Serial.println("An Error has occurred while mounting SPIFFS");
-    return;
-  }
-
-  if(!RTC.begin()) {
-    Serial.println("RTC initialization failed");
-    rtcState = MODULE_ERR;
-  } else {
-    rtcState = MODULE_OK;
-  }
-
+#if APP_NETWORK
+  // Wi-Fi takes seconds to associate, bring it up next to the logger
+  xTaskCreatePinnedToCore(NetStartTask, "netStart", NET_START_STACK, NULL, 1, NULL, 0);
+#endif
+  bootProfile.mark(BOOT_NET_TASK);
 
+  rtcState = timeService.begin() ? MODULE_OK : MODULE_ERR;
+  bootProfile.mark(BOOT_RTC);
 
   for (int i = 0; i < LOG_SUPERSAMPLE; i++) {
     th_log_array[i].temperature = NAN;
     th_log_array[i].humidity = NAN;
   }
+  // may fail right after power up, dispTempTimer retries
+  RefreshTemp();
+  bootProfile.mark(BOOT_SENSOR);
 
-  if(rtcState == MODULE_OK) {
-    if (RTC.lostPower()) {
-      Serial.println("RTC lost power, initializing with build time");
-      rtcState = MODULE_ERR;
-      InitRTC();
-      setUnixtime(RTC.now().unixtime());
-    } else {
-      setUnixtime(RTC.now().unixtime());
+  SdFile::dateTimeCallback(dateTime);
+  logStore.setStats(&storageStats);
+  LoadRetentionPolicy();
+  LoadRotationPolicy();
+
+  debugLog.info("Initializing SD card...");
+  // see if the card is present and can be initialized:
+  {
+    // the web server may already be up
+    SDLock lock(SD_WRITER, SD_WRITE_WAIT_MS);
+    if (!sdManager.begin()) {
+      sdState = MODULE_ERR;
+    }
+    else  {
+      OnSDMounted();
     }
   }
+  bootProfile.mark(BOOT_SD);
+
+  // records on full intervals, samples at (k + 0.5) * LOG_SLOT before them
+  tempLogTimer.setInterval(TEMP_LOG_INTERVAL);
+  tempTimer.setInterval(LOG_SLOT, LOG_SLOT / 2);
+  dispTempTimer.setInterval(DISP_TEMP_INTERVAL);
+  dispTimer.setInterval(DISP_INTERVAL);
+  if (PERF_DUMP_INTERVAL > 0)
+    perfDumpTimer.setInterval(PERF_DUMP_INTERVAL);
+  retentionTimer.setInterval(RETENTION_INTERVAL);
+#if APP_BUTTON
+  button.setTapHandler(ButtonTap);
+#endif
+  WriteBootRecord();
+  bootProfile.mark(BOOT_TIMERS);
 
+#if APP_DISPLAY
   if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C)) {
-    Serial.println(F("OLED SSD1306 allocation failed"));
+    debugLog.error("OLED SSD1306 allocation failed");
   }
 
   display.clearDisplay();
   display.display();
-  Serial.println(F("OLED SSD1306 initialized"));
+  debugLog.info("OLED SSD1306 initialized");
+  PrintSysInfo();
+#endif
+  bootProfile.mark(BOOT_DISPLAY);
+
+  time(&last_action_time);
+  boot_time = last_action_time;
+  screen = 0;
+  bootProfile.mark(BOOT_SETUP_DONE);
+}
+
+#if APP_NETWORK
+//=============================================================================
+// Wi-Fi, the web server and (from WiFiGotIP) mDNS, started next to setup()
+void NetStartTask(void* arg) {
+#if APP_EAP
+  // only holds the EAP root certificate, the pages are in flash
+  if (!SPIFFS.begin()) {
+    debugLog.error("An Error has occurred while mounting SPIFFS");
+  }
+#endif
 
   WiFi.onEvent(WiFiGotIP, WiFiEvent_t::SYSTEM_EVENT_STA_GOT_IP);
   WiFi.onEvent(WiFiLostIP, WiFiEvent_t::SYSTEM_EVENT_STA_LOST_IP);
+  WiFi.onEvent(WiFiStaConnected, WiFiEvent_t::SYSTEM_EVENT_STA_CONNECTED);
+  WiFi.onEvent(WiFiStaDisconnected, WiFiEvent_t::SYSTEM_EVENT_STA_DISCONNECTED);
 
   StartWifi();
+  bootProfile.mark(BOOT_WIFI);
+#if APP_WEB
   StartWWW();
-
-  Serial.print("Initializing SD card...");
-  // see if the card is present and can be initialized:
-  if (!sd.begin(SD_CS, SPI_SPEED)) {
-    Serial.println("Card failed, or not present");
-    sdState = MODULE_ERR;
-  }
-  else  {
-    sdState = MODULE_OK;
-    Serial.println("SD card initialized.");
-  }
-
-  SdFile::dateTimeCallback(dateTime);
-
-  PrintSysInfo();
-
-
-  tempLogTimer.setInterval(60000);
-  tempTimer.setInterval(60000 / (LOG_SUPERSAMPLE - 1));
-  dispTempTimer.setInterval(3000);
-  dispTimer.setInterval(200);
-  button.setTapHandler(ButtonTap);
-
-  time(&last_action_time);
-  boot_time = last_action_time;
-  th_log_idx = 0;
-  screen = 0;
+#endif
+  bootProfile.mark(BOOT_WWW);
+  netReady = true;
+  vTaskDelete(NULL);
 }
 
 //=============================================================================
 
 void StartWifi(){
+  wifiConnection.stop();
+#if APP_CAPTIVE_DNS
   dnsServer.stop();
+#endif
   WiFi.disconnect();
-  Serial.println("Initializing Wifi...");
+  debugLog.info("Initializing Wifi...");
 
   if(preferences.getBool("apEnabled", true)){
     WiFi.mode(WIFI_AP_STA);
-    Serial.printf("Creating Accesspoint SSID %s, Channel %d\n",preferences.getString("apSSID","HTLogger").c_str(), preferences.getInt("apChannel",7));
+    debugLog.info("Creating Accesspoint SSID %s, Channel %d",preferences.getString("apSSID","HTLogger").c_str(), preferences.getInt("apChannel",7));
     WiFi.softAP(preferences.getString("apSSID","HTLogger").c_str(),preferences.getString("apSSIDpass","#qawsedrf").c_str(),preferences.getInt("apChannel",7),0,4);
+#if APP_CAPTIVE_DNS
     dnsServer.start(53, "htlogger.local", WiFi.softAPIP());
+#endif
   }
   else {
     WiFi.mode(WIFI_STA);
   }
 
+#if APP_EAP
   if(preferences.getBool("useEAP", false)){
     esp_wifi_sta_wpa2_ent_set_identity((uint8_t *)preferences.getString("eapIdentity").c_str(), preferences.getString("eapIdentity").length());
     esp_wifi_sta_wpa2_ent_set_username((uint8_t *)preferences.getString("eapAnIdentity").c_str(), preferences.getString("eapAnIdentity").length());
@@ -252,40 +413,36 @@ void StartWifi(){
       {
         int cerBufLen = cer.readBytes(cerBuf, cer.size()+1);
         if(esp_wifi_sta_wpa2_ent_set_ca_cert((unsigned char*)cerBuf, cerBufLen) != ESP_OK){
-          Serial.println("ERROR esp_wifi_sta_wpa2_ent_set_ca_cert");
+          debugLog.error("ERROR esp_wifi_sta_wpa2_ent_set_ca_cert");
         }
         free(cerBuf);
       }
       else {
-        Serial.printf("malloc for CER buffer for %d bytes failed", cer.size());
+        debugLog.error("malloc for CER buffer for %d bytes failed", (int)cer.size());
       }
       cer.close();
     }
     esp_wpa2_config_t config = WPA2_CONFIG_INIT_DEFAULT();
     if (esp_wifi_sta_wpa2_ent_enable(&config) != ESP_OK) {
-      Serial.println("WPA2 Settings Not OK");
+      debugLog.error("WPA2 Settings Not OK");
     }    
+    wifiConnection.begin(preferences.getString("clientSSID").c_str(), "", true);
   }
-  else {
+  else
+#endif
+  {
     String ssid = preferences.getString("clientSSID");
     String password = preferences.getString("clientSSIDpass");
 
     if(ssid.length() != 0 && password.length() !=0){
-      WiFi.begin(ssid.c_str(), password.c_str());
+      wifiConnection.begin(ssid.c_str(), password.c_str(), false);
     }
     else {
-      Serial.println("Wifi client not configured.");
+      debugLog.warn("Wifi client not configured.");
     }
   }
 }
-
-//=============================================================================
-int setUnixtime(time_t unixtime) {
-  timeval epoch = {unixtime, 0};
-  Serial.println("SYS time adjusted");
-  return settimeofday((const timeval*)&epoch, 0);
-}
-//=============================================================================
+#endif
 
 //=============================================================================
 time_t getUnixtime() {
@@ -310,6 +467,7 @@ void dateTime(uint16_t* date, uint16_t* time)
 }
 //=============================================================================
 
+#if APP_NETWORK
 void SetupNTP(){
   char ntpPool[25];
 
@@ -322,29 +480,25 @@ void SetupNTP(){
 
   configTime(0, 0, ntpPool);
 }
+#endif
 
-//=============================================================================
-
-void SyncRTC(){
-  if(wifiState == MODULE_OK && rtcState == MODULE_OK){
-    time_t s_now;
-    time(&s_now);
-    time_t r_now = RTC.now().unixtime();
-    if(abs(r_now-s_now)>30){
-      RTC.adjust(DateTime(s_now));
-      Serial.println("RTC adjusted");
-    }
+// an SNTP reply set the system clock within the last 8 polls; an IP alone
+// says nothing about the clock, and the RTC must not follow an unset one
+bool NtpSynced() {
+#if APP_NETWORK
+  if (wifiState != MODULE_OK || !sntp_enabled())
+    return false;
+  for (uint8_t i = 0; i < SNTP_MAX_SERVERS; i++) {
+    if (sntp_getreachability(i))
+      return true;
   }
+#endif
+  return false;
 }
 
 //=============================================================================
 
-void InitRTC() {
-  DateTime init = DateTime(__DATE__, __TIME__);
-  RTC.adjust(init);
-}
-
-//=============================================================================
+#if APP_WEB
 
 void StartWWW(){
     //  server.on("/", []() {
@@ -355,77 +509,158 @@ void StartWWW(){
   //    server.send(200, "text/plain", "Login OK");
   //  });
 
-  server.serveStatic("/src", SPIFFS, "/src/").setCacheControl("public, max-age=31536000");
-  server.serveStatic("/", SPIFFS, "/").setDefaultFile("index.html").setTemplateProcessor(indexProc);
+  responseCache.begin();
+  server.addHandler(new WebAssetHandler());
+
+  // before the /logs/<name> pattern, which would take it as a file name
+  server.on("/logs/archive", HTTP_GET, [] (AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_ARCHIVE);
+    onGetLogsArchive(request);
+  });
 
   // Send a GET request to <IP>/sensor/<number>
   server.on("^\\/logs\\/(.+)$", HTTP_GET, [] (AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_LOGS);
     onGetLogs(request);
   });
 
   server.on("/api/logs", HTTP_GET,  [] (AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_API_LOGS);
     onApiLogsGet(request);
   });
 
-  //First request will return 0 results unless you start scan from somewhere else (loop/setup)
-  //Do not request more often than 3-5 seconds
+  server.on("/api/chart", HTTP_GET,  [] (AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_CHART);
+    onApiChart(request);
+  });
+
+  server.on("/api/sync", HTTP_GET,  [] (AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_SYNC);
+    onApiSync(request);
+  });
+
+  server.on("/api/quantiles", HTTP_GET,  [] (AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_QUANTILES);
+    onApiQuantiles(request);
+  });
+
+  server.on("/api/export", HTTP_GET,  [] (AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_EXPORT);
+    onApiExport(request);
+  });
+
   server.on("/api/wifi", HTTP_GET, [](AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_WIFI);
     onApiWifi(request);
   });
 
   server.on("/set_wifi", HTTP_POST,  [](AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_SET);
     onSet_WifiPost(request);
   });
 
   server.on("/set_wifi_ap", HTTP_POST,  [](AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_SET);
     onSet_Wifi_ApPost(request);
   });
 
 
   server.on("/set_settings", HTTP_POST,  [](AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_SET);
     onSet_SettingsPost(request);
   });
 
 
   server.on("/api/state", HTTP_GET, [](AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_STATE);
     onApiState(request);
   });
 
+  server.on("/api/perf", HTTP_GET, [](AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_PERF);
+    onApiPerf(request);
+  });
+
+  server.on("/api/debuglog", HTTP_GET, [](AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_DEBUG_LOG);
+    onApiDebugLog(request);
+  });
+
+  server.on("/api/config", HTTP_GET, [](AsyncWebServerRequest * request) {
+    PerfScope p(PERF_HTTP_CONFIG);
+    onApiConfig(request);
+  });
+
   server.onNotFound(notFound);
 
   server.begin();
-  Serial.print("Open http://");
-  Serial.print(WiFi.localIP());
-  Serial.println("/ in your browser to see it working");
+  debugLog.info("Open http://%s/ in your browser to see it working", WiFi.localIP().toString().c_str());
 
 }
+#endif
 
+#if APP_NETWORK
 //=============================================================================
 // on wifi connected
 void WiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info) {
-  Serial.print("WiFi connected, IP address: ");
-  Serial.println(IPAddress(info.got_ip.ip_info.ip.addr));
+  bootProfile.mark(BOOT_GOT_IP);
+  wifiConnection.onGotIP();
+  debugLog.info("WiFi connected, IP address: %s", IPAddress(info.got_ip.ip_info.ip.addr).toString().c_str());
 
   SetupNTP();
 
-  Serial.printf("Local Time: %s\n", GetSysTimeString());
-  Serial.printf("RTC Time: %s\n", GetTimeString());
+  debugLog.info("Local Time: %s", GetSysTimeString());
+  debugLog.info("Log Time: %s", GetTimeString());
 
+#if APP_MDNS
   if (!MDNS.begin("htlogger")) {
-    Serial.println("Error setting up MDNS responder!");
+    debugLog.error("Error setting up MDNS responder!");
   } else {
-    Serial.println("mDNS responder started");
+    debugLog.info("mDNS responder started");
     // Add service to MDNS-SD
     MDNS.addService("http", "tcp", 80);
   }
+#endif
 
   wifiState = MODULE_OK;
 }
+#endif
+
+#if APP_WEB
+//=============================================================================
+// readings and module states /api/state was last built from
+struct state_snapshot {
+  float temperature;
+  float humidity;
+  module_status sd;
+  module_status rtc;
+  module_status dht;
+  module_status wifi;
+};
+state_snapshot shownState;
+
+// a new reading or module state since the last call; compared bytewise, so
+// a NaN reading that stays NaN is no change
+bool StateChanged() {
+  state_snapshot now;
+  memset(&now, 0, sizeof(now));
+  now.temperature = temperature;
+  now.humidity = humidity;
+  now.sd = sdState;
+  now.rtc = rtcState;
+  now.dht = dhtState;
+  now.wifi = wifiState;
+  if (memcmp(&now, &shownState, sizeof(now)) == 0)
+    return false;
+  shownState = now;
+  return true;
+}
+#endif
 
 //=============================================================================
+// the card is mounted once by sdManager, this is only a flag check
 bool startSD() {
-  if (!sd.begin(SD_CS, SPI_SPEED)) {
-    Serial.println("SD Card failed, or not present");
+  if (!sdManager.mounted()) {
     sdState = MODULE_ERR;
     return false;
   }
@@ -433,38 +668,75 @@ bool startSD() {
 }
 
 //=============================================================================
-
-String MakeLogsTable(){
-  if (!startSD()){    
-    return String("<div class=\"alert alert-danger\" role=\"alert\">SD card not present!</div>");
+// called after every (re)mount, the card may have been swapped
+void OnSDMounted() {
+  sdState = MODULE_OK;
+  storageStats.mounted();
+  if (!sd.exists("/logs")) {
+    sd.mkdir("/logs");
   }
+  logStore.recover(time(NULL));
+  logStore.closeStale();
+  retentionPending = true;
+}
 
-    File logs = sd.open("/logs", O_READ);
-  FatFile file;
-  dir_t entry;
+//=============================================================================
 
-  String table = "<table class=\"table table-bordered table-condensed table-striped table-hover\"><thead><tr><th scope=\"col\">#</th><th scope=\"col\">Name</th><th scope=\"col\">Size [kB]</th><th scope=\"col\">Time</th></tr></thead><tbody>";
-  char filename[50];
-  char filetime[50];
-  int idx = 1;
-  while (file.openNext(&logs, O_READ))
-  {
-    file.getName(filename, 50);
-    if (!file.dirEntry(&entry)) {
-      Serial.println("file.dirEntry failed");
-    }
+// unsigned settings of the storage form; the policies, /api/config and the
+// form handler all read them with these defaults
+struct uint_setting {
+  const char* key;
+  uint32_t def;
+  uint32_t max;
+};
+enum storage_setting {SET_RET_MAX_AGE, SET_RET_MAX_MB, SET_RET_MIN_FREE_MB, SET_LOG_ROTATE, SET_LOG_MAX_KB, STORAGE_SETTING_COUNT};
+const uint_setting storage_settings[STORAGE_SETTING_COUNT] = {
+  {"retMaxAge", 0, 36500},
+  {"retMaxMB", 0, 4194304},
+  {"retMinFreeMB", 64, 4194304},
+  {"logRotate", LOG_ROTATE_MONTHLY, LOG_ROTATE_HOURLY},
+  {"logMaxKB", 0, 4194303},   // bytes must fit 32 bits
+};
 
-    sprintf(filetime, "%04d-%02d-%02d %02d:%02d:%02d", FAT_YEAR(entry.lastWriteDate), FAT_MONTH(entry.lastWriteDate), FAT_DAY(entry.lastWriteDate), FAT_HOUR(entry.lastWriteDate), FAT_MINUTE(entry.lastWriteDate), FAT_SECOND(entry.lastWriteDate));
-    table += "<tr class=\"table-row\" data-href=\"logs/"+String(filename)+"\"><th scope=\"row\">"+String(idx++)+"</th><td>"+String(filename)+"</td><td>"+String(file.fileSize()/1024)+"</td><td>"+String(filetime)+"</td></tr>";
-    file.close();
+uint32_t GetStorageSetting(storage_setting i) {
+  return preferences.getUInt(storage_settings[i].key, storage_settings[i].def);
+}
+
+// digits only, at most the setting's max; false leaves the stored value
+bool SetStorageSetting(storage_setting i, const String& value) {
+  const char* text = value.c_str();
+  char* end;
+  unsigned long v = strtoul(text, &end, 10);
+  if (!isdigit((unsigned char)text[0]) || *end != 0 || v > storage_settings[i].max)
+    return false;
+  if (GetStorageSetting(i) != v) {
+    preferences.putUInt(storage_settings[i].key, v);
+    debugLog.info("Updated %s", storage_settings[i].key);
   }
-  logs.close();
-  table += "</tbody></table>";
-  return table;
+  return true;
+}
+
+void LoadRetentionPolicy() {
+  retention_policy policy;
+  policy.maxAgeDays = GetStorageSetting(SET_RET_MAX_AGE);
+  policy.maxMB = GetStorageSetting(SET_RET_MAX_MB);
+  policy.minFreeMB = GetStorageSetting(SET_RET_MIN_FREE_MB);
+  retention.setPolicy(policy);
+}
+
+// a file per month, day or hour, optionally split into parts of logMaxKB
+void LoadRotationPolicy() {
+  log_rotation_policy rotation;
+  rotation.period = (log_rotation)constrain(GetStorageSetting(SET_LOG_ROTATE), LOG_ROTATE_MONTHLY, LOG_ROTATE_HOURLY);
+  rotation.maxBytes = GetStorageSetting(SET_LOG_MAX_KB) * 1024;
+  logStore.setRotation(rotation);
+  // a full period of records, rounded up to clusters by SdFat
+  logStore.setPreallocSize(LogRotationSeconds(rotation.period) / (TEMP_LOG_INTERVAL / 1000) * LOG_RECORD_AVG_LEN + strlen(LOG_RECORD_HEADER));
 }
 
 //=============================================================================
 
+#if APP_WEB
 void onGetLogs(AsyncWebServerRequest * request) {
   if (!startSD()){
     request->send(500);
@@ -476,41 +748,45 @@ void onGetLogs(AsyncWebServerRequest * request) {
   char path[50];
   request->pathArg(0).toCharArray(path, 50);
   snprintf(filename, 50, "/logs/%s", path);
-  Serial.printf("get log %s\n", filename);
-  if (!sd.exists(filename)) {
-    Serial.printf("%s not found\n", filename);
-    request->send(404);
+  debugLog.verbose("get log %s", filename);
+
+  log_format format = LOG_FORMAT_CSV;
+  if (!GetFormatParam(request, &format)) {
+    request->send(400);
     return;
   }
 
-  AsyncSDFileResponse* resp = new AsyncSDFileResponse(sd, String(filename), String(), true);
+  // the lock is released before send(), which already fills the first chunk
+  AsyncWebServerResponse* resp = NULL;
+  {
+    SDLock lock(SD_READER, SD_HANDLER_WAIT_MS);
+    if (!lock.locked()) {
+      request->send(503);
+      return;
+    }
+    if (!sd.exists(filename)) {
+      debugLog.warn("%s not found", filename);
+      request->send(404);
+      return;
+    }
+
+    if (String(filename).endsWith(".csv") && format != LOG_FORMAT_CSV) {
+      resp = new LogExportResponse(sd, logStore, "/logs", filename, format);
+    } else if (String(filename).endsWith(".csv")) {
+      resp = new LogFileResponse(sd, logStore, String(filename));
+    } else {
+      resp = new AsyncSDFileResponse(sd, String(filename), String(), true);
+    }
+  }
   request->send(resp);
 }
 
 //=============================================================================
 
+// answered from the cache, the scans run from loop() while this is polled
 void onApiWifi(AsyncWebServerRequest * request) {
-  String json = "[";
-  int n = WiFi.scanComplete();
-  if (n == -2) {
-    WiFi.scanNetworks(true);
-  } else if (n) {
-    for (int i = 0; i < n; ++i) {
-      if (i) json += ",";
-      json += "{";
-      json += "\"rssi\":" + String(WiFi.RSSI(i));
-      json += ",\"ssid\":\"" + WiFi.SSID(i) + "\"";
-      json += ",\"bssid\":\"" + WiFi.BSSIDstr(i) + "\"";
-      json += ",\"channel\":" + String(WiFi.channel(i));
-      json += ",\"secure\":" + String(WiFi.encryptionType(i));
-      json += "}";
-    }
-    WiFi.scanDelete();
-    if (WiFi.scanComplete() == -2) {
-      WiFi.scanNetworks(true);
-    }
-  }
-  json += "]";
+  wifiScanner.demand();
+  String json = wifiScanner.toJson();
   request->send(200, "application/json", json);
   json = String();
 }
@@ -520,7 +796,7 @@ void onApiWifi(AsyncWebServerRequest * request) {
 void UpdateStringPreference(const char* key, const String value){
   if(preferences.getString(key) != value){
     preferences.putString(key, value);
-    Serial.printf("Updated %s\n",key);
+    debugLog.info("Updated %s",key);
   }
 }
 
@@ -534,7 +810,7 @@ void onSet_WifiPost(AsyncWebServerRequest * request) {
     }
   } else
   {
-    Serial.println("useEAP not found");
+    debugLog.warn("useEAP not found");
   }
 
   AsyncWebParameter* clientSSID = request->getParam("clientSSID", true);
@@ -554,32 +830,40 @@ void onSet_WifiPost(AsyncWebServerRequest * request) {
   if(identity!=NULL){
     UpdateStringPreference("eapIdentity", identity->value());
   }
+#if APP_EAP
   AsyncWebParameter* rootCA = request->getParam("rootCA", true, true);
   if(rootCA != NULL && rootCA->size() > 100){
     fs::File certFile = SPIFFS.open("rootCA.cer", "w");
     certFile.write((uint8_t*)rootCA->value().c_str(), rootCA->size());
-    Serial.println("EAP rootCA.cer updated");
+    debugLog.info("EAP rootCA.cer updated");
   }
+#endif
 
+  responseCache.invalidate(CACHE_CONFIG);
   request->redirect("/wifi.html?message=Saved");
 }
 
 //=============================================================================
 
 void onSet_Wifi_ApPost(AsyncWebServerRequest * request) {
+  // checked before anything is stored, the AP restarts with these settings
+  AsyncWebParameter* apChannel = request->getParam("apChannel", true);
+  long channel = apChannel != NULL ? apChannel->value().toInt() : 0;
+  if(apChannel != NULL && (channel < 1 || channel > 13)){
+    request->send(400);
+    return;
+  }
+
   AsyncWebParameter* apEnabled = request->getParam("apEnabled", true);
   if(apEnabled != NULL) {
     if(preferences.getBool("apEnabled") != ( apEnabled->value() == "on")){
       preferences.putBool("apEnabled", apEnabled->value() == "on");
     }
   } else  {
-    Serial.println("apEnabled not found");
+    debugLog.warn("apEnabled not found");
   }
 
-  AsyncWebParameter* apChannel = request->getParam("apChannel", true);
   if(apChannel!=NULL){
-    int channel;
-    scanf("%i", &channel);
     if(preferences.getInt("apChannel",7)!=channel){
       preferences.putInt("apChannel", channel);
     }
@@ -593,7 +877,8 @@ void onSet_Wifi_ApPost(AsyncWebServerRequest * request) {
     UpdateStringPreference("apSSIDpass", apSSIDpass->value());
   }
 
-  StartWifi();
+  responseCache.invalidate(CACHE_CONFIG);
+  wifiRestartPending = true;
   request->redirect("/wifi_ap.html?message=Saved");
 }
 
@@ -603,9 +888,37 @@ void onSet_SettingsPost(AsyncWebServerRequest * request) {
     UpdateStringPreference("NTP_POOL", ntpPool->value());
     SetupNTP();
   } else {
-    Serial.println("ntpPool not found");
+    debugLog.warn("ntpPool not found");
   }
 
+  bool storageOk = true;
+  for (int i = 0; i < STORAGE_SETTING_COUNT; i++) {
+    AsyncWebParameter* p = request->getParam(storage_settings[i].key, true);
+    if (p != NULL && !SetStorageSetting((storage_setting)i, p->value())) {
+      debugLog.warn("Invalid %s: %s", storage_settings[i].key, p->value().c_str());
+      storageOk = false;
+    }
+  }
+  storagePending = true;
+
+  // rules that do not compile are not stored
+  bool alertRulesOk = true;
+  AsyncWebParameter* alertRules = request->getParam("alertRules", true);
+  if (alertRules != NULL) {
+    alert_rule rules[ALERT_MAX_RULES];
+    uint8_t count;
+    size_t errorAt;
+    alertRulesOk = alertRules->value().length() <= ALERT_RULES_MAX_LEN &&
+                   ParseAlertRules(alertRules->value().c_str(), rules, ALERT_MAX_RULES, &count, &errorAt);
+    if (alertRulesOk)
+      UpdateStringPreference("alertRules", alertRules->value());
+  }
+  AsyncWebParameter* alertUrl = request->getParam("alertUrl", true);
+  if (alertUrl != NULL && alertUrl->value().length() < ALERT_URL_MAX_LEN) {
+    UpdateStringPreference("alertUrl", alertUrl->value());
+  }
+  alertsPending = true;
+
   AsyncWebParameter* devLogin = request->getParam("devLogin", true);
   if(devLogin != NULL){
     UpdateStringPreference("devLogin", devLogin->value());
@@ -616,10 +929,19 @@ void onSet_SettingsPost(AsyncWebServerRequest * request) {
     UpdateStringPreference("devPass", devPass->value());
   }
 
-  request->redirect("/settings.html?message=Saved");
+  responseCache.invalidate(CACHE_CONFIG);
+  request->redirect(!storageOk ? "/settings.html?message=Invalid+storage+settings" :
+                    alertRulesOk ? "/settings.html?message=Saved" : "/settings.html?message=Invalid+alert+rules");
 }
 
+// every poll within a sensor period gets the same bytes, see StateChanged()
 void onApiState(AsyncWebServerRequest * request) {
+  AsyncWebServerResponse* cached = responseCache.get(CACHE_STATE);
+  if (cached != NULL) {
+    request->send(cached);
+    return;
+  }
+  uint32_t generation = responseCache.generation(CACHE_STATE);
   String json = "{";
   json += "\"temperature\":\"" + GetTemperature() + "\"";
   json += ",\"humidity\":\"" + GetHumidity() + "\"";
@@ -627,181 +949,308 @@ void onApiState(AsyncWebServerRequest * request) {
   json += ",\"rtcState\":" + String(rtcState);
   json += ",\"dhtState\":" + String(dhtState);
   json += ",\"wifiState\":" + String(wifiState);
+  json += ",\"wifi\":" + wifiConnection.toJson();
   json += ",\"freeHeap\":" + String(ESP.getFreeHeap());
+  json += ",\"sdCardMB\":" + String((uint32_t)(storageStats.cardBytes() >> 20));
+  if (storageStats.valid())
+    json += ",\"sdFreeMB\":" + String((uint32_t)(storageStats.freeBytes() >> 20));
+  json += ",\"sdMounts\":" + String(sdManager.mounts());
+  json += ",\"sdErrors\":" + String(sdManager.errors());
+  json += ",\"corruptRecords\":" + String(logStore.corruptRecords());
+  json += ",\"recoveredBytes\":" + String(logStore.recoveredBytes());
+  json += ",\"logFile\":\"" + String(logStore.activeName()) + "\"";
+  json += ",\"retention\":" + retention.toJson();
+  json += ",\"sdLock\":" + sdArbiter.toJson();
+  json += ",\"time\":" + timeService.toJson();
+  json += ",\"boot\":" + bootProfile.toJson();
+  json += ",\"alerts\":" + AlertsToJson();
+  json += ",\"quantiles\":" + quantileStore.toJson();
   json += "}";
+  request->send(responseCache.put(CACHE_STATE, generation, json));
+  json = String();
+}
+
+void onApiPerf(AsyncWebServerRequest * request) {
+  if (request->hasParam("reset")) {
+    perf.reset();
+    sdArbiter.reset();
+    responseCache.reset();
+  }
+  // hit rates of the cached routes next to the stage timings
+  String json = perf.toJson(",\"responseCache\":" + responseCache.toJson());
   request->send(200, "application/json", json);
   json = String();
 }
 
+// /api/debuglog?since=&level=, the kept lines from since on; level changes what is kept
+void onApiDebugLog(AsyncWebServerRequest * request) {
+  if (request->hasParam("level")) {
+    debug_level level;
+    if (!DebugLog::parseLevel(request->getParam("level")->value().c_str(), &level)) {
+      request->send(400);
+      return;
+    }
+    debugLog.setLevel(level);
+  }
+  uint32_t since = 0;
+  if (request->hasParam("since"))
+    since = strtoul(request->getParam("since")->value().c_str(), NULL, 10);
+  String json = debugLog.toJson(since);
+  request->send(200, "application/json", json);
+  json = String();
+}
+
+// values shown by the settings forms, the pages are static
+void onApiConfig(AsyncWebServerRequest * request) {
+  AsyncWebServerResponse* cached = responseCache.get(CACHE_CONFIG);
+  if (cached != NULL) {
+    request->send(cached);
+    return;
+  }
+  uint32_t generation = responseCache.generation(CACHE_CONFIG);
+  String json = "{";
+  json += "\"ntpPool\":" + JsonString(preferences.getString("NTP_POOL"));
+  for (int i = 0; i < STORAGE_SETTING_COUNT; i++)
+    json += ",\"" + String(storage_settings[i].key) + "\":" + String(GetStorageSetting((storage_setting)i));
+  json += ",\"devLogin\":" + JsonString(preferences.getString("devLogin"));
+  json += ",\"useEap\":" + String(preferences.getBool("useEap") ? "true" : "false");
+  json += ",\"clientSSID\":" + JsonString(preferences.getString("clientSSID"));
+  json += ",\"eapAnonymousIdentity\":" + JsonString(preferences.getString("eapAnIdentity"));
+  json += ",\"eapIdentity\":" + JsonString(preferences.getString("eapIdentity"));
+  json += ",\"apEnabled\":" + String(preferences.getBool("apEnabled", true) ? "true" : "false");
+  json += ",\"apSSID\":" + JsonString(preferences.getString("apSSID", "HTLogger"));
+  json += ",\"apChannel\":" + String(preferences.getInt("apChannel", 7));
+  json += ",\"alertRules\":" + JsonString(preferences.getString("alertRules"));
+  json += ",\"alertUrl\":" + JsonString(preferences.getString("alertUrl"));
+  json += "}";
+  request->send(responseCache.put(CACHE_CONFIG, generation, json));
+  json = String();
+}
+
 void onApiLogsGet (AsyncWebServerRequest * request) {
-  if (!startSD())
+  if (!startSD()) {
+    request->send(503);
     return;
+  }
 
-  File logs = sd.open("/logs", O_READ);
-  FatFile file;
-  dir_t entry;
+  // optional ?from=&to= picks files by their metadata, without opening them
+  uint32_t from = GetTimeParam(request, "from", 0);
+  uint32_t to = GetTimeParam(request, "to", 0xffffffff);
 
-  String json = "[";
-  char filename[50];
-  char filetime[50];
-  bool first = true;
-  while (file.openNext(&logs, O_READ))
+  String json;
   {
-    if (first) {
-      first = false;
-    } else {
-      json += ",";
+    SDLock lock(SD_READER, SD_HANDLER_WAIT_MS);
+    if (!lock.locked()) {
+      request->send(503);
+      return;
     }
+    json = logStore.listJson(from, to);
+  }
+  request->send(200, "application/json", json);
+  json = String();
+}
 
-    file.getName(filename, 50);
-    if (!file.dirEntry(&entry)) {
-      Serial.println("file.dirEntry failed");
-    }
+//=============================================================================
+// unix time or "YYYY-MM-DD hh:mm:ss"
+uint32_t GetTimeParam(AsyncWebServerRequest * request, const char* name, uint32_t def) {
+  AsyncWebParameter* param = request->getParam(name);
+  if (param == NULL)
+    return def;
+  uint32_t t;
+  const String& value = param->value();
+  if (LogParseTime(value.c_str(), value.length(), &t))
+    return t;
+  return strtoul(value.c_str(), NULL, 10);
+}
 
-    sprintf(filetime, "%04d-%02d-%02d %02d:%02d:%02d", FAT_YEAR(entry.lastWriteDate), FAT_MONTH(entry.lastWriteDate), FAT_DAY(entry.lastWriteDate), FAT_HOUR(entry.lastWriteDate), FAT_MINUTE(entry.lastWriteDate), FAT_SECOND(entry.lastWriteDate));
-    json += "{";
-    json += "\"name\":\"" + String(filename) + "\"";
-    json += ",\"date\":\"" + String(filetime) + "\"";
-    json += ",\"size\":" + String(file.fileSize());
-    json += "}";
+// ?format=csv|ndjson|cbor, false if unknown
+bool GetFormatParam(AsyncWebServerRequest * request, log_format* format) {
+  AsyncWebParameter* param = request->getParam("format");
+  return param == NULL || ParseLogFormat(param->value().c_str(), format);
+}
 
-    file.close();
+// /api/chart?from=&to=&points=N, defaults to the last 24 hours
+void onApiChart(AsyncWebServerRequest * request) {
+  if (!startSD()) {
+    request->send(503);
+    return;
   }
-  logs.close();
-  json += "]";
-  request->send(200, "application/json", json);
-  json = String();
+
+  uint32_t to = GetTimeParam(request, "to", time(NULL));
+  uint32_t from = GetTimeParam(request, "from", to > 86400 ? to - 86400 : 0);
+  int points = CHART_DEFAULT_POINTS;
+  if (request->hasParam("points"))
+    points = constrain(request->getParam("points")->value().toInt(), 2, CHART_MAX_POINTS);
+  if (from > to) {
+    request->send(400);
+    return;
+  }
+
+  request->send(new ChartResponse(sd, logStore, "/logs", from, to, points));
+}
+
+// /api/export?from=&to=&format=, defaults to the last 24 hours as CSV
+void onApiExport(AsyncWebServerRequest * request) {
+  if (!startSD()) {
+    request->send(503);
+    return;
+  }
+
+  uint32_t to = GetTimeParam(request, "to", time(NULL));
+  uint32_t from = GetTimeParam(request, "from", to > 86400 ? to - 86400 : 0);
+  log_format format = LOG_FORMAT_CSV;
+  if (from > to || !GetFormatParam(request, &format)) {
+    request->send(400);
+    return;
+  }
+
+  request->send(new LogExportResponse(sd, logStore, "/logs", from, to, format));
+}
+
+// /logs/archive?from=&to=, the files holding records of the range as one ZIP, all by default
+void onGetLogsArchive(AsyncWebServerRequest * request) {
+  if (!startSD()) {
+    request->send(503);
+    return;
+  }
+
+  uint32_t from = GetTimeParam(request, "from", 0);
+  uint32_t to = GetTimeParam(request, "to", 0xffffffff);
+  if (from > to) {
+    request->send(400);
+    return;
+  }
+
+  request->send(new LogArchiveResponse(sd, logStore, "/logs", from, to));
+}
+
+// /api/sync?since=<cursor>&max=N, NDJSON records after the cursor and a last line with the next one
+void onApiSync(AsyncWebServerRequest * request) {
+  char name[LOG_NAME_MAX];
+  uint32_t offset = 0;
+  name[0] = 0;
+  AsyncWebParameter* since = request->getParam("since");
+  if (since != NULL && since->value().length() &&
+      !ParseSyncCursor(since->value().c_str(), name, sizeof(name), &offset)) {
+    request->send(400);
+    return;
+  }
+  uint32_t max = SYNC_PAGE_RECORDS;
+  AsyncWebParameter* maxParam = request->getParam("max");
+  if (maxParam != NULL)
+    max = constrain(maxParam->value().toInt(), 1, SYNC_MAX_RECORDS);
+
+  // nothing was written since, answered from RAM without touching the SD
+  if (name[0] && logStore.isActive(name) && offset == logStore.dataEnd()) {
+    char trailer[SYNC_CURSOR_MAX_LEN + 80];
+    FormatSyncTrailer(trailer, sizeof(trailer), since->value().c_str(), 0, false, false);
+    request->send(200, LogFormatContentType(LOG_FORMAT_NDJSON), trailer);
+    return;
+  }
+
+  if (!startSD()) {
+    request->send(503);
+    return;
+  }
+  request->send(new SyncResponse(sd, logStore, "/logs", name, offset, max));
+}
+
+// /api/quantiles?from=&to=&tempAbove=&humAbove=, p5/p50/p95 per UTC day and
+// over the range, defaults to the last 7 days; a threshold adds aboveSeconds
+void onApiQuantiles(AsyncWebServerRequest * request) {
+  if (!startSD()) {
+    request->send(503);
+    return;
+  }
+
+  uint32_t to = GetTimeParam(request, "to", time(NULL));
+  uint32_t from = GetTimeParam(request, "from", to > 6 * 86400 ? to - 6 * 86400 : 0);
+  if (from > to || to / 86400 - from / 86400 >= QUANTILE_MAX_DAYS) {
+    request->send(400);
+    return;
+  }
+  float tempAbove = NAN;
+  float humAbove = NAN;
+  if (request->hasParam("tempAbove"))
+    tempAbove = request->getParam("tempAbove")->value().toFloat();
+  if (request->hasParam("humAbove"))
+    humAbove = request->getParam("humAbove")->value().toFloat();
+
+  request->send(new QuantileResponse(sd, quantileStore, from / 86400, to / 86400,
+                                     TEMP_LOG_INTERVAL / 1000, tempAbove, humAbove));
 }
 
 void notFound(AsyncWebServerRequest *request) {
 #ifdef DEBUG_WWW
-  Serial.printf("NOT_FOUND: ");
+  const char* method = "UNKNOWN";
   if(request->method() == HTTP_GET)
-    Serial.printf("GET");
+    method = "GET";
   else if(request->method() == HTTP_POST)
-    Serial.printf("POST");
+    method = "POST";
   else if(request->method() == HTTP_DELETE)
-    Serial.printf("DELETE");
+    method = "DELETE";
   else if(request->method() == HTTP_PUT)
-    Serial.printf("PUT");
+    method = "PUT";
   else if(request->method() == HTTP_PATCH)
-    Serial.printf("PATCH");
+    method = "PATCH";
   else if(request->method() == HTTP_HEAD)
-    Serial.printf("HEAD");
+    method = "HEAD";
   else if(request->method() == HTTP_OPTIONS)
-    Serial.printf("OPTIONS");
-  else
-    Serial.printf("UNKNOWN");
-  Serial.printf(" http://%s%s\n", request->host().c_str(), request->url().c_str());
+    method = "OPTIONS";
+  debugLog.verbose("NOT_FOUND: %s http://%s%s", method, request->host().c_str(), request->url().c_str());
 
   if(request->contentLength()){
-    Serial.printf("_CONTENT_TYPE: %s\n", request->contentType().c_str());
-    Serial.printf("_CONTENT_LENGTH: %u\n", request->contentLength());
+    debugLog.verbose("_CONTENT_TYPE: %s", request->contentType().c_str());
+    debugLog.verbose("_CONTENT_LENGTH: %u", request->contentLength());
   }
 
   int headers = request->headers();
   int i;
   for(i=0;i<headers;i++){
     AsyncWebHeader* h = request->getHeader(i);
-    Serial.printf("_HEADER[%s]: %s\n", h->name().c_str(), h->value().c_str());
+    debugLog.verbose("_HEADER[%s]: %s", h->name().c_str(), h->value().c_str());
   }
 
   int params = request->params();
   for(i=0;i<params;i++){
     AsyncWebParameter* p = request->getParam(i);
     if(p->isFile()){
-      Serial.printf("_FILE[%s]: %s, size: %u\n", p->name().c_str(), p->value().c_str(), p->size());
+      debugLog.verbose("_FILE[%s]: %s, size: %u", p->name().c_str(), p->value().c_str(), p->size());
     } else if(p->isPost()){
-      Serial.printf("_POST[%s]: %s\n", p->name().c_str(), p->value().c_str());
+      debugLog.verbose("_POST[%s]: %s", p->name().c_str(), p->value().c_str());
     } else {
-      Serial.printf("_GET[%s]: %s\n", p->name().c_str(), p->value().c_str());
+      debugLog.verbose("_GET[%s]: %s", p->name().c_str(), p->value().c_str());
     }
   }
 #endif
   request->send(404, "text/plain", "Not found");
 }
+#endif
 //=============================================================================
-//=============================================================================
-
-String indexProc(const String& var) {
-  if (var == "TEMP")
-    return GetTemperature();
-  if (var == "HUMID")
-    return GetHumidity();
-
-  if (var == "DHT_S")
-    return GetButtonStyle(dhtState);
-  if (var == "SD_S")
-    return GetButtonStyle(sdState);
-  if (var == "RTC_S")
-    return GetButtonStyle(rtcState);
-  if (var == "WIFI_S")
-    return GetButtonStyle(wifiState);
-
-  if (var == "USE_EAP_CHECKED"){
-    if(preferences.getBool("useEap"))
-      return "checked";
-    else
-      return "";
-  }
-
-  if (var == "CLIENTSSID")
-    return preferences.getString("clientSSID");
 
-  if (var == "EAP_ANONYMOUS_IDENTITY")
-    return preferences.getString("eapAnIdentity");
-
-  if (var == "EAP_IDENTITY")
-    return preferences.getString("eapIdentity");
-
-  if (var == "NTP_POOL")
-    return preferences.getString("NTP_POOL");
-
-  if (var == "LOG_TABLE")
-    return MakeLogsTable();
-
-  if (var == "AP_ENABLED"){
-    if(preferences.getBool("apEnabled", true))
-      return "checked";
-    else
-      return "";
-  }
-
-  if (var == "AP_SSID")
-    return preferences.getString("apSSID", "HTLogger");
-
-  if (var == "AP_CHANNEL")
-    return String(preferences.getInt("apChannel", 7));
-
-  return String();
-}
-//=============================================================================
+#if APP_NETWORK
 //=============================================================================
+// on wifi disconnected, the web server stays up for the soft-AP and the reconnect
+void WiFiLostIP(WiFiEvent_t event, WiFiEventInfo_t info) {
+#if APP_MDNS
+  debugLog.warn("Lost Wifi IP, stopping mDNS..");
+  MDNS.end();
+#else
+  debugLog.warn("Lost Wifi IP");
+#endif
+  wifiState = MODULE_ERR;
+}
 
-String GetButtonStyle(module_status s) {
-  switch (s) {
-    case MODULE_OK:
-      return String("success");
-      break;
-    case MODULE_ERR:
-      return String("danger");
-      break;
-    case MODULE_UNK:
-    default:
-      return String("warning");
-      break;
-  }
+// associated, remembers the access point for the next reconnect
+void WiFiStaConnected(WiFiEvent_t event, WiFiEventInfo_t info) {
+  wifiConnection.onConnected(info.connected.bssid, info.connected.channel);
 }
-//=============================================================================
 
-//=============================================================================
-// on wifi disconnected
-void WiFiLostIP(WiFiEvent_t event, WiFiEventInfo_t info) {
-  Serial.println("Lost Wifi IP, stopping WebServer and mDNS..");
-  server.end();
-  MDNS.end();
+void WiFiStaDisconnected(WiFiEvent_t event, WiFiEventInfo_t info) {
+  wifiConnection.onDisconnected(info.disconnected.reason);
   wifiState = MODULE_ERR;
 }
+#endif
 //=============================================================================
 
 
@@ -814,9 +1263,10 @@ void RefreshTemp() {
     humidity = dht.getHumidity();
     temperature = dht.getTemperature();
     dhtState = MODULE_OK;
+    bootProfile.mark(BOOT_FIRST_SAMPLE);
   }
   else {
-    Serial.println("Failed to get temprature and humidity value.");
+    debugLog.warn("Failed to get temprature and humidity value.");
     humidity = NAN;
     temperature = NAN;
     dhtState = MODULE_ERR;
@@ -824,6 +1274,74 @@ void RefreshTemp() {
 }
 //=============================================================================
 
+//=============================================================================
+// compile the rules from the settings, a bad stored string disables alerts
+void LoadAlertRules() {
+  alertsPending = false;
+  alert_rule rules[ALERT_MAX_RULES];
+  uint8_t count = 0;
+  size_t errorAt = 0;
+  String spec = preferences.getString("alertRules");
+  if (!ParseAlertRules(spec.c_str(), rules, ALERT_MAX_RULES, &count, &errorAt)) {
+    debugLog.error("Alert rules: error at %u in \"%s\"", (unsigned)errorAt, spec.c_str());
+    count = 0;
+  }
+  alerts.setRules(rules, count);
+#if APP_NETWORK
+  alertNotifier.setUrl(preferences.getString("alertUrl").c_str());
+#endif
+  debugLog.info("Alert rules: %u", count);
+}
+
+// check the latest reading, events go out before the next read
+void EvaluateAlerts() {
+  if (alerts.evaluate(millis(), getUnixtime(), temperature, humidity, dhtState == MODULE_OK) == 0)
+    return;
+  alert_event event;
+  alert_message msg;
+  while (alerts.nextEvent(&event)) {
+    FormatAlertRule(msg.rule, sizeof(msg.rule), alerts.rule(event.rule));
+    msg.raised = event.raised;
+    msg.value = event.value;
+    msg.time = event.time;
+    debugLog.warn("Alert %s: %s %.1f", event.raised ? "raised" : "cleared", msg.rule, event.value);
+#if APP_NETWORK
+    alertNotifier.notify(msg);
+#endif
+#if APP_DISPLAY
+    if (event.raised) {
+      // wake the display on the readings screen
+      time(&last_action_time);
+      screen = 0;
+    }
+#endif
+  }
+}
+
+String AlertsToJson() {
+  char rule[ALERT_RULE_MAX_LEN];
+  String json = "{\"rules\":" + String(alerts.count());
+  json += ",\"active\":[";
+  bool first = true;
+  for (uint8_t i = 0; i < alerts.count(); i++) {
+    if (!alerts.active(i))
+      continue;
+    if (!first)
+      json += ",";
+    first = false;
+    FormatAlertRule(rule, sizeof(rule), alerts.rule(i));
+    json += "{\"rule\":\"" + String(rule) + "\",\"value\":" + String(alerts.value(i), 1) + "}";
+  }
+  json += "]";
+  json += ",\"raised\":" + String(alerts.raised());
+#if APP_NETWORK
+  json += ",\"notify\":" + alertNotifier.toJson();
+#endif
+  json += "}";
+  return json;
+}
+//=============================================================================
+
 
 //=============================================================================
 // get temperature as string
@@ -849,18 +1367,9 @@ String GetHumidity() {
 //=============================================================================
 
 //=============================================================================
-// get RTC time as string
+// get log time as string, RTC disciplined system clock with ms
 char* GetTimeString() {
-  if (RTC.lostPower()) {
-    rtcState = MODULE_ERR;
-    Serial.println("RTC not running");
-  }
-  else {
-    rtcState = MODULE_OK;
-  }
-
-  DateTime now = RTC.now();
-  sprintf(timeString, "%04d-%02d-%02d %02d:%02d:%02d", now.year(), now.month(), now.day(), now.hour(), now.minute(), now.second());
+  timeService.format(timeString, sizeof(timeString));
   return timeString;
 }
 //=============================================================================
@@ -875,13 +1384,17 @@ char* GetSysTimeString() {
 }
 //=============================================================================
 
-void GetLogFileName(char* name_buffer) {
-  struct tm timeinfo;
-  getLocalTime(&timeinfo);
-  sprintf(name_buffer, LogFileName, timeinfo.tm_year + 1900, timeinfo.tm_mon + 1);
+// write the first valid reading as soon as the card is up, after a
+// brownout this is the record that would otherwise be lost
+void WriteBootRecord() {
+  if (!bootRecordPending || dhtState != MODULE_OK || !sdManager.mounted())
+    return;
+  bootRecordPending = false;
+  AddTempHumidToArray();
+  WriteReadingsToSD();
 }
-
 //=============================================================================
+
 // write readings to LOG
 void WriteReadingsToSD() {
   if (!startSD())
@@ -892,43 +1405,36 @@ void WriteReadingsToSD() {
   float avgT = GetAvgTemperature();
   float avgH = GetAvgHumidity();
   InitLogArray();
-  char name_buffer[50];
-  GetLogFileName(name_buffer);
-  if (!sd.exists("/logs")) {
-    sd.mkdir("/logs");
-  }
 
   if (!isnan(avgT) && !isnan(avgH)) {
-    File logFile = File(name_buffer, O_WRONLY | O_APPEND | O_CREAT);
-
-    if (logFile.fileSize() == 0) {
-      if (logFile.write("Time;Temperature;Humidity\n") < 0) {
-        Serial.printf("Write to %s failed\n", name_buffer);
-        return;
-      }
+    SDLock lock(SD_WRITER, SD_WRITE_WAIT_MS);
+    if (!lock.locked()) {
+      debugLog.warn("Log: skipped - SD busy");
     }
-
-    char logLine[100];
-    sprintf(logLine, "%s;%f;%f\n", GetTimeString(), avgT, avgH);
-    if (logFile.write(logLine) < 0) {
-      Serial.printf("Write to %s failed\n", name_buffer);
-      sdState = MODULE_ERR;
+    else if (logStore.append(GetTimeString(), avgT, avgH)) {
+      sdState = MODULE_OK;
+      sdManager.ioOk();
+      {
+        PerfScope p(PERF_QUANTILES);
+        quantileStore.add(getUnixtime(), avgT, avgH);
+      }
+      if (bootProfile.mark(BOOT_FIRST_RECORD))
+        bootProfile.dump(Serial);
     }
     else {
-      sdState = MODULE_OK;
-      Serial.printf("Log: %s\n", logLine);
+      sdState = MODULE_ERR;
+      sdManager.ioError("log write");
     }
-
-    logFile.close();
   }
   else {
-    Serial.println("Log: skipped - no valid data");
+    debugLog.warn("Log: skipped - no valid data");
   }
 
 }
 //=============================================================================
 
 
+#if APP_DISPLAY
 //=============================================================================
 // screen display dispatch
 void UpdateDisplay() {
@@ -997,7 +1503,16 @@ void DisplayReadings() {
   display.println(GetHumidity());
   display.setTextSize(1);
   display.println("");
-  display.println("");
+  // first active alert in place of the spacer line
+  char rule[ALERT_RULE_MAX_LEN] = "";
+  for (uint8_t i = 0; i < alerts.count() && rule[0] == 0; i++) {
+    if (alerts.active(i))
+      FormatAlertRule(rule, sizeof(rule), alerts.rule(i));
+  }
+  if (rule[0])
+    display.printf("ALERT %s\n", rule);
+  else
+    display.println("");
   display.print(" SD: ");
   display.print(module_status_string[sdState]);
   display.print("   RTC: ");
@@ -1020,16 +1535,19 @@ void PrintSysInfo() {
   display.setCursor(0, 0);
 
   if ( sdState == MODULE_OK) {
-    uint64_t cardSize = (0.512 * sd.card()->cardSize()) / 1024;
-    uint64_t freeSpace = (0.512 * sd.vol()->freeClusterCount() * sd.vol()->blocksPerCluster()) / 1024;
-    display.printf("SD: %llu/%lluMB\n", cardSize, freeSpace);
+    uint64_t cardSize = storageStats.cardBytes() >> 20;
+    if (storageStats.valid()) {
+      uint64_t freeSpace = storageStats.freeBytes() >> 20;
+      display.printf("SD: %llu/%lluMB\n", cardSize, freeSpace);
+    } else {
+      display.printf("SD: %lluMB/scanning\n", cardSize);
+    }
   } else {
     display.println("SD NOT available");
   }
 
   if (rtcState == MODULE_OK) {
-    display.print("R:");
-    display.println(GetTimeString());
+    display.printf("R:%+dms %+.1fppm\n", (int)timeService.offsetMs(), timeService.driftPpm());
   } else {
     display.printf("RTC NOT Running\n");
   }
@@ -1038,6 +1556,7 @@ void PrintSysInfo() {
   display.println(GetSysTimeString());
 
 
+#if APP_NETWORK
   if (WiFi.isConnected()) {
     display.print("SSID:");
     display.println(WiFi.SSID());
@@ -1054,21 +1573,25 @@ void PrintSysInfo() {
     display.print("MAC:");
     display.println(WiFi.macAddress());
   }
+#endif
 
   display.display();
 }
 //=============================================================================
+#endif
 
+#if APP_BUTTON
 //=============================================================================
 // on button tap
 void ButtonTap(Button2& btn) {
-  Serial.println("ButtonTap");
+  debugLog.verbose("ButtonTap");
   if (!screen_saver && !screen_dimmed)
     screen = ++screen % 2;
   time(&last_action_time);
   UpdateDisplay();
 }
 //=============================================================================
+#endif
 
 
 //=============================================================================
@@ -1088,25 +1611,22 @@ void AddTempHumidToArray() {
 float GetAvgTemperature () {
   int count = 0;
   float aggr = 0;
-  Serial.print("Avg temp comp: ");
   for (int i = 0; i < LOG_SUPERSAMPLE; i++) {
 
     if (IsValidReading(th_log_array[i].temperature)) {
       aggr += th_log_array[i].temperature;
-      Serial.print(th_log_array[i].temperature);
-      Serial.print(" ");
       count++;
     }
   }
 
   if (count > 0)
   {
-    Serial.println(aggr / count);
+    debugLog.verbose("Avg temp comp: %.2f of %d samples", aggr / count, count);
     return aggr / count;
   }
   else
   {
-    Serial.println(NAN);
+    debugLog.verbose("Avg temp comp: no valid samples");
     return NAN;
   }
 }
@@ -1117,22 +1637,18 @@ float GetAvgTemperature () {
 float GetAvgHumidity () {
   int count = 0;
   float aggr = 0;
-  Serial.print("Avg humid comp: ");
   for (int i = 0; i < LOG_SUPERSAMPLE; i++) {
     if (IsValidReading(th_log_array[i].humidity)) {
       aggr += th_log_array[i].humidity;
-      Serial.print(th_log_array[i].humidity);
-      Serial.print(" ");
-
       count++;
     }
   }
   if (count > 0) {
-    Serial.println(aggr / count);
+    debugLog.verbose("Avg humid comp: %.2f of %d samples", aggr / count, count);
     return aggr / count;
   }
   else {
-    Serial.println(NAN);
+    debugLog.verbose("Avg humid comp: no valid samples");
     return NAN;
   }
 }
@@ -1154,27 +1670,135 @@ bool IsValidReading(float reading) {
 //=============================================================================
 
 void loop() {
-  button.loop();
-  if (dispTempTimer.isReady()) {
-    RefreshTemp();
-    dispTempTimer.reset();
+  PerfScope loopScope(PERF_LOOP);
+
+#if APP_BUTTON
+  {
+    PerfScope p(PERF_BUTTON);
+    button.loop();
   }
+#endif
+
+  // sensor read first, a sample slot due at the same deadline uses it
+  if (dispTempTimer.isReady()) {
+    perf.timerFired(PERF_TIMER_DISP_TEMP, dispTempTimer.lateUs(), dispTempTimer.missed());
+    {
+      PerfScope p(PERF_REFRESH_TEMP);
+      RefreshTemp();
+      WriteBootRecord();
+    }
+    PerfScope p(PERF_ALERTS);
+    if (alertsPending)
+      LoadAlertRules();
+    EvaluateAlerts();
+  }
+#if APP_WEB
+  if (StateChanged())
+    responseCache.invalidate(CACHE_STATE);
+#endif
 
   if (tempTimer.isReady()) {
+    perf.timerFired(PERF_TIMER_TEMP, tempTimer.lateUs(), tempTimer.missed());
+    PerfScope p(PERF_ADD_SAMPLE);
     AddTempHumidToArray();
-    tempTimer.reset();
   }
 
   if (tempLogTimer.isReady()) {
-    tempLogTimer.reset();
+    perf.timerFired(PERF_TIMER_LOG, tempLogTimer.lateUs(), tempLogTimer.missed());
+    PerfScope p(PERF_WRITE_SD);
     WriteReadingsToSD();
-    SyncRTC();
   }
+  {
+    PerfScope p(PERF_SYNC_RTC);
+    timeService.loop(NtpSynced());
+    rtcState = timeService.rtcOk() ? MODULE_OK : MODULE_ERR;
+  }
+#if APP_DISPLAY
   if (dispTimer.isReady()) {
+    perf.timerFired(PERF_TIMER_DISP, dispTimer.lateUs(), dispTimer.missed());
+    PerfScope p(PERF_UPDATE_DISPLAY);
     UpdateDisplay();
-    dispTimer.reset();
   }
-  dnsServer.processNextRequest();
+#endif
+
+#if APP_CAPTIVE_DNS
+  {
+    PerfScope p(PERF_DNS);
+    if (netReady)
+      dnsServer.processNextRequest();
+  }
+#endif
+
+#if APP_NETWORK
+  if (netReady) {
+    PerfScope p(PERF_WIFI_CONN);
+    if (wifiRestartPending) {
+      wifiRestartPending = false;
+      StartWifi();
+    }
+    wifiConnection.loop();
+  }
+#endif
+#if APP_WEB
+  if (netReady) {
+    // a scan during an association attempt would make it fail
+    PerfScope p(PERF_WIFI_SCAN);
+    if (wifiConnection.state() != WIFI_CONN_CONNECTING)
+      wifiScanner.loop();
+  }
+#endif
+
+  {
+    PerfScope p(PERF_SD_MANAGER);
+    SDLock lock(SD_WRITER, SD_WRITE_WAIT_MS);
+    if (lock.locked() && sdManager.loop()) {
+      OnSDMounted();
+    }
+  }
+
+  if (sdManager.mounted()) {
+    if (storageStats.scanDue()) {
+      PerfScope p(PERF_STORAGE_SCAN);
+      SDLock lock(SD_WRITER, SD_WRITE_WAIT_MS);
+      if (lock.locked())
+        storageStats.scanStep();
+    }
+  } else {
+    storageStats.unmounted();
+  }
+
+  if (storagePending) {
+    // appends read the rotation and preallocation size, deletes the retention limits
+    SDLock lock(SD_WRITER, SD_WRITE_WAIT_MS);
+    if (lock.locked()) {
+      storagePending = false;
+      LoadRetentionPolicy();
+      LoadRotationPolicy();
+      retentionPending = true;
+    }
+  }
+
+  if (retentionTimer.isReady())
+    retentionPending = true;
+#if APP_WEB
+  // an archive lists the directory twice, its files must stay until then
+  if (retentionPending && LogArchiveResponse::active() == 0) {
+#else
+  if (retentionPending) {
+#endif
+    retentionTimer.reset();
+    if (startSD()) {
+      PerfScope p(PERF_RETENTION);
+      SDLock lock(SD_WRITER, SD_WRITE_WAIT_MS);
+      if (lock.locked())
+        retentionPending = retention.enforce(getUnixtime());
+    }
+  }
+
+  if (PERF_DUMP_INTERVAL > 0 && perfDumpTimer.isReady()) {
+    perf.dump(Serial);
+    perfDumpTimer.reset();
+  }
 }
 
 
@@ -1204,7 +1828,7 @@ void PrintSysInfo2Serial() {
       Serial.println("UNKNOWN");
     }
 
-    uint64_t cardSize = sd.card()->cardSize() / 1024;
+    uint64_t cardSize = storageStats.cardBytes() >> 20;
     Serial.printf("SD Card Size: %lluMB\n", cardSize);
     //    Serial.printf("Total space: %lluMB\n", SD.totalBytes() / (1024 * 1024));
     //    Serial.printf("Used space: %lluMB\n", SD.usedBytes() / (1024 * 1024));
@@ -1213,12 +1837,12 @@ void PrintSysInfo2Serial() {
   }
 
   if (rtcState == MODULE_OK) {
-    Serial.print("RTC Time: ");
-    Serial.println(GetTimeString());
+    Serial.printf("RTC offset: %dms, drift: %.2fppm\n", (int)timeService.offsetMs(), timeService.driftPpm());
   } else {
     Serial.printf("RTC NOT Running\n");
   }
 
+#if APP_NETWORK
   if (WiFi.isConnected()) {
     Serial.print("SSID:");
     Serial.println(WiFi.SSID());
@@ -1232,6 +1856,7 @@ void PrintSysInfo2Serial() {
     Serial.print("MAC:");
     Serial.println(WiFi.macAddress());
   }
+#endif
 
 }
 //=============================================================================
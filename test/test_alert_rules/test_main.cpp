@@ -0,0 +1,171 @@
+// Unit tests of the alert rule syntax and of AlertEngine hysteresis and hold times
+
+#include <math.h>
+#include <string.h>
+#include <unity.h>
+
+#include "AlertRules.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static AlertEngine engine;
+
+static void load(const char* spec) {
+  alert_rule rules[ALERT_MAX_RULES];
+  uint8_t count;
+  size_t errorAt;
+  TEST_ASSERT_TRUE(ParseAlertRules(spec, rules, ALERT_MAX_RULES, &count, &errorAt));
+  engine.setRules(rules, count);
+  alert_event event;
+  while (engine.nextEvent(&event));
+}
+
+// one reading a second, returns the events it queued
+static uint8_t reading(uint32_t s, float temperature, float humidity = 50.0f, bool ok = true) {
+  return engine.evaluate(s * 1000, 1600000000 + s, temperature, humidity, ok);
+}
+
+void test_parse_rules(void) {
+  alert_rule rules[ALERT_MAX_RULES];
+  uint8_t count;
+  size_t errorAt;
+  TEST_ASSERT_TRUE(ParseAlertRules("t>8~1@300;h<20;t+3/900;h-10/600@60;fault@30", rules, ALERT_MAX_RULES, &count, &errorAt));
+  TEST_ASSERT_EQUAL(5, count);
+  TEST_ASSERT_EQUAL(ALERT_ABOVE, rules[0].type);
+  TEST_ASSERT_EQUAL(ALERT_TEMPERATURE, rules[0].channel);
+  TEST_ASSERT_EQUAL_FLOAT(8.0f, rules[0].limit);
+  TEST_ASSERT_EQUAL_FLOAT(1.0f, rules[0].hysteresis);
+  TEST_ASSERT_EQUAL_UINT32(300000, rules[0].holdMs);
+  TEST_ASSERT_EQUAL(ALERT_BELOW, rules[1].type);
+  TEST_ASSERT_EQUAL(ALERT_HUMIDITY, rules[1].channel);
+  TEST_ASSERT_EQUAL_FLOAT(ALERT_DEFAULT_HYSTERESIS, rules[1].hysteresis);
+  TEST_ASSERT_EQUAL(ALERT_RISE, rules[2].type);
+  TEST_ASSERT_EQUAL_UINT32(900000, rules[2].windowMs);
+  TEST_ASSERT_EQUAL(ALERT_FALL, rules[3].type);
+  TEST_ASSERT_EQUAL_UINT32(60000, rules[3].holdMs);
+  TEST_ASSERT_EQUAL(ALERT_FAULT, rules[4].type);
+
+  char buf[ALERT_RULE_MAX_LEN];
+  TEST_ASSERT_GREATER_THAN(0, FormatAlertRule(buf, sizeof(buf), rules[0]));
+  TEST_ASSERT_EQUAL_STRING("t>8.0~1.0@300", buf);
+}
+
+void test_parse_errors(void) {
+  alert_rule rules[ALERT_MAX_RULES];
+  uint8_t count;
+  size_t errorAt;
+  TEST_ASSERT_FALSE(ParseAlertRules("t>8;x<3", rules, ALERT_MAX_RULES, &count, &errorAt));
+  TEST_ASSERT_EQUAL(4, errorAt);
+  TEST_ASSERT_FALSE(ParseAlertRules("t>", rules, ALERT_MAX_RULES, &count, &errorAt));
+  TEST_ASSERT_FALSE(ParseAlertRules("t>8@999999", rules, ALERT_MAX_RULES, &count, &errorAt));
+  TEST_ASSERT_FALSE(ParseAlertRules("t>1;t>2;t>3", rules, 2, &count, &errorAt));
+}
+
+void test_above_hysteresis(void) {
+  load("t>8~0.5");
+  TEST_ASSERT_EQUAL(0, reading(0, 8.0f));
+  // raised once above the limit
+  TEST_ASSERT_EQUAL(1, reading(1, 8.1f));
+  TEST_ASSERT_TRUE(engine.active(0));
+  alert_event event;
+  TEST_ASSERT_TRUE(engine.nextEvent(&event));
+  TEST_ASSERT_TRUE(event.raised);
+  TEST_ASSERT_EQUAL_FLOAT(8.1f, event.value);
+  TEST_ASSERT_EQUAL_UINT32(1600000001, event.time);
+  // noise around the limit neither clears nor raises again
+  TEST_ASSERT_EQUAL(0, reading(2, 7.9f));
+  TEST_ASSERT_EQUAL(0, reading(3, 8.2f));
+  TEST_ASSERT_EQUAL(0, reading(4, 7.5f));
+  TEST_ASSERT_TRUE(engine.active(0));
+  // cleared only below limit - hysteresis
+  TEST_ASSERT_EQUAL(1, reading(5, 7.49f));
+  TEST_ASSERT_FALSE(engine.active(0));
+  TEST_ASSERT_TRUE(engine.nextEvent(&event));
+  TEST_ASSERT_FALSE(event.raised);
+  TEST_ASSERT_EQUAL_UINT32(1, engine.raised());
+}
+
+void test_below_hysteresis(void) {
+  load("h<20~2");
+  TEST_ASSERT_EQUAL(1, reading(0, 20.0f, 19.0f));
+  TEST_ASSERT_EQUAL(0, reading(1, 20.0f, 21.9f));
+  TEST_ASSERT_TRUE(engine.active(0));
+  TEST_ASSERT_EQUAL(1, reading(2, 20.0f, 22.1f));
+  TEST_ASSERT_FALSE(engine.active(0));
+}
+
+void test_hold_time(void) {
+  load("t>8@300");
+  TEST_ASSERT_EQUAL(0, reading(0, 9.0f));
+  TEST_ASSERT_EQUAL(0, reading(299, 9.0f));
+  // a dip below the limit restarts the hold
+  TEST_ASSERT_EQUAL(0, reading(300, 7.0f));
+  TEST_ASSERT_EQUAL(0, reading(301, 9.0f));
+  TEST_ASSERT_EQUAL(0, reading(600, 9.0f));
+  TEST_ASSERT_EQUAL(1, reading(601, 9.0f));
+  TEST_ASSERT_TRUE(engine.active(0));
+}
+
+void test_invalid_readings(void) {
+  load("t>8;fault@10");
+  TEST_ASSERT_EQUAL(1, reading(0, 9.0f));
+  // NAN leaves the threshold rule as it is, the fault rule counts
+  TEST_ASSERT_EQUAL(0, reading(1, NAN, NAN, false));
+  TEST_ASSERT_TRUE(engine.active(0));
+  TEST_ASSERT_EQUAL(0, reading(10, NAN, NAN, false));
+  TEST_ASSERT_EQUAL(1, reading(11, NAN, NAN, false));
+  TEST_ASSERT_TRUE(engine.active(1));
+  TEST_ASSERT_EQUAL(1, reading(12, 9.0f));
+  TEST_ASSERT_FALSE(engine.active(1));
+}
+
+void test_rise(void) {
+  load("t+3/600");
+  uint32_t s = 0;
+  // flat, then 3.5 degrees within a few minutes
+  for (; s < 1200; s += 60)
+    TEST_ASSERT_EQUAL(0, reading(s, 20.0f));
+  uint8_t events = 0;
+  for (float t = 20.5f; t <= 23.5f; t += 0.5f, s += 60)
+    events += reading(s, t);
+  TEST_ASSERT_EQUAL(1, events);
+  TEST_ASSERT_TRUE(engine.active(0));
+  // it clears once the change over the window is back under the limit
+  for (int i = 0; i < 30; i++, s += 60)
+    events += reading(s, 23.5f);
+  TEST_ASSERT_FALSE(engine.active(0));
+}
+
+void test_event_queue_drops_oldest(void) {
+  load("t>8~0");
+  for (uint32_t s = 0; s < 2 * ALERT_EVENT_QUEUE; s += 2) {
+    reading(s, 9.0f);
+    reading(s + 1, 7.0f);
+  }
+  TEST_ASSERT_GREATER_THAN(0, engine.dropped());
+  alert_event event;
+  uint8_t n = 0;
+  uint32_t last = 0;
+  while (engine.nextEvent(&event)) {
+    TEST_ASSERT_TRUE(event.time >= last);
+    last = event.time;
+    n++;
+  }
+  TEST_ASSERT_EQUAL(ALERT_EVENT_QUEUE, n);
+  // the newest event is kept
+  TEST_ASSERT_EQUAL_UINT32(1600000000 + 2 * ALERT_EVENT_QUEUE - 1, last);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_rules);
+  RUN_TEST(test_parse_errors);
+  RUN_TEST(test_above_hysteresis);
+  RUN_TEST(test_below_hysteresis);
+  RUN_TEST(test_hold_time);
+  RUN_TEST(test_invalid_readings);
+  RUN_TEST(test_rise);
+  RUN_TEST(test_event_queue_drops_oldest);
+  return UNITY_END();
+}
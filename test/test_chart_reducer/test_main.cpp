@@ -0,0 +1,121 @@
+// Unit tests of the min/max chart reduction
+
+#include <string.h>
+#include <unity.h>
+
+#include "ChartReducer.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static log_record record(uint32_t time, float temperature, float humidity) {
+  log_record rec = {time, 0, temperature, humidity, 0};
+  return rec;
+}
+
+void test_bucket_width(void) {
+  ChartReducer reducer;
+  // 100 s in 5 buckets
+  reducer.begin(1000, 1099, 10);
+  TEST_ASSERT_EQUAL_UINT32(20, reducer.bucketSeconds());
+  // an uneven span rounds the width up, so the buckets cover it
+  reducer.begin(1000, 1100, 10);
+  TEST_ASSERT_EQUAL_UINT32(21, reducer.bucketSeconds());
+  // fewer than 2 points still makes one bucket
+  reducer.begin(0, 99, 1);
+  TEST_ASSERT_EQUAL_UINT32(100, reducer.bucketSeconds());
+}
+
+void test_min_max_per_bucket(void) {
+  ChartReducer reducer;
+  reducer.begin(0, 99, 10);
+  chart_bucket out;
+  TEST_ASSERT_FALSE(reducer.add(record(0, 20.0f, 50.0f), &out));
+  TEST_ASSERT_FALSE(reducer.add(record(5, 25.5f, 40.0f), &out));
+  // a spike in the middle of a bucket survives
+  TEST_ASSERT_FALSE(reducer.add(record(10, -4.0f, 90.0f), &out));
+  TEST_ASSERT_FALSE(reducer.add(record(19, 21.0f, 45.0f), &out));
+  TEST_ASSERT_TRUE(reducer.add(record(20, 30.0f, 10.0f), &out));
+  TEST_ASSERT_EQUAL_UINT32(0, out.time);
+  TEST_ASSERT_EQUAL_UINT32(4, out.count);
+  TEST_ASSERT_EQUAL_FLOAT(-4.0f, out.tMin);
+  TEST_ASSERT_EQUAL_FLOAT(25.5f, out.tMax);
+  TEST_ASSERT_EQUAL_FLOAT(40.0f, out.hMin);
+  TEST_ASSERT_EQUAL_FLOAT(90.0f, out.hMax);
+
+  TEST_ASSERT_TRUE(reducer.finish(&out));
+  TEST_ASSERT_EQUAL_UINT32(20, out.time);
+  TEST_ASSERT_EQUAL_UINT32(1, out.count);
+  TEST_ASSERT_EQUAL_FLOAT(30.0f, out.tMin);
+  TEST_ASSERT_EQUAL_FLOAT(30.0f, out.tMax);
+  TEST_ASSERT_FALSE(reducer.finish(&out));
+}
+
+void test_empty_buckets_and_range(void) {
+  ChartReducer reducer;
+  reducer.begin(100, 199, 10);
+  chart_bucket out;
+  // outside [from, to]
+  TEST_ASSERT_FALSE(reducer.add(record(99, 0.0f, 0.0f), &out));
+  TEST_ASSERT_FALSE(reducer.add(record(200, 0.0f, 0.0f), &out));
+  TEST_ASSERT_FALSE(reducer.finish(&out));
+
+  // the buckets in between are skipped, not emitted empty
+  TEST_ASSERT_FALSE(reducer.add(record(100, 1.0f, 1.0f), &out));
+  TEST_ASSERT_TRUE(reducer.add(record(190, 2.0f, 2.0f), &out));
+  TEST_ASSERT_EQUAL_UINT32(100, out.time);
+  TEST_ASSERT_TRUE(reducer.finish(&out));
+  TEST_ASSERT_EQUAL_UINT32(180, out.time);
+}
+
+void test_step_back_merges(void) {
+  ChartReducer reducer;
+  reducer.begin(0, 99, 10);
+  chart_bucket out;
+  TEST_ASSERT_FALSE(reducer.add(record(45, 10.0f, 10.0f), &out));
+  // an earlier record goes into the open bucket
+  TEST_ASSERT_FALSE(reducer.add(record(5, 50.0f, 5.0f), &out));
+  TEST_ASSERT_TRUE(reducer.finish(&out));
+  TEST_ASSERT_EQUAL_UINT32(40, out.time);
+  TEST_ASSERT_EQUAL_UINT32(2, out.count);
+  TEST_ASSERT_EQUAL_FLOAT(50.0f, out.tMax);
+  TEST_ASSERT_EQUAL_FLOAT(5.0f, out.hMin);
+}
+
+void test_points_bound(void) {
+  // a year of minutes never gives more than points / 2 rows
+  ChartReducer reducer;
+  uint32_t from = LogMakeTime(2020, 1, 1, 0, 0, 0);
+  uint32_t to = from + 366 * 86400 - 1;
+  reducer.begin(from, to, CHART_DEFAULT_POINTS);
+  chart_bucket out;
+  uint32_t rows = 0;
+  uint32_t records = 0;
+  for (uint32_t t = from; t <= to; t += 60) {
+    rows += reducer.add(record(t, (float)(t % 97), (float)(t % 89)), &out);
+    records++;
+  }
+  rows += reducer.finish(&out);
+  TEST_ASSERT_EQUAL_UINT32(CHART_DEFAULT_POINTS / 2, rows);
+  TEST_ASSERT_EQUAL_UINT32(527040, records);
+}
+
+void test_format_bucket(void) {
+  chart_bucket bucket = {1598788800, 3, -1.5f, 22.25f, 40.0f, 45.126f};
+  char buf[80];
+  size_t n = FormatChartBucket(buf, sizeof(buf), bucket);
+  TEST_ASSERT_EQUAL_STRING("[1598788800,-1.50,22.25,40.00,45.13,3]", buf);
+  TEST_ASSERT_EQUAL(strlen(buf), n);
+  TEST_ASSERT_EQUAL(0, FormatChartBucket(buf, 10, bucket));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_bucket_width);
+  RUN_TEST(test_min_max_per_bucket);
+  RUN_TEST(test_empty_buckets_and_range);
+  RUN_TEST(test_step_back_merges);
+  RUN_TEST(test_points_bound);
+  RUN_TEST(test_format_bucket);
+  return UNITY_END();
+}
@@ -0,0 +1,101 @@
+// Unit tests of the CSV, NDJSON and CBOR export encoders
+
+#include <string.h>
+#include <unity.h>
+
+#include "LogExport.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static const log_record golden = {1598788800, 250, 21.5f, 45.0f, 17};
+
+void test_parse_format(void) {
+  log_format format;
+  TEST_ASSERT_TRUE(ParseLogFormat("csv", &format));
+  TEST_ASSERT_EQUAL(LOG_FORMAT_CSV, format);
+  TEST_ASSERT_TRUE(ParseLogFormat("ndjson", &format));
+  TEST_ASSERT_EQUAL(LOG_FORMAT_NDJSON, format);
+  TEST_ASSERT_TRUE(ParseLogFormat("cbor", &format));
+  TEST_ASSERT_EQUAL(LOG_FORMAT_CBOR, format);
+  TEST_ASSERT_FALSE(ParseLogFormat("json", &format));
+  TEST_ASSERT_FALSE(ParseLogFormat("", &format));
+  TEST_ASSERT_EQUAL_STRING("application/cbor", LogFormatContentType(LOG_FORMAT_CBOR));
+  TEST_ASSERT_EQUAL_STRING(".ndjson", LogFormatExtension(LOG_FORMAT_NDJSON));
+}
+
+void test_csv_is_the_log_format(void) {
+  uint8_t buf[LOG_EXPORT_MAX_LEN];
+  size_t n = FormatExportRecord(buf, sizeof(buf), LOG_FORMAT_CSV, golden);
+  const char* line = "2020-08-30 12:00:00.250;21.500000;45.000000;17;0a3d2976\n";
+  TEST_ASSERT_EQUAL(strlen(line), n);
+  TEST_ASSERT_EQUAL_MEMORY(line, buf, n);
+  TEST_ASSERT_EQUAL(strlen(LOG_RECORD_HEADER), FormatExportHeader(buf, sizeof(buf), LOG_FORMAT_CSV));
+  TEST_ASSERT_EQUAL_MEMORY(LOG_RECORD_HEADER, buf, strlen(LOG_RECORD_HEADER));
+  TEST_ASSERT_EQUAL(0, FormatExportFooter(buf, sizeof(buf), LOG_FORMAT_CSV));
+}
+
+void test_ndjson_record(void) {
+  uint8_t buf[LOG_EXPORT_MAX_LEN];
+  size_t n = FormatExportRecord(buf, sizeof(buf), LOG_FORMAT_NDJSON, golden);
+  const char* line = "{\"time\":1598788800,\"ms\":250,\"temperature\":21.5,\"humidity\":45,\"seq\":17}\n";
+  TEST_ASSERT_EQUAL(strlen(line), n);
+  TEST_ASSERT_EQUAL_MEMORY(line, buf, n);
+  TEST_ASSERT_EQUAL(0, FormatExportHeader(buf, sizeof(buf), LOG_FORMAT_NDJSON));
+  TEST_ASSERT_EQUAL(0, FormatExportFooter(buf, sizeof(buf), LOG_FORMAT_NDJSON));
+  // one short of the line does not fit
+  TEST_ASSERT_EQUAL(0, FormatExportRecord(buf, strlen(line), LOG_FORMAT_NDJSON, golden));
+}
+
+void test_cbor_record(void) {
+  // checked by hand against RFC 8949
+  const uint8_t expected[] = {
+    0x85,                               // array(5)
+    0x1a, 0x5f, 0x4b, 0x94, 0xc0,       // uint32 1598788800
+    0x18, 0xfa,                         // uint8 250
+    0xfa, 0x41, 0xac, 0x00, 0x00,       // float32 21.5
+    0xfa, 0x42, 0x34, 0x00, 0x00,       // float32 45.0
+    0x11                                // 17
+  };
+  uint8_t buf[LOG_EXPORT_MAX_LEN];
+  size_t n = FormatExportRecord(buf, sizeof(buf), LOG_FORMAT_CBOR, golden);
+  TEST_ASSERT_EQUAL(sizeof(expected), n);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, buf, n);
+}
+
+void test_cbor_integer_sizes(void) {
+  log_record rec = {23, 0, 0.0f, -2.0f, 65536};
+  const uint8_t expected[] = {
+    0x85,
+    0x17,                               // 23 fits the initial byte
+    0x00,
+    0xfa, 0x00, 0x00, 0x00, 0x00,
+    0xfa, 0xc0, 0x00, 0x00, 0x00,       // float32 -2.0
+    0x1a, 0x00, 0x01, 0x00, 0x00        // 65536 needs 4 bytes
+  };
+  uint8_t buf[LOG_EXPORT_MAX_LEN];
+  size_t n = FormatExportRecord(buf, sizeof(buf), LOG_FORMAT_CBOR, rec);
+  TEST_ASSERT_EQUAL(sizeof(expected), n);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, buf, n);
+}
+
+void test_cbor_stream(void) {
+  uint8_t buf[LOG_EXPORT_MAX_LEN];
+  // indefinite length array closed by a break
+  TEST_ASSERT_EQUAL(1, FormatExportHeader(buf, sizeof(buf), LOG_FORMAT_CBOR));
+  TEST_ASSERT_EQUAL_HEX8(0x9f, buf[0]);
+  TEST_ASSERT_EQUAL(1, FormatExportFooter(buf, sizeof(buf), LOG_FORMAT_CBOR));
+  TEST_ASSERT_EQUAL_HEX8(0xff, buf[0]);
+  TEST_ASSERT_EQUAL(0, FormatExportRecord(buf, 8, LOG_FORMAT_CBOR, golden));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_format);
+  RUN_TEST(test_csv_is_the_log_format);
+  RUN_TEST(test_ndjson_record);
+  RUN_TEST(test_cbor_record);
+  RUN_TEST(test_cbor_integer_sizes);
+  RUN_TEST(test_cbor_stream);
+  return UNITY_END();
+}
@@ -0,0 +1,173 @@
+// Unit tests of the log record format: CRC, formatting, parsing, line splitting
+
+#include <string.h>
+#include <unity.h>
+
+#include "LogRecord.h"
+
+// checked against zlib.crc32() of the line up to the last ';'
+#define GOLDEN_LINE "2020-08-30 12:00:00.250;21.500000;45.000000;17;0a3d2976\n"
+#define GOLDEN_LINE2 "2020-08-30 12:01:00;-3.250000;99.900002;18;614016dd\n"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_crc_check_value(void) {
+  // the CRC-32 check value of the standard
+  TEST_ASSERT_EQUAL_HEX32(0xcbf43926, LogCrc32("123456789", 9));
+  TEST_ASSERT_EQUAL_HEX32(0, LogCrc32("", 0));
+}
+
+void test_crc_continues(void) {
+  uint32_t crc = LogCrc32("1234", 4);
+  TEST_ASSERT_EQUAL_HEX32(0xcbf43926, LogCrc32("56789", 5, crc));
+}
+
+void test_format_golden(void) {
+  char buf[LOG_RECORD_MAX_LEN];
+  size_t n = FormatLogRecord(buf, sizeof(buf), "2020-08-30 12:00:00.250", 21.5f, 45.0f, 17);
+  TEST_ASSERT_EQUAL(strlen(GOLDEN_LINE), n);
+  TEST_ASSERT_EQUAL_STRING_LEN(GOLDEN_LINE, buf, n);
+  n = FormatLogRecord(buf, sizeof(buf), "2020-08-30 12:01:00", -3.25f, 99.9f, 18);
+  TEST_ASSERT_EQUAL(strlen(GOLDEN_LINE2), n);
+  TEST_ASSERT_EQUAL_STRING_LEN(GOLDEN_LINE2, buf, n);
+}
+
+void test_format_too_small(void) {
+  char buf[20];
+  TEST_ASSERT_EQUAL(0, FormatLogRecord(buf, sizeof(buf), "2020-08-30 12:00:00", 21.5f, 45.0f, 17));
+}
+
+void test_parse_golden(void) {
+  log_record rec;
+  TEST_ASSERT_EQUAL(LOG_RECORD_OK, ParseLogRecord(GOLDEN_LINE, strlen(GOLDEN_LINE), &rec));
+  TEST_ASSERT_EQUAL_UINT32(1598788800, rec.time);
+  TEST_ASSERT_EQUAL_UINT16(250, rec.ms);
+  TEST_ASSERT_EQUAL_FLOAT(21.5f, rec.temperature);
+  TEST_ASSERT_EQUAL_FLOAT(45.0f, rec.humidity);
+  TEST_ASSERT_EQUAL_UINT32(17, rec.seq);
+  // without the trailing '\n'
+  TEST_ASSERT_EQUAL(LOG_RECORD_OK, ParseLogRecord(GOLDEN_LINE2, strlen(GOLDEN_LINE2) - 1, &rec));
+  TEST_ASSERT_EQUAL_UINT16(0, rec.ms);
+  TEST_ASSERT_EQUAL_FLOAT(-3.25f, rec.temperature);
+}
+
+void test_parse_legacy_and_header(void) {
+  const char* legacy = "2020-08-30 12:00:00;21.50;45.00\n";
+  log_record rec;
+  TEST_ASSERT_EQUAL(LOG_RECORD_LEGACY, ParseLogRecord(legacy, strlen(legacy), &rec));
+  TEST_ASSERT_EQUAL_UINT32(1598788800, rec.time);
+  TEST_ASSERT_EQUAL_UINT32(0, rec.seq);
+  TEST_ASSERT_EQUAL(LOG_RECORD_HEADER_LINE, ParseLogRecord(LOG_RECORD_HEADER, strlen(LOG_RECORD_HEADER), &rec));
+}
+
+void test_parse_detects_corruption(void) {
+  char line[] = GOLDEN_LINE;
+  log_record rec;
+  // any changed byte before the CRC field
+  for (size_t i = 0; i < strlen(line) - 10; i++) {
+    char c = line[i];
+    line[i] = c == '1' ? '2' : '1';
+    TEST_ASSERT_EQUAL(LOG_RECORD_CORRUPT, ParseLogRecord(line, strlen(line), &rec));
+    line[i] = c;
+  }
+  // a torn line, cut inside the CRC or the values
+  TEST_ASSERT_EQUAL(LOG_RECORD_CORRUPT, ParseLogRecord(line, strlen(line) - 4, &rec));
+  TEST_ASSERT_EQUAL(LOG_RECORD_CORRUPT, ParseLogRecord(line, 30, &rec));
+  TEST_ASSERT_EQUAL(LOG_RECORD_CORRUPT, ParseLogRecord("\xff\xff\xff\xff", 4, &rec));
+}
+
+void test_time_roundtrip(void) {
+  TEST_ASSERT_EQUAL_UINT32(1598788800, LogMakeTime(2020, 8, 30, 12, 0, 0));
+  TEST_ASSERT_EQUAL_UINT32(951782400, LogMakeTime(2000, 2, 29, 0, 0, 0));
+  char buf[24];
+  TEST_ASSERT_EQUAL(19, LogFormatTime(buf, sizeof(buf), 951868799));
+  TEST_ASSERT_EQUAL_STRING("2000-02-29 23:59:59", buf);
+  uint32_t time;
+  uint16_t ms;
+  TEST_ASSERT_TRUE(LogParseTime("2000-02-29 23:59:59.007", 23, &time, &ms));
+  TEST_ASSERT_EQUAL_UINT32(951868799, time);
+  TEST_ASSERT_EQUAL_UINT16(7, ms);
+  TEST_ASSERT_FALSE(LogParseTime("2000-13-01 00:00:00", 19, &time));
+}
+
+void test_splitter_any_chunking(void) {
+  const char* stream = LOG_RECORD_HEADER GOLDEN_LINE GOLDEN_LINE2;
+  size_t total = strlen(stream);
+  for (size_t chunk = 1; chunk <= total; chunk++) {
+    LogLineSplitter splitter;
+    int lines = 0;
+    for (size_t pos = 0; pos < total; ) {
+      size_t n = total - pos < chunk ? total - pos : chunk;
+      for (size_t off = 0; off < n; ) {
+        const char* line;
+        size_t len;
+        bool overlong;
+        off += splitter.push(stream + pos + off, n - off, &line, &len, &overlong);
+        if (len == 0)
+          continue;
+        TEST_ASSERT_FALSE(overlong);
+        log_record rec;
+        TEST_ASSERT_EQUAL(lines ? LOG_RECORD_OK : LOG_RECORD_HEADER_LINE, ParseLogRecord(line, len, &rec));
+        lines++;
+      }
+      pos += n;
+    }
+    TEST_ASSERT_EQUAL(3, lines);
+    const char* rest;
+    TEST_ASSERT_EQUAL(0, splitter.pending(&rest));
+  }
+}
+
+void test_splitter_torn_tail(void) {
+  // power lost in the middle of the second record
+  const char* stream = GOLDEN_LINE "2020-08-30 12:01:00;-3.25";
+  LogLineSplitter splitter;
+  const char* line;
+  size_t len;
+  bool overlong;
+  size_t off = splitter.push(stream, strlen(stream), &line, &len, &overlong);
+  TEST_ASSERT_EQUAL(strlen(GOLDEN_LINE), off);
+  off += splitter.push(stream + off, strlen(stream) - off, &line, &len, &overlong);
+  TEST_ASSERT_EQUAL(strlen(stream), off);
+  TEST_ASSERT_EQUAL(0, len);
+  size_t torn = splitter.pending(&line);
+  TEST_ASSERT_EQUAL(strlen(stream) - strlen(GOLDEN_LINE), torn);
+  log_record rec;
+  TEST_ASSERT_EQUAL(LOG_RECORD_CORRUPT, ParseLogRecord(line, torn, &rec));
+}
+
+void test_splitter_overlong(void) {
+  char junk[3 * LOG_RECORD_MAX_LEN];
+  memset(junk, 'x', sizeof(junk));
+  junk[sizeof(junk) - 1] = '\n';
+  LogLineSplitter splitter;
+  int cut = 0;
+  for (size_t off = 0; off < sizeof(junk); ) {
+    const char* line;
+    size_t len;
+    bool overlong;
+    off += splitter.push(junk + off, sizeof(junk) - off, &line, &len, &overlong);
+    if (len) {
+      TEST_ASSERT_LESS_OR_EQUAL(LOG_RECORD_MAX_LEN, len);
+      cut += overlong;
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(0, cut);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_crc_check_value);
+  RUN_TEST(test_crc_continues);
+  RUN_TEST(test_format_golden);
+  RUN_TEST(test_format_too_small);
+  RUN_TEST(test_parse_golden);
+  RUN_TEST(test_parse_legacy_and_header);
+  RUN_TEST(test_parse_detects_corruption);
+  RUN_TEST(test_time_roundtrip);
+  RUN_TEST(test_splitter_any_chunking);
+  RUN_TEST(test_splitter_torn_tail);
+  RUN_TEST(test_splitter_overlong);
+  return UNITY_END();
+}
@@ -0,0 +1,127 @@
+// Unit tests of log file naming, rotation periods and metadata sidecars
+
+#include <string.h>
+#include <unity.h>
+
+#include "LogRotation.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_file_names(void) {
+  char name[64];
+  uint32_t t = LogMakeTime(2020, 8, 30, 12, 34, 56);
+  TEST_ASSERT_EQUAL(strlen("/logs/2020-08_hmd.csv"), LogFileNameFor(name, sizeof(name), "/logs", LOG_ROTATE_MONTHLY, t, 0));
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-08_hmd.csv", name);
+  LogFileNameFor(name, sizeof(name), "/logs", LOG_ROTATE_DAILY, t, 0);
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-08-30_hmd.csv", name);
+  LogFileNameFor(name, sizeof(name), "/logs", LOG_ROTATE_HOURLY, t, 0);
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-08-30T12_hmd.csv", name);
+  LogFileNameFor(name, sizeof(name), "/logs", LOG_ROTATE_DAILY, t, 7);
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-08-30_hmd_007.csv", name);
+  // a following part sorts after the first one
+  char first[64];
+  LogFileNameFor(first, sizeof(first), "/logs", LOG_ROTATE_DAILY, t, 0);
+  TEST_ASSERT_TRUE(strcmp(first, name) < 0);
+  TEST_ASSERT_EQUAL(0, LogFileNameFor(name, 10, "/logs", LOG_ROTATE_MONTHLY, t, 0));
+}
+
+void test_period_boundaries(void) {
+  char before[64];
+  char after[64];
+  // the last second of a period and the first of the next
+  LogFileNameFor(before, sizeof(before), "/logs", LOG_ROTATE_MONTHLY, LogMakeTime(2020, 12, 31, 23, 59, 59), 0);
+  LogFileNameFor(after, sizeof(after), "/logs", LOG_ROTATE_MONTHLY, LogMakeTime(2021, 1, 1, 0, 0, 0), 0);
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-12_hmd.csv", before);
+  TEST_ASSERT_EQUAL_STRING("/logs/2021-01_hmd.csv", after);
+  LogFileNameFor(before, sizeof(before), "/logs", LOG_ROTATE_HOURLY, LogMakeTime(2020, 2, 29, 9, 59, 59), 0);
+  LogFileNameFor(after, sizeof(after), "/logs", LOG_ROTATE_HOURLY, LogMakeTime(2020, 2, 29, 10, 0, 0), 0);
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-02-29T09_hmd.csv", before);
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-02-29T10_hmd.csv", after);
+  TEST_ASSERT_EQUAL_UINT32(3600, LogRotationSeconds(LOG_ROTATE_HOURLY));
+  TEST_ASSERT_EQUAL_UINT32(86400, LogRotationSeconds(LOG_ROTATE_DAILY));
+  TEST_ASSERT_EQUAL_UINT32(31 * 86400, LogRotationSeconds(LOG_ROTATE_MONTHLY));
+}
+
+void test_file_spans(void) {
+  uint32_t first, last;
+  TEST_ASSERT_TRUE(LogFileSpan("/logs/2020-02_hmd.csv", &first, &last));
+  TEST_ASSERT_EQUAL_UINT32(LogMakeTime(2020, 2, 1, 0, 0, 0), first);
+  TEST_ASSERT_EQUAL_UINT32(LogMakeTime(2020, 3, 1, 0, 0, 0) - 1, last);
+  TEST_ASSERT_TRUE(LogFileSpan("2020-12_hmd_003.csv", &first, &last));
+  TEST_ASSERT_EQUAL_UINT32(LogMakeTime(2021, 1, 1, 0, 0, 0) - 1, last);
+  TEST_ASSERT_TRUE(LogFileSpan("2020-08-30_hmd.csv", &first, &last));
+  TEST_ASSERT_EQUAL_UINT32(LogMakeTime(2020, 8, 30, 0, 0, 0), first);
+  TEST_ASSERT_EQUAL_UINT32(first + 86399, last);
+  TEST_ASSERT_TRUE(LogFileSpan("2020-08-30T23_hmd.csv", &first, &last));
+  TEST_ASSERT_EQUAL_UINT32(LogMakeTime(2020, 8, 30, 23, 0, 0), first);
+  TEST_ASSERT_EQUAL_UINT32(first + 3599, last);
+  // every name LogFileNameFor() makes spans the time it was made for
+  uint32_t t = LogMakeTime(2021, 7, 14, 5, 6, 7);
+  const log_rotation periods[] = {LOG_ROTATE_MONTHLY, LOG_ROTATE_DAILY, LOG_ROTATE_HOURLY};
+  for (int i = 0; i < 3; i++) {
+    char name[64];
+    LogFileNameFor(name, sizeof(name), "/logs", periods[i], t, 2);
+    TEST_ASSERT_TRUE(LogFileSpan(name, &first, &last));
+    TEST_ASSERT_TRUE(first <= t && t <= last);
+  }
+  TEST_ASSERT_FALSE(LogFileSpan("boot.txt", &first, &last));
+  TEST_ASSERT_FALSE(LogFileSpan("2020-13_hmd.csv", &first, &last));
+  TEST_ASSERT_FALSE(LogFileSpan("2020-08-30T24_hmd.csv", &first, &last));
+}
+
+void test_meta_names(void) {
+  char buf[64];
+  TEST_ASSERT_EQUAL(strlen("/logs/2020-08_hmd.meta"), LogMetaNameFor(buf, sizeof(buf), "/logs/2020-08_hmd.csv"));
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-08_hmd.meta", buf);
+  TEST_ASSERT_TRUE(IsLogMetaName(buf));
+  TEST_ASSERT_FALSE(IsLogMetaName("/logs/2020-08_hmd.csv"));
+  TEST_ASSERT_EQUAL(0, LogMetaNameFor(buf, 10, "/logs/2020-08_hmd.csv"));
+}
+
+void test_meta_accounting(void) {
+  log_meta meta;
+  LogMetaClear(&meta);
+  const char* data = LOG_RECORD_HEADER "2020-08-30 12:00:00;21.500000;45.000000;1;00000000\n";
+  LogMetaAddBytes(&meta, data, 10);
+  LogMetaAddBytes(&meta, data + 10, strlen(data) - 10);
+  LogMetaAddRecord(&meta, 200);
+  LogMetaAddRecord(&meta, 100);
+  LogMetaAddRecord(&meta, 300);
+  TEST_ASSERT_EQUAL_UINT32(strlen(data), meta.dataBytes);
+  TEST_ASSERT_EQUAL_HEX32(LogCrc32(data, strlen(data)), meta.crc);
+  TEST_ASSERT_EQUAL_UINT32(3, meta.count);
+  TEST_ASSERT_EQUAL_UINT32(100, meta.first);
+  TEST_ASSERT_EQUAL_UINT32(300, meta.last);
+}
+
+void test_meta_roundtrip(void) {
+  log_meta meta = {1598788800, 1598792400, 61, 3702, 0x0a3d2976, true};
+  char buf[LOG_META_MAX_LEN];
+  size_t n = FormatLogMeta(buf, sizeof(buf), meta);
+  TEST_ASSERT_GREATER_THAN(0, n);
+  TEST_ASSERT_EQUAL_STRING_LEN("M1;1598788800;1598792400;61;3702;0a3d2976;1;", buf, 44);
+  log_meta back;
+  TEST_ASSERT_TRUE(ParseLogMeta(buf, n, &back));
+  TEST_ASSERT_EQUAL_UINT32(meta.first, back.first);
+  TEST_ASSERT_EQUAL_UINT32(meta.last, back.last);
+  TEST_ASSERT_EQUAL_UINT32(meta.count, back.count);
+  TEST_ASSERT_EQUAL_UINT32(meta.dataBytes, back.dataBytes);
+  TEST_ASSERT_EQUAL_HEX32(meta.crc, back.crc);
+  TEST_ASSERT_TRUE(back.closed);
+  // a damaged sidecar is refused
+  buf[5] = buf[5] == '9' ? '8' : '9';
+  TEST_ASSERT_FALSE(ParseLogMeta(buf, n, &back));
+  TEST_ASSERT_FALSE(ParseLogMeta(buf, 20, &back));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_file_names);
+  RUN_TEST(test_period_boundaries);
+  RUN_TEST(test_file_spans);
+  RUN_TEST(test_meta_names);
+  RUN_TEST(test_meta_accounting);
+  RUN_TEST(test_meta_roundtrip);
+  return UNITY_END();
+}
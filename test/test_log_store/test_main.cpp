@@ -0,0 +1,233 @@
+// Unit tests of LogStore on the tools/host SdFat: torn tail recovery and rotation
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unity.h>
+
+#include "LogStore.h"
+
+#define LINE1 "2020-08-30 12:00:00.250;21.500000;45.000000;17;0a3d2976\n"
+#define LINE2 "2020-08-30 12:01:00;-3.250000;99.900002;18;614016dd\n"
+
+static char root[64];
+static SdFat sd;
+
+static void hostPath(char* buf, size_t size, const char* name) {
+  snprintf(buf, size, "%s%s", root, name);
+}
+
+static void writeFile(const char* name, const char* data, size_t len) {
+  char path[128];
+  hostPath(path, sizeof(path), name);
+  FILE* f = fopen(path, "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  fwrite(data, 1, len, f);
+  fclose(f);
+}
+
+// whole file, -1 if it does not exist
+static long readFile(const char* name, char* buf, size_t size) {
+  char path[128];
+  hostPath(path, sizeof(path), name);
+  FILE* f = fopen(path, "rb");
+  if (!f)
+    return -1;
+  long n = fread(buf, 1, size, f);
+  fclose(f);
+  return n;
+}
+
+static bool exists(const char* name) {
+  char path[128];
+  struct stat st;
+  hostPath(path, sizeof(path), name);
+  return stat(path, &st) == 0;
+}
+
+// the last record of a file
+static log_record_status lastRecord(const char* name, uint32_t end, log_record* rec) {
+  static char buf[65536];
+  long n = readFile(name, buf, sizeof(buf));
+  TEST_ASSERT_TRUE(n >= (long)end && end > 0);
+  uint32_t start = end - 1;
+  while (start > 0 && buf[start - 1] != '\n')
+    start--;
+  return ParseLogRecord(buf + start, end - start, rec);
+}
+
+void setUp(void) {
+  strcpy(root, "/tmp/logstore_XXXXXX");
+  TEST_ASSERT_NOT_NULL(mkdtemp(root));
+  char path[128];
+  hostPath(path, sizeof(path), "/logs");
+  mkdir(path, 0755);
+  SdFat::hostRoot(root);
+  SdFat::hostContiguous(false);
+  TEST_ASSERT_TRUE(sd.begin(0, 0));
+}
+
+void tearDown(void) {
+  char cmd[128];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+  system(cmd);
+}
+
+//=============================================================================
+// recovery
+
+void test_recover_truncates_torn_tail(void) {
+  const char* torn = "2020-08-30 12:02:00;21.";
+  char data[512];
+  int len = snprintf(data, sizeof(data), "%s%s%s%s", LOG_RECORD_HEADER, LINE1, LINE2, torn);
+  writeFile("/logs/2020-08_hmd.csv", data, len);
+
+  LogStore store(sd, "/logs");
+  TEST_ASSERT_TRUE(store.recover(LogMakeTime(2020, 8, 30, 12, 5, 0)));
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-08_hmd.csv", store.activeName());
+  TEST_ASSERT_EQUAL_UINT32(18, store.seq());
+  TEST_ASSERT_EQUAL_UINT32(strlen(torn), store.recoveredBytes());
+  uint32_t clean = len - strlen(torn);
+  TEST_ASSERT_EQUAL_UINT32(clean, store.dataEnd());
+  TEST_ASSERT_EQUAL(clean, readFile("/logs/2020-08_hmd.csv", data, sizeof(data)));
+
+  // the next record follows the last good one
+  TEST_ASSERT_TRUE(store.append("2020-08-30 12:05:00", 22.0f, 50.0f));
+  log_record rec;
+  TEST_ASSERT_EQUAL(LOG_RECORD_OK, lastRecord("/logs/2020-08_hmd.csv", store.dataEnd(), &rec));
+  TEST_ASSERT_EQUAL_UINT32(19, rec.seq);
+  TEST_ASSERT_EQUAL_UINT32(LogMakeTime(2020, 8, 30, 12, 5, 0), rec.time);
+}
+
+void test_recover_drops_corrupt_last_record(void) {
+  char data[512];
+  int len = snprintf(data, sizeof(data), "%s%s%s", LOG_RECORD_HEADER, LINE1, LINE2);
+  // a complete line whose CRC does not match
+  data[len - 3] = data[len - 3] == '0' ? '1' : '0';
+  writeFile("/logs/2020-08_hmd.csv", data, len);
+
+  LogStore store(sd, "/logs");
+  TEST_ASSERT_TRUE(store.recover(LogMakeTime(2020, 8, 30, 12, 5, 0)));
+  TEST_ASSERT_EQUAL_UINT32(17, store.seq());
+  TEST_ASSERT_EQUAL_UINT32(strlen(LINE2), store.recoveredBytes());
+}
+
+void test_recover_keeps_clean_file(void) {
+  char data[512];
+  int len = snprintf(data, sizeof(data), "%s%s%s", LOG_RECORD_HEADER, LINE1, LINE2);
+  writeFile("/logs/2020-08_hmd.csv", data, len);
+
+  LogStore store(sd, "/logs");
+  TEST_ASSERT_TRUE(store.recover(LogMakeTime(2020, 8, 30, 12, 5, 0)));
+  TEST_ASSERT_EQUAL_UINT32(0, store.recoveredBytes());
+  TEST_ASSERT_EQUAL_UINT32(len, store.dataEnd());
+  // the metadata is rebuilt from the records
+  log_meta meta;
+  TEST_ASSERT_TRUE(store.readMeta("2020-08_hmd.csv", &meta));
+  TEST_ASSERT_EQUAL_UINT32(2, meta.count);
+  TEST_ASSERT_EQUAL_UINT32(len, meta.dataBytes);
+  TEST_ASSERT_EQUAL_HEX32(LogCrc32(data, len), meta.crc);
+}
+
+void test_recover_preallocated(void) {
+  SdFat::hostContiguous(true);
+  uint32_t now = LogMakeTime(2020, 8, 30, 12, 0, 0);
+  uint32_t end;
+  {
+    LogStore store(sd, "/logs");
+    store.setPreallocSize(8192);
+    TEST_ASSERT_TRUE(store.recover(now));
+    TEST_ASSERT_TRUE(store.append("2020-08-30 12:00:00", 21.0f, 40.0f));
+    TEST_ASSERT_TRUE(store.append("2020-08-30 12:01:00", 21.1f, 41.0f));
+    TEST_ASSERT_TRUE(store.preallocated());
+    end = store.dataEnd();
+  }
+  // power lost while the third record was written
+  char path[128];
+  hostPath(path, sizeof(path), "/logs/2020-08_hmd.csv");
+  FILE* f = fopen(path, "r+b");
+  TEST_ASSERT_NOT_NULL(f);
+  fseek(f, end, SEEK_SET);
+  fputs("2020-08-30 12:02:00;21.2", f);
+  fclose(f);
+
+  LogStore store(sd, "/logs");
+  store.setPreallocSize(8192);
+  TEST_ASSERT_TRUE(store.recover(now));
+  TEST_ASSERT_TRUE(store.preallocated());
+  TEST_ASSERT_EQUAL_UINT32(end, store.dataEnd());
+  TEST_ASSERT_EQUAL_UINT32(2, store.seq());
+  // the torn bytes are blank again, so the next boot finds the same end
+  static char buf[8192];
+  TEST_ASSERT_EQUAL(8192, readFile("/logs/2020-08_hmd.csv", buf, sizeof(buf)));
+  for (uint32_t i = end; i < sizeof(buf); i++)
+    TEST_ASSERT_EQUAL_HEX8(0, buf[i]);
+  SdFat::hostContiguous(false);
+}
+
+//=============================================================================
+// rotation
+
+void test_rotation_on_period_change(void) {
+  LogStore store(sd, "/logs");
+  log_rotation_policy policy = {LOG_ROTATE_DAILY, 0};
+  store.setRotation(policy);
+  TEST_ASSERT_TRUE(store.recover(LogMakeTime(2020, 8, 30, 23, 0, 0)));
+  TEST_ASSERT_TRUE(store.append("2020-08-30 23:59:00", 20.0f, 50.0f));
+  TEST_ASSERT_TRUE(store.append("2020-08-31 00:00:00", 20.0f, 50.0f));
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-08-31_hmd.csv", store.activeName());
+  TEST_ASSERT_EQUAL_UINT32(1, store.seq());
+
+  // the previous day is closed with its metadata
+  log_meta meta;
+  TEST_ASSERT_TRUE(store.readMeta("2020-08-30_hmd.csv", &meta));
+  TEST_ASSERT_TRUE(meta.closed);
+  TEST_ASSERT_EQUAL_UINT32(1, meta.count);
+  TEST_ASSERT_EQUAL_UINT32(LogMakeTime(2020, 8, 30, 23, 59, 0), meta.first);
+}
+
+void test_rotation_on_size(void) {
+  LogStore store(sd, "/logs");
+  uint32_t maxBytes = strlen(LOG_RECORD_HEADER) + 3 * strlen(LINE2);
+  log_rotation_policy policy = {LOG_ROTATE_MONTHLY, maxBytes};
+  store.setRotation(policy);
+  TEST_ASSERT_TRUE(store.recover(LogMakeTime(2020, 8, 1, 0, 0, 0)));
+  char time[24];
+  for (int i = 0; i < 10; i++) {
+    snprintf(time, sizeof(time), "2020-08-01 00:%02d:00", i);
+    TEST_ASSERT_TRUE(store.append(time, 20.0f, 50.0f));
+  }
+  TEST_ASSERT_TRUE(exists("/logs/2020-08_hmd.csv"));
+  TEST_ASSERT_TRUE(exists("/logs/2020-08_hmd_001.csv"));
+  TEST_ASSERT_TRUE(exists("/logs/2020-08_hmd_002.csv"));
+  TEST_ASSERT_TRUE(exists("/logs/2020-08_hmd_003.csv"));
+  TEST_ASSERT_FALSE(exists("/logs/2020-08_hmd_004.csv"));
+  static char buf[1024];
+  const char* parts[] = {"/logs/2020-08_hmd.csv", "/logs/2020-08_hmd_001.csv", "/logs/2020-08_hmd_002.csv"};
+  for (int i = 0; i < 3; i++) {
+    long n = readFile(parts[i], buf, sizeof(buf));
+    TEST_ASSERT_TRUE(n > 0 && (uint32_t)n <= maxBytes);
+  }
+
+  // a new month starts again without a part number
+  TEST_ASSERT_TRUE(store.append("2020-09-01 00:00:00", 20.0f, 50.0f));
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-09_hmd.csv", store.activeName());
+
+  // recovery continues the last part of the current period
+  LogStore again(sd, "/logs");
+  again.setRotation(policy);
+  TEST_ASSERT_TRUE(again.recover(LogMakeTime(2020, 8, 1, 1, 0, 0)));
+  TEST_ASSERT_EQUAL_STRING("/logs/2020-08_hmd_003.csv", again.activeName());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_recover_truncates_torn_tail);
+  RUN_TEST(test_recover_drops_corrupt_last_record);
+  RUN_TEST(test_recover_keeps_clean_file);
+  RUN_TEST(test_recover_preallocated);
+  RUN_TEST(test_rotation_on_period_change);
+  RUN_TEST(test_rotation_on_size);
+  return UNITY_END();
+}
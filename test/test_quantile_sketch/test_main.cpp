@@ -0,0 +1,147 @@
+// Unit tests of the rank error bounds and persistence of QuantileSketch
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "QuantileSketch.h"
+
+#define SAMPLES 86400
+
+static float samples[SAMPLES];
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// deterministic pseudo random in [0, 1)
+static uint32_t rng = 1;
+static float uniform() {
+  rng = rng * 1664525u + 1013904223u;
+  return (rng >> 8) / 16777216.0f;
+}
+
+static int compareFloat(const void* a, const void* b) {
+  float x = *(const float*)a;
+  float y = *(const float*)b;
+  return x < y ? -1 : x > y;
+}
+
+// fraction of the sorted samples at or below value
+static float exactRank(const float* sorted, size_t n, float value) {
+  size_t lo = 0;
+  size_t hi = n;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (sorted[mid] <= value)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return (float)lo / n;
+}
+
+// a day of readings: a daily swing, noise and a few spikes
+static void fillDay(float* out, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = 20.0f + 5.0f * sinf(i * 2 * 3.14159265f / n) + 2.0f * (uniform() - 0.5f);
+    if (uniform() < 0.001f)
+      out[i] += 15.0f;
+  }
+}
+
+static void assertRankError(QuantileSketch& sketch, const float* sorted, size_t n) {
+  const float qs[] = {0.01f, 0.05f, 0.25f, 0.5f, 0.75f, 0.95f, 0.99f};
+  // the arcsine scale keeps the tails tighter than the middle
+  const float bounds[] = {0.003f, 0.006f, 0.02f, 0.02f, 0.02f, 0.006f, 0.003f};
+  for (int i = 0; i < 7; i++) {
+    float rank = exactRank(sorted, n, sketch.quantile(qs[i]));
+    TEST_ASSERT_FLOAT_WITHIN(bounds[i], qs[i], rank);
+  }
+}
+
+void test_empty(void) {
+  QuantileSketch sketch;
+  TEST_ASSERT_EQUAL_UINT32(0, sketch.count());
+  TEST_ASSERT_TRUE(isnan(sketch.quantile(0.5f)));
+  TEST_ASSERT_TRUE(isnan(sketch.mean()));
+  sketch.add(NAN);
+  TEST_ASSERT_EQUAL_UINT32(0, sketch.count());
+}
+
+void test_exact_extremes(void) {
+  QuantileSketch sketch;
+  for (int i = 0; i < 1000; i++)
+    sketch.add((float)((i * 37) % 1000));
+  TEST_ASSERT_EQUAL_UINT32(1000, sketch.count());
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, sketch.min());
+  TEST_ASSERT_EQUAL_FLOAT(999.0f, sketch.max());
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, sketch.quantile(0.0f));
+  TEST_ASSERT_EQUAL_FLOAT(999.0f, sketch.quantile(1.0f));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 499.5f, sketch.mean());
+  TEST_ASSERT_TRUE(sketch.centroids() <= QUANTILE_CENTROIDS);
+}
+
+void test_rank_error_one_day(void) {
+  rng = 1;
+  fillDay(samples, SAMPLES);
+  QuantileSketch sketch;
+  for (size_t i = 0; i < SAMPLES; i++)
+    sketch.add(samples[i]);
+  qsort(samples, SAMPLES, sizeof(float), compareFloat);
+  assertRankError(sketch, samples, SAMPLES);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 0.95f, sketch.cdf(sketch.quantile(0.95f)));
+}
+
+void test_rank_error_merged_days(void) {
+  // a week merged from daily sketches, as the range report does
+  static float week[7 * 8640];
+  QuantileSketch total;
+  rng = 7;
+  for (int d = 0; d < 7; d++) {
+    float* day = week + d * 8640;
+    fillDay(day, 8640);
+    for (int i = 0; i < 8640; i++)
+      day[i] += d;
+    QuantileSketch sketch;
+    for (int i = 0; i < 8640; i++)
+      sketch.add(day[i]);
+    total.merge(sketch);
+  }
+  TEST_ASSERT_EQUAL_UINT32(7 * 8640, total.count());
+  qsort(week, 7 * 8640, sizeof(float), compareFloat);
+  assertRankError(total, week, 7 * 8640);
+}
+
+void test_save_load(void) {
+  QuantileSketch sketch;
+  rng = 3;
+  for (int i = 0; i < 5000; i++)
+    sketch.add(uniform() * 100);
+  quantile_channel saved;
+  sketch.save(&saved);
+  QuantileSketch back;
+  TEST_ASSERT_TRUE(back.load(saved));
+  TEST_ASSERT_EQUAL_UINT32(sketch.count(), back.count());
+  TEST_ASSERT_EQUAL_FLOAT(sketch.min(), back.min());
+  TEST_ASSERT_EQUAL_FLOAT(sketch.max(), back.max());
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, sketch.quantile(0.5f), back.quantile(0.5f));
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, sketch.quantile(0.95f), back.quantile(0.95f));
+
+  // weights that do not add up to the count are refused
+  saved.count += 1000;
+  TEST_ASSERT_FALSE(back.load(saved));
+  saved.count -= 1000;
+  saved.centroids = QUANTILE_CENTROIDS + 1;
+  TEST_ASSERT_FALSE(back.load(saved));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_exact_extremes);
+  RUN_TEST(test_rank_error_one_day);
+  RUN_TEST(test_rank_error_merged_days);
+  RUN_TEST(test_save_load);
+  return UNITY_END();
+}
@@ -0,0 +1,115 @@
+// Host benchmark of alert rule evaluation against the number of rules
+/**
+ * \file
+ * \brief alert_bench, cost of AlertEngine::evaluate() per reading
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -DALERT_MAX_RULES=128 -Iinclude tools/alert_bench.cpp src/AlertRules.cpp -o alert_bench
+ *   ./alert_bench [readings]
+ *
+ * Feeds a day of readings at the 2.5 s sensor interval (a drifting
+ * temperature with excursions, humidity and a failed read now and then)
+ * through tables of 1 to ALERT_MAX_RULES rules that mix every rule type.
+ * The firmware allows 16 rules; the larger tables show that the cost
+ * stays linear. The numbers are host CPU time; the "alerts" stage of
+ * /api/perf gives the cost on the device.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+#include "AlertRules.h"
+
+#define SAMPLE_MS 2500
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct reading {
+  float temperature;
+  float humidity;
+  bool ok;
+};
+
+static std::vector<reading> makeReadings(uint32_t count) {
+  std::vector<reading> readings(count);
+  for (uint32_t i = 0; i < count; i++) {
+    reading& r = readings[i];
+    float minutes = i * SAMPLE_MS / 60000.0f;
+    r.ok = rand() % 500 != 0;
+    // a freezer around -18 with a defrost excursion every 8 hours
+    r.temperature = -18.0f + 1.5f * sinf(minutes * 2 * M_PI / 45) + (rand() % 5) * 0.1f;
+    if (fmodf(minutes, 480) < 25)
+      r.temperature += fmodf(minutes, 480) * 0.6f;
+    r.humidity = 60.0f + 15.0f * sinf(minutes * 2 * M_PI / 1440);
+    if (!r.ok)
+      r.temperature = r.humidity = NAN;
+  }
+  return readings;
+}
+
+// every rule type, with limits spread so some fire and some never do
+static std::vector<alert_rule> makeRules(uint32_t count) {
+  static const char* templates[] = {"t>%d~0.5@60", "t<%d", "t+%d/600", "h>%d@300", "h-%d/900", "fault@30"};
+  std::vector<alert_rule> rules;
+  char spec[ALERT_RULE_MAX_LEN];
+  for (uint32_t i = 0; i < count; i++) {
+    int kind = i % 6;
+    int limit = kind == 0 ? -16 + (int)(i / 6) % 20 : kind == 1 ? -22 + (int)(i / 6) % 5 :
+                kind == 3 ? 65 + (int)(i / 6) % 15 : 1 + (int)(i / 6) % 8;
+    snprintf(spec, sizeof(spec), templates[kind], limit);
+    alert_rule rule;
+    uint8_t parsed;
+    size_t errorAt;
+    if (!ParseAlertRules(spec, &rule, 1, &parsed, &errorAt) || parsed != 1) {
+      fprintf(stderr, "bad rule %s at %zu\n", spec, errorAt);
+      exit(1);
+    }
+    rules.push_back(rule);
+  }
+  return rules;
+}
+
+int main(int argc, char** argv) {
+  uint32_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 86400000 / SAMPLE_MS;
+  std::vector<reading> readings = makeReadings(count);
+  printf("input: %u readings, %d ms apart\n", count, SAMPLE_MS);
+  printf("%6s %12s %10s %10s %10s\n", "rules", "ns/reading", "ns/rule", "raised", "bytes");
+
+  static AlertEngine engine;
+  for (uint32_t n = 1; n <= ALERT_MAX_RULES; n *= 2) {
+    std::vector<alert_rule> rules = makeRules(n);
+    uint32_t events = 0;
+    uint32_t raised = 0;
+    int runs = 0;
+    double start = now();
+    double elapsed;
+    do {
+      engine.setRules(&rules[0], n);
+      uint32_t before = engine.raised();
+      alert_event event;
+      for (uint32_t i = 0; i < count; i++) {
+        const reading& r = readings[i];
+        if (engine.evaluate(i * SAMPLE_MS, 1600000000 + i * SAMPLE_MS / 1000, r.temperature, r.humidity, r.ok)) {
+          while (engine.nextEvent(&event))
+            events++;
+        }
+      }
+      raised = engine.raised() - before;
+      runs++;
+      elapsed = now() - start;
+    } while (elapsed < 0.5);
+    double perReading = elapsed / runs / count * 1e9;
+    printf("%6u %12.1f %10.2f %10u %10zu\n", n, perReading, perReading / n, raised,
+           n * sizeof(alert_rule));
+  }
+  printf("engine: %zu bytes for %d rules\n", sizeof(AlertEngine), ALERT_MAX_RULES);
+  return 0;
+}
@@ -0,0 +1,117 @@
+# Compare flash, RAM and boot time of the firmware variants in platformio.ini
+#
+# Run from the repository root:
+#   python tools/compare_variants.py [env ...]
+#   python tools/compare_variants.py --boot /dev/ttyUSB0 [env ...]
+#   python tools/compare_variants.py --markdown --boot /dev/ttyUSB0
+#
+# Builds each environment (all of them by default) with `pio run` and
+# tabulates the RAM and Flash figures PlatformIO prints at the end of the
+# link, with the difference to the first one. With --boot each variant is
+# also uploaded to the board on that port and the boot phases it dumps on
+# Serial at its first record (BootProfile::dump()) are read back; this
+# needs pyserial, which PlatformIO already installs. --markdown prints the
+# table in the form of the one in README.md.
+
+import argparse
+import re
+import subprocess
+import sys
+import time
+
+ENVS = ["esp32doit-devkit-v1", "headless", "sensor-only", "offline"]
+# BootProfile phases shown, in ms after reset
+PHASES = ["setupDone", "gotIP", "firstSample", "firstRecord"]
+SIZE = re.compile(r"^(RAM|Flash):.*\(used (\d+) bytes from (\d+) bytes\)", re.M)
+PHASE = re.compile(r"^\s+(\w+)\s+(\d+) ms")
+BOOT_TIMEOUT = 180
+
+
+def build(env):
+    out = subprocess.run(["pio", "run", "-e", env], stdout=subprocess.PIPE,
+                         stderr=subprocess.STDOUT, universal_newlines=True)
+    if out.returncode != 0:
+        sys.stdout.write(out.stdout)
+        sys.exit("build of %s failed" % env)
+    sizes = {}
+    for kind, used, total in SIZE.findall(out.stdout):
+        sizes[kind] = (int(used), int(total))
+    return sizes
+
+
+def boot(env, port):
+    import serial
+
+    subprocess.run(["pio", "run", "-e", env, "-t", "upload", "--upload-port", port],
+                   stdout=subprocess.DEVNULL, check=True)
+    phases = {}
+    with serial.Serial(port, 115200, timeout=1) as tty:
+        # reset through RTS like the monitor does
+        tty.rts = True
+        time.sleep(0.1)
+        tty.rts = False
+        deadline = time.time() + BOOT_TIMEOUT
+        dumping = False
+        while time.time() < deadline:
+            line = tty.readline().decode("ascii", "replace")
+            if line.startswith("Boot phases"):
+                dumping = True
+                continue
+            m = PHASE.match(line)
+            if dumping and m:
+                phases[m.group(1)] = int(m.group(2))
+            elif dumping:
+                break
+    if not phases:
+        print("%s: no boot dump within %d s, is the SD card in?" % (env, BOOT_TIMEOUT))
+    return phases
+
+
+def print_markdown(rows, base, booted):
+    header = ["env", "flash", "RAM"] + (PHASES if booted else [])
+    print("| " + " | ".join(header) + " |")
+    print("|" + "---|" * len(header))
+    for env, sizes, phases in rows:
+        cells = ["`%s`" % env]
+        for kind in ("Flash", "RAM"):
+            used = sizes.get(kind, (0, 0))[0]
+            delta = used - base.get(kind, (0, 0))[0]
+            cells.append("%d (%+d)" % (used, delta) if delta else "%d" % used)
+        if booted:
+            cells += ["%s ms" % phases[p] if p in phases else "-" for p in PHASES]
+        print("| " + " | ".join(cells) + " |")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="compare the firmware variants")
+    parser.add_argument("--boot", metavar="PORT", help="also upload and time the boot")
+    parser.add_argument("--markdown", action="store_true", help="print a markdown table")
+    parser.add_argument("envs", nargs="*", default=ENVS)
+    args = parser.parse_args()
+
+    rows = []
+    for env in args.envs:
+        sizes = build(env)
+        phases = boot(env, args.boot) if args.boot else {}
+        rows.append((env, sizes, phases))
+
+    base = rows[0][1]
+    if args.markdown:
+        print_markdown(rows, base, args.boot)
+        return
+    header = "%-22s %10s %9s %10s %9s" % ("env", "flash", "delta", "ram", "delta")
+    if args.boot:
+        header += "".join(" %11s" % p for p in PHASES)
+    print(header)
+    for env, sizes, phases in rows:
+        line = "%-22s" % env
+        for kind in ("Flash", "RAM"):
+            used = sizes.get(kind, (0, 0))[0]
+            line += " %10d %+9d" % (used, used - base.get(kind, (0, 0))[0])
+        if args.boot:
+            line += "".join(" %11s" % phases.get(p, "-") for p in PHASES)
+        print(line)
+
+
+if __name__ == "__main__":
+    main()
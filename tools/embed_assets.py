@@ -0,0 +1,104 @@
+# Embed data/ into flash as a gzipped asset table
+#
+# Runs as a PlatformIO pre script (extra_scripts = pre:tools/embed_assets.py)
+# and can be run by hand from the repository root:
+#   python tools/embed_assets.py
+#
+# Writes src/WebAssetsData.cpp with one const array per file, sorted by URL
+# for FindWebAsset(). Files are gzipped with a fixed mtime so the output,
+# and the ETag (sha256 of the bytes sent), only change with the content.
+# Files already ending in .gz are served under the name without it.
+# The output is only rewritten when it changes, so it does not force a
+# rebuild.
+
+import gzip
+import hashlib
+import os
+import sys
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".htm": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".json": "application/json",
+    ".png": "image/png",
+    ".gif": "image/gif",
+    ".jpg": "image/jpeg",
+    ".ico": "image/x-icon",
+    ".svg": "image/svg+xml",
+    ".txt": "text/plain",
+}
+
+
+def collect(data_dir):
+    assets = []
+    for root, dirs, files in os.walk(data_dir):
+        dirs.sort()
+        for name in sorted(files):
+            path = os.path.join(root, name)
+            url = "/" + os.path.relpath(path, data_dir).replace(os.sep, "/")
+            with open(path, "rb") as f:
+                raw = f.read()
+            if url.endswith(".gz"):
+                url = url[:-3]
+                body, gz = raw, True
+            else:
+                packed = gzip.compress(raw, 9, mtime=0)
+                body, gz = (packed, True) if len(packed) < len(raw) else (raw, False)
+            ext = os.path.splitext(url)[1].lower()
+            assets.append({
+                "url": url,
+                "type": CONTENT_TYPES.get(ext, "application/octet-stream"),
+                "body": body,
+                "gzip": gz,
+                "etag": hashlib.sha256(body).hexdigest()[:16],
+                "raw": len(raw),
+            })
+    assets.sort(key=lambda a: a["url"])
+    return assets
+
+
+def render(assets):
+    out = ["// Generated by tools/embed_assets.py from data/, do not edit", "",
+           "#include \"WebAssets.h\"", ""]
+    for i, a in enumerate(assets):
+        out.append("// %s, %u -> %u bytes" % (a["url"], a["raw"], len(a["body"])))
+        out.append("static const uint8_t asset_%d[] = {" % i)
+        body = a["body"]
+        for off in range(0, len(body), 16):
+            out.append("  " + ", ".join("0x%02x" % b for b in body[off:off + 16]) + ",")
+        out.append("};")
+        out.append("")
+    out.append("const web_asset web_assets[] = {")
+    for i, a in enumerate(assets):
+        out.append("  {\"%s\", \"%s\", asset_%d, %u, \"\\\"%s\\\"\", %s}," %
+                   (a["url"], a["type"], i, len(a["body"]), a["etag"], "true" if a["gzip"] else "false"))
+    out.append("};")
+    out.append("const size_t web_asset_count = %d;" % len(assets))
+    out.append("")
+    return "\n".join(out)
+
+
+def generate(project_dir):
+    data_dir = os.path.join(project_dir, "data")
+    target = os.path.join(project_dir, "src", "WebAssetsData.cpp")
+    assets = collect(data_dir)
+    text = render(assets)
+    old = None
+    if os.path.exists(target):
+        with open(target) as f:
+            old = f.read()
+    if old != text:
+        with open(target, "w") as f:
+            f.write(text)
+    total = sum(len(a["body"]) for a in assets)
+    print("embed_assets: %d files, %u bytes in flash" % (len(assets), total))
+
+
+try:
+    Import("env")  # noqa: F821, defined when run by PlatformIO
+    generate(env.subst("$PROJECT_DIR"))  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        generate(sys.argv[1] if len(sys.argv) > 1 else os.getcwd())
@@ -0,0 +1,97 @@
+// Host benchmark of log record conversion to CSV, NDJSON and CBOR
+/**
+ * \file
+ * \brief export_bench, throughput of the LogExport conversions
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -Iinclude tools/export_bench.cpp src/LogRecord.cpp src/LogExport.cpp -o export_bench
+ *   ./export_bench [records]
+ *
+ * Runs the same split/parse/format path as LogExportResponse over a
+ * generated month of CSV held in memory, so the numbers are CPU cost
+ * only; on the device the SD read rate comes on top.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+#include "LogRecord.h"
+#include "LogExport.h"
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// one record a minute from 2020-08-01 with a daily temperature cycle
+static std::vector<char> makeCsv(uint32_t records) {
+  std::vector<char> csv(LOG_RECORD_HEADER, LOG_RECORD_HEADER + strlen(LOG_RECORD_HEADER));
+  uint32_t start = LogMakeTime(2020, 8, 1, 0, 0, 0);
+  char timeString[24];
+  char line[LOG_RECORD_MAX_LEN];
+  for (uint32_t i = 0; i < records; i++) {
+    uint32_t t = start + i * 60;
+    LogFormatTime(timeString, sizeof(timeString), t);
+    float temperature = 21.0f + 3.0f * sinf(i * 2 * M_PI / 1440) + (rand() % 10) * 0.01f;
+    float humidity = 45.0f + 10.0f * cosf(i * 2 * M_PI / 1440);
+    size_t len = FormatLogRecord(line, sizeof(line), timeString, temperature, humidity, i + 1);
+    csv.insert(csv.end(), line, line + len);
+  }
+  return csv;
+}
+
+// returns output bytes
+static size_t convert(const std::vector<char>& csv, log_format format, uint32_t* records) {
+  LogLineSplitter splitter;
+  uint8_t out[LOG_EXPORT_MAX_LEN];
+  size_t total = FormatExportHeader(out, sizeof(out), format);
+  size_t pos = 0;
+  *records = 0;
+  while (pos < csv.size()) {
+    const char* line;
+    size_t len;
+    bool overlong;
+    pos += splitter.push(&csv[pos], csv.size() - pos, &line, &len, &overlong);
+    log_record rec;
+    if (len == 0 || overlong)
+      continue;
+    log_record_status status = ParseLogRecord(line, len, &rec);
+    if (status != LOG_RECORD_OK && status != LOG_RECORD_LEGACY)
+      continue;
+    total += FormatExportRecord(out, sizeof(out), format, rec);
+    (*records)++;
+  }
+  total += FormatExportFooter(out, sizeof(out), format);
+  return total;
+}
+
+int main(int argc, char** argv) {
+  uint32_t records = argc > 1 ? strtoul(argv[1], NULL, 10) : 31 * 1440;
+  std::vector<char> csv = makeCsv(records);
+  printf("input: %u records, %zu bytes CSV\n", records, csv.size());
+  printf("%-8s %12s %10s %12s %10s\n", "format", "out bytes", "out/in", "records/s", "in MB/s");
+
+  static const log_format formats[] = {LOG_FORMAT_CSV, LOG_FORMAT_NDJSON, LOG_FORMAT_CBOR};
+  static const char* names[] = {"csv", "ndjson", "cbor"};
+  for (int f = 0; f < 3; f++) {
+    uint32_t converted = 0;
+    size_t bytes = 0;
+    int runs = 0;
+    double start = now();
+    double elapsed;
+    do {
+      bytes = convert(csv, formats[f], &converted);
+      runs++;
+      elapsed = now() - start;
+    } while (elapsed < 1.0);
+    double perRun = elapsed / runs;
+    printf("%-8s %12zu %10.2f %12.0f %10.1f\n", names[f], bytes, (double)bytes / csv.size(),
+           converted / perRun, csv.size() / perRun / 1e6);
+  }
+  return 0;
+}
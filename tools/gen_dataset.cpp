@@ -0,0 +1,300 @@
+// Host generator of synthetic multi-year log trees
+/**
+ * \file
+ * \brief gen_dataset, writes /logs as the logger would after years of use
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -Iinclude tools/gen_dataset.cpp src/LogRecord.cpp src/LogRotation.cpp -o gen_dataset
+ *   ./gen_dataset <root> [-y years] [-r month|day|hour] [-k maxKB] [-s seed] [-L legacyMonths] [-t]
+ *
+ * Files go to <root>/logs with the names, header, record format and
+ * metadata sidecars LogStore writes, one record a minute from 2020-08-01:
+ * - temperature and humidity follow a yearly and a daily cycle with noise,
+ *   in the 0.1 steps of the DHT22
+ * - power outages of minutes to days leave gaps, the first record after
+ *   one is the off-grid boot record
+ * - sensor failures skip single records and runs of records, as
+ *   WriteReadingsToSD does when there is no valid reading
+ * - periods roll over by the rotation policy, -k splits them into parts
+ * - the first -L months use the legacy 3 field format without CRC and
+ *   have no sidecar
+ * - the last file is left active: its sidecar lags behind by up to
+ *   LOG_META_INTERVAL records and -t leaves a torn last line
+ *
+ * The output only depends on the arguments, so two runs give the same
+ * tree for storage_bench.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "LogRecord.h"
+#include "LogRotation.h"
+
+// same as LogStore.h, which needs SdFat
+#define LOG_META_INTERVAL 60
+#define LOG_NAME_MAX 300
+
+#define LEGACY_HEADER "Time;Temperature;Humidity\n"
+
+// xorshift32, the same sequence on every host
+static uint32_t rng = 1;
+static uint32_t nextRandom() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+static bool chance(uint32_t oneIn) { return nextRandom() % oneIn == 0; }
+static uint32_t between(uint32_t lo, uint32_t hi) { return lo + nextRandom() % (hi - lo + 1); }
+
+struct gen_stats {
+  uint32_t files;
+  uint32_t records;
+  uint64_t bytes;
+  uint32_t outages;
+  uint32_t outageMinutes;
+  uint32_t skipped;
+};
+
+//=============================================================================
+
+class Writer {
+  private:
+    const char* _dir;
+    log_rotation_policy _rotation;
+    FILE* _file;
+    char _name[LOG_NAME_MAX];
+    uint16_t _part;
+    log_meta _meta;
+    log_meta _checkpoint;   // last sidecar write of the active file
+    uint16_t _pending;
+    bool _legacy;           // written before sidecars existed
+    gen_stats* _stats;
+    void _writeMeta(const log_meta& meta);
+  public:
+    Writer(const char* dir, const log_rotation_policy& rotation, gen_stats* stats);
+    bool append(uint32_t time, uint16_t ms, float temperature, float humidity, bool legacy);
+    void close();
+    void finish(bool torn);
+};
+
+Writer::Writer(const char* dir, const log_rotation_policy& rotation, gen_stats* stats) {
+  _dir = dir;
+  _rotation = rotation;
+  _file = NULL;
+  _name[0] = 0;
+  _part = 0;
+  _stats = stats;
+  _pending = 0;
+  _legacy = false;
+  LogMetaClear(&_meta);
+  LogMetaClear(&_checkpoint);
+}
+
+void Writer::_writeMeta(const log_meta& meta) {
+  char metaName[LOG_NAME_MAX];
+  char buf[LOG_META_MAX_LEN];
+  size_t len = FormatLogMeta(buf, sizeof(buf), meta);
+  if (_legacy || !LogMetaNameFor(metaName, sizeof(metaName), _name) || len == 0)
+    return;
+  FILE* f = fopen(metaName, "wb");
+  if (f) {
+    fwrite(buf, 1, len, f);
+    fclose(f);
+  }
+}
+
+void Writer::close() {
+  if (!_file)
+    return;
+  fclose(_file);
+  _file = NULL;
+  _meta.closed = true;
+  _writeMeta(_meta);
+}
+
+// same rollover rules as LogStore::append()
+bool Writer::append(uint32_t time, uint16_t ms, float temperature, float humidity, bool legacy) {
+  char name[LOG_NAME_MAX];
+  LogFileNameFor(name, sizeof(name), _dir, _rotation.period, time, _part);
+  if (_part && strcmp(name, _name) != 0) {
+    _part = 0;
+    LogFileNameFor(name, sizeof(name), _dir, _rotation.period, time, 0);
+  }
+
+  char timeString[32];
+  LogFormatTime(timeString, sizeof(timeString), time);
+  if (!legacy)
+    snprintf(timeString + 19, sizeof(timeString) - 19, ".%03u", (unsigned)ms);
+  char line[LOG_RECORD_MAX_LEN];
+  size_t len = legacy ? snprintf(line, sizeof(line), "%s;%f;%f\n", timeString, temperature, humidity)
+                      : FormatLogRecord(line, sizeof(line), timeString, temperature, humidity, _meta.count + 1);
+
+  if (_rotation.maxBytes && _file && strcmp(name, _name) == 0 && _meta.count &&
+      _meta.dataBytes + len > _rotation.maxBytes && _part < 999) {
+    _part++;
+    LogFileNameFor(name, sizeof(name), _dir, _rotation.period, time, _part);
+  }
+
+  if (strcmp(name, _name) != 0) {
+    close();
+    strcpy(_name, name);
+    LogMetaClear(&_meta);
+    LogMetaClear(&_checkpoint);
+    _pending = 0;
+    _legacy = legacy;
+    _file = fopen(_name, "wb");
+    if (!_file) {
+      fprintf(stderr, "cannot create %s: %s\n", _name, strerror(errno));
+      return false;
+    }
+    const char* header = legacy ? LEGACY_HEADER : LOG_RECORD_HEADER;
+    fputs(header, _file);
+    LogMetaAddBytes(&_meta, header, strlen(header));
+    _stats->bytes += strlen(header);
+    _stats->files++;
+    // the seq of the first record is 1
+    if (!legacy)
+      len = FormatLogRecord(line, sizeof(line), timeString, temperature, humidity, 1);
+  }
+
+  fwrite(line, 1, len, _file);
+  LogMetaAddBytes(&_meta, line, len);
+  LogMetaAddRecord(&_meta, time);
+  if (++_pending >= LOG_META_INTERVAL) {
+    _checkpoint = _meta;
+    _pending = 0;
+  }
+  _stats->bytes += len;
+  _stats->records++;
+  return true;
+}
+
+// the active file: the sidecar as last checkpointed, optionally a torn last line
+void Writer::finish(bool torn) {
+  if (!_file)
+    return;
+  if (torn) {
+    char timeString[24];
+    char line[LOG_RECORD_MAX_LEN];
+    LogFormatTime(timeString, sizeof(timeString), _meta.last + 60);
+    size_t len = FormatLogRecord(line, sizeof(line), timeString, 21.5f, 45.0f, _meta.count + 1);
+    fwrite(line, 1, len / 2, _file);
+    _stats->bytes += len / 2;
+  }
+  fclose(_file);
+  _file = NULL;
+  _checkpoint.closed = false;
+  _writeMeta(_checkpoint);
+}
+
+//=============================================================================
+
+static float tenths(float v) {
+  return (int)lroundf(v * 10) / 10.0f;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: gen_dataset <root> [-y years] [-r month|day|hour] [-k maxKB] [-s seed] [-L legacyMonths] [-t]\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2)
+    usage();
+  const char* root = argv[1];
+  uint32_t years = 5;
+  uint32_t legacyMonths = 0;
+  bool torn = false;
+  log_rotation_policy rotation = {LOG_ROTATE_MONTHLY, 0};
+  rng = 1;
+  for (int i = 2; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(arg, "-t") == 0) {
+      torn = true;
+      continue;
+    }
+    if (!val)
+      usage();
+    i++;
+    if (strcmp(arg, "-y") == 0) years = strtoul(val, NULL, 10);
+    else if (strcmp(arg, "-k") == 0) rotation.maxBytes = strtoul(val, NULL, 10) * 1024;
+    else if (strcmp(arg, "-s") == 0) rng = strtoul(val, NULL, 10) | 1;
+    else if (strcmp(arg, "-L") == 0) legacyMonths = strtoul(val, NULL, 10);
+    else if (strcmp(arg, "-r") == 0) {
+      if (strcmp(val, "month") == 0) rotation.period = LOG_ROTATE_MONTHLY;
+      else if (strcmp(val, "day") == 0) rotation.period = LOG_ROTATE_DAILY;
+      else if (strcmp(val, "hour") == 0) rotation.period = LOG_ROTATE_HOURLY;
+      else usage();
+    }
+    else usage();
+  }
+
+  char dir[LOG_NAME_MAX];
+  snprintf(dir, sizeof(dir), "%s/logs", root);
+  mkdir(root, 0755);
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "cannot create %s: %s\n", dir, strerror(errno));
+    return 1;
+  }
+
+  gen_stats stats;
+  memset(&stats, 0, sizeof(stats));
+  Writer writer(dir, rotation, &stats);
+
+  const uint32_t start = LogMakeTime(2020, 8, 1, 0, 0, 0);
+  const uint32_t end = LogMakeTime(2020 + years, 8, 1, 0, 0, 0);
+  const uint32_t legacyEnd = LogMakeTime(2020 + (7 + legacyMonths) / 12, (7 + legacyMonths) % 12 + 1, 1, 0, 0, 0);
+  uint32_t sensorDown = 0;
+  uint32_t t = start;
+  while (t < end) {
+    // power outage: about one a month, minutes to days
+    if (chance(30 * 1440)) {
+      uint32_t minutes = chance(4) ? between(120, 5 * 1440) : between(2, 90);
+      stats.outages++;
+      stats.outageMinutes += minutes;
+      t += minutes * 60;
+      // boot record: first valid reading a few seconds after power up
+      uint32_t boot = t + between(2, 20);
+      float day = (boot - start) / 86400.0f;
+      writer.append(boot, between(0, 999),
+                    tenths(21.0f - 4.0f * cosf(day * 2 * M_PI / 365.25f) + 1.5f * sinf(day * 2 * M_PI)),
+                    tenths(50.0f + 8.0f * cosf(day * 2 * M_PI / 365.25f) - 5.0f * sinf(day * 2 * M_PI)),
+                    boot < legacyEnd);
+      t += 60 - t % 60;
+      continue;
+    }
+    // sensor failures: single reads and unplugged for a while
+    if (sensorDown == 0 && chance(90 * 1440))
+      sensorDown = between(10, 600);
+    if (sensorDown || chance(1000)) {
+      if (sensorDown)
+        sensorDown--;
+      stats.skipped++;
+      t += 60;
+      continue;
+    }
+
+    float day = (t - start) / 86400.0f;
+    float temperature = 21.0f - 4.0f * cosf(day * 2 * M_PI / 365.25f) + 1.5f * sinf(day * 2 * M_PI) + (int)between(0, 6) * 0.1f - 0.3f;
+    float humidity = 50.0f + 8.0f * cosf(day * 2 * M_PI / 365.25f) - 5.0f * sinf(day * 2 * M_PI) + (int)between(0, 20) * 0.1f - 1.0f;
+    if (!writer.append(t, between(0, 40), tenths(temperature), tenths(humidity), t < legacyEnd))
+      return 1;
+    t += 60;
+  }
+  writer.finish(torn);
+
+  printf("files %u\n", stats.files);
+  printf("records %u\n", stats.records);
+  printf("bytes %llu\n", (unsigned long long)stats.bytes);
+  printf("outages %u\n", stats.outages);
+  printf("outage_minutes %u\n", stats.outageMinutes);
+  printf("skipped %u\n", stats.skipped);
+  return 0;
+}
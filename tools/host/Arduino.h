@@ -0,0 +1,158 @@
+// Host stand-in for the parts of the Arduino core the log modules use
+/**
+ * \file
+ * \brief Arduino.h for building device sources on the host
+ *
+ * Only what the storage, response and monitoring modules need, single
+ * threaded: tasks are never started, mutexes are always free and
+ * critical sections do nothing. Time comes from CLOCK_MONOTONIC.
+ */
+
+#ifndef __HostArduino__
+#define __HostArduino__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define PROGMEM
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+//=============================================================================
+
+class String {
+  private:
+    std::string _s;
+  public:
+    String(const char* s = "") : _s(s ? s : "") {}
+    String(const std::string& s) : _s(s) {}
+    String(char c) : _s(1, c) {}
+    String(int v) : _s(std::to_string(v)) {}
+    String(unsigned v) : _s(std::to_string(v)) {}
+    String(long v) : _s(std::to_string(v)) {}
+    String(unsigned long v) : _s(std::to_string(v)) {}
+    String(long long v) : _s(std::to_string(v)) {}
+    String(unsigned long long v) : _s(std::to_string(v)) {}
+    String(double v, unsigned char decimals = 2) {
+      char buf[40];
+      snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+      _s = buf;
+    }
+    const char* c_str() const { return _s.c_str(); }
+    unsigned int length() const { return _s.size(); }
+    bool reserve(unsigned int n) { _s.reserve(n); return true; }
+    String& operator+=(const String& o) { _s += o._s; return *this; }
+    String& operator+=(const char* o) { _s += o; return *this; }
+    String& operator+=(char o) { _s += o; return *this; }
+    bool concat(const char* o, unsigned int n) { _s.append(o, n); return true; }
+    bool operator==(const String& o) const { return _s == o._s; }
+    bool operator==(const char* o) const { return _s == o; }
+    bool operator!=(const String& o) const { return _s != o._s; }
+    char operator[](unsigned int i) const { return _s[i]; }
+    int lastIndexOf(char c) const { size_t i = _s.rfind(c); return i == std::string::npos ? -1 : (int)i; }
+    int indexOf(char c) const { size_t i = _s.find(c); return i == std::string::npos ? -1 : (int)i; }
+    String substring(unsigned int from) const { return _s.substr(from); }
+    String substring(unsigned int from, unsigned int to) const { return _s.substr(from, to - from); }
+    long toInt() const { return atol(_s.c_str()); }
+    void toCharArray(char* buf, unsigned int size) const { snprintf(buf, size, "%s", _s.c_str()); }
+    void replace(const String& from, const String& to) {
+      for (size_t i = 0; !from._s.empty() && (i = _s.find(from._s, i)) != std::string::npos; i += to._s.size())
+        _s.replace(i, from._s.size(), to._s);
+    }
+    void remove(unsigned int index) { _s.erase(index); }
+    void remove(unsigned int index, unsigned int count) { _s.erase(index, count); }
+};
+
+inline String operator+(const String& a, const String& b) { String s(a); s += b; return s; }
+inline String operator+(const String& a, const char* b) { String s(a); s += b; return s; }
+inline String operator+(const char* a, const String& b) { String s(a); s += b; return s; }
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) { return fputc(c, stderr) == EOF ? 0 : 1; }
+    virtual size_t write(const uint8_t* buf, size_t n) { return fwrite(buf, 1, n, stderr); }
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+      va_list args;
+      va_start(args, format);
+      int n = vfprintf(stderr, format, args);
+      va_end(args);
+      return n > 0 ? n : 0;
+    }
+    size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t println(const char* s) { return print(s) + print("\n"); }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    virtual void flush() {}
+};
+
+class HardwareSerial : public Stream {
+  public:
+    void begin(unsigned long) {}
+    int availableForWrite() { return 4096; }
+};
+extern HardwareSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+class EspClass {
+  public:
+    uint32_t getCycleCount();
+    uint32_t getCpuFreqMHz() { return 240; }
+    uint32_t getFreeHeap() { return 200000; }
+    uint32_t getMinFreeHeap() { return 200000; }
+    uint32_t getMaxAllocHeap() { return 110000; }
+};
+extern EspClass ESP;
+
+//=============================================================================
+// FreeRTOS, one thread
+
+typedef void* TaskHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef int portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+#define pdMS_TO_TICKS(ms) (ms)
+#define portMAX_DELAY 0xffffffff
+#define portTICK_PERIOD_MS 1
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return (TaskHandle_t)1; }
+inline BaseType_t xPortGetCoreID() { return 1; }
+inline void vTaskDelay(TickType_t ms) { delay(ms); }
+inline BaseType_t xTaskCreate(void (*)(void*), const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*) { return pdPASS; }
+inline BaseType_t xTaskCreatePinnedToCore(void (*)(void*), const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*, BaseType_t) { return pdPASS; }
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return (SemaphoreHandle_t)1; }
+inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() { return (SemaphoreHandle_t)1; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t) { return pdTRUE; }
+
+#endif
@@ -0,0 +1 @@
+// Host stand-in, ESPAsyncWebServer.h brings everything the modules use
@@ -0,0 +1,39 @@
+// Host stand-in for the response classes of ESPAsyncWebServer
+/**
+ * \file
+ * \brief ESPAsyncWebServer.h for building device sources on the host
+ *
+ * Enough for AsyncAbstractResponse subclasses: the bench calls
+ * _fillBuffer() the way the server does, until it returns 0.
+ */
+
+#ifndef __HostESPAsyncWebServer__
+#define __HostESPAsyncWebServer__
+
+#include <Arduino.h>
+#include <vector>
+
+#define RESPONSE_TRY_AGAIN 0xFFFFFFFF
+
+class AsyncWebServerResponse {
+  protected:
+    int _code;
+    String _contentType;
+    size_t _contentLength;
+    bool _sendContentLength;
+    bool _chunked;
+    std::vector<std::pair<String, String> > _headers;
+  public:
+    virtual ~AsyncWebServerResponse() {}
+    void addHeader(const String& name, const String& value) { _headers.push_back(std::make_pair(name, value)); }
+    int code() const { return _code; }
+    const String& contentType() const { return _contentType; }
+};
+
+class AsyncAbstractResponse : public AsyncWebServerResponse {
+  public:
+    virtual bool _sourceValid() const { return false; }
+    virtual size_t _fillBuffer(uint8_t*, size_t) { return 0; }
+};
+
+#endif
@@ -0,0 +1 @@
+// Host stand-in, SdFat.h brings everything the modules use
@@ -0,0 +1,146 @@
+// Host stand-in for SdFat 1.1 over a directory of the host file system
+/**
+ * \file
+ * \brief SdFat.h for building device sources on the host
+ *
+ * "/" is the directory given to SdFat::hostRoot(). Files are read with
+ * pread at their own position, so copies of a File are independent like
+ * on the device.
+ *
+ * hostSdStats counts the SD traffic the same calls cause on the card,
+ * in 512 byte blocks:
+ * - file reads and writes through SdFat's one block cache, a read that
+ *   starts in the block the last one ended in does not read it again
+ * - directory entries, 16 per block, with the long file name entries a
+ *   name that is not 8.3 needs; open() reads the entries up to the name
+ * - SdSpiCard::readBlock, for files SdFat::hostContiguous() made
+ *   contiguous
+ * - begin(), card initialisation plus the MBR and volume boot block
+ * FAT chain walks of fragmented files are not counted.
+ */
+
+#ifndef __HostSdFat__
+#define __HostSdFat__
+
+#include <Arduino.h>
+#include <fcntl.h>
+#include <vector>
+
+#define O_READ O_RDONLY
+#define O_WRITE O_WRONLY
+#define O_AT_END 0x40000000
+
+#define FAT_DATE(year, month, day) (((year) - 1980) << 9 | (month) << 5 | (day))
+#define FAT_TIME(hour, minute, second) ((hour) << 11 | (minute) << 5 | (second) >> 1)
+#define FAT_YEAR(date) (1980 + ((date) >> 9))
+#define FAT_MONTH(date) (((date) >> 5) & 0xf)
+#define FAT_DAY(date) ((date) & 0x1f)
+#define FAT_HOUR(time) ((time) >> 11)
+#define FAT_MINUTE(time) (((time) >> 5) & 0x3f)
+#define FAT_SECOND(time) (2 * ((time) & 0x1f))
+
+#define SD_SCK_MHZ(mhz) ((mhz) * 1000000UL)
+
+struct dir_t {
+  uint8_t name[11];
+  uint8_t attributes;
+  uint16_t creationTime;
+  uint16_t creationDate;
+  uint16_t lastWriteTime;
+  uint16_t lastWriteDate;
+  uint32_t fileSize;
+};
+
+struct host_sd_stats {
+  uint64_t blocks;      // 512 byte blocks transferred
+  uint64_t reads;       // read calls, of files and raw blocks
+  uint64_t dirEntries;  // 32 byte directory entries visited
+  uint32_t opens;
+  uint32_t begins;      // card initialisations
+};
+extern host_sd_stats hostSdStats;
+
+class FatFile {
+  private:
+    int _fd;
+    std::string _path;
+    bool _dir;
+    uint32_t _pos;
+    std::vector<std::string> _entries;  // of a directory, in name order
+    size_t _next;
+    uint32_t _nextSlot;                 // directory entry of _entries[_next]
+    void _countRead(uint32_t pos, size_t n);
+  public:
+    FatFile();
+    FatFile(const FatFile& other);
+    FatFile& operator=(const FatFile& other);
+    ~FatFile();
+    bool open(const char* path, int oflag = O_READ);
+    bool openNext(FatFile* dir, int oflag = O_READ);
+    bool close();
+    bool isOpen() const { return _fd >= 0 || _dir; }
+    bool isDir() const { return _dir; }
+    bool getName(char* name, size_t size);
+    bool dirEntry(dir_t* entry);
+    uint32_t fileSize() const;
+    uint32_t curPosition() const { return _pos; }
+    bool seekSet(uint32_t pos);
+    int read(void* buf, size_t n);
+    int write(const void* buf, size_t n);
+    bool sync() { return true; }
+    bool truncate(uint32_t size);
+    bool remove();
+    bool createContiguous(FatFile* dir, const char* path, uint32_t size);
+    bool contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock);
+    operator bool() const { return isOpen(); }
+};
+
+class File : public FatFile, public Stream {
+  public:
+    using FatFile::read;
+    using FatFile::write;
+    int read() { uint8_t b; return FatFile::read(&b, 1) == 1 ? b : -1; }
+    size_t write(uint8_t b) { return FatFile::write(&b, 1) == 1 ? 1 : 0; }
+    size_t write(const char* s) { int n = FatFile::write(s, strlen(s)); return n > 0 ? n : 0; }
+    operator bool() const { return isOpen(); }
+};
+
+typedef FatFile SdBaseFile;
+
+class SdSpiCard {
+  public:
+    uint32_t cardSize();
+    bool erase(uint32_t, uint32_t) { return true; }
+    bool readBlock(uint32_t block, uint8_t* dst);
+};
+
+class FatVolume {
+  public:
+    uint8_t blocksPerCluster() const { return 64; }
+    uint32_t clusterCount() const;
+    uint8_t fatType() const { return 0; }
+    uint32_t fatStartBlock() const { return 0; }
+    int32_t freeClusterCount() const { return clusterCount() / 2; }
+    void cacheClear();
+};
+
+class SdFat {
+  private:
+    SdSpiCard _card;
+    FatVolume _vol;
+    FatFile _root;
+  public:
+    // host only: the directory that is "/", and whether files count as contiguous
+    static void hostRoot(const char* path);
+    static void hostContiguous(bool on);
+    bool begin(uint8_t csPin, uint32_t spiHz);
+    File open(const char* path, int oflag = O_READ);
+    bool exists(const char* path);
+    bool mkdir(const char* path);
+    bool remove(const char* path);
+    SdSpiCard* card() { return &_card; }
+    FatVolume* vol() { return &_vol; }
+    FatFile* vwd() { return &_root; }
+};
+
+#endif
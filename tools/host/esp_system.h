@@ -0,0 +1,14 @@
+// Host stand-in for the ESP-IDF reset reason
+
+#ifndef __HostEspSystem__
+#define __HostEspSystem__
+
+typedef enum {
+  ESP_RST_UNKNOWN, ESP_RST_POWERON, ESP_RST_EXT, ESP_RST_SW, ESP_RST_PANIC,
+  ESP_RST_INT_WDT, ESP_RST_TASK_WDT, ESP_RST_WDT, ESP_RST_DEEPSLEEP, ESP_RST_BROWNOUT
+} esp_reset_reason_t;
+
+// always a power on reset
+esp_reset_reason_t esp_reset_reason();
+
+#endif
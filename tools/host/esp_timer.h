@@ -0,0 +1,11 @@
+// Host stand-in for the ESP-IDF high resolution timer
+
+#ifndef __HostEspTimer__
+#define __HostEspTimer__
+
+#include <stdint.h>
+
+// microseconds since start, CLOCK_MONOTONIC
+int64_t esp_timer_get_time();
+
+#endif
@@ -0,0 +1,364 @@
+// Host stand-ins for the Arduino core and SdFat
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static uint64_t nowUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+unsigned long millis() { return nowUs() / 1000; }
+unsigned long micros() { return nowUs(); }
+
+void delay(unsigned long ms) {
+  struct timespec ts = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000};
+  nanosleep(&ts, NULL);
+}
+
+uint32_t EspClass::getCycleCount() { return (uint32_t)(nowUs() * getCpuFreqMHz()); }
+
+int64_t esp_timer_get_time() { return nowUs(); }
+esp_reset_reason_t esp_reset_reason() { return ESP_RST_POWERON; }
+
+//=============================================================================
+// SdFat
+
+host_sd_stats hostSdStats;
+
+static std::string sdRoot = ".";
+static bool sdContiguous = false;
+// first block of each file made contiguous, by path
+static std::map<std::string, uint32_t> sdExtents;
+static std::map<uint32_t, std::string> sdExtentAt;
+static uint32_t sdNextBlock = 1 << 20;
+// SdFat's block cache, file (inode) and block
+static ino_t cacheFile = 0;
+static uint32_t cacheBlock = 0xffffffff;
+
+void SdFat::hostRoot(const char* path) { sdRoot = path; }
+void SdFat::hostContiguous(bool on) { sdContiguous = on; }
+
+static std::string hostPath(const char* path) {
+  return sdRoot + (path[0] == '/' ? "" : "/") + path;
+}
+
+// 32 byte entries of a name: the short one plus 13 characters per long one
+static uint32_t dirSlots(const char* name) {
+  const char* dot = strrchr(name, '.');
+  size_t base = dot ? (size_t)(dot - name) : strlen(name);
+  size_t ext = dot ? strlen(dot + 1) : 0;
+  bool shortName = base <= 8 && ext <= 3 && strchr(name, '.') == dot;
+  for (const char* p = name; *p && shortName; p++)
+    shortName = !(*p >= 'a' && *p <= 'z');
+  return shortName ? 1 : 1 + (strlen(name) + 12) / 13;
+}
+
+static void countDirEntries(uint32_t firstSlot, uint32_t slots) {
+  hostSdStats.dirEntries += slots;
+  // a block is read when an entry starts one
+  for (uint32_t s = firstSlot; s < firstSlot + slots; s++) {
+    if (s % 16 == 0)
+      hostSdStats.blocks++;
+  }
+}
+
+static std::vector<std::string> listDir(const std::string& path) {
+  std::vector<std::string> names;
+  DIR* dir = opendir(path.c_str());
+  if (!dir)
+    return names;
+  while (struct dirent* e = readdir(dir)) {
+    if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+      names.push_back(e->d_name);
+  }
+  closedir(dir);
+  // FAT keeps creation order, which is name order for log files
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+// the directory entries SdFat reads to find path
+static void countLookup(const char* path) {
+  std::string dir = sdRoot;
+  const char* p = path;
+  while (*p) {
+    while (*p == '/')
+      p++;
+    const char* end = strchr(p, '/');
+    std::string name = end ? std::string(p, end - p) : std::string(p);
+    if (name.empty())
+      break;
+    uint32_t slot = 0;
+    for (const std::string& entry : listDir(dir)) {
+      uint32_t n = dirSlots(entry.c_str());
+      if (entry == name) {
+        countDirEntries(0, slot + n);
+        break;
+      }
+      slot += n;
+    }
+    dir += "/" + name;
+    if (!end)
+      break;
+    p = end + 1;
+  }
+}
+
+FatFile::FatFile() {
+  _fd = -1;
+  _dir = false;
+  _pos = 0;
+  _next = 0;
+  _nextSlot = 0;
+}
+
+FatFile::FatFile(const FatFile& other) : FatFile() {
+  *this = other;
+}
+
+FatFile& FatFile::operator=(const FatFile& other) {
+  if (this == &other)
+    return *this;
+  close();
+  _fd = other._fd >= 0 ? dup(other._fd) : -1;
+  _path = other._path;
+  _dir = other._dir;
+  _pos = other._pos;
+  _entries = other._entries;
+  _next = other._next;
+  _nextSlot = other._nextSlot;
+  return *this;
+}
+
+FatFile::~FatFile() {
+  close();
+}
+
+bool FatFile::open(const char* path, int oflag) {
+  close();
+  hostSdStats.opens++;
+  _path = hostPath(path);
+  struct stat st;
+  if (stat(_path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+    countLookup(path);
+    _dir = true;
+    _entries = listDir(_path);
+    _next = 0;
+    _nextSlot = 0;
+    return true;
+  }
+  int flags = oflag & ~O_AT_END;
+  _fd = ::open(_path.c_str(), flags, 0644);
+  if (_fd < 0)
+    return false;
+  countLookup(path);
+  _pos = oflag & O_AT_END ? fileSize() : 0;
+  return true;
+}
+
+bool FatFile::openNext(FatFile* dir, int oflag) {
+  close();
+  if (!dir->_dir || dir->_next >= dir->_entries.size())
+    return false;
+  const std::string& name = dir->_entries[dir->_next++];
+  uint32_t slots = dirSlots(name.c_str());
+  countDirEntries(dir->_nextSlot, slots);
+  dir->_nextSlot += slots;
+  std::string relative = dir->_path.substr(sdRoot.size()) + "/" + name;
+  _path = hostPath(relative.c_str());
+  struct stat st;
+  if (stat(_path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+    _dir = true;
+    _entries = listDir(_path);
+    return true;
+  }
+  _fd = ::open(_path.c_str(), oflag & ~O_AT_END);
+  _pos = 0;
+  return _fd >= 0;
+}
+
+bool FatFile::close() {
+  if (_fd >= 0)
+    ::close(_fd);
+  _fd = -1;
+  _dir = false;
+  _entries.clear();
+  return true;
+}
+
+bool FatFile::getName(char* name, size_t size) {
+  size_t slash = _path.rfind('/');
+  snprintf(name, size, "%s", _path.c_str() + (slash == std::string::npos ? 0 : slash + 1));
+  return true;
+}
+
+bool FatFile::dirEntry(dir_t* entry) {
+  struct stat st;
+  if (stat(_path.c_str(), &st) != 0)
+    return false;
+  memset(entry, 0, sizeof(*entry));
+  struct tm tm;
+  gmtime_r(&st.st_mtime, &tm);
+  entry->lastWriteDate = FAT_DATE(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+  entry->lastWriteTime = FAT_TIME(tm.tm_hour, tm.tm_min, tm.tm_sec);
+  // stat() has no creation time, the last write is not later than it
+  entry->creationDate = entry->lastWriteDate;
+  entry->creationTime = entry->lastWriteTime;
+  entry->fileSize = st.st_size;
+  return true;
+}
+
+uint32_t FatFile::fileSize() const {
+  struct stat st;
+  if (_fd < 0 || fstat(_fd, &st) != 0)
+    return 0;
+  return st.st_size;
+}
+
+bool FatFile::seekSet(uint32_t pos) {
+  if (_fd < 0 || pos > fileSize())
+    return false;
+  _pos = pos;
+  return true;
+}
+
+void FatFile::_countRead(uint32_t pos, size_t n) {
+  struct stat st;
+  fstat(_fd, &st);
+  uint32_t first = pos / 512;
+  uint32_t last = (pos + n - 1) / 512;
+  hostSdStats.reads++;
+  hostSdStats.blocks += last - first + 1;
+  if (st.st_ino == cacheFile && first == cacheBlock)
+    hostSdStats.blocks--;
+  cacheFile = st.st_ino;
+  cacheBlock = last;
+}
+
+int FatFile::read(void* buf, size_t n) {
+  if (_fd < 0)
+    return -1;
+  ssize_t got = pread(_fd, buf, n, _pos);
+  if (got < 0)
+    return -1;
+  if (got > 0)
+    _countRead(_pos, got);
+  _pos += got;
+  return got;
+}
+
+int FatFile::write(const void* buf, size_t n) {
+  if (_fd < 0)
+    return -1;
+  ssize_t put = pwrite(_fd, buf, n, _pos);
+  if (put < 0)
+    return -1;
+  if (put > 0)
+    hostSdStats.blocks += (_pos + put - 1) / 512 - _pos / 512 + 1;
+  _pos += put;
+  return put;
+}
+
+bool FatFile::truncate(uint32_t size) {
+  if (_fd < 0 || ftruncate(_fd, size) != 0)
+    return false;
+  if (_pos > size)
+    _pos = size;
+  return true;
+}
+
+bool FatFile::remove() {
+  std::string path = _path;
+  close();
+  return unlink(path.c_str()) == 0;
+}
+
+bool FatFile::createContiguous(FatFile*, const char* path, uint32_t size) {
+  if (!open(path, O_RDWR | O_CREAT | O_EXCL))
+    return false;
+  return truncate(size);
+}
+
+bool FatFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock) {
+  if (!sdContiguous || _fd < 0)
+    return false;
+  uint32_t blocks = (fileSize() + 511) / 512;
+  auto it = sdExtents.find(_path);
+  if (it == sdExtents.end()) {
+    it = sdExtents.insert(std::make_pair(_path, sdNextBlock)).first;
+    sdExtentAt[sdNextBlock] = _path;
+    sdNextBlock += blocks + 1;
+  }
+  *bgnBlock = it->second;
+  *endBlock = it->second + (blocks ? blocks - 1 : 0);
+  return true;
+}
+
+uint32_t SdSpiCard::cardSize() {
+  return 16u << 21;  // 16 GB
+}
+
+bool SdSpiCard::readBlock(uint32_t block, uint8_t* dst) {
+  auto it = sdExtentAt.upper_bound(block);
+  if (it == sdExtentAt.begin())
+    return false;
+  --it;
+  int fd = ::open(it->second.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  memset(dst, 0, 512);
+  ssize_t got = pread(fd, dst, 512, (off_t)(block - it->first) * 512);
+  ::close(fd);
+  hostSdStats.reads++;
+  hostSdStats.blocks++;
+  return got >= 0;
+}
+
+uint32_t FatVolume::clusterCount() const {
+  return (16u << 21) / blocksPerCluster();
+}
+
+void FatVolume::cacheClear() {
+  cacheBlock = 0xffffffff;
+}
+
+bool SdFat::begin(uint8_t, uint32_t) {
+  hostSdStats.begins++;
+  // MBR and volume boot block, the cache starts empty
+  hostSdStats.blocks += 2;
+  hostSdStats.reads += 2;
+  cacheBlock = 0xffffffff;
+  return _root.open("/");
+}
+
+File SdFat::open(const char* path, int oflag) {
+  File file;
+  file.FatFile::open(path, oflag);
+  return file;
+}
+
+bool SdFat::exists(const char* path) {
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool SdFat::mkdir(const char* path) {
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool SdFat::remove(const char* path) {
+  return unlink(hostPath(path).c_str()) == 0;
+}
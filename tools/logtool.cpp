@@ -0,0 +1,831 @@
+// Host toolkit for log trees: validate, convert, resample, merge and bench
+/**
+ * \file
+ * \brief logtool, fast processing of many log files on a PC
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -pthread -Iinclude tools/logtool.cpp src/LogRecord.cpp src/LogRotation.cpp src/LogExport.cpp -o logtool
+ *   ./logtool validate [-g gapSeconds] [-j threads] <path>...
+ *   ./logtool convert  [-f csv|ndjson|cbor] [-o out] [-j threads] <path>...
+ *   ./logtool resample -i seconds [-f csv|ndjson] [-o out] [-j threads] <path>...
+ *   ./logtool merge    [-f csv|ndjson] [-o out] [-j threads] [name=]<path>...
+ *   ./logtool bench    [-j threads] [-n runs] <path>...
+ *
+ * A path is a log file or a directory of them (a device's /logs, files in
+ * name order, which is time order). merge takes one path per device and
+ * interleaves their records by time; the other commands treat all paths
+ * as one stream.
+ *
+ * Files are memory mapped and lines found with memchr(), which libc
+ * already vectorises; each line goes through the firmware's
+ * ParseLogRecord(), so CRC and legacy handling are the same as on the
+ * device. Files are parsed in parallel and consumed in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LogRecord.h"
+#include "LogRotation.h"
+#include "LogExport.h"
+
+// a record a minute, anything over 3 minutes is a gap
+#define DEFAULT_GAP_SECONDS 180
+// corrupt line numbers listed per file
+#define MAX_LISTED_LINES 5
+#define OUT_BUFFER (1 << 20)
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//=============================================================================
+// line scanning
+
+// scalar reference for the benchmark
+static const char* findNewlineScalar(const char* p, const char* end) {
+  while (p < end && *p != '\n')
+    p++;
+  return p;
+}
+
+// first '\n' in [p, end), end if there is none
+static const char* findNewline(const char* p, const char* end) {
+  const char* nl = (const char*)memchr(p, '\n', end - p);
+  return nl ? nl : end;
+}
+
+//=============================================================================
+
+class MappedFile {
+  private:
+    const char* _data;
+    size_t _size;
+  public:
+    MappedFile() : _data(NULL), _size(0) {}
+    ~MappedFile() { close(); }
+    bool open(const char* path);
+    void close();
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+};
+
+bool MappedFile::open(const char* path) {
+  close();
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  _size = st.st_size;
+  if (_size) {
+    void* p = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      _size = 0;
+      return false;
+    }
+    madvise(p, _size, MADV_SEQUENTIAL);
+    _data = (const char*)p;
+  }
+  ::close(fd);
+  return true;
+}
+
+void MappedFile::close() {
+  if (_data)
+    munmap((void*)_data, _size);
+  _data = NULL;
+  _size = 0;
+}
+
+//=============================================================================
+// per file parse results
+
+struct file_check {
+  bool opened;
+  uint64_t bytes;
+  uint32_t lines;
+  uint32_t records;
+  uint32_t legacy;
+  uint32_t corrupt;
+  uint32_t overlong;
+  bool torn;
+  uint32_t seqGaps;
+  uint32_t outOfOrder;
+  uint32_t gaps;
+  uint32_t maxGap;
+  uint32_t first;
+  uint32_t last;
+  uint32_t listed[MAX_LISTED_LINES];
+  // sidecar: 0 none, 1 matches, -1 differs
+  int meta;
+};
+
+/**
+ * Walks every line of a mapped file. onRecord gets the valid records in
+ * file order; check collects the line statistics.
+ */
+static void scanRecords(const char* data, size_t size, uint32_t gapSeconds, file_check* check,
+                        const std::function<void(const log_record&)>& onRecord) {
+  const char* p = data;
+  const char* end = data + size;
+  uint32_t prevTime = 0;
+  uint32_t prevSeq = 0;
+  bool havePrev = false;
+  while (p < end) {
+    const char* nl = findNewline(p, end);
+    size_t len = nl - p;
+    check->lines++;
+    if (nl == end) {
+      // the logger truncates a torn tail on the next mount
+      check->torn = true;
+      break;
+    }
+    log_record rec;
+    log_record_status status = len >= LOG_RECORD_MAX_LEN ? LOG_RECORD_CORRUPT : ParseLogRecord(p, len, &rec);
+    if (len >= LOG_RECORD_MAX_LEN)
+      check->overlong++;
+    if (status == LOG_RECORD_CORRUPT) {
+      if (check->corrupt < MAX_LISTED_LINES)
+        check->listed[check->corrupt] = check->lines;
+      check->corrupt++;
+    } else if (status != LOG_RECORD_HEADER_LINE) {
+      check->records++;
+      if (status == LOG_RECORD_LEGACY)
+        check->legacy++;
+      else if (prevSeq && rec.seq != prevSeq + 1)
+        check->seqGaps++;
+      if (status == LOG_RECORD_OK)
+        prevSeq = rec.seq;
+      if (havePrev) {
+        if (rec.time < prevTime)
+          check->outOfOrder++;
+        else if (rec.time - prevTime > gapSeconds)
+          check->gaps++;
+        if (rec.time > prevTime && rec.time - prevTime > check->maxGap)
+          check->maxGap = rec.time - prevTime;
+      } else {
+        check->first = rec.time;
+      }
+      havePrev = true;
+      prevTime = rec.time;
+      check->last = rec.time;
+      onRecord(rec);
+    }
+    p = nl + 1;
+  }
+}
+
+static void checkMeta(const std::string& path, const char* data, size_t size, const file_check& check, file_check* out) {
+  char metaName[512];
+  if (!LogMetaNameFor(metaName, sizeof(metaName), path.c_str()))
+    return;
+  MappedFile metaFile;
+  log_meta meta;
+  if (!metaFile.open(metaName) || !ParseLogMeta(metaFile.data(), metaFile.size(), &meta)) {
+    out->meta = 0;
+    return;
+  }
+  // an open file's sidecar lags behind by up to a checkpoint
+  bool ok = meta.dataBytes <= size && LogCrc32(data, meta.dataBytes) == meta.crc;
+  if (meta.closed)
+    ok = ok && meta.count == check.records && meta.dataBytes == size;
+  out->meta = ok ? 1 : -1;
+}
+
+//=============================================================================
+// inputs and parallel ordered processing
+
+struct input_file {
+  std::string path;
+  uint32_t device;
+};
+
+static bool isLogFileName(const char* name) {
+  size_t len = strlen(name);
+  return !IsLogMetaName(name) && len > 4 && strcmp(name + len - 4, ".csv") == 0;
+}
+
+// a file, or the log files of a directory in name order
+static bool addPath(const std::string& path, uint32_t device, std::vector<input_file>* files) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    files->push_back({path, device});
+    return true;
+  }
+  DIR* dir = opendir(path.c_str());
+  if (!dir) {
+    fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  std::vector<std::string> names;
+  while (struct dirent* entry = readdir(dir)) {
+    if (isLogFileName(entry->d_name))
+      names.push_back(entry->d_name);
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  for (size_t i = 0; i < names.size(); i++)
+    files->push_back({path + "/" + names[i], device});
+  return true;
+}
+
+static void parallelFor(size_t count, unsigned threads, const std::function<void(size_t)>& body) {
+  if (threads <= 1 || count <= 1) {
+    for (size_t i = 0; i < count; i++)
+      body(i);
+    return;
+  }
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < threads && t < count; t++) {
+    pool.push_back(std::thread([&]() {
+      for (size_t i = next++; i < count; i = next++)
+        body(i);
+    }));
+  }
+  for (size_t t = 0; t < pool.size(); t++)
+    pool[t].join();
+}
+
+/**
+ * produce(i, &result) runs in parallel, consume(i, result) in file order,
+ * a batch of 4 files per thread is in memory at a time.
+ */
+template <class T>
+static void processOrdered(size_t count, unsigned threads,
+                           const std::function<void(size_t, T*)>& produce,
+                           const std::function<void(size_t, T&)>& consume) {
+  size_t batch = threads * 4;
+  for (size_t start = 0; start < count; start += batch) {
+    size_t n = std::min(batch, count - start);
+    std::vector<T> results(n);
+    parallelFor(n, threads, [&](size_t i) { produce(start + i, &results[i]); });
+    for (size_t i = 0; i < n; i++)
+      consume(start + i, results[i]);
+  }
+}
+
+//=============================================================================
+// output
+
+class Output {
+  private:
+    FILE* _file;
+    std::vector<char> _buf;
+  public:
+    Output() : _file(NULL) {}
+    ~Output() { close(); }
+    bool open(const char* path);
+    void write(const void* data, size_t len) { fwrite(data, 1, len, _file); }
+    bool close();
+};
+
+bool Output::open(const char* path) {
+  _file = path ? fopen(path, "wb") : stdout;
+  if (!_file) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return false;
+  }
+  _buf.resize(OUT_BUFFER);
+  setvbuf(_file, &_buf[0], _IOFBF, _buf.size());
+  return true;
+}
+
+bool Output::close() {
+  if (!_file)
+    return true;
+  bool ok = fflush(_file) == 0 && !ferror(_file);
+  if (_file != stdout)
+    ok = fclose(_file) == 0 && ok;
+  _file = NULL;
+  return ok;
+}
+
+//=============================================================================
+
+struct options {
+  log_format format;
+  uint32_t gapSeconds;
+  uint32_t interval;
+  unsigned threads;
+  unsigned runs;
+  const char* out;
+  std::vector<std::string> paths;
+};
+
+static void usage() {
+  fprintf(stderr,
+          "usage: logtool validate [-g gapSeconds] [-j threads] <path>...\n"
+          "       logtool convert  [-f csv|ndjson|cbor] [-o out] [-j threads] <path>...\n"
+          "       logtool resample -i seconds [-f csv|ndjson] [-o out] [-j threads] <path>...\n"
+          "       logtool merge    [-f csv|ndjson] [-o out] [-j threads] [name=]<path>...\n"
+          "       logtool bench    [-j threads] [-n runs] <path>...\n");
+  exit(2);
+}
+
+//=============================================================================
+// validate: line statistics per file and over the whole stream
+
+static int cmdValidate(const options& opt, const std::vector<input_file>& files) {
+  file_check total;
+  memset(&total, 0, sizeof(total));
+  uint32_t problemFiles = 0;
+  uint32_t streamGaps = 0;
+  uint32_t prevLast = 0;
+  uint32_t prevDevice = 0;
+  double start = now();
+
+  processOrdered<file_check>(files.size(), opt.threads,
+    [&](size_t i, file_check* check) {
+      memset(check, 0, sizeof(*check));
+      MappedFile file;
+      if (!file.open(files[i].path.c_str()))
+        return;
+      check->opened = true;
+      check->bytes = file.size();
+      scanRecords(file.data(), file.size(), opt.gapSeconds, check, [](const log_record&) {});
+      checkMeta(files[i].path, file.data(), file.size(), *check, check);
+    },
+    [&](size_t i, file_check& check) {
+      const char* path = files[i].path.c_str();
+      if (!check.opened) {
+        printf("%s: cannot open\n", path);
+        problemFiles++;
+        return;
+      }
+      // a gap across the boundary of two files of the same device
+      if (check.records && prevLast && files[i].device == prevDevice && check.first > prevLast &&
+          check.first - prevLast > opt.gapSeconds) {
+        streamGaps++;
+        if (check.first - prevLast > total.maxGap)
+          total.maxGap = check.first - prevLast;
+      }
+      if (check.records) {
+        prevLast = check.last;
+        prevDevice = files[i].device;
+      }
+      bool problem = check.corrupt || check.torn || check.outOfOrder || check.seqGaps || check.meta < 0;
+      if (problem) {
+        problemFiles++;
+        printf("%s: records %u corrupt %u overlong %u torn %d seq_gaps %u out_of_order %u meta %s",
+               path, check.records, check.corrupt, check.overlong, check.torn, check.seqGaps,
+               check.outOfOrder, check.meta > 0 ? "ok" : check.meta < 0 ? "BAD" : "none");
+        for (uint32_t k = 0; k < check.corrupt && k < MAX_LISTED_LINES; k++)
+          printf("%s%u", k ? "," : " lines ", check.listed[k]);
+        printf("\n");
+      }
+      total.bytes += check.bytes;
+      total.lines += check.lines;
+      total.records += check.records;
+      total.legacy += check.legacy;
+      total.corrupt += check.corrupt;
+      total.overlong += check.overlong;
+      total.torn += check.torn;
+      total.seqGaps += check.seqGaps;
+      total.outOfOrder += check.outOfOrder;
+      total.gaps += check.gaps;
+      if (check.maxGap > total.maxGap)
+        total.maxGap = check.maxGap;
+      if (check.meta < 0)
+        total.meta++;
+    });
+
+  double elapsed = now() - start;
+  printf("files %zu\n", files.size());
+  printf("problem_files %u\n", problemFiles);
+  printf("bytes %llu\n", (unsigned long long)total.bytes);
+  printf("records %u\n", total.records);
+  printf("legacy %u\n", total.legacy);
+  printf("corrupt %u\n", total.corrupt);
+  printf("overlong %u\n", total.overlong);
+  printf("torn %u\n", (unsigned)total.torn);
+  printf("seq_gaps %u\n", total.seqGaps);
+  printf("out_of_order %u\n", total.outOfOrder);
+  printf("gaps %u\n", total.gaps + streamGaps);
+  printf("max_gap_s %u\n", total.maxGap);
+  printf("meta_mismatch %d\n", total.meta);
+  printf("gb_per_s %.3f\n", total.bytes / elapsed / 1e9);
+  return problemFiles ? 1 : 0;
+}
+
+//=============================================================================
+// convert: the export formats of the web interface, over many files
+
+static int cmdConvert(const options& opt, const std::vector<input_file>& files) {
+  Output out;
+  if (!out.open(opt.out))
+    return 1;
+  uint8_t buf[LOG_EXPORT_MAX_LEN];
+  out.write(buf, FormatExportHeader(buf, sizeof(buf), opt.format));
+
+  processOrdered<std::vector<uint8_t> >(files.size(), opt.threads,
+    [&](size_t i, std::vector<uint8_t>* result) {
+      MappedFile file;
+      file_check check;
+      memset(&check, 0, sizeof(check));
+      if (!file.open(files[i].path.c_str())) {
+        fprintf(stderr, "%s: cannot open\n", files[i].path.c_str());
+        return;
+      }
+      result->reserve(file.size() * (opt.format == LOG_FORMAT_NDJSON ? 2 : 1));
+      uint8_t line[LOG_EXPORT_MAX_LEN];
+      scanRecords(file.data(), file.size(), 0xffffffff, &check, [&](const log_record& rec) {
+        size_t len = FormatExportRecord(line, sizeof(line), opt.format, rec);
+        result->insert(result->end(), line, line + len);
+      });
+    },
+    [&](size_t, std::vector<uint8_t>& result) {
+      if (!result.empty())
+        out.write(&result[0], result.size());
+    });
+
+  out.write(buf, FormatExportFooter(buf, sizeof(buf), opt.format));
+  return out.close() ? 0 : 1;
+}
+
+//=============================================================================
+// resample: mean, min and max per fixed interval
+
+struct resample_bucket {
+  uint32_t time;
+  uint32_t count;
+  double tSum;
+  double hSum;
+  float tMin;
+  float tMax;
+  float hMin;
+  float hMax;
+};
+
+static void addToBucket(resample_bucket* b, const log_record& rec) {
+  if (b->count == 0) {
+    b->tMin = b->tMax = rec.temperature;
+    b->hMin = b->hMax = rec.humidity;
+  }
+  b->tMin = std::min(b->tMin, rec.temperature);
+  b->tMax = std::max(b->tMax, rec.temperature);
+  b->hMin = std::min(b->hMin, rec.humidity);
+  b->hMax = std::max(b->hMax, rec.humidity);
+  b->tSum += rec.temperature;
+  b->hSum += rec.humidity;
+  b->count++;
+}
+
+static void mergeBucket(resample_bucket* into, const resample_bucket& b) {
+  into->tMin = std::min(into->tMin, b.tMin);
+  into->tMax = std::max(into->tMax, b.tMax);
+  into->hMin = std::min(into->hMin, b.hMin);
+  into->hMax = std::max(into->hMax, b.hMax);
+  into->tSum += b.tSum;
+  into->hSum += b.hSum;
+  into->count += b.count;
+}
+
+static void writeBucket(Output& out, log_format format, const resample_bucket& b) {
+  char line[256];
+  char timeString[24];
+  LogFormatTime(timeString, sizeof(timeString), b.time);
+  int n;
+  if (format == LOG_FORMAT_NDJSON)
+    n = snprintf(line, sizeof(line), "{\"time\":%u,\"temperature\":%.2f,\"humidity\":%.2f,\"tMin\":%.2f,\"tMax\":%.2f,\"hMin\":%.2f,\"hMax\":%.2f,\"count\":%u}\n",
+                 (unsigned)b.time, b.tSum / b.count, b.hSum / b.count, b.tMin, b.tMax, b.hMin, b.hMax, (unsigned)b.count);
+  else
+    n = snprintf(line, sizeof(line), "%s;%.2f;%.2f;%.2f;%.2f;%.2f;%.2f;%u\n",
+                 timeString, b.tSum / b.count, b.hSum / b.count, b.tMin, b.tMax, b.hMin, b.hMax, (unsigned)b.count);
+  out.write(line, n);
+}
+
+static int cmdResample(const options& opt, const std::vector<input_file>& files) {
+  if (opt.interval == 0 || opt.format == LOG_FORMAT_CBOR)
+    usage();
+  Output out;
+  if (!out.open(opt.out))
+    return 1;
+  if (opt.format == LOG_FORMAT_CSV) {
+    const char* header = "Time;Temperature;Humidity;TMin;TMax;HMin;HMax;Count\n";
+    out.write(header, strlen(header));
+  }
+
+  // the last bucket of a file may continue in the next one
+  resample_bucket open;
+  memset(&open, 0, sizeof(open));
+  processOrdered<std::vector<resample_bucket> >(files.size(), opt.threads,
+    [&](size_t i, std::vector<resample_bucket>* buckets) {
+      MappedFile file;
+      file_check check;
+      memset(&check, 0, sizeof(check));
+      if (!file.open(files[i].path.c_str()))
+        return;
+      scanRecords(file.data(), file.size(), 0xffffffff, &check, [&](const log_record& rec) {
+        uint32_t time = rec.time - rec.time % opt.interval;
+        if (buckets->empty() || buckets->back().time != time) {
+          resample_bucket b;
+          memset(&b, 0, sizeof(b));
+          b.time = time;
+          buckets->push_back(b);
+        }
+        addToBucket(&buckets->back(), rec);
+      });
+    },
+    [&](size_t, std::vector<resample_bucket>& buckets) {
+      for (size_t k = 0; k < buckets.size(); k++) {
+        if (open.count && open.time == buckets[k].time) {
+          mergeBucket(&open, buckets[k]);
+          continue;
+        }
+        if (open.count)
+          writeBucket(out, opt.format, open);
+        open = buckets[k];
+      }
+    });
+  if (open.count)
+    writeBucket(out, opt.format, open);
+  return out.close() ? 0 : 1;
+}
+
+//=============================================================================
+// merge: several devices interleaved by time
+
+struct device_stream {
+  std::string name;
+  std::vector<size_t> files;
+  size_t nextFile;
+  std::vector<log_record> current;
+  size_t pos;
+  std::vector<log_record> next;
+  bool nextReady;
+};
+
+static void loadFile(const input_file& input, std::vector<log_record>* records) {
+  MappedFile file;
+  file_check check;
+  memset(&check, 0, sizeof(check));
+  records->clear();
+  if (!file.open(input.path.c_str())) {
+    fprintf(stderr, "%s: cannot open\n", input.path.c_str());
+    return;
+  }
+  records->reserve(file.size() / LOG_RECORD_MAX_LEN * 2);
+  scanRecords(file.data(), file.size(), 0xffffffff, &check, [&](const log_record& rec) {
+    records->push_back(rec);
+  });
+}
+
+struct merge_head {
+  uint64_t key;
+  uint32_t device;
+  bool operator<(const merge_head& o) const { return key > o.key || (key == o.key && device > o.device); }
+};
+
+static int cmdMerge(const options& opt, const std::vector<input_file>& files, const std::vector<std::string>& names) {
+  if (opt.format == LOG_FORMAT_CBOR)
+    usage();
+  std::vector<device_stream> devices(names.size());
+  for (size_t d = 0; d < names.size(); d++) {
+    devices[d].name = names[d];
+    devices[d].nextFile = 0;
+    devices[d].pos = 0;
+    devices[d].nextReady = false;
+  }
+  for (size_t i = 0; i < files.size(); i++)
+    devices[files[i].device].files.push_back(i);
+
+  // parse the next file of every device that has none ready, in parallel;
+  // devices that cover the same time run out of data at about the same time
+  auto prefetch = [&]() {
+    std::vector<size_t> todo;
+    for (size_t d = 0; d < devices.size(); d++) {
+      if (!devices[d].nextReady && devices[d].nextFile < devices[d].files.size())
+        todo.push_back(d);
+    }
+    parallelFor(todo.size(), opt.threads, [&](size_t k) {
+      device_stream& dev = devices[todo[k]];
+      loadFile(files[dev.files[dev.nextFile]], &dev.next);
+    });
+    for (size_t k = 0; k < todo.size(); k++) {
+      devices[todo[k]].nextFile++;
+      devices[todo[k]].nextReady = true;
+    }
+  };
+  // false when the device has no records left
+  auto advance = [&](device_stream& dev) {
+    while (dev.pos >= dev.current.size()) {
+      if (!dev.nextReady && dev.nextFile >= dev.files.size())
+        return false;
+      if (!dev.nextReady)
+        prefetch();
+      dev.current.swap(dev.next);
+      dev.nextReady = false;
+      dev.pos = 0;
+    }
+    return true;
+  };
+  auto key = [](const log_record& rec) { return (uint64_t)rec.time * 1000 + rec.ms; };
+
+  Output out;
+  if (!out.open(opt.out))
+    return 1;
+  if (opt.format == LOG_FORMAT_CSV) {
+    const char* header = "Time;Device;Temperature;Humidity\n";
+    out.write(header, strlen(header));
+  }
+
+  prefetch();
+  std::priority_queue<merge_head> heads;
+  for (size_t d = 0; d < devices.size(); d++) {
+    if (advance(devices[d]))
+      heads.push({key(devices[d].current[0]), (uint32_t)d});
+  }
+  char line[LOG_EXPORT_MAX_LEN + 64];
+  char timeString[24];
+  uint64_t records = 0;
+  while (!heads.empty()) {
+    merge_head head = heads.top();
+    heads.pop();
+    device_stream& dev = devices[head.device];
+    const log_record& rec = dev.current[dev.pos++];
+    LogFormatTime(timeString, sizeof(timeString), rec.time);
+    int n;
+    if (opt.format == LOG_FORMAT_NDJSON)
+      n = snprintf(line, sizeof(line), "{\"time\":%u,\"ms\":%u,\"device\":\"%s\",\"temperature\":%.2f,\"humidity\":%.2f}\n",
+                   (unsigned)rec.time, (unsigned)rec.ms, dev.name.c_str(), rec.temperature, rec.humidity);
+    else
+      n = snprintf(line, sizeof(line), "%s.%03u;%s;%.2f;%.2f\n", timeString, (unsigned)rec.ms, dev.name.c_str(),
+                   rec.temperature, rec.humidity);
+    if (n > 0 && (size_t)n < sizeof(line))
+      out.write(line, n);
+    records++;
+    if (advance(dev))
+      heads.push({key(dev.current[dev.pos]), head.device});
+  }
+  fprintf(stderr, "merged %llu records from %zu devices\n", (unsigned long long)records, devices.size());
+  return out.close() ? 0 : 1;
+}
+
+//=============================================================================
+// bench: throughput of each stage over the mapped inputs, in GB/s
+
+static int cmdBench(const options& opt, const std::vector<input_file>& files) {
+  std::vector<MappedFile> mapped(files.size());
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (!mapped[i].open(files[i].path.c_str())) {
+      fprintf(stderr, "%s: cannot open\n", files[i].path.c_str());
+      return 1;
+    }
+    bytes += mapped[i].size();
+  }
+  printf("input: %zu files, %.1f MB, %u threads, median of %u runs\n", files.size(), bytes / 1e6, opt.threads, opt.runs);
+  printf("%-22s %10s %12s\n", "stage", "GB/s", "Mrecords/s");
+
+  // median wall time of opt.runs runs of body(threads), returns records
+  auto measure = [&](const char* name, unsigned threads, const std::function<uint64_t(size_t)>& perFile) {
+    std::vector<double> times;
+    uint64_t records = 0;
+    for (unsigned r = 0; r < opt.runs; r++) {
+      std::atomic<uint64_t> count(0);
+      double start = now();
+      parallelFor(files.size(), threads, [&](size_t i) { count += perFile(i); });
+      times.push_back(now() - start);
+      records = count;
+    }
+    std::sort(times.begin(), times.end());
+    double t = times[times.size() / 2];
+    char label[40];
+    snprintf(label, sizeof(label), "%s/%u", name, threads);
+    printf("%-22s %10.3f %12.2f\n", label, bytes / t / 1e9, records / t / 1e6);
+  };
+
+  auto countLines = [&](size_t i, const char* (*find)(const char*, const char*)) {
+    const char* p = mapped[i].data();
+    const char* end = p + mapped[i].size();
+    uint64_t lines = 0;
+    while (p < end) {
+      p = find(p, end) + 1;
+      lines++;
+    }
+    return lines;
+  };
+  // the first pass also faults the pages in
+  measure("scan.scalar", 1, [&](size_t i) { return countLines(i, findNewlineScalar); });
+  measure("scan.memchr", 1, [&](size_t i) { return countLines(i, findNewline); });
+
+  auto parse = [&](size_t i) {
+    file_check check;
+    memset(&check, 0, sizeof(check));
+    scanRecords(mapped[i].data(), mapped[i].size(), DEFAULT_GAP_SECONDS, &check, [](const log_record&) {});
+    return (uint64_t)check.records;
+  };
+  auto convert = [&](size_t i, log_format format) {
+    file_check check;
+    memset(&check, 0, sizeof(check));
+    uint8_t line[LOG_EXPORT_MAX_LEN];
+    scanRecords(mapped[i].data(), mapped[i].size(), 0xffffffff, &check, [&](const log_record& rec) {
+      FormatExportRecord(line, sizeof(line), format, rec);
+    });
+    return (uint64_t)check.records;
+  };
+  for (unsigned threads = 1; ; threads *= 2) {
+    unsigned t = std::min(threads, opt.threads);
+    measure("parse", t, parse);
+    measure("convert.ndjson", t, [&](size_t i) { return convert(i, LOG_FORMAT_NDJSON); });
+    measure("convert.cbor", t, [&](size_t i) { return convert(i, LOG_FORMAT_CBOR); });
+    if (t == opt.threads)
+      break;
+  }
+  return 0;
+}
+
+//=============================================================================
+
+int main(int argc, char** argv) {
+  if (argc < 3)
+    usage();
+  const char* cmd = argv[1];
+  options opt;
+  opt.format = LOG_FORMAT_CSV;
+  opt.gapSeconds = DEFAULT_GAP_SECONDS;
+  opt.interval = 0;
+  opt.threads = std::max(1u, std::thread::hardware_concurrency());
+  opt.runs = 5;
+  opt.out = NULL;
+  for (int i = 2; i < argc; i++) {
+    const char* arg = argv[i];
+    if (arg[0] != '-' || arg[1] == 0 || arg[2] != 0) {
+      opt.paths.push_back(arg);
+      continue;
+    }
+    if (i + 1 >= argc)
+      usage();
+    const char* val = argv[++i];
+    switch (arg[1]) {
+      case 'f':
+        if (!ParseLogFormat(val, &opt.format))
+          usage();
+        break;
+      case 'g': opt.gapSeconds = strtoul(val, NULL, 10); break;
+      case 'i': opt.interval = strtoul(val, NULL, 10); break;
+      case 'j': opt.threads = std::max(1ul, strtoul(val, NULL, 10)); break;
+      case 'n': opt.runs = std::max(1ul, strtoul(val, NULL, 10)); break;
+      case 'o': opt.out = val; break;
+      default: usage();
+    }
+  }
+  if (opt.paths.empty())
+    usage();
+
+  bool merge = strcmp(cmd, "merge") == 0;
+  std::vector<input_file> files;
+  std::vector<std::string> names;
+  for (size_t p = 0; p < opt.paths.size(); p++) {
+    std::string path = opt.paths[p];
+    std::string name = path;
+    size_t eq = merge ? path.find('=') : std::string::npos;
+    if (eq != std::string::npos) {
+      name = path.substr(0, eq);
+      path = path.substr(eq + 1);
+    }
+    names.push_back(name);
+    if (!addPath(path, merge ? p : 0, &files))
+      return 1;
+  }
+
+  if (strcmp(cmd, "validate") == 0)
+    return cmdValidate(opt, files);
+  if (strcmp(cmd, "convert") == 0)
+    return cmdConvert(opt, files);
+  if (strcmp(cmd, "resample") == 0)
+    return cmdResample(opt, files);
+  if (merge)
+    return cmdMerge(opt, files, names);
+  if (strcmp(cmd, "bench") == 0)
+    return cmdBench(opt, files);
+  usage();
+  return 2;
+}
@@ -0,0 +1,130 @@
+// Host benchmark of the daily quantile sketch: cost per sample and accuracy
+/**
+ * \file
+ * \brief quantile_bench, QuantileSketch against exact quantiles
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -Iinclude tools/quantile_bench.cpp src/QuantileSketch.cpp -o quantile_bench
+ *   ./quantile_bench [days] [samples per day]
+ *
+ * Feeds days of readings (one per minute by default, as logged) into a
+ * sketch per day, then compares p5/p50/p95 and the fraction above a
+ * threshold of each day and of all days merged with the values computed
+ * from the sorted samples. Errors are given in the unit of the reading
+ * and in rank (percentage points). The timings are host CPU time; the
+ * sketch is updated once per logged record on the device.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#include "QuantileSketch.h"
+
+#define THRESHOLD -15.0f
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// a freezer around -18 with a defrost excursion every 8 hours, 0.1 resolution
+static std::vector<float> makeDay(uint32_t day, uint32_t count) {
+  std::vector<float> samples(count);
+  for (uint32_t i = 0; i < count; i++) {
+    float minutes = (day * count + i) * 1440.0f / count;
+    float t = -18.0f + 1.5f * sinf(minutes * 2 * M_PI / 45) + (rand() % 5) * 0.1f + 0.3f * (day % 7);
+    if (fmodf(minutes, 480) < 25)
+      t += fmodf(minutes, 480) * 0.6f;
+    samples[i] = roundf(t * 10) / 10;
+  }
+  return samples;
+}
+
+static float exactQuantile(std::vector<float> sorted, float q) {
+  std::sort(sorted.begin(), sorted.end());
+  float pos = q * (sorted.size() - 1);
+  size_t i = (size_t)pos;
+  if (i + 1 >= sorted.size())
+    return sorted.back();
+  return sorted[i] + (sorted[i + 1] - sorted[i]) * (pos - i);
+}
+
+static float exactAbove(const std::vector<float>& samples, float threshold) {
+  size_t above = 0;
+  for (size_t i = 0; i < samples.size(); i++)
+    above += samples[i] > threshold;
+  return (float)above / samples.size();
+}
+
+struct error_stat {
+  float value;
+  float rank;
+  void add(const std::vector<float>& samples, float q, float exact, float estimate) {
+    std::vector<float> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    float e = fabsf(estimate - exact);
+    if (e > value)
+      value = e;
+    // how far q is from the ranks of the reading the estimate rounds to,
+    // 0 inside a run of equal readings
+    estimate = roundf(estimate * 10) / 10;
+    float lo = (float)(std::lower_bound(sorted.begin(), sorted.end(), estimate) - sorted.begin()) / sorted.size();
+    float hi = (float)(std::upper_bound(sorted.begin(), sorted.end(), estimate) - sorted.begin()) / sorted.size();
+    float r = q < lo ? lo - q : q > hi ? q - hi : 0;
+    if (r > rank)
+      rank = r;
+  }
+};
+
+int main(int argc, char** argv) {
+  uint32_t days = argc > 1 ? strtoul(argv[1], NULL, 10) : 30;
+  uint32_t perDay = argc > 2 ? strtoul(argv[2], NULL, 10) : 1440;
+  static const float qs[] = {0.05f, 0.5f, 0.95f};
+  printf("input: %u days of %u samples\n", days, perDay);
+
+  std::vector<float> all;
+  std::vector<QuantileSketch> sketches(days);
+  error_stat errors[3] = {};
+  float aboveError = 0;
+  double addTime = 0;
+  for (uint32_t d = 0; d < days; d++) {
+    std::vector<float> samples = makeDay(d, perDay);
+    all.insert(all.end(), samples.begin(), samples.end());
+    double start = now();
+    for (uint32_t i = 0; i < perDay; i++)
+      sketches[d].add(samples[i]);
+    sketches[d].flush();
+    addTime += now() - start;
+    for (int k = 0; k < 3; k++)
+      errors[k].add(samples, qs[k], exactQuantile(samples, qs[k]), sketches[d].quantile(qs[k]));
+    float e = fabsf(1 - sketches[d].cdf(THRESHOLD) - exactAbove(samples, THRESHOLD));
+    if (e > aboveError)
+      aboveError = e;
+  }
+  printf("add: %.1f ns/sample, %u centroids on day 0\n", addTime / days / perDay * 1e9,
+         sketches[0].centroids());
+  printf("%-10s %12s %12s\n", "per day", "max error", "max rank");
+  for (int k = 0; k < 3; k++)
+    printf("p%-9.0f %12.3f %11.2f%%\n", qs[k] * 100, errors[k].value, errors[k].rank * 100);
+  printf("%-10s %12s %11.2f%%\n", "above", "", aboveError * 100);
+
+  QuantileSketch merged;
+  double start = now();
+  for (uint32_t d = 0; d < days; d++)
+    merged.merge(sketches[d]);
+  double mergeTime = now() - start;
+  printf("merge: %.2f us/day, %u centroids\n", mergeTime / days * 1e6, merged.centroids());
+  for (int k = 0; k < 3; k++) {
+    float exact = exactQuantile(all, qs[k]);
+    printf("p%-9.0f exact %8.3f sketch %8.3f\n", qs[k] * 100, exact, merged.quantile(qs[k]));
+  }
+  printf("above %.1f: exact %.2f%% sketch %.2f%%\n", THRESHOLD, exactAbove(all, THRESHOLD) * 100,
+         (1 - merged.cdf(THRESHOLD)) * 100);
+  printf("persisted: %zu bytes per channel\n", sizeof(quantile_channel));
+  return 0;
+}
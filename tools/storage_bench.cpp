@@ -0,0 +1,362 @@
+// Host benchmark of the log listing, download and query paths
+/**
+ * \file
+ * \brief storage_bench, runs the web handlers' SD code on a log tree
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -Itools/host -Iinclude tools/storage_bench.cpp tools/host/host.cpp \
+ *       src/LogRecord.cpp src/LogRotation.cpp src/ChartReducer.cpp src/LogExport.cpp \
+ *       src/LogStore.cpp src/StorageStats.cpp src/LogRangeReader.cpp src/LogFileResponse.cpp \
+ *       src/ChunkedResponse.cpp src/ChartResponse.cpp src/LogExportResponse.cpp src/SDArbiter.cpp \
+ *       src/PerfMonitor.cpp src/DebugLog.cpp -o storage_bench
+ *   ./gen_dataset /tmp/ds
+ *   ./storage_bench /tmp/ds [-n runs] [-c] [-b baseline.txt] [-t tolerancePct] > report.txt
+ *
+ * The device sources are built against the SdFat and Arduino stand-ins
+ * in tools/host, with <root> as the card:
+ * - list      LogStore::listJson(), the body of /api/logs
+ * - download  LogFileResponse, the largest file and every file
+ * - chart     ChartResponse over the last day/week/month/year/all
+ * - export    LogExportResponse, last month as NDJSON
+ * Responses are drained through _fillBuffer() in 1460 byte calls, as the
+ * server does for one TCP segment. list.remount and
+ * download.largest.remount mount the card before every request, as
+ * startSD() did before SDManager.
+ *
+ * -c reads files as contiguous, the raw block path of preallocated
+ * files; without it they are read through the FAT. No file is active,
+ * so the last one is read like a closed one, up to its sidecar.
+ *
+ * The report has one "key value" line per metric in a fixed order.
+ * Counts, bytes, blocks and output CRCs do not depend on the host, they
+ * change only when the data or the code paths change; blocks are the
+ * SD traffic of the request (see tools/host/SdFat.h). Keys ending in
+ * .ms are the median of the runs, measured with a warm page cache, so
+ * they are CPU and syscall cost only.
+ *
+ * With -b the report is compared against an earlier one: any changed
+ * count, or a time above baseline * (1 + tolerance) and more than 1 ms
+ * slower, is printed and the exit code is 1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include "SdFat.h"
+
+#include "LogRecord.h"
+#include "LogRotation.h"
+#include "LogStore.h"
+#include "LogFileResponse.h"
+#include "ChartResponse.h"
+#include "LogExportResponse.h"
+#include "SDArbiter.h"
+
+// one TCP segment, what the server asks _fillBuffer() for
+#define BENCH_FILL_LEN 1460
+
+static SdFat sd;
+static LogStore logStore(sd, "/logs");
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct response_result {
+  uint64_t bytes;
+  uint32_t crc;
+  uint32_t fills;
+  uint32_t corrupt;
+};
+
+// what the server does with a chunked response
+static response_result drain(AsyncAbstractResponse* response) {
+  response_result r = {0, 0, 0, 0};
+  uint32_t corrupt = logStore.corruptRecords();
+  uint8_t buf[BENCH_FILL_LEN];
+  if (response->_sourceValid()) {
+    for (;;) {
+      size_t n = response->_fillBuffer(buf, sizeof(buf));
+      if (n == RESPONSE_TRY_AGAIN)
+        continue;
+      if (n == 0)
+        break;
+      r.fills++;
+      r.bytes += n;
+      r.crc = LogCrc32(buf, n, r.crc);
+    }
+  }
+  // the response adds what it skipped when it is deleted
+  delete response;
+  r.corrupt = logStore.corruptRecords() - corrupt;
+  return r;
+}
+
+//=============================================================================
+// the dataset, read once before the runs
+
+struct log_file {
+  std::string path;
+  uint32_t first;
+  uint32_t size;
+};
+
+static std::vector<log_file> scanFiles() {
+  std::vector<log_file> files;
+  File logs = sd.open("/logs", O_READ);
+  FatFile file;
+  char name[LOG_NAME_MAX];
+  while (file.openNext(&logs, O_READ)) {
+    file.getName(name, sizeof(name));
+    uint32_t first, last;
+    if (!file.isDir() && !IsLogMetaName(name) && LogFileSpan(name, &first, &last)) {
+      log_file f = {std::string("/logs/") + name, first, file.fileSize()};
+      log_meta meta;
+      if (logStore.readMeta(name, &meta) && meta.count)
+        f.first = meta.first;
+      files.push_back(f);
+    }
+    file.close();
+  }
+  return files;
+}
+
+// newest record time in the last LOG_RANGE_CHUNK bytes, the sidecar of the
+// last file lags behind
+static uint32_t tailTime(const std::string& path) {
+  char buf[LOG_RANGE_CHUNK];
+  File file = sd.open(path.c_str(), O_READ);
+  if (!file)
+    return 0;
+  uint32_t size = file.fileSize();
+  uint32_t start = size > LOG_RANGE_CHUNK ? size - LOG_RANGE_CHUNK : 0;
+  int n = file.seekSet(start) ? file.read(buf, sizeof(buf)) : 0;
+  uint32_t newest = 0;
+  const char* p = buf;
+  const char* end = buf + (n > 0 ? n : 0);
+  while (p < end) {
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    if (!nl)
+      break;
+    log_record rec;
+    log_record_status status = ParseLogRecord(p, nl - p + 1, &rec);
+    if ((status == LOG_RECORD_OK || status == LOG_RECORD_LEGACY) && rec.time > newest)
+      newest = rec.time;
+    p = nl + 1;
+  }
+  return newest;
+}
+
+//=============================================================================
+// report
+
+static std::vector<std::pair<std::string, std::string> > report;
+
+static void put(const std::string& key, uint64_t value) {
+  report.push_back(std::make_pair(key, std::to_string(value)));
+}
+
+static void putHex(const std::string& key, uint32_t value) {
+  char buf[12];
+  snprintf(buf, sizeof(buf), "%08x", value);
+  report.push_back(std::make_pair(key, buf));
+}
+
+static void putResponse(const std::string& prefix, const response_result& r) {
+  put(prefix + ".out_bytes", r.bytes);
+  putHex(prefix + ".out_crc", r.crc);
+  put(prefix + ".fills", r.fills);
+  put(prefix + ".corrupt", r.corrupt);
+}
+
+// runs fn n times, the counts and the SD traffic come from the first run
+template <typename Fn>
+static void timed(const std::string& key, int runs, Fn fn) {
+  std::vector<double> ms;
+  for (int i = 0; i < runs; i++) {
+    host_sd_stats before = hostSdStats;
+    double start = now();
+    fn(i == 0);
+    ms.push_back((now() - start) * 1000);
+    if (i == 0) {
+      put(key + ".blocks", hostSdStats.blocks - before.blocks);
+      put(key + ".reads", hostSdStats.reads - before.reads);
+      put(key + ".dir_entries", hostSdStats.dirEntries - before.dirEntries);
+      put(key + ".opens", hostSdStats.opens - before.opens);
+      put(key + ".mounts", hostSdStats.begins - before.begins);
+    }
+  }
+  std::sort(ms.begin(), ms.end());
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%.2f", ms[ms.size() / 2]);
+  report.push_back(std::make_pair(key + ".ms", buf));
+}
+
+static int compare(const char* baselinePath, double tolerance) {
+  FILE* f = fopen(baselinePath, "r");
+  if (!f) {
+    fprintf(stderr, "cannot read %s\n", baselinePath);
+    return 1;
+  }
+  std::map<std::string, std::string> base;
+  char key[128];
+  char value[64];
+  while (fscanf(f, "%127s %63s", key, value) == 2)
+    base[key] = value;
+  fclose(f);
+
+  int problems = 0;
+  for (const auto& kv : report) {
+    auto it = base.find(kv.first);
+    if (it == base.end())
+      continue;
+    const std::string& key = kv.first;
+    if (key.size() > 3 && key.compare(key.size() - 3, 3, ".ms") == 0) {
+      double was = atof(it->second.c_str());
+      double is = atof(kv.second.c_str());
+      if (is > was * (1 + tolerance / 100) && is - was > 1.0) {
+        fprintf(stderr, "SLOWER  %s %s -> %s\n", key.c_str(), it->second.c_str(), kv.second.c_str());
+        problems++;
+      }
+    } else if (it->second != kv.second) {
+      fprintf(stderr, "CHANGED %s %s -> %s\n", key.c_str(), it->second.c_str(), kv.second.c_str());
+      problems++;
+    }
+  }
+  return problems ? 1 : 0;
+}
+
+//=============================================================================
+
+static void usage() {
+  fprintf(stderr, "usage: storage_bench <root> [-n runs] [-c] [-b baseline.txt] [-t tolerancePct]\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2)
+    usage();
+  int runs = 5;
+  const char* baseline = NULL;
+  double tolerance = 25;
+  bool contiguous = false;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "-c") == 0) {
+      contiguous = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+      usage();
+    if (strcmp(argv[i], "-n") == 0) runs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0) baseline = argv[++i];
+    else if (strcmp(argv[i], "-t") == 0) tolerance = atof(argv[++i]);
+    else usage();
+  }
+  if (runs < 1)
+    runs = 1;
+
+  SdFat::hostRoot(argv[1]);
+  SdFat::hostContiguous(contiguous);
+  sdArbiter.begin();
+  if (!sd.begin(0, 0)) {
+    fprintf(stderr, "cannot open %s\n", argv[1]);
+    return 1;
+  }
+
+  // the dataset: time range and largest file
+  std::vector<log_file> files = scanFiles();
+  if (files.empty()) {
+    fprintf(stderr, "no log files in %s/logs\n", argv[1]);
+    return 1;
+  }
+  uint32_t oldest = 0xffffffff;
+  uint64_t bytes = 0;
+  const log_file* newestFile = &files[0];
+  const log_file* largest = &files[0];
+  for (const log_file& f : files) {
+    bytes += f.size;
+    if (f.first < oldest)
+      oldest = f.first;
+    if (f.first >= newestFile->first)
+      newestFile = &f;
+    if (f.size > largest->size)
+      largest = &f;
+  }
+  uint32_t newest = tailTime(newestFile->path);
+
+  report.push_back(std::make_pair("report", std::string("storage_bench-2")));
+  put("dataset.files", files.size());
+  put("dataset.bytes", bytes);
+  put("dataset.oldest", oldest);
+  put("dataset.newest", newest);
+  put("dataset.contiguous", contiguous);
+
+  for (int remount = 0; remount < 2; remount++) {
+    std::string key = remount ? "list.remount" : "list";
+    timed(key, runs, [&](bool first) {
+      if (remount)
+        sd.begin(0, 0);
+      String json = logStore.listJson(0, 0xffffffff);
+      if (first) {
+        put(key + ".json_bytes", json.length());
+        putHex(key + ".json_crc", LogCrc32(json.c_str(), json.length()));
+      }
+    });
+  }
+
+  for (int remount = 0; remount < 2; remount++) {
+    std::string key = remount ? "download.largest.remount" : "download.largest";
+    timed(key, runs, [&](bool first) {
+      if (remount)
+        sd.begin(0, 0);
+      response_result r = drain(new LogFileResponse(sd, logStore, largest->path.c_str()));
+      if (first)
+        putResponse(key, r);
+    });
+  }
+
+  timed("download.all", runs, [&](bool first) {
+    response_result all = {0, 0, 0, 0};
+    for (const log_file& f : files) {
+      response_result r = drain(new LogFileResponse(sd, logStore, f.path.c_str()));
+      all.bytes += r.bytes;
+      all.crc = LogCrc32(&r.crc, sizeof(r.crc), all.crc);
+      all.fills += r.fills;
+      all.corrupt += r.corrupt;
+    }
+    if (first)
+      putResponse("download.all", all);
+  });
+
+  static const struct { const char* name; uint32_t seconds; } ranges[] = {
+    {"day", 86400}, {"week", 7 * 86400}, {"month", 31 * 86400}, {"year", 366 * 86400}, {"all", 0}
+  };
+  for (const auto& range : ranges) {
+    uint32_t from = range.seconds && newest - oldest > range.seconds ? newest - range.seconds : oldest;
+    std::string key = std::string("chart.") + range.name;
+    timed(key, runs, [&](bool first) {
+      response_result r = drain(new ChartResponse(sd, logStore, "/logs", from, newest, CHART_DEFAULT_POINTS));
+      if (first)
+        putResponse(key, r);
+    });
+  }
+
+  timed("export.month.ndjson", runs, [&](bool first) {
+    response_result r = drain(new LogExportResponse(sd, logStore, "/logs", newest - 31 * 86400, newest, LOG_FORMAT_NDJSON));
+    if (first)
+      putResponse("export.month.ndjson", r);
+  });
+
+  for (const auto& kv : report)
+    printf("%s %s\n", kv.first.c_str(), kv.second.c_str());
+  return baseline ? compare(baseline, tolerance) : 0;
+}